@@ -5,5 +5,15 @@ COMPONENT_PRIV_INCLUDEDIRS := src
 COMPONENT_SRCDIRS += utils/src
 COMPONENT_ADD_INCLUDEDIRS += utils/include
 
-COMPONENT_SRCDIRS += platforms/aws
+COMPONENT_SRCDIRS += platforms/common
 COMPONENT_PRIV_INCLUDEDIRS += platforms/include
+
+ifdef CONFIG_ESP_CLOUD_TRANSPORT_AWS_IOT
+COMPONENT_SRCDIRS += platforms/aws
+endif
+ifdef CONFIG_ESP_CLOUD_TRANSPORT_ESP_MQTT
+COMPONENT_SRCDIRS += platforms/esp_mqtt
+endif
+ifdef CONFIG_ESP_CLOUD_TRANSPORT_LOOPBACK
+COMPONENT_SRCDIRS += platforms/loopback
+endif
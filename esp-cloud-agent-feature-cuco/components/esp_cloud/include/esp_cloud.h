@@ -27,6 +27,18 @@ typedef struct {
 
 extern char *ota_vertion;
 
+/** Transport used to reach the cloud */
+typedef enum {
+    /** The default transport selected in menuconfig */
+    ESP_CLOUD_TRANSPORT_DEFAULT = 0,
+    /** AWS IoT Device SDK, with the AWS IoT device shadow */
+    ESP_CLOUD_TRANSPORT_AWS_IOT,
+    /** ESP-IDF MQTT client, with the shadow over the AWS IoT shadow MQTT topics */
+    ESP_CLOUD_TRANSPORT_ESP_MQTT,
+    /** In-process loopback broker, for running the agent without a network (see esp_cloud_loopback.h) */
+    ESP_CLOUD_TRANSPORT_LOOPBACK,
+} esp_cloud_transport_type_t;
+
 /** Cloud configuration required during initialization */
 typedef struct {
     esp_cloud_identifier_t id;
@@ -46,6 +58,8 @@ typedef struct {
      * ESP Cloud
      */
     uint16_t reconnect_attempts;
+    /* Transport to be used. ESP_CLOUD_TRANSPORT_DEFAULT (0) selects the one in menuconfig */
+    esp_cloud_transport_type_t transport;
 } esp_cloud_config_t;
 
 /** ESP Cloud Parameter Value type */
@@ -82,6 +96,45 @@ typedef struct {
 /** Cloud handle to be used for all ESP Cloud APIs */
 typedef void * esp_cloud_handle_t;
 
+/** Class of the messages exchanged with the cloud. The publish and subscribe
+ * paths look up the \ref esp_cloud_msg_policy_t of the class
+ */
+typedef enum {
+    /** Messages not belonging to any of the classes below */
+    ESP_CLOUD_MSG_CLASS_DEFAULT = 0,
+    /** Device information, reported after connecting */
+    ESP_CLOUD_MSG_CLASS_DEVICE_INFO,
+    /** Events and results, like bind status, Alexa sign in status and OTA status */
+    ESP_CLOUD_MSG_CLASS_EVENT,
+    /** Periodic progress updates, like the OTA progress. Only the latest one matters */
+    ESP_CLOUD_MSG_CLASS_PROGRESS,
+    /** Diagnostics data */
+    ESP_CLOUD_MSG_CLASS_DIAGNOSTICS,
+    /** Requests received from the cloud, like the OTA URL and app commands */
+    ESP_CLOUD_MSG_CLASS_REQUEST,
+    /** Number of classes. Not a valid class */
+    ESP_CLOUD_MSG_CLASS_MAX,
+} esp_cloud_msg_class_t;
+
+/** Priority of a message published in the background */
+typedef enum {
+    /** Published after the messages queued earlier */
+    ESP_CLOUD_MSG_PRIORITY_NORMAL = 0,
+    /** Published before the messages of normal priority queued earlier, but after the
+     * messages of high priority queued earlier */
+    ESP_CLOUD_MSG_PRIORITY_HIGH,
+} esp_cloud_msg_priority_t;
+
+/** Delivery policy for a message class */
+typedef struct {
+    /** MQTT QoS. 0 or 1 */
+    uint8_t qos;
+    /** Ask the broker to retain the message. Not used for subscriptions */
+    bool retain;
+    /** Priority in the background publish queue. Not used for subscriptions */
+    esp_cloud_msg_priority_t priority;
+} esp_cloud_msg_policy_t;
+
 /** Initialize ESP Cloud Agent
  *
  * This initializes the internal data required by ESP Cloud agent and allocates memory as required.
@@ -103,6 +156,7 @@ esp_err_t esp_cloud_init(esp_cloud_config_t *config, esp_cloud_handle_t *handle)
  * @param[in] handle The ESP Cloud Handle
  *
  * @return ESP_OK on success.
+ * @return ESP_ERR_INVALID_STATE if the agent is already running.
  * @return error in case of failures.
  */
 esp_err_t esp_cloud_start(esp_cloud_handle_t handle);
@@ -110,6 +164,9 @@ esp_err_t esp_cloud_start(esp_cloud_handle_t handle);
 /** Stop ESP Cloud Agent
  *
  * This call stops the ESP Cloud Agent instance started earlier by esp_cloud_start().
+ * It returns once the agent has disconnected and its task has exited, so esp_cloud_start()
+ * can be called right after. When called from the agent's own task, like from a work
+ * function or a parameter callback, it only asks the agent to stop and returns.
  *
  * @param[in] handle The ESP Cloud Handle
  *
@@ -354,6 +411,98 @@ esp_err_t esp_cloud_update_float_param(esp_cloud_handle_t handle, const char *na
  */
 esp_err_t esp_cloud_update_string_param(esp_cloud_handle_t handle, const char *name, char *val);
 
+/** Shadow traffic statistics */
+typedef struct {
+    /** Number of shadow updates sent */
+    uint32_t updates;
+    /** Total size of the shadow update documents sent */
+    uint32_t tx_bytes;
+    /** Bytes saved by not mirroring the reported values into desired */
+    uint32_t tx_bytes_saved;
+    /** Number of update/accepted documents received */
+    uint32_t accepted;
+    /** Total size of the update/accepted documents received */
+    uint32_t accepted_rx_bytes;
+    /** Number of reported values not sent since the shadow already had them */
+    uint32_t suppressed;
+    /** Number of requested values not applied since the param already had them */
+    uint32_t actuations_suppressed;
+    /** Last shadow version received from the cloud */
+    uint32_t version;
+} esp_cloud_shadow_stats_t;
+
+/** Get Shadow Statistics
+ *
+ * Gets the statistics of the shadow traffic since the ESP Cloud was started.
+ *
+ * @param[in] handle The ESP Cloud Handle
+ * @param[out] stats Pointer to \ref esp_cloud_shadow_stats_t to be filled
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failures.
+ */
+esp_err_t esp_cloud_get_shadow_stats(esp_cloud_handle_t handle, esp_cloud_shadow_stats_t *stats);
+
+/** Statistics of the messages published in the background */
+typedef struct {
+    /** Number of messages queued for publishing */
+    uint32_t queued;
+    /** Number of messages not queued since the queue was full */
+    uint32_t dropped;
+    /** Number of messages handed over to the MQTT client */
+    uint32_t sent;
+    /** Number of messages acknowledged by the broker */
+    uint32_t acked;
+    /** Number of messages which failed or were not acknowledged in time */
+    uint32_t failed;
+    /** Number of messages waiting in the queue */
+    uint32_t pending;
+    /** Number of messages sent and awaiting acknowledgement */
+    uint32_t in_flight;
+    /** Highest number of messages in flight at a time */
+    uint32_t max_in_flight;
+} esp_cloud_publish_stats_t;
+
+/** Get Publish Statistics
+ *
+ * Get the statistics of the messages (like OTA progress and diagnostics) which are published
+ * from the ESP Cloud task, without waiting for the broker acknowledgement.
+ *
+ * @param[in] handle ESP Cloud Handle
+ * @param[out] stats Pointer to \ref esp_cloud_publish_stats_t to be filled
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failures.
+ */
+esp_err_t esp_cloud_get_publish_stats(esp_cloud_handle_t handle, esp_cloud_publish_stats_t *stats);
+
+/** Set the delivery policy of a message class
+ *
+ * The new policy is used for the subsequent publishes, and for the subsequent subscriptions
+ * in case of \ref ESP_CLOUD_MSG_CLASS_REQUEST.
+ *
+ * @param[in] handle ESP Cloud Handle
+ * @param[in] msg_class The message class
+ * @param[in] policy Pointer to the policy to be used for the class
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failures.
+ */
+esp_err_t esp_cloud_set_msg_policy(esp_cloud_handle_t handle, esp_cloud_msg_class_t msg_class,
+        const esp_cloud_msg_policy_t *policy);
+
+/** Get the delivery policy of a message class
+ *
+ * @param[in] handle ESP Cloud Handle
+ * @param[in] msg_class The message class
+ * @param[out] policy Pointer to \ref esp_cloud_msg_policy_t to be filled
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failures.
+ */
+esp_err_t esp_cloud_get_msg_policy(esp_cloud_handle_t handle, esp_cloud_msg_class_t msg_class,
+        esp_cloud_msg_policy_t *policy);
+
 /** Prototype for ESP Cloud Work Queue Function
  *
  * @param[in] handle The ESP Cloud Handle
@@ -0,0 +1,76 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include <esp_cloud.h>
+
+/* The loopback transport runs on the target, like the rest of the agent, and on a Linux
+ * host with the FreeRTOS and ESP-IDF stand-ins of test/host.
+ */
+
+/** Callback for the messages published by the device on the loopback transport
+ *
+ * This is called in the context of the task which published the message.
+ *
+ * @param[in] topic NULL terminated topic
+ * @param[in] data The published data
+ * @param[in] data_len Length of the data
+ * @param[in] qos The QoS of the message, as per the message class policy
+ * @param[in] priv_data The private data passed to esp_cloud_loopback_set_tap()
+ */
+typedef void (*esp_cloud_loopback_tap_t)(const char *topic, const void *data, size_t data_len, int qos, void *priv_data);
+
+/** Set the callback for the messages published by the device
+ *
+ * This can be used by a test harness to play the cloud, when the agent is initialised
+ * with \ref ESP_CLOUD_TRANSPORT_LOOPBACK.
+ *
+ * @param[in] handle ESP Cloud Handle
+ * @param[in] tap The callback. NULL to remove it
+ * @param[in] priv_data Private data to be passed to the callback
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failures.
+ */
+esp_err_t esp_cloud_loopback_set_tap(esp_cloud_handle_t handle, esp_cloud_loopback_tap_t tap, void *priv_data);
+
+/** Send a message to the device on the loopback transport
+ *
+ * The message is handed over to the handlers subscribed to the topic in the ESP Cloud task,
+ * like a message received from the cloud. This can be called from any task.
+ *
+ * @param[in] handle ESP Cloud Handle
+ * @param[in] topic NULL terminated topic
+ * @param[in] payload The message payload. This is copied
+ * @param[in] payload_len Length of the payload
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failures.
+ */
+esp_err_t esp_cloud_loopback_inject(esp_cloud_handle_t handle, const char *topic, const void *payload, size_t payload_len);
+
+/** Set the simulated broker round trip time on the loopback transport
+ *
+ * QoS1 messages published in the background are acknowledged this long after being sent,
+ * and the other QoS1 publishes block for this long.
+ *
+ * @param[in] handle ESP Cloud Handle
+ * @param[in] latency_ms The round trip time in milliseconds
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failures.
+ */
+esp_err_t esp_cloud_loopback_set_ack_latency(esp_cloud_handle_t handle, uint32_t latency_ms);
@@ -0,0 +1,53 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/** Binary trace record
+ *
+ * The hot paths of the agent record these instead of logging. The format string and
+ * the meaning of the arguments are identified by the id, and are only required to decode
+ * the records, using tools/esp_cloud_trace_decode.py.
+ */
+typedef struct {
+    /** Sequence number of the record, starting from 1 */
+    uint32_t seq;
+    /** Time of the record in microseconds since boot, wrapping around */
+    uint32_t timestamp;
+    /** Trace point id */
+    uint16_t id;
+    uint16_t reserved;
+    /** Arguments for the format string of the trace point */
+    uint32_t args[3];
+} esp_cloud_trace_record_t;
+
+/** Read the trace records
+ *
+ * Copies the latest records, oldest first. Records which are being overwritten while
+ * copying are skipped. This can be called from any task.
+ *
+ * @param[out] records Buffer for the records
+ * @param[in] max_records Number of records the buffer can hold
+ *
+ * @return the number of records copied
+ */
+size_t esp_cloud_trace_read(esp_cloud_trace_record_t *records, size_t max_records);
+
+/** Print the trace records to the console
+ *
+ * Each record is printed in hex on a line starting with "ESPTRACE ", which the decoder can
+ * pick from a console log.
+ */
+void esp_cloud_trace_dump(void);
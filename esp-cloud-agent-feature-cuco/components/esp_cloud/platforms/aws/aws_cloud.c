@@ -13,12 +13,15 @@
 // limitations under the License.
 #include <stdio.h>
 #include <string.h>
+#include <sdkconfig.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
 #include <esp_log.h>
 #include <nvs_flash.h>
 #include <nvs.h>
+#include <json_parser.h>
+#include <json_sax.h>
 
 #include <aws_iot_config.h>
 #include <aws_iot_log.h>
@@ -31,22 +34,37 @@
 #include <esp_cloud_storage.h>
 
 #include "esp_cloud_platform.h"
+#include "esp_cloud_topic_router.h"
+#include "esp_cloud_publish_queue.h"
+#include "esp_cloud_trace_points.h"
+#include "esp_cloud_mqtt_common.h"
 #include "aws_custom_utils.h"
 #include "app_auth_user.h"
 // #include "production_test.h"
-#define MAX_LENGTH_OF_UPDATE_JSON_BUFFER 200
 #define AWS_TASK_STACK  12 * 1024
 static const char *TAG = "aws_cloud";
 
 
 #define MFG_PARTITION_NAME "fctry"
-#define MAX_MQTT_SUBSCRIPTIONS      3
 
+/* Shadow updates are published on "$aws/things/<thing_name>/shadow/update". The
+ * topic, its length and the MQTT fixed header share the Tx buffer with the document.
+ */
+#define SHADOW_UPDATE_TOPIC_FORMAT_LEN  (sizeof("$aws/things//shadow/update") - 1)
+#define MQTT_PUBLISH_HEADER_LEN         (5 + 2)
+
+/* Value used to clear the desired value of a param in the shadow */
+static char aws_json_null[] = "null";
+
+/* Per dynamic param state maintained by the AWS platform layer */
 typedef struct {
-    char *topic;
-    esp_cloud_platform_subscribe_cb_t cb;
-    void *priv;
-} aws_cloud_subscription_t;
+    /* Explicit null which clears the desired value of the param */
+    jsonStruct_t desired_null;
+    /* The shadow may have a desired value for the param, which should be cleared */
+    bool clear_desired;
+    /* The shadow document being loaded has a desired value, which is in the binding */
+    bool desired_found;
+} aws_param_state_t;
 
 typedef struct {
     AWS_IoT_Client mqttClient;
@@ -54,13 +72,25 @@ typedef struct {
     char *client_cert;
     char *client_key;
     char *server_cert;
+    /* All of the below point into the binding arena */
     jsonStruct_t *dynamic_params;
+    aws_param_state_t *param_states;
     jsonStruct_t **desired_handles;
     jsonStruct_t **reported_handles;
+    char *sax_buf;
+    size_t sax_buf_len;
+    void *binding_arena;
+    size_t binding_arena_size;
     size_t reported_count;
     size_t desired_count;
-    bool shadowUpdateInProgress;
-    aws_cloud_subscription_t *subscriptions[MAX_MQTT_SUBSCRIPTIONS];
+    uint8_t param_count;
+    uint8_t shadow_updates_in_flight;
+    bool shadow_update_failed;
+    bool shadow_get_in_progress;
+    esp_cloud_topic_router_t *topic_router;
+    esp_cloud_shadow_state_t shadow_state;
+    esp_cloud_shadow_stats_t shadow_stats;
+    int publish_msg_id;
 } aws_cloud_platform_data_t;
 
 static void aws_common_subscribe_callback(AWS_IoT_Client *pClient, char *pTopicName, uint16_t topicNameLen, IoT_Publish_Message_Params *params, void *pClientData)
@@ -68,90 +98,83 @@ static void aws_common_subscribe_callback(AWS_IoT_Client *pClient, char *pTopicN
     if (!pClientData) {
         return;
     }
-    aws_cloud_subscription_t **subscriptions = (aws_cloud_subscription_t **)pClientData;
-    int i;
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (subscriptions[i]) {
-            if (strncmp(pTopicName, subscriptions[i]->topic, topicNameLen) == 0) {
-                subscriptions[i]->cb(pTopicName, params->payload, params->payloadLen, subscriptions[i]->priv);
-            }
-        }
-    }
+    /* The SDK calls this once for each subscription matching the topic, with the router
+     * filter of that subscription as the client data.
+     */
+    esp_cloud_topic_filter_t *filter = (esp_cloud_topic_filter_t *)pClientData;
+    uint32_t alloc_count = esp_cloud_mem_get_alloc_count();
+    esp_cloud_topic_filter_dispatch(filter, pTopicName, params->payload, params->payloadLen);
+    ESP_LOGD(TAG, "Allocations for message on %.*s: %u", topicNameLen, pTopicName,
+            esp_cloud_mem_get_alloc_count() - alloc_count);
 }
 
-esp_err_t esp_cloud_platform_subscribe(esp_cloud_internal_handle_t *handle, const char *topic, esp_cloud_platform_subscribe_cb_t cb, void *priv_data)
+static esp_err_t aws_platform_subscribe(esp_cloud_internal_handle_t *handle, const char *topic,
+        esp_cloud_msg_class_t msg_class, esp_cloud_platform_subscribe_cb_t cb, void *priv_data)
 {
     if (!handle || !topic || !cb || !handle->cloud_platform_priv) {
         return ESP_FAIL;
     }
     aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
-    int i;
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (!platform_data->subscriptions[i]) {
-            aws_cloud_subscription_t *subscription = esp_cloud_mem_calloc(1, sizeof(aws_cloud_subscription_t));
-            if (!subscription) {
-                return ESP_FAIL;
-            }
-            subscription->topic = strdup(topic);
-            if (!subscription->topic) {
-                free(subscription);
-                return ESP_FAIL;
-            }
-            IoT_Error_t rc = aws_iot_mqtt_subscribe(&platform_data->mqttClient, subscription->topic, strlen(subscription->topic),
-                        QOS1, aws_common_subscribe_callback, platform_data->subscriptions);
-            if (rc != SUCCESS) {
-                free(subscription->topic);
-                free(subscription);
-                return ESP_FAIL;
-            }
-            subscription->priv = priv_data;
-            subscription->cb = cb;
-            platform_data->subscriptions[i] = subscription;
-            ESP_LOGI(TAG, "Subscribed to topic: %s", topic);
-            return ESP_OK;
-        }
+    bool new_filter = false;
+    esp_cloud_topic_filter_t *filter = esp_cloud_topic_router_add(platform_data->topic_router, topic, cb, priv_data, &new_filter);
+    if (!filter) {
+        return ESP_FAIL;
     }
-    return ESP_FAIL;
+    if (!new_filter) {
+        /* Already subscribed. The message will be given to this handler as well */
+        ESP_LOGI(TAG, "Added handler for topic: %s", topic);
+        return ESP_OK;
+    }
+    /* The SDK holds on to the topic pointer, so the copy owned by the router is used */
+    const char *filter_name = esp_cloud_topic_filter_get_name(filter);
+    const esp_cloud_msg_policy_t *policy = esp_cloud_msg_policy_get(handle, msg_class);
+    IoT_Error_t rc = aws_iot_mqtt_subscribe(&platform_data->mqttClient, filter_name, strlen(filter_name),
+                policy->qos ? QOS1 : QOS0, aws_common_subscribe_callback, filter);
+    if (rc != SUCCESS) {
+        ESP_LOGE(TAG, "aws_iot_mqtt_subscribe returned error %d", rc);
+        esp_cloud_topic_router_remove(platform_data->topic_router, topic);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Subscribed to topic: %s", topic);
+    return ESP_OK;
 }
 
-esp_err_t esp_cloud_platform_unsubscribe(esp_cloud_internal_handle_t *handle, const char *topic)
+static esp_err_t aws_platform_unsubscribe(esp_cloud_internal_handle_t *handle, const char *topic)
 {
     if (!handle || !topic || !handle->cloud_platform_priv) {
         return ESP_FAIL;
     }
     aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
+    if (!esp_cloud_topic_router_find(platform_data->topic_router, topic)) {
+        return ESP_FAIL;
+    }
     IoT_Error_t rc = aws_iot_mqtt_unsubscribe(&platform_data->mqttClient, topic, strlen(topic));
-    if (rc == SUCCESS) {
+    if (rc != SUCCESS) {
+        /* The SDK still has the filter name and the filter as its callback data, so the
+         * filter is kept for the messages which may still arrive.
+         */
         ESP_LOGW(TAG, "Could not unsubscribe from topic: %s", topic);
+        return ESP_FAIL;
     }
-    aws_cloud_subscription_t **subscriptions = platform_data->subscriptions;
-    int i;
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (subscriptions[i]) {
-            if (strncmp(topic, subscriptions[i]->topic, strlen(topic)) == 0) {
-                free(subscriptions[i]->topic);
-                free(subscriptions[i]);
-                subscriptions[i] = NULL;
-                return ESP_OK;
-            }
-        }
-    }
-    return ESP_FAIL;
+    return esp_cloud_topic_router_remove(platform_data->topic_router, topic);
 }
 
-esp_err_t esp_cloud_platform_publish(esp_cloud_internal_handle_t *handle, const char *topic, const char *data)
+static esp_err_t aws_platform_publish(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+        size_t data_len, esp_cloud_msg_class_t msg_class)
 {
     if (!handle || !topic || !data || !handle->cloud_platform_priv) {
         return ESP_FAIL;
     }
     aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
+    const esp_cloud_msg_policy_t *policy = esp_cloud_msg_policy_get(handle, msg_class);
     IoT_Publish_Message_Params publish_msg;
-    publish_msg.qos = QOS1;
+    publish_msg.qos = policy->qos ? QOS1 : QOS0;
     publish_msg.payload = (void *) data;
-    publish_msg.payloadLen = strlen(data);
-    publish_msg.isRetained = 0;
-    ESP_LOGI(TAG, "Publishing to: %s", topic);
-    ESP_LOGI(TAG, "Publish Data: %s", data);
+    publish_msg.payloadLen = data_len;
+    publish_msg.isRetained = policy->retain ? 1 : 0;
+    ESP_CLOUD_TRACE(PUBLISH, esp_cloud_trace_hash(topic, strlen(topic)), data_len, msg_class);
+    ESP_LOGD(TAG, "Publishing to: %s", topic);
+    ESP_LOGD(TAG, "Publish Data: %.*s", (int)data_len, (const char *)data);
     IoT_Error_t rc = aws_iot_mqtt_publish(&platform_data->mqttClient, topic, strlen(topic), &publish_msg);
 
     if (SUCCESS != rc) {
@@ -161,6 +184,24 @@ esp_err_t esp_cloud_platform_publish(esp_cloud_internal_handle_t *handle, const
     return ESP_OK;
 }
 
+/* The SDK does not return until the PUBACK is received, so a QoS1 message is complete here.
+ * The publish queue completes the QoS0 ones.
+ */
+static esp_err_t aws_platform_publish_async(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+        size_t data_len, esp_cloud_msg_class_t msg_class, int *msg_id)
+{
+    if (!handle || !msg_id || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
+    *msg_id = ++platform_data->publish_msg_id;
+    esp_err_t err = aws_platform_publish(handle, topic, data, data_len, msg_class);
+    if (err == ESP_OK && esp_cloud_msg_policy_get(handle, msg_class)->qos) {
+        esp_cloud_publish_queue_complete(handle, *msg_id, ESP_OK);
+    }
+    return err;
+}
+
 static void aws_get_new_param_val(esp_cloud_param_val_t *param_val, const jsonStruct_t *received_val)
 {
     switch(param_val->type) {
@@ -182,135 +223,418 @@ static void aws_get_new_param_val(esp_cloud_param_val_t *param_val, const jsonSt
     }
 }
 
-static void aws_common_delta_callback(const char* pJsonValueBuffer, uint32_t valueLength, jsonStruct_t *pContext)
+void get_new_value(esp_cloud_param_val_t *param_val, jsonStruct_t *dynamic_params)
 {
-    printf("aws_common_delta_callback------>\r\n");
-    if(pContext == NULL) {
+    switch(param_val->type) {
+        case CLOUD_PARAM_TYPE_BOOLEAN:
+            * (bool *)dynamic_params->pData = param_val->val.b;
+        break;
+        case CLOUD_PARAM_TYPE_INTEGER:
+            * (int *)dynamic_params->pData = param_val->val.i;
+        break;
+        case CLOUD_PARAM_TYPE_FLOAT:
+            * (float *)dynamic_params->pData = param_val->val.f;
+        break;
+        case CLOUD_PARAM_TYPE_STRING:
+            strncpy((char *)dynamic_params->pData, param_val->val.s, dynamic_params->dataLength - 1);
+            ((char *)dynamic_params->pData)[dynamic_params->dataLength - 1] = '\0';
+        break;
+        default:
+            ESP_LOGE(TAG, "aws_get_new_param_val got invalid value type");
+        break;
+    }
+}
+
+static bool aws_param_val_equal(const esp_cloud_param_val_t *val1, const esp_cloud_param_val_t *val2)
+{
+    switch(val1->type) {
+        case CLOUD_PARAM_TYPE_BOOLEAN:
+            return val1->val.b == val2->val.b;
+        case CLOUD_PARAM_TYPE_INTEGER:
+            return val1->val.i == val2->val.i;
+        case CLOUD_PARAM_TYPE_FLOAT:
+            return val1->val.f == val2->val.f;
+        case CLOUD_PARAM_TYPE_STRING:
+            return (val1->val.s && val2->val.s && strcmp(val1->val.s, val2->val.s) == 0);
+        default:
+            return false;
+    }
+}
+
+static aws_cloud_platform_data_t *aws_get_platform_data(void)
+{
+    esp_cloud_internal_handle_t *handle = (esp_cloud_internal_handle_t *)esp_cloud_get_handle();
+    if (!handle) {
+        return NULL;
+    }
+    return handle->cloud_platform_priv;
+}
+
+/* Handle a value requested from the cloud, which is already in aws_param->pData */
+static void aws_handle_remote_value(jsonStruct_t *aws_param)
+{
+    esp_cloud_dynamic_param_t *param = esp_cloud_get_dynamic_param_by_name(aws_param->pKey);
+    if (!param) {
         return;
     }
-    esp_cloud_dynamic_param_t *param = esp_cloud_get_dynamic_param_by_name(pContext->pKey);
-    if (param) {
-        if (param->cb) {
-            esp_cloud_param_val_t new_val;
-            new_val.type = param->val.type;
-            new_val.val_size = param->val.val_size;
-            aws_get_new_param_val(&new_val, pContext);
-            if (param->cb(pContext->pKey, &new_val, param->priv_data) == ESP_OK) {
-                param->flags |= CLOUD_PARAM_FLAG_REMOTE_CHANGE;
+    esp_cloud_param_val_t new_val;
+    new_val.type = param->val.type;
+    new_val.val_size = param->val.val_size;
+    aws_get_new_param_val(&new_val, aws_param);
+    if (aws_param_val_equal(&param->val, &new_val)) {
+        /* Nothing to actuate. The param is still reported, in case the shadow needs it */
+        ESP_LOGD(TAG, "%s already has the requested value", aws_param->pKey);
+        aws_cloud_platform_data_t *platform_data = aws_get_platform_data();
+        if (platform_data) {
+            platform_data->shadow_stats.actuations_suppressed++;
+        }
+        param->flags |= CLOUD_PARAM_FLAG_REMOTE_CHANGE;
+        return;
+    }
+    if (param->cb && param->cb(aws_param->pKey, &new_val, param->priv_data) == ESP_OK) {
+        if (param->val.type == CLOUD_PARAM_TYPE_STRING) {
+            char *new_str = strdup(new_val.val.s);
+            if (new_str) {
+                free(param->val.val.s);
+                param->val.val.s = new_str;
             }
+        } else {
+            param->val.val = new_val.val;
         }
+        param->flags |= CLOUD_PARAM_FLAG_REMOTE_CHANGE;
+    } else {
+        /* Restore the current value, since the requested one was not applied */
+        get_new_value(&param->val, aws_param);
     }
 }
 
+static void aws_common_delta_callback(const char* pJsonValueBuffer, uint32_t valueLength, jsonStruct_t *pContext)
+{
+    if(pContext == NULL) {
+        return;
+    }
+    ESP_CLOUD_TRACE(SHADOW_DELTA, esp_cloud_trace_hash(pContext->pKey, strlen(pContext->pKey)), valueLength, 0);
+    ESP_LOGD(TAG, "Shadow delta for %s", pContext->pKey);
+    aws_handle_remote_value(pContext);
+}
+
+/* Called once all the shadow updates sent are acknowledged */
+static void aws_shadow_updates_done(aws_cloud_platform_data_t *platform_data)
+{
+    esp_cloud_shadow_state_updates_done(&platform_data->shadow_state, platform_data->shadow_update_failed);
+    platform_data->shadow_update_failed = false;
+}
+
 static void update_status_callback(const char *pThingName, ShadowActions_t action, Shadow_Ack_Status_t status,
                                    const char *pReceivedJsonDocument, void *pContextData)
 {
     IOT_UNUSED(pThingName);
     IOT_UNUSED(action);
-    IOT_UNUSED(pReceivedJsonDocument);
     aws_cloud_platform_data_t *platform_data = (aws_cloud_platform_data_t *) pContextData;
-
-    if (platform_data) {
-        platform_data->shadowUpdateInProgress = false;
+    if (!platform_data) {
+        return;
     }
 
     if (SHADOW_ACK_TIMEOUT == status) {
         ESP_LOGE(TAG, "Update timed out-1");
+        platform_data->shadow_update_failed = true;
     } else if (SHADOW_ACK_REJECTED == status) {
         ESP_LOGE(TAG, "Update rejected");
+        platform_data->shadow_update_failed = true;
     } else if (SHADOW_ACK_ACCEPTED == status) {
-        ESP_LOGI(TAG, "Update accepted");
+        ESP_LOGD(TAG, "Update accepted");
+        platform_data->shadow_stats.version = aws_iot_shadow_get_last_received_version();
+        if (pReceivedJsonDocument) {
+            platform_data->shadow_stats.accepted++;
+            platform_data->shadow_stats.accepted_rx_bytes += strlen(pReceivedJsonDocument);
+        }
+    }
+
+    ESP_CLOUD_TRACE(SHADOW_UPDATE_ACK, status, platform_data->shadow_stats.version,
+            platform_data->shadow_updates_in_flight);
+    if (platform_data->shadow_updates_in_flight) {
+        platform_data->shadow_updates_in_flight--;
+        if (platform_data->shadow_updates_in_flight == 0) {
+            aws_shadow_updates_done(platform_data);
+        }
     }
 }
 
-static IoT_Error_t shadow_update(esp_cloud_internal_handle_t *handle)
+/* Largest shadow document which can be sent in a single update */
+static size_t shadow_max_doc_len(esp_cloud_internal_handle_t *handle)
 {
-    if (!handle || !handle->cloud_platform_priv) {
-        return ESP_FAIL;
+    size_t overhead = SHADOW_UPDATE_TOPIC_FORMAT_LEN + strlen(handle->device_id) + MQTT_PUBLISH_HEADER_LEN;
+    if (overhead >= AWS_IOT_MQTT_TX_BUF_LEN) {
+        return 0;
     }
+    return AWS_IOT_MQTT_TX_BUF_LEN - overhead;
+}
+
+/* Generate a shadow document in an exactly sized buffer and send it */
+static IoT_Error_t shadow_update_doc(esp_cloud_internal_handle_t *handle,
+                                     uint8_t reported_count, jsonStruct_t **reported_handles,
+                                     uint8_t desired_count, jsonStruct_t **desired_handles)
+{
     aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
-    IoT_Error_t rc = FAILURE;
+    size_t doc_size = custom_aws_iot_shadow_get_json_len(handle->device_id, reported_count, reported_handles,
+                                                         desired_count, desired_handles);
+    char *JsonDocumentBuffer = esp_cloud_mem_malloc(doc_size);
+    if (!JsonDocumentBuffer) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes for shadow document", doc_size);
+        platform_data->shadow_update_failed = true;
+        return FAILURE;
+    }
 
-    char JsonDocumentBuffer[MAX_LENGTH_OF_UPDATE_JSON_BUFFER];
-    size_t sizeOfJsonDocumentBuffer = sizeof(JsonDocumentBuffer) / sizeof(JsonDocumentBuffer[0]);
-    rc = aws_iot_shadow_init_json_document(JsonDocumentBuffer, sizeOfJsonDocumentBuffer);
+    IoT_Error_t rc = aws_iot_shadow_init_json_document(JsonDocumentBuffer, doc_size);
+    if (rc == SUCCESS && reported_count > 0) {
+        rc = custom_aws_iot_shadow_add_reported(JsonDocumentBuffer, doc_size,
+                                                reported_count, reported_handles);
+    }
+    if (rc == SUCCESS && desired_count > 0) {
+        rc = custom_aws_iot_shadow_add_desired(JsonDocumentBuffer, doc_size,
+                                               desired_count, desired_handles);
+    }
+    if (rc == SUCCESS) {
+        rc = aws_iot_finalize_json_document(JsonDocumentBuffer, doc_size);
+    }
     if (rc != SUCCESS) {
+        ESP_LOGE(TAG, "Failed to generate shadow document. Error %d", rc);
+        platform_data->shadow_update_failed = true;
+        free(JsonDocumentBuffer);
         return rc;
     }
+    ESP_CLOUD_TRACE(SHADOW_UPDATE, strlen(JsonDocumentBuffer), reported_count, desired_count);
+    ESP_LOGD(TAG, "Update Shadow: %s", JsonDocumentBuffer);
+    rc = aws_iot_shadow_update(&platform_data->mqttClient, handle->device_id, JsonDocumentBuffer,
+                               update_status_callback, platform_data, 4, true);
+    if (rc == SUCCESS) {
+        platform_data->shadow_updates_in_flight++;
+        platform_data->shadow_stats.updates++;
+        platform_data->shadow_stats.tx_bytes += strlen(JsonDocumentBuffer);
+    } else {
+        ESP_LOGE(TAG, "aws_iot_shadow_update returned error %d", rc);
+        platform_data->shadow_update_failed = true;
+    }
+    free(JsonDocumentBuffer);
+    return rc;
+}
 
-    if (platform_data->reported_count > 0) {
-        rc = custom_aws_iot_shadow_add_reported(JsonDocumentBuffer,
-                                                sizeOfJsonDocumentBuffer,
-                                                platform_data->reported_count,
-                                                platform_data->reported_handles);
-        if (rc != SUCCESS) {
-            return rc;
+static size_t shadow_split_doc_len(esp_cloud_internal_handle_t *handle, bool desired,
+                                   uint8_t count, jsonStruct_t **handles)
+{
+    if (desired) {
+        return custom_aws_iot_shadow_get_json_len(handle->device_id, 0, NULL, count, handles);
+    }
+    return custom_aws_iot_shadow_get_json_len(handle->device_id, count, handles, 0, NULL);
+}
+
+/* Send the handles using as many updates as required to keep each document within the
+ * MQTT Tx buffer.
+ */
+static IoT_Error_t shadow_update_split(esp_cloud_internal_handle_t *handle, bool desired,
+                                       uint8_t count, jsonStruct_t **handles)
+{
+    size_t max_doc_len = shadow_max_doc_len(handle);
+    IoT_Error_t rc = SUCCESS;
+    uint8_t start = 0;
+    while (start < count) {
+        uint8_t n = 1;
+        while ((start + n < count) &&
+                (shadow_split_doc_len(handle, desired, n + 1, &handles[start]) <= max_doc_len)) {
+            n++;
+        }
+        size_t doc_len = shadow_split_doc_len(handle, desired, n, &handles[start]);
+        if (doc_len > max_doc_len) {
+            ESP_LOGE(TAG, "Param %s needs %d bytes, but the MQTT Tx buffer allows only %d. Increase AWS_IOT_MQTT_TX_BUF_LEN.",
+                    handles[start]->pKey, doc_len, max_doc_len);
+            rc = SHADOW_JSON_BUFFER_TRUNCATED;
+            ((aws_cloud_platform_data_t *)handle->cloud_platform_priv)->shadow_update_failed = true;
+            start++;
+            continue;
         }
+        IoT_Error_t err = desired ? shadow_update_doc(handle, 0, NULL, n, &handles[start]) :
+                shadow_update_doc(handle, n, &handles[start], 0, NULL);
+        if (err != SUCCESS) {
+            rc = err;
+        }
+        start += n;
     }
+    return rc;
+}
 
-    if (platform_data->desired_count > 0) {
-        rc = custom_aws_iot_shadow_add_desired(JsonDocumentBuffer,
-                            sizeOfJsonDocumentBuffer,
-                            platform_data->desired_count,
+static IoT_Error_t shadow_update_all(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
+
+    size_t doc_len = custom_aws_iot_shadow_get_json_len(handle->device_id,
+                            platform_data->reported_count, platform_data->reported_handles,
+                            platform_data->desired_count, platform_data->desired_handles);
+#ifdef CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY
+    /* Size the document would have had if the reported values were mirrored into desired */
+    size_t mirror_doc_len = custom_aws_iot_shadow_get_json_len(handle->device_id,
+                            platform_data->reported_count, platform_data->reported_handles,
+                            platform_data->reported_count, platform_data->reported_handles);
+    if (mirror_doc_len > doc_len) {
+        platform_data->shadow_stats.tx_bytes_saved += mirror_doc_len - doc_len;
+    }
+#endif /* CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY */
+    if (doc_len <= shadow_max_doc_len(handle)) {
+        return shadow_update_doc(handle, platform_data->reported_count, platform_data->reported_handles,
+                            platform_data->desired_count, platform_data->desired_handles);
+    }
+    ESP_LOGW(TAG, "Shadow document of %d bytes does not fit in one update. Splitting it.", doc_len);
+    /* Desired values go first so that a transient delta never asks for an older value */
+    IoT_Error_t desired_rc = shadow_update_split(handle, true, platform_data->desired_count,
                             platform_data->desired_handles);
-        if (rc != SUCCESS) {
-            return rc;
+    IoT_Error_t reported_rc = shadow_update_split(handle, false, platform_data->reported_count,
+                            platform_data->reported_handles);
+    return (desired_rc != SUCCESS) ? desired_rc : reported_rc;
+}
+
+static IoT_Error_t shadow_update(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
+    IoT_Error_t rc = shadow_update_all(handle);
+    /* Nothing may have been sent, if all the updates failed */
+    if (platform_data->shadow_updates_in_flight == 0) {
+        aws_shadow_updates_done(platform_data);
+    }
+    return rc;
+}
+
+/* Storage for the value of a non string param */
+typedef union {
+    bool b;
+    int i;
+    float f;
+} aws_param_scalar_t;
+
+#define AWS_ARENA_ALIGN(len)    (((len) + 7) & ~((size_t)7))
+
+/* Room in the buffer for parsing the shadow document, besides a param name and value, for
+ * the other keys and values, like the client token.
+ */
+#define AWS_SHADOW_SAX_MARGIN   128
+
+/* Size of the arena holding all the shadow binding state: the jsonStruct_t of the params,
+ * their states, the handle arrays for the shadow updates, the param values and the buffer
+ * for parsing the shadow document.
+ */
+static size_t aws_binding_arena_get_size(esp_cloud_internal_handle_t *handle, size_t *sax_buf_len)
+{
+    size_t count = handle->cur_dynamic_params_count;
+    size_t size = AWS_ARENA_ALIGN(count * sizeof(jsonStruct_t))
+            + AWS_ARENA_ALIGN(count * sizeof(aws_param_state_t))
+            + AWS_ARENA_ALIGN(2 * count * sizeof(jsonStruct_t *))
+            + AWS_ARENA_ALIGN(count * sizeof(aws_param_scalar_t));
+    size_t max_str_len = 0;
+    size_t max_key_len = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        esp_cloud_param_val_t *val = &handle->dynamic_cloud_params[i].val;
+        size_t key_len = strlen(handle->dynamic_cloud_params[i].name);
+        if (key_len > max_key_len) {
+            max_key_len = key_len;
+        }
+        if (val->type == CLOUD_PARAM_TYPE_STRING) {
+            size += AWS_ARENA_ALIGN(val->val_size);
+            if (val->val_size > max_str_len) {
+                max_str_len = val->val_size;
+            }
         }
     }
+    /* The key and the value, both NULL terminated */
+    *sax_buf_len = max_key_len + 1 + max_str_len + AWS_SHADOW_SAX_MARGIN;
+    return size + *sax_buf_len;
+}
 
-    rc = aws_iot_finalize_json_document(JsonDocumentBuffer, sizeOfJsonDocumentBuffer);
-    if (rc != SUCCESS) {
-        return rc;
+static void *aws_binding_arena_take(uint8_t **cursor, size_t len)
+{
+    void *ptr = *cursor;
+    *cursor += AWS_ARENA_ALIGN(len);
+    return ptr;
+}
+
+/* The arena is allocated on the first registration and reused for the later ones, i.e.
+ * after every reconnection. It is reallocated only if the params need more space.
+ */
+static esp_err_t aws_binding_arena_prepare(esp_cloud_internal_handle_t *handle)
+{
+    aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
+    size_t sax_buf_len;
+    size_t size = aws_binding_arena_get_size(handle, &sax_buf_len);
+    if (size > platform_data->binding_arena_size) {
+        if (platform_data->binding_arena) {
+            free(platform_data->binding_arena);
+        }
+        platform_data->binding_arena_size = 0;
+        platform_data->binding_arena = esp_cloud_mem_malloc(size);
+        if (!platform_data->binding_arena) {
+            ESP_LOGE(TAG, "Failed to allocate %d bytes for the shadow bindings", size);
+            return ESP_ERR_NO_MEM;
+        }
+        platform_data->binding_arena_size = size;
     }
-    ESP_LOGI(TAG, "Update Shadow: %s", JsonDocumentBuffer);
-    rc = aws_iot_shadow_update(&platform_data->mqttClient, handle->device_id, JsonDocumentBuffer,
-                               update_status_callback, platform_data, 4, true);           
-    platform_data->shadowUpdateInProgress = true;
-    return rc;
+    memset(platform_data->binding_arena, 0, platform_data->binding_arena_size);
+
+    size_t count = handle->cur_dynamic_params_count;
+    uint8_t *cursor = platform_data->binding_arena;
+    platform_data->dynamic_params = aws_binding_arena_take(&cursor, count * sizeof(jsonStruct_t));
+    platform_data->param_states = aws_binding_arena_take(&cursor, count * sizeof(aws_param_state_t));
+    platform_data->desired_handles = aws_binding_arena_take(&cursor, count * sizeof(jsonStruct_t *));
+    platform_data->reported_handles = aws_binding_arena_take(&cursor, count * sizeof(jsonStruct_t *));
+    aws_param_scalar_t *scalars = aws_binding_arena_take(&cursor, count * sizeof(aws_param_scalar_t));
+    int i;
+    for (i = 0; i < count; i++) {
+        esp_cloud_param_val_t *val = &handle->dynamic_cloud_params[i].val;
+        if (val->type == CLOUD_PARAM_TYPE_STRING) {
+            platform_data->dynamic_params[i].pData = aws_binding_arena_take(&cursor, val->val_size);
+        } else {
+            platform_data->dynamic_params[i].pData = &scalars[i];
+        }
+    }
+    platform_data->sax_buf = (char *)cursor;
+    platform_data->sax_buf_len = sax_buf_len;
+    return ESP_OK;
 }
 
+/* Fill in a param binding. aws_param->pData should already point to the storage for the value */
 static esp_err_t esp_cloud_param_map_to_aws(esp_cloud_dynamic_param_t *cloud_param, jsonStruct_t *aws_param)
 {
-    if (!cloud_param || !aws_param) {
+    if (!cloud_param || !aws_param || !aws_param->pData) {
         return ESP_FAIL;
     }
     switch(cloud_param->val.type) {
-        case CLOUD_PARAM_TYPE_BOOLEAN: {
-                aws_param->pData = esp_cloud_mem_malloc(sizeof(bool));
-                *(bool *)aws_param->pData = cloud_param->val.val.b;
-                aws_param->dataLength = cloud_param->val.val_size;
-                aws_param->pKey = cloud_param->name;
-                aws_param->type = SHADOW_JSON_BOOL;
-            }
+        case CLOUD_PARAM_TYPE_BOOLEAN:
+            *(bool *)aws_param->pData = cloud_param->val.val.b;
+            aws_param->type = SHADOW_JSON_BOOL;
             break;
-        case CLOUD_PARAM_TYPE_INTEGER: {
-                aws_param->pData = esp_cloud_mem_malloc(sizeof(int));
-                *(int *)aws_param->pData = cloud_param->val.val.i;
-                aws_param->dataLength = cloud_param->val.val_size;
-                aws_param->pKey = cloud_param->name;
-                aws_param->type = SHADOW_JSON_INT32;
-            }
+        case CLOUD_PARAM_TYPE_INTEGER:
+            *(int *)aws_param->pData = cloud_param->val.val.i;
+            aws_param->type = SHADOW_JSON_INT32;
             break;
-        case CLOUD_PARAM_TYPE_FLOAT: {
-                aws_param->pData = esp_cloud_mem_malloc(sizeof(float));
-                *(float *)aws_param->pData = cloud_param->val.val.f;
-                aws_param->dataLength = cloud_param->val.val_size;
-                aws_param->pKey = cloud_param->name;
-                aws_param->type = SHADOW_JSON_FLOAT;
-            }
+        case CLOUD_PARAM_TYPE_FLOAT:
+            *(float *)aws_param->pData = cloud_param->val.val.f;
+            aws_param->type = SHADOW_JSON_FLOAT;
             break;
-        case CLOUD_PARAM_TYPE_STRING: {
-                aws_param->pData = esp_cloud_mem_calloc(1, cloud_param->val.val_size);
-                strncpy((char *)aws_param->pData, cloud_param->val.val.s, cloud_param->val.val_size);
-                aws_param->dataLength = cloud_param->val.val_size;
-                aws_param->pKey = cloud_param->name;
-                aws_param->type = SHADOW_JSON_STRING;
+        case CLOUD_PARAM_TYPE_STRING:
+            if (cloud_param->val.val.s && cloud_param->val.val_size) {
+                strncpy((char *)aws_param->pData, cloud_param->val.val.s, cloud_param->val.val_size - 1);
             }
+            aws_param->type = SHADOW_JSON_STRING;
             break;
         default :
             ESP_LOGW(TAG, "Invalid Cloud param value type. Skipping...");
             return ESP_FAIL;
     }
+    aws_param->dataLength = cloud_param->val.val_size;
+    aws_param->pKey = cloud_param->name;
     return ESP_OK;
 }
 
@@ -335,7 +659,7 @@ void disconnectCallbackHandler(AWS_IoT_Client *pClient, void *data)
     }
 }
 
-esp_err_t esp_cloud_platform_connect(esp_cloud_internal_handle_t *handle)
+static esp_err_t aws_platform_connect(esp_cloud_internal_handle_t *handle)
 {
     if (!handle || !handle->cloud_platform_priv) {
         return ESP_FAIL;
@@ -375,6 +699,8 @@ esp_err_t esp_cloud_platform_connect(esp_cloud_internal_handle_t *handle)
         }else{
             dev_states = IOT_OK;
             ESP_LOGI(TAG, "connecting to %s:%d",sp.pHost, sp.port);
+            /* Drop deltas older than the last shadow version received */
+            aws_iot_shadow_enable_discard_old_delta_msgs();
         }
         // if (handle->reconnect_attempts) {
         //     reconnect_attempts--;
@@ -388,41 +714,42 @@ esp_err_t esp_cloud_platform_connect(esp_cloud_internal_handle_t *handle)
     return ESP_OK;
 }
 
+static void aws_unsubscribe_filter(const char *filter, void *priv_data)
+{
+    aws_cloud_platform_data_t *platform_data = (aws_cloud_platform_data_t *)priv_data;
+    IoT_Error_t rc = aws_iot_mqtt_unsubscribe(&platform_data->mqttClient, filter, strlen(filter));
+    if (rc != SUCCESS) {
+        /* Kept, since the SDK still refers to it */
+        ESP_LOGW(TAG, "Could not unsubscribe from topic: %s", filter);
+        return;
+    }
+    esp_cloud_topic_router_remove(platform_data->topic_router, filter);
+}
+
+/* Only the filters which the SDK no longer refers to are removed */
 static void aws_unsubscribe_all(esp_cloud_internal_handle_t *handle)
 {
     aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
-    int i;
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (platform_data->subscriptions[i]) {
-            esp_cloud_platform_unsubscribe(handle, platform_data->subscriptions[i]->topic);
-        }
-    }
+    esp_cloud_topic_router_foreach(platform_data->topic_router, aws_unsubscribe_filter, platform_data);
 }
 
 
+/* The bindings are dropped, but the arena holding them is kept for the next registration */
 static void aws_remove_all_dynamic_params(esp_cloud_internal_handle_t *handle)
 {
     aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
-    int i;
-    for (i = 0; i < handle->cur_dynamic_params_count; i++) {
-        if (platform_data->dynamic_params[i].type == SHADOW_JSON_STRING) {
-            free(platform_data->dynamic_params[i].pData);
-        }
-    }
-    if (platform_data->dynamic_params) {
-        free(platform_data->dynamic_params);
-        platform_data->dynamic_params = NULL;
-    }
-    if (platform_data->desired_handles) {
-        free(platform_data->desired_handles);
-        platform_data->desired_handles = NULL;
-    }
-    if (platform_data->reported_handles) {
-        free(platform_data->reported_handles);
-        platform_data->reported_handles = NULL;
-    }
+    platform_data->dynamic_params = NULL;
+    platform_data->param_states = NULL;
+    platform_data->desired_handles = NULL;
+    platform_data->reported_handles = NULL;
+    platform_data->sax_buf = NULL;
+    platform_data->sax_buf_len = 0;
+    platform_data->param_count = 0;
+    platform_data->desired_count = 0;
+    platform_data->reported_count = 0;
 }
-esp_err_t esp_cloud_platform_disconnect(esp_cloud_internal_handle_t *handle)
+
+static esp_err_t aws_platform_disconnect(esp_cloud_internal_handle_t *handle)
 {
     if (!handle || !handle->cloud_platform_priv) {
         return ESP_FAIL;
@@ -439,7 +766,7 @@ esp_err_t esp_cloud_platform_disconnect(esp_cloud_internal_handle_t *handle)
     return ESP_OK;
 }
 
-esp_err_t esp_cloud_platform_register_dynamic_params(esp_cloud_internal_handle_t *handle)
+static esp_err_t aws_platform_register_dynamic_params(esp_cloud_internal_handle_t *handle)
 {
     if (!handle || !handle->cloud_platform_priv) {
         return ESP_FAIL;
@@ -450,10 +777,18 @@ esp_err_t esp_cloud_platform_register_dynamic_params(esp_cloud_internal_handle_t
     if (handle->cur_dynamic_params_count == 0) {
         return ESP_OK;
     }
-    jsonStruct_t *dynamic_params = esp_cloud_mem_calloc(handle->cur_dynamic_params_count, sizeof(jsonStruct_t));
+    uint32_t alloc_count = esp_cloud_mem_get_alloc_count();
+    if (aws_binding_arena_prepare(handle) != ESP_OK ||
+            esp_cloud_shadow_state_prepare(&platform_data->shadow_state, handle,
+                    &platform_data->shadow_stats) != ESP_OK) {
+        aws_remove_all_dynamic_params(handle);
+        return ESP_FAIL;
+    }
+    jsonStruct_t *dynamic_params = platform_data->dynamic_params;
+    aws_param_state_t *param_states = platform_data->param_states;
 
     int i;
-    printf("handle->cur_dynamic_params_count:%d--------------\r\n",handle->cur_dynamic_params_count);
+    ESP_LOGD(TAG, "Registering %d dynamic params", handle->cur_dynamic_params_count);
     for (i = 0; i < handle->cur_dynamic_params_count; i++) {
         dynamic_params[i].cb = aws_common_delta_callback;
         esp_err_t err = esp_cloud_param_map_to_aws(&handle->dynamic_cloud_params[i], &dynamic_params[i]);
@@ -461,32 +796,290 @@ esp_err_t esp_cloud_platform_register_dynamic_params(esp_cloud_internal_handle_t
             rc = aws_iot_shadow_register_delta(&platform_data->mqttClient, &dynamic_params[i]);
             if(SUCCESS != rc) {
                 ESP_LOGE(TAG, "Shadow Register Delta Error %d", rc);
-                free(dynamic_params);
+                aws_remove_all_dynamic_params(handle);
                 return ESP_FAIL;
             }
         }
     }
-    jsonStruct_t **desired_handles = esp_cloud_mem_calloc(handle->cur_dynamic_params_count, sizeof(jsonStruct_t *));
-    if (desired_handles == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory");
-        free(dynamic_params);
-        return ESP_FAIL;
+    for (i = 0; i < handle->cur_dynamic_params_count; i++) {
+        param_states[i].desired_null.pKey = handle->dynamic_cloud_params[i].name;
+        param_states[i].desired_null.pData = aws_json_null;
+        param_states[i].desired_null.dataLength = strlen(aws_json_null);
+        param_states[i].desired_null.type = SHADOW_JSON_OBJECT;
+#ifdef CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY
+        /* The desired values may have been left over by an earlier session */
+        param_states[i].clear_desired = true;
+#endif
+    }
+    platform_data->param_count = handle->cur_dynamic_params_count;
+    ESP_LOGD(TAG, "Shadow bindings use %d + %d bytes. Allocations: %u", platform_data->binding_arena_size,
+            platform_data->shadow_state.size, esp_cloud_mem_get_alloc_count() - alloc_count);
+    return ESP_OK;
+}
+
+/* Add a param to the next shadow update. The reported value is skipped if the shadow
+ * already has it. With CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY, the desired value is only
+ * cleared with an explicit null, and that too only if the shadow may have one.
+ */
+static void aws_add_param(aws_cloud_platform_data_t *platform_data, int index,
+        const esp_cloud_param_val_t *val, bool remote_change)
+{
+    jsonStruct_t *aws_param = &platform_data->dynamic_params[index];
+    aws_param_state_t *param_state = &platform_data->param_states[index];
+
+    if (esp_cloud_shadow_state_report(&platform_data->shadow_state, index, val)) {
+        platform_data->reported_handles[platform_data->reported_count++] = aws_param;
+#ifndef CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY
+        platform_data->desired_handles[platform_data->desired_count++] = aws_param;
+#endif
+    }
+#ifdef CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY
+    if (remote_change || param_state->clear_desired) {
+        platform_data->desired_handles[platform_data->desired_count++] = &param_state->desired_null;
+        param_state->clear_desired = false;
+    }
+#endif /* CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY */
+}
+
+/* Add the params which have changed, or all params, to the next shadow update */
+static void aws_add_params(esp_cloud_internal_handle_t *handle, bool all)
+{
+    aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
+    platform_data->desired_count = 0;
+    platform_data->reported_count = 0;
+    int i;
+    for (i = 0; i < handle->cur_dynamic_params_count; i++) {
+        uint8_t flags = handle->dynamic_cloud_params[i].flags;
+        if (flags & CLOUD_PARAM_FLAG_LOCAL_CHANGE) {
+            get_new_value(&handle->dynamic_cloud_params[i].val, &platform_data->dynamic_params[i]);
+        }
+        if (all || (flags & (CLOUD_PARAM_FLAG_LOCAL_CHANGE | CLOUD_PARAM_FLAG_REMOTE_CHANGE))) {
+            aws_add_param(platform_data, i, &handle->dynamic_cloud_params[i].val,
+                    flags & CLOUD_PARAM_FLAG_REMOTE_CHANGE);
+        }
+        handle->dynamic_cloud_params[i].flags = 0;
+    }
+}
+
+/* Convert a value from the shadow document into data, as per the type of the param */
+static int aws_json_get_param(jsonStruct_t *aws_param, json_sax_event_t event, const char *str, int len,
+        void *data)
+{
+    if (aws_param->type == SHADOW_JSON_STRING) {
+        if (event != JSON_SAX_STRING || len >= aws_param->dataLength) {
+            return -1;
+        }
+        memmove(data, str, len + 1);
+        return 0;
+    }
+    if (event != JSON_SAX_PRIMITIVE) {
+        return -1;
+    }
+    switch(aws_param->type) {
+        case SHADOW_JSON_BOOL:
+            return json_primitive_get_bool(str, len, (bool *)data);
+        case SHADOW_JSON_INT32:
+            return json_primitive_get_int(str, len, (int *)data);
+        case SHADOW_JSON_FLOAT:
+            return json_primitive_get_float(str, len, (float *)data);
+        default:
+            return -1;
+    }
+}
+
+/* Get the param value held in data, as written by aws_json_get_param() */
+static void aws_param_get_val(jsonStruct_t *aws_param, void *data, esp_cloud_param_val_t *val)
+{
+    aws_param_scalar_t *scalar = data;
+    val->val_size = aws_param->dataLength;
+    switch(aws_param->type) {
+        case SHADOW_JSON_BOOL:
+            val->type = CLOUD_PARAM_TYPE_BOOLEAN;
+            val->val.b = scalar->b;
+            break;
+        case SHADOW_JSON_INT32:
+            val->type = CLOUD_PARAM_TYPE_INTEGER;
+            val->val.i = scalar->i;
+            break;
+        case SHADOW_JSON_FLOAT:
+            val->type = CLOUD_PARAM_TYPE_FLOAT;
+            val->val.f = scalar->f;
+            break;
+        default:
+            val->type = CLOUD_PARAM_TYPE_STRING;
+            val->val.s = (char *)data;
+            break;
+    }
+}
+
+typedef enum {
+    AWS_SHADOW_SECTION_OTHER,
+    AWS_SHADOW_SECTION_REPORTED,
+    AWS_SHADOW_SECTION_DESIRED,
+} aws_shadow_section_t;
+
+typedef struct {
+    aws_cloud_platform_data_t *platform_data;
+    aws_shadow_section_t section;
+    bool in_state;
+} aws_shadow_load_ctx_t;
+
+static void aws_shadow_load_val(aws_shadow_load_ctx_t *ctx, const char *key, json_sax_event_t event,
+        const char *str, int len)
+{
+    aws_cloud_platform_data_t *platform_data = ctx->platform_data;
+    int i;
+    for (i = 0; i < platform_data->param_count; i++) {
+        if (strcmp(platform_data->dynamic_params[i].pKey, key) == 0) {
+            break;
+        }
+    }
+    if (i == platform_data->param_count) {
+        return;
+    }
+    jsonStruct_t *aws_param = &platform_data->dynamic_params[i];
+    if (ctx->section == AWS_SHADOW_SECTION_REPORTED) {
+        /* A string is converted in place, in the parser's buffer */
+        aws_param_scalar_t scalar;
+        void *data = (aws_param->type == SHADOW_JSON_STRING) ? (void *)str : &scalar;
+        if (aws_json_get_param(aws_param, event, str, len, data) == 0) {
+            esp_cloud_param_val_t val;
+            aws_param_get_val(aws_param, data, &val);
+            esp_cloud_shadow_state_set_acked(&platform_data->shadow_state, i, &val);
+        }
+    } else {
+        /* Handled once the whole document is known to be valid */
+        if (aws_json_get_param(aws_param, event, str, len, aws_param->pData) == 0) {
+            platform_data->param_states[i].desired_found = true;
+        }
+    }
+}
+
+/* Only the values in state.reported and state.desired are of interest */
+static int aws_shadow_load_cb(json_sax_event_t event, const char *key, const char *val, int val_len,
+        int depth, void *priv)
+{
+    aws_shadow_load_ctx_t *ctx = priv;
+    switch (event) {
+        case JSON_SAX_OBJECT_START:
+            if (depth == 1) {
+                ctx->in_state = (key && strcmp(key, "state") == 0);
+            } else if (depth == 2 && ctx->in_state && key) {
+                if (strcmp(key, "reported") == 0) {
+                    ctx->section = AWS_SHADOW_SECTION_REPORTED;
+                } else if (strcmp(key, "desired") == 0) {
+                    ctx->section = AWS_SHADOW_SECTION_DESIRED;
+                }
+            }
+            break;
+        case JSON_SAX_OBJECT_END:
+            if (depth == 1) {
+                ctx->in_state = false;
+            } else if (depth == 2) {
+                ctx->section = AWS_SHADOW_SECTION_OTHER;
+            }
+            break;
+        case JSON_SAX_STRING:
+        case JSON_SAX_PRIMITIVE:
+            if (depth == 3 && key && ctx->section != AWS_SHADOW_SECTION_OTHER) {
+                aws_shadow_load_val(ctx, key, event, val, val_len);
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+/* Put back the current value of a param, in place of a desired value which is not applied */
+static void aws_param_restore(jsonStruct_t *aws_param)
+{
+    esp_cloud_dynamic_param_t *param = esp_cloud_get_dynamic_param_by_name(aws_param->pKey);
+    if (param) {
+        get_new_value(&param->val, aws_param);
+    }
+}
+
+/* Use the shadow from the cloud to find the reported values which need not be sent again,
+ * and the desired values which were set while the device was offline. The document is
+ * parsed with json_sax, so that no tokens are allocated for it, however large it is.
+ */
+static void aws_shadow_load(aws_cloud_platform_data_t *platform_data, const char *doc, size_t doc_len)
+{
+    int i;
+    if (!platform_data->sax_buf) {
+        return;
+    }
+    for (i = 0; i < platform_data->param_count; i++) {
+        platform_data->param_states[i].desired_found = false;
+    }
+    aws_shadow_load_ctx_t ctx = {
+        .platform_data = platform_data,
+    };
+    json_sax_ctx_t sax;
+    json_sax_start(&sax, platform_data->sax_buf, platform_data->sax_buf_len, aws_shadow_load_cb, &ctx);
+    int ret = json_sax_feed(&sax, doc, doc_len);
+    if (ret == 0) {
+        ret = json_sax_end(&sax);
+    }
+    if (ret != 0) {
+        ESP_LOGW(TAG, "Invalid shadow document (%d). All params will be reported.", ret);
+        esp_cloud_shadow_state_forget_acked(&platform_data->shadow_state);
+        for (i = 0; i < platform_data->param_count; i++) {
+            if (platform_data->param_states[i].desired_found) {
+                aws_param_restore(&platform_data->dynamic_params[i]);
+            }
+        }
+        return;
     }
+    for (i = 0; i < platform_data->param_count; i++) {
+        jsonStruct_t *aws_param = &platform_data->dynamic_params[i];
+        bool desired_found = platform_data->param_states[i].desired_found;
+#ifdef CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY
+        platform_data->param_states[i].clear_desired = desired_found;
+#endif
+        if (!desired_found) {
+            continue;
+        }
+        esp_cloud_param_val_t val;
+        aws_param_get_val(aws_param, aws_param->pData, &val);
+        if (esp_cloud_shadow_state_is_acked(&platform_data->shadow_state, i, &val)) {
+            aws_param_restore(aws_param);
+        } else {
+            aws_handle_remote_value(aws_param);
+        }
+    }
+}
 
-    jsonStruct_t **reported_handles = esp_cloud_mem_calloc(handle->cur_dynamic_params_count, sizeof(jsonStruct_t *));
-    if (reported_handles == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory");
-        free(desired_handles);
-        free(dynamic_params);
+static void shadow_get_callback(const char *pThingName, ShadowActions_t action, Shadow_Ack_Status_t status,
+                                const char *pReceivedJsonDocument, void *pContextData)
+{
+    IOT_UNUSED(pThingName);
+    IOT_UNUSED(action);
+    aws_cloud_platform_data_t *platform_data = (aws_cloud_platform_data_t *) pContextData;
+    if (!platform_data) {
+        return;
+    }
+    platform_data->shadow_get_in_progress = false;
+    if (SHADOW_ACK_ACCEPTED != status || !pReceivedJsonDocument) {
+        ESP_LOGW(TAG, "Could not get the shadow. All params will be reported.");
+        return;
+    }
+    platform_data->shadow_stats.version = aws_iot_shadow_get_last_received_version();
+    aws_shadow_load(platform_data, pReceivedJsonDocument, strlen(pReceivedJsonDocument));
+}
+
+static esp_err_t aws_platform_get_shadow_stats(esp_cloud_internal_handle_t *handle, esp_cloud_shadow_stats_t *stats)
+{
+    if (!handle || !handle->cloud_platform_priv || !stats) {
         return ESP_FAIL;
     }
-    platform_data->dynamic_params = dynamic_params;
-    platform_data->desired_handles = desired_handles;
-    platform_data->reported_handles = reported_handles;
+    aws_cloud_platform_data_t *platform_data = handle->cloud_platform_priv;
+    *stats = platform_data->shadow_stats;
     return ESP_OK;
 }
 
-esp_err_t esp_cloud_platform_report_state(esp_cloud_internal_handle_t *handle)
+static esp_err_t aws_platform_report_state(esp_cloud_internal_handle_t *handle)
 {
     if (!handle || !handle->cloud_platform_priv) {
         return ESP_FAIL;
@@ -495,32 +1088,30 @@ esp_err_t esp_cloud_platform_report_state(esp_cloud_internal_handle_t *handle)
     if (handle->cur_dynamic_params_count == 0) {
         return ESP_OK;
     }
+    /* Get the shadow first, so that only the values it does not have are reported */
+    IoT_Error_t rc = aws_iot_shadow_get(&platform_data->mqttClient, handle->device_id,
+                                        shadow_get_callback, platform_data, 4, false);
+    if (rc == SUCCESS) {
+        platform_data->shadow_get_in_progress = true;
+        while(platform_data->shadow_get_in_progress) {
+            aws_iot_shadow_yield(&platform_data->mqttClient, 1000);
+        }
+    } else {
+        ESP_LOGW(TAG, "aws_iot_shadow_get returned error %d", rc);
+    }
     // Report the initial values once
-    platform_data->reported_count = 0;
-    int i;
-    for (i = 0; i < handle->cur_dynamic_params_count; i++) {
-        platform_data->reported_handles[platform_data->reported_count++] =
-                &platform_data->dynamic_params[i];
+    aws_add_params(handle, true);
+    ESP_CLOUD_TRACE(REPORT_STATE, platform_data->reported_count, platform_data->desired_count, 0);
+    ESP_LOGD(TAG, "Reporting %d params", platform_data->reported_count);
+    if (platform_data->reported_count > 0 || platform_data->desired_count > 0) {
+        shadow_update(handle);
     }
-    printf("platform_data->reported_count:%d\n",platform_data->reported_count);
-    shadow_update(handle);  
-    while(platform_data->shadowUpdateInProgress) {
+    while(platform_data->shadow_updates_in_flight) {
         aws_iot_shadow_yield(&platform_data->mqttClient, 1000);
     }
     return ESP_OK;
 }
-void get_new_value(esp_cloud_param_val_t *param_val, jsonStruct_t *dynamic_params)
-{
-    switch(param_val->type) {
-        case CLOUD_PARAM_TYPE_BOOLEAN:
-            * (bool *)dynamic_params->pData = param_val->val.b;
-        break;
-        default:
-            ESP_LOGE(TAG, "aws_get_new_param_val got invalid value type");
-        break;
-    }
-}
-esp_err_t esp_cloud_platform_wait(esp_cloud_internal_handle_t *handle)
+static esp_err_t aws_platform_wait(esp_cloud_internal_handle_t *handle)
 {
     if (!handle || !handle->cloud_platform_priv) {
         return ESP_FAIL;
@@ -529,7 +1120,7 @@ esp_err_t esp_cloud_platform_wait(esp_cloud_internal_handle_t *handle)
     IoT_Error_t rc = SUCCESS;
     while (1) {
         rc = aws_iot_shadow_yield(&platform_data->mqttClient, 200);
-        if (NETWORK_ATTEMPTING_RECONNECT == rc || platform_data->shadowUpdateInProgress) {
+        if (NETWORK_ATTEMPTING_RECONNECT == rc || platform_data->shadow_updates_in_flight) {
            aws_iot_shadow_yield(&platform_data->mqttClient, 1000);
             // If the client is attempting to reconnect, or already waiting on a shadow update,
             // we will skip the rest of the loop.
@@ -537,26 +1128,7 @@ esp_err_t esp_cloud_platform_wait(esp_cloud_internal_handle_t *handle)
         }
         break;
     }
-    platform_data->desired_count = 0;
-    platform_data->reported_count = 0;
-    int i;
-    for (i = 0; i < handle->cur_dynamic_params_count; i++) {
-        if (handle->dynamic_cloud_params[i].flags & CLOUD_PARAM_FLAG_LOCAL_CHANGE) {
-            get_new_value(&handle->dynamic_cloud_params[i].val, &platform_data->dynamic_params[i]);
-            platform_data->reported_handles[platform_data->reported_count++] =
-                &platform_data->dynamic_params[i];
-            platform_data->desired_handles[platform_data->desired_count++] =
-                &platform_data->dynamic_params[i];
-        } else if (handle->dynamic_cloud_params[i].flags & CLOUD_PARAM_FLAG_REMOTE_CHANGE) {
-            platform_data->reported_handles[platform_data->reported_count++] =
-                &platform_data->dynamic_params[i];
-
-            platform_data->desired_handles[platform_data->desired_count++] =                //lin 2019-9-19
-                &platform_data->dynamic_params[i];
-
-        }
-        handle->dynamic_cloud_params[i].flags = 0;
-    }
+    aws_add_params(handle, false);
 
     if (platform_data->reported_count > 0 || platform_data->desired_count > 0) {
         rc = shadow_update(handle);
@@ -564,7 +1136,7 @@ esp_err_t esp_cloud_platform_wait(esp_cloud_internal_handle_t *handle)
     return ESP_OK;
 }
 
-esp_err_t esp_cloud_platform_init(esp_cloud_internal_handle_t *handle)
+static esp_err_t aws_platform_init(esp_cloud_internal_handle_t *handle)
 {
     if (handle->cloud_platform_priv) {
         return ESP_FAIL;
@@ -586,6 +1158,9 @@ esp_err_t esp_cloud_platform_init(esp_cloud_internal_handle_t *handle)
     if ((platform_data->server_cert = esp_cloud_storage_get("server_cert")) == NULL) {
         goto init_err;
     }
+    if ((platform_data->topic_router = esp_cloud_topic_router_create()) == NULL) {
+        goto init_err;
+    }
     handle->cloud_platform_priv = platform_data;
     return ESP_OK;
 
@@ -605,3 +1180,18 @@ init_err:
     free(platform_data);
     return ESP_FAIL;
 }
+
+const esp_cloud_transport_t esp_cloud_transport_aws_iot = {
+    .name = "AWS IoT",
+    .init = aws_platform_init,
+    .connect = aws_platform_connect,
+    .wait = aws_platform_wait,
+    .disconnect = aws_platform_disconnect,
+    .report_state = aws_platform_report_state,
+    .register_dynamic_params = aws_platform_register_dynamic_params,
+    .get_shadow_stats = aws_platform_get_shadow_stats,
+    .publish = aws_platform_publish,
+    .publish_async = aws_platform_publish_async,
+    .subscribe = aws_platform_subscribe,
+    .unsubscribe = aws_platform_unsubscribe,
+};
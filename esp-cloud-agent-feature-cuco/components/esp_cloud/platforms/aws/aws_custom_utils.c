@@ -15,8 +15,11 @@
 #include <stdbool.h>
 #include "aws_custom_utils.h"
 #include "string.h"
+#include <json_generator.h>
 
 #define OBJECT_NAME_STRING "\"%s\":{"
+/* The client token sequence number is a 32 bit signed integer */
+#define MAX_CLIENT_TOKEN_SEQUENCE_DIGITS	11
 
 static inline IoT_Error_t check_snprintf_ret_val(int32_t snPrintfReturn, size_t maxSizeOfJsonDocument) {
 	if(snPrintfReturn < 0) {
@@ -27,31 +30,39 @@ static inline IoT_Error_t check_snprintf_ret_val(int32_t snPrintfReturn, size_t
 	return SUCCESS;
 }
 
-static IoT_Error_t convert_data_to_string(char *pStringBuffer, size_t maxSizeofStringBuffer, JsonPrimitiveType type,
-									   void *pData) {
+/* Prints the value followed by a comma. Can be called with a NULL buffer and
+ * 0 size to just get the length required. Returns the snprintf() return value.
+ * Integers and floats are formatted by json_generator, without printf.
+ */
+static int32_t print_data(char *pStringBuffer, size_t maxSizeofStringBuffer, JsonPrimitiveType type,
+						  void *pData) {
 	int32_t snPrintfReturn = 0;
-	IoT_Error_t ret_val = SUCCESS;
-
-	if(maxSizeofStringBuffer == 0) {
-		return SHADOW_JSON_ERROR;
-	}
+	char num[JSON_FLOAT_STR_MAX];
 
 	if(type == SHADOW_JSON_INT32) {
-		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%i,", *(int32_t *) (pData));
+		json_format_int(num, *(int32_t *) (pData));
+		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%s,", num);
 	} else if(type == SHADOW_JSON_INT16) {
-		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%hi,", *(int16_t *) (pData));
+		json_format_int(num, *(int16_t *) (pData));
+		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%s,", num);
 	} else if(type == SHADOW_JSON_INT8) {
-		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%hhi,", *(int8_t *) (pData));
+		json_format_int(num, *(int8_t *) (pData));
+		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%s,", num);
 	} else if(type == SHADOW_JSON_UINT32) {
-		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%u,", *(uint32_t *) (pData));
+		json_format_uint(num, *(uint32_t *) (pData));
+		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%s,", num);
 	} else if(type == SHADOW_JSON_UINT16) {
-		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%hu,", *(uint16_t *) (pData));
+		json_format_uint(num, *(uint16_t *) (pData));
+		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%s,", num);
 	} else if(type == SHADOW_JSON_UINT8) {
-		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%hhu,", *(uint8_t *) (pData));
+		json_format_uint(num, *(uint8_t *) (pData));
+		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%s,", num);
 	} else if(type == SHADOW_JSON_DOUBLE) {
+		/* Not used by esp_cloud. Kept as is, since json_format_float() would lose precision */
 		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%f,", *(double *) (pData));
 	} else if(type == SHADOW_JSON_FLOAT) {
-		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%f,", *(float *) (pData));
+		json_format_float(num, *(float *) (pData));
+		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%s,", num);
 	} else if(type == SHADOW_JSON_BOOL) {
 		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%s,", *(bool *) (pData) ? "true" : "false");
 	} else if(type == SHADOW_JSON_STRING) {
@@ -59,10 +70,34 @@ static IoT_Error_t convert_data_to_string(char *pStringBuffer, size_t maxSizeofS
 	} else if(type == SHADOW_JSON_OBJECT) {
 		snPrintfReturn = snprintf(pStringBuffer, maxSizeofStringBuffer, "%s,", (char *) (pData));
 	}
+	return snPrintfReturn;
+}
 
-	ret_val = check_snprintf_ret_val(snPrintfReturn, maxSizeofStringBuffer);
+static IoT_Error_t convert_data_to_string(char *pStringBuffer, size_t maxSizeofStringBuffer, JsonPrimitiveType type,
+									   void *pData) {
+	if(maxSizeofStringBuffer == 0) {
+		return SHADOW_JSON_ERROR;
+	}
 
-	return ret_val;
+	return check_snprintf_ret_val(print_data(pStringBuffer, maxSizeofStringBuffer, type, pData),
+								  maxSizeofStringBuffer);
+}
+
+/* Length added by generate_json_object() for the given object. The trailing comma
+ * of the last element gets replaced by the "}," which closes the object.
+ */
+static size_t get_json_object_len(char *object_name, uint8_t count, jsonStruct_t **handler) {
+	size_t len = strlen(object_name) + strlen("\"\":{");
+	int8_t i;
+
+	for(i = 0; i < count; i++) {
+		int32_t data_len = print_data(NULL, 0, handler[i]->type, handler[i]->pData);
+		if(data_len < 0) {
+			return 0;
+		}
+		len += strlen(handler[i]->pKey) + strlen("\"\":") + data_len;
+	}
+	return len - 1 + strlen("},");
 }
 
 static IoT_Error_t generate_json_object(char *object_name, char *pJsonDocument, size_t maxSizeOfJsonDocument, uint8_t count, jsonStruct_t **handler) {
@@ -84,7 +119,7 @@ static IoT_Error_t generate_json_object(char *object_name, char *pJsonDocument,
 	remSizeOfJsonBuffer = tempSize;
 
 	snPrintfReturn = snprintf(pJsonDocument + strlen(pJsonDocument), remSizeOfJsonBuffer, OBJECT_NAME_STRING, object_name);
-	ret_val = check_snprintf_ret_val(snPrintfReturn, maxSizeOfJsonDocument);
+	ret_val = check_snprintf_ret_val(snPrintfReturn, remSizeOfJsonBuffer);
 	if (ret_val != SUCCESS) {
 		return ret_val;
 	}
@@ -101,9 +136,11 @@ static IoT_Error_t generate_json_object(char *object_name, char *pJsonDocument,
 			if (snPrintfReturn < 0) {
 				return NULL_VALUE_ERROR;
 			}
+			ret_val = check_snprintf_ret_val(snPrintfReturn, remSizeOfJsonBuffer);
 			if(ret_val != SUCCESS) {
 				return ret_val;
 			}
+			remSizeOfJsonBuffer -= snPrintfReturn;
 			if(pTemporary->pKey != NULL && pTemporary->pData != NULL) {				
                 ret_val = convert_data_to_string(pJsonDocument + strlen(pJsonDocument), remSizeOfJsonBuffer,
 											  pTemporary->type, pTemporary->pData);
@@ -118,8 +155,10 @@ static IoT_Error_t generate_json_object(char *object_name, char *pJsonDocument,
 		}
 	}
 
+	/* The last comma gets overwritten, so it is a part of the remaining size */
+	remSizeOfJsonBuffer = maxSizeOfJsonDocument - strlen(pJsonDocument) + 1;
 	snPrintfReturn = snprintf(pJsonDocument + strlen(pJsonDocument) - 1, remSizeOfJsonBuffer, "},");
-	ret_val = check_snprintf_ret_val(snPrintfReturn, maxSizeOfJsonDocument);
+	ret_val = check_snprintf_ret_val(snPrintfReturn, remSizeOfJsonBuffer);
 	if (ret_val != SUCCESS) {
 		return ret_val;
 	}	
@@ -142,3 +181,27 @@ IoT_Error_t custom_aws_iot_shadow_add_reported(char *pJsonDocument,
 {
 	return generate_json_object("reported", pJsonDocument, maxSizeOfJsonDocument, count, handler);
 }
+
+size_t custom_aws_iot_shadow_get_json_len(const char *pClientToken,
+										  uint8_t reported_count,
+										  jsonStruct_t **reported_handler,
+										  uint8_t desired_count,
+										  jsonStruct_t **desired_handler)
+{
+	/* {"state":{ added by aws_iot_shadow_init_json_document() */
+	size_t len = strlen("{\"state\":{");
+
+	if(reported_count > 0) {
+		len += get_json_object_len("reported", reported_count, reported_handler);
+	}
+	if(desired_count > 0) {
+		len += get_json_object_len("desired", desired_count, desired_handler);
+	}
+	/* aws_iot_finalize_json_document() replaces the last comma with
+	 * }, "clientToken":"<client token>-<sequence number>"}
+	 */
+	len += strlen("}, \"clientToken\":\"") - 1;
+	len += strlen(pClientToken) + strlen("-") + MAX_CLIENT_TOKEN_SEQUENCE_DIGITS;
+	len += strlen("\"}");
+	return len + 1; /* + 1 for NULL termination */
+}
@@ -25,3 +25,15 @@ IoT_Error_t custom_aws_iot_shadow_add_reported(char *pJsonDocument,
                         size_t maxSizeOfJsonDocument,
                         uint8_t count,
                         jsonStruct_t **handler);
+
+/* Get the exact buffer size (including NULL termination) required for a shadow
+ * update document generated using aws_iot_shadow_init_json_document(),
+ * custom_aws_iot_shadow_add_reported(), custom_aws_iot_shadow_add_desired()
+ * and aws_iot_finalize_json_document(). The count for an object should be 0
+ * if it is not added to the document.
+ */
+size_t custom_aws_iot_shadow_get_json_len(const char *pClientToken,
+                        uint8_t reported_count,
+                        jsonStruct_t **reported_handler,
+                        uint8_t desired_count,
+                        jsonStruct_t **desired_handler);
@@ -0,0 +1,600 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <string.h>
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <json_parser.h>
+#include <json_generator.h>
+
+#include <esp_cloud_mem.h>
+#include "esp_cloud_publish_queue.h"
+#include "esp_cloud_trace_points.h"
+#include "esp_cloud_mqtt_common.h"
+
+static const char *TAG = "esp_cloud_mqtt";
+
+#define RX_QUEUE_SIZE   8
+
+typedef enum {
+    RX_ITEM_MSG,
+    RX_ITEM_ACK,
+} esp_cloud_rx_item_type_t;
+
+/* For messages, the topic and payload are stored right after this, in the same allocation.
+ * A NULL item only wakes up the receiver.
+ */
+typedef struct {
+    esp_cloud_rx_item_type_t type;
+    int msg_id;
+    esp_err_t result;
+    char *topic;
+    char *payload;
+    size_t payload_len;
+} esp_cloud_rx_item_t;
+
+QueueHandle_t esp_cloud_rx_queue_create(void)
+{
+    return xQueueCreate(RX_QUEUE_SIZE, sizeof(esp_cloud_rx_item_t *));
+}
+
+void esp_cloud_rx_queue_delete(QueueHandle_t queue)
+{
+    if (!queue) {
+        return;
+    }
+    esp_cloud_rx_item_t *item;
+    while (xQueueReceive(queue, &item, 0) == pdTRUE) {
+        free(item);
+    }
+    vQueueDelete(queue);
+}
+
+static esp_err_t esp_cloud_rx_queue_post(QueueHandle_t queue, esp_cloud_rx_item_t *item)
+{
+    if (xQueueSend(queue, &item, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Rx queue full. Dropping %s", item->type == RX_ITEM_MSG ? item->topic : "ack");
+        free(item);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_cloud_rx_queue_post_msg(QueueHandle_t queue, const char *topic, size_t topic_len,
+        const void *payload, size_t payload_len)
+{
+    if (!queue || !topic) {
+        return ESP_FAIL;
+    }
+    /* Both the topic and the payload are NULL terminated */
+    esp_cloud_rx_item_t *item = esp_cloud_mem_malloc(sizeof(esp_cloud_rx_item_t) + topic_len + payload_len + 2);
+    if (!item) {
+        return ESP_ERR_NO_MEM;
+    }
+    item->type = RX_ITEM_MSG;
+    item->topic = (char *)(item + 1);
+    memcpy(item->topic, topic, topic_len);
+    item->topic[topic_len] = '\0';
+    item->payload = item->topic + topic_len + 1;
+    if (payload_len) {
+        memcpy(item->payload, payload, payload_len);
+    }
+    item->payload[payload_len] = '\0';
+    item->payload_len = payload_len;
+    return esp_cloud_rx_queue_post(queue, item);
+}
+
+esp_err_t esp_cloud_rx_queue_post_ack(QueueHandle_t queue, int msg_id, esp_err_t result)
+{
+    if (!queue) {
+        return ESP_FAIL;
+    }
+    esp_cloud_rx_item_t *item = esp_cloud_mem_calloc(1, sizeof(esp_cloud_rx_item_t));
+    if (!item) {
+        return ESP_ERR_NO_MEM;
+    }
+    item->type = RX_ITEM_ACK;
+    item->msg_id = msg_id;
+    item->result = result;
+    return esp_cloud_rx_queue_post(queue, item);
+}
+
+esp_err_t esp_cloud_rx_queue_wake(QueueHandle_t queue)
+{
+    if (!queue) {
+        return ESP_FAIL;
+    }
+    esp_cloud_rx_item_t *item = NULL;
+    /* A full queue wakes up the receiver anyway */
+    xQueueSend(queue, &item, 0);
+    return ESP_OK;
+}
+
+void esp_cloud_rx_queue_process(esp_cloud_internal_handle_t *handle, QueueHandle_t queue,
+        esp_cloud_topic_router_t *router, TickType_t timeout)
+{
+    esp_cloud_rx_item_t *item;
+    while (xQueueReceive(queue, &item, timeout) == pdTRUE) {
+        if (!item) {
+            /* Woken up. Handle whatever else was received, without waiting */
+        } else if (item->type == RX_ITEM_MSG) {
+            size_t topic_len = strlen(item->topic);
+            int handlers = 0;
+            if (!router) {
+                ESP_LOGD(TAG, "Dropping message on %s", item->topic);
+            } else if ((handlers = esp_cloud_topic_router_dispatch(router, item->topic, topic_len,
+                        item->payload, item->payload_len)) == 0) {
+                ESP_LOGD(TAG, "No handler for message on %s", item->topic);
+            }
+            ESP_CLOUD_TRACE(RX, esp_cloud_trace_hash(item->topic, topic_len), item->payload_len, handlers);
+        } else {
+            esp_cloud_publish_queue_complete(handle, item->msg_id, item->result);
+        }
+        free(item);
+        timeout = 0;
+    }
+}
+
+#define SHADOW_TOPIC_PREFIX     "$aws/things/"
+#define SHADOW_UPDATE_SUFFIX    "/shadow/update"
+#define SHADOW_DELTA_SUFFIX     "/shadow/update/delta"
+/* Tokens on the stack for parsing a delta. Larger deltas fall back to the heap */
+#define SHADOW_DELTA_JSON_TOKENS    48
+
+static char *esp_cloud_mqtt_shadow_topic(const char *thing_name, const char *suffix)
+{
+    size_t len = strlen(SHADOW_TOPIC_PREFIX) + strlen(thing_name) + strlen(suffix) + 1;
+    char *topic = esp_cloud_mem_malloc(len);
+    if (topic) {
+        snprintf(topic, len, "%s%s%s", SHADOW_TOPIC_PREFIX, thing_name, suffix);
+    }
+    return topic;
+}
+
+esp_err_t esp_cloud_mqtt_shadow_init(esp_cloud_mqtt_shadow_t *shadow, esp_cloud_internal_handle_t *handle)
+{
+    if (!shadow || !handle || !handle->device_id) {
+        return ESP_FAIL;
+    }
+    memset(shadow, 0, sizeof(esp_cloud_mqtt_shadow_t));
+    shadow->handle = handle;
+    shadow->update_topic = esp_cloud_mqtt_shadow_topic(handle->device_id, SHADOW_UPDATE_SUFFIX);
+    shadow->delta_topic = esp_cloud_mqtt_shadow_topic(handle->device_id, SHADOW_DELTA_SUFFIX);
+    if (!shadow->update_topic || !shadow->delta_topic) {
+        esp_cloud_mqtt_shadow_deinit(shadow);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void esp_cloud_mqtt_shadow_deinit(esp_cloud_mqtt_shadow_t *shadow)
+{
+    if (shadow->update_topic) {
+        free(shadow->update_topic);
+        shadow->update_topic = NULL;
+    }
+    if (shadow->delta_topic) {
+        free(shadow->delta_topic);
+        shadow->delta_topic = NULL;
+    }
+    esp_cloud_shadow_state_free(&shadow->state);
+}
+
+static bool esp_cloud_mqtt_shadow_val_equal(const esp_cloud_param_val_t *val1, const esp_cloud_param_val_t *val2)
+{
+    switch(val1->type) {
+        case CLOUD_PARAM_TYPE_BOOLEAN:
+            return val1->val.b == val2->val.b;
+        case CLOUD_PARAM_TYPE_INTEGER:
+            return val1->val.i == val2->val.i;
+        case CLOUD_PARAM_TYPE_FLOAT:
+            return val1->val.f == val2->val.f;
+        case CLOUD_PARAM_TYPE_STRING:
+            return (val1->val.s && val2->val.s && strcmp(val1->val.s, val2->val.s) == 0);
+        default:
+            return false;
+    }
+}
+
+#define SHADOW_STATE_ALIGN(len)    (((len) + 7) & ~((size_t)7))
+
+esp_err_t esp_cloud_shadow_state_prepare(esp_cloud_shadow_state_t *state, esp_cloud_internal_handle_t *handle,
+        esp_cloud_shadow_stats_t *stats)
+{
+    size_t count = handle->cur_dynamic_params_count;
+    size_t size = SHADOW_STATE_ALIGN(count * sizeof(esp_cloud_shadow_param_state_t));
+    int i;
+    for (i = 0; i < count; i++) {
+        esp_cloud_param_val_t *val = &handle->dynamic_cloud_params[i].val;
+        if (val->type == CLOUD_PARAM_TYPE_STRING) {
+            size += 2 * SHADOW_STATE_ALIGN(val->val_size);
+        }
+    }
+    state->stats = stats;
+    state->count = 0;
+    if (size > state->size) {
+        esp_cloud_shadow_state_free(state);
+        state->params = esp_cloud_mem_malloc(size);
+        if (!state->params) {
+            ESP_LOGE(TAG, "Failed to allocate %d bytes for the shadow state", (int)size);
+            return ESP_ERR_NO_MEM;
+        }
+        state->size = size;
+    }
+    if (!state->params) {
+        return ESP_OK;
+    }
+    memset(state->params, 0, state->size);
+    uint8_t *cursor = (uint8_t *)state->params + SHADOW_STATE_ALIGN(count * sizeof(esp_cloud_shadow_param_state_t));
+    for (i = 0; i < count; i++) {
+        esp_cloud_param_val_t *val = &handle->dynamic_cloud_params[i].val;
+        esp_cloud_shadow_param_state_t *param_state = &state->params[i];
+        param_state->acked.type = param_state->pending_val.type = val->type;
+        if (val->type == CLOUD_PARAM_TYPE_STRING) {
+            param_state->acked.val_size = param_state->pending_val.val_size = val->val_size;
+            param_state->acked.val.s = (char *)cursor;
+            cursor += SHADOW_STATE_ALIGN(val->val_size);
+            param_state->pending_val.val.s = (char *)cursor;
+            cursor += SHADOW_STATE_ALIGN(val->val_size);
+        }
+    }
+    state->count = count;
+    return ESP_OK;
+}
+
+void esp_cloud_shadow_state_free(esp_cloud_shadow_state_t *state)
+{
+    if (state->params) {
+        free(state->params);
+        state->params = NULL;
+    }
+    state->size = 0;
+    state->count = 0;
+}
+
+/* Copy a value into the storage of dst. Fails for a string which does not fit */
+static bool esp_cloud_shadow_state_copy_val(esp_cloud_param_val_t *dst, const esp_cloud_param_val_t *src)
+{
+    if (dst->type != CLOUD_PARAM_TYPE_STRING) {
+        dst->val = src->val;
+        return true;
+    }
+    if (!src->val.s || strlen(src->val.s) >= dst->val_size) {
+        return false;
+    }
+    strcpy(dst->val.s, src->val.s);
+    return true;
+}
+
+bool esp_cloud_shadow_state_is_acked(esp_cloud_shadow_state_t *state, int index, const esp_cloud_param_val_t *val)
+{
+    if (index >= state->count || !state->params[index].acked_valid) {
+        return false;
+    }
+    return esp_cloud_mqtt_shadow_val_equal(&state->params[index].acked, val);
+}
+
+void esp_cloud_shadow_state_set_acked(esp_cloud_shadow_state_t *state, int index, const esp_cloud_param_val_t *val)
+{
+    if (index < state->count) {
+        esp_cloud_shadow_param_state_t *param_state = &state->params[index];
+        param_state->acked_valid = esp_cloud_shadow_state_copy_val(&param_state->acked, val);
+    }
+}
+
+void esp_cloud_shadow_state_forget_acked(esp_cloud_shadow_state_t *state)
+{
+    int i;
+    for (i = 0; i < state->count; i++) {
+        state->params[i].acked_valid = false;
+    }
+}
+
+bool esp_cloud_shadow_state_report(esp_cloud_shadow_state_t *state, int index, const esp_cloud_param_val_t *val)
+{
+    if (index >= state->count) {
+        /* Not tracked, e.g. if the state could not be allocated */
+        return true;
+    }
+    if (esp_cloud_shadow_state_is_acked(state, index, val)) {
+        if (state->stats) {
+            state->stats->suppressed++;
+        }
+        return false;
+    }
+    esp_cloud_shadow_param_state_t *param_state = &state->params[index];
+    param_state->pending = true;
+    param_state->pending_valid = esp_cloud_shadow_state_copy_val(&param_state->pending_val, val);
+    return true;
+}
+
+bool esp_cloud_shadow_state_is_pending(esp_cloud_shadow_state_t *state, int index)
+{
+    return (index >= state->count) || state->params[index].pending;
+}
+
+void esp_cloud_shadow_state_updates_done(esp_cloud_shadow_state_t *state, bool failed)
+{
+    int i;
+    for (i = 0; i < state->count; i++) {
+        esp_cloud_shadow_param_state_t *param_state = &state->params[i];
+        if (!param_state->pending) {
+            continue;
+        }
+        /* The pending copy becomes the acknowledged one */
+        esp_cloud_param_val_t acked = param_state->acked;
+        param_state->acked = param_state->pending_val;
+        param_state->pending_val = acked;
+        param_state->acked_valid = !failed && param_state->pending_valid;
+        param_state->pending = false;
+    }
+}
+
+/* Apply the requested value of a param, if the delta state (the current object) has one */
+static void esp_cloud_mqtt_shadow_apply(esp_cloud_mqtt_shadow_t *shadow, jparse_ctx_t *jctx,
+        esp_cloud_dynamic_param_t *param)
+{
+    esp_cloud_param_val_t new_val = {
+        .type = param->val.type,
+        .val_size = param->val.val_size,
+    };
+    char *new_str = NULL;
+    int ret = -1;
+    switch (param->val.type) {
+        case CLOUD_PARAM_TYPE_BOOLEAN:
+            ret = json_obj_get_bool(jctx, param->name, &new_val.val.b);
+            break;
+        case CLOUD_PARAM_TYPE_INTEGER:
+            ret = json_obj_get_int(jctx, param->name, &new_val.val.i);
+            break;
+        case CLOUD_PARAM_TYPE_FLOAT:
+            ret = json_obj_get_float(jctx, param->name, &new_val.val.f);
+            break;
+        case CLOUD_PARAM_TYPE_STRING: {
+            const char *str;
+            int len;
+            ret = json_obj_get_strptr(jctx, param->name, &str, &len);
+            if (ret == 0) {
+                if (param->val.val_size && len >= param->val.val_size) {
+                    len = param->val.val_size - 1;
+                }
+                new_str = esp_cloud_mem_malloc(len + 1);
+                if (!new_str) {
+                    return;
+                }
+                memcpy(new_str, str, len);
+                new_str[len] = '\0';
+                new_val.val.s = new_str;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    if (ret != 0) {
+        return;
+    }
+    ESP_CLOUD_TRACE(SHADOW_DELTA, esp_cloud_trace_hash(param->name, strlen(param->name)), 0, 0);
+    if (esp_cloud_mqtt_shadow_val_equal(&param->val, &new_val)) {
+        ESP_LOGD(TAG, "%s already has the requested value", param->name);
+        shadow->stats.actuations_suppressed++;
+        param->flags |= CLOUD_PARAM_FLAG_REMOTE_CHANGE;
+    } else if (param->cb && param->cb(param->name, &new_val, param->priv_data) == ESP_OK) {
+        if (param->val.type == CLOUD_PARAM_TYPE_STRING) {
+            free(param->val.val.s);
+            param->val.val.s = new_str;
+            new_str = NULL;
+        } else {
+            param->val.val = new_val.val;
+        }
+        param->flags |= CLOUD_PARAM_FLAG_REMOTE_CHANGE;
+    }
+    if (new_str) {
+        free(new_str);
+    }
+}
+
+static void esp_cloud_mqtt_shadow_delta_handler(const char *topic, const void *payload, size_t payload_len,
+        void *priv_data)
+{
+    esp_cloud_mqtt_shadow_t *shadow = (esp_cloud_mqtt_shadow_t *)priv_data;
+    esp_cloud_internal_handle_t *handle = shadow->handle;
+    jparse_ctx_t jctx;
+    json_tok_t tokens[SHADOW_DELTA_JSON_TOKENS];
+    if (json_parse_start_static(&jctx, (const char *)payload, payload_len, tokens, SHADOW_DELTA_JSON_TOKENS) != 0) {
+        ESP_LOGE(TAG, "Invalid shadow delta");
+        return;
+    }
+    int version;
+    if (json_obj_get_int(&jctx, "version", &version) == 0) {
+        if (shadow->stats.version && (uint32_t)version <= shadow->stats.version) {
+            ESP_LOGW(TAG, "Dropping old shadow delta, version %d", version);
+            json_parse_end(&jctx);
+            return;
+        }
+        shadow->stats.version = version;
+    }
+    if (json_obj_get_object(&jctx, "state") == 0) {
+        int i;
+        for (i = 0; i < handle->cur_dynamic_params_count; i++) {
+            esp_cloud_mqtt_shadow_apply(shadow, &jctx, &handle->dynamic_cloud_params[i]);
+        }
+        json_obj_leave_object(&jctx);
+    }
+    json_parse_end(&jctx);
+}
+
+esp_err_t esp_cloud_mqtt_shadow_register(esp_cloud_mqtt_shadow_t *shadow)
+{
+    if (!shadow || !shadow->delta_topic) {
+        return ESP_FAIL;
+    }
+    /* Start from scratch, since the delta versions need not continue from an earlier session,
+     * and the shadow may have been changed in between.
+     */
+    shadow->stats.version = 0;
+    shadow->report_all = true;
+    esp_err_t err = esp_cloud_shadow_state_prepare(&shadow->state, shadow->handle, &shadow->stats);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (shadow->handle->cur_dynamic_params_count == 0) {
+        return ESP_OK;
+    }
+    return esp_cloud_platform_subscribe(shadow->handle, shadow->delta_topic, ESP_CLOUD_MSG_CLASS_REQUEST,
+            esp_cloud_mqtt_shadow_delta_handler, shadow);
+}
+
+typedef struct {
+    esp_cloud_internal_handle_t *handle;
+    esp_cloud_shadow_state_t *state;
+    bool all;
+} esp_cloud_mqtt_shadow_doc_t;
+
+static bool esp_cloud_mqtt_shadow_param_changed(uint8_t flags, bool all)
+{
+    return all || (flags & (CLOUD_PARAM_FLAG_LOCAL_CHANGE | CLOUD_PARAM_FLAG_REMOTE_CHANGE));
+}
+
+static void esp_cloud_mqtt_shadow_set_val(json_str_t *jstr, char *name, esp_cloud_param_val_t *val)
+{
+    switch (val->type) {
+        case CLOUD_PARAM_TYPE_BOOLEAN:
+            json_obj_set_bool(jstr, name, val->val.b);
+            break;
+        case CLOUD_PARAM_TYPE_INTEGER:
+            json_obj_set_int(jstr, name, val->val.i);
+            break;
+        case CLOUD_PARAM_TYPE_FLOAT:
+            json_obj_set_float(jstr, name, val->val.f);
+            break;
+        case CLOUD_PARAM_TYPE_STRING:
+            json_obj_set_string(jstr, name, val->val.s ? val->val.s : "");
+            break;
+        default:
+            break;
+    }
+}
+
+/* Only the pending values are reported. With CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY, the desired
+ * value is cleared with an explicit null after a remote change and, when reporting all params,
+ * in case an earlier session left it. Otherwise, the reported values are mirrored into desired.
+ */
+static void esp_cloud_mqtt_shadow_build_doc(json_str_t *jstr, void *priv_data)
+{
+    esp_cloud_mqtt_shadow_doc_t *doc = (esp_cloud_mqtt_shadow_doc_t *)priv_data;
+    esp_cloud_internal_handle_t *handle = doc->handle;
+    int i;
+    json_start_object(jstr);
+    json_push_object(jstr, "state");
+    json_push_object(jstr, "reported");
+    for (i = 0; i < handle->cur_dynamic_params_count; i++) {
+        esp_cloud_dynamic_param_t *param = &handle->dynamic_cloud_params[i];
+        if (esp_cloud_shadow_state_is_pending(doc->state, i)) {
+            esp_cloud_mqtt_shadow_set_val(jstr, param->name, &param->val);
+        }
+    }
+    json_pop_object(jstr);
+    json_push_object(jstr, "desired");
+    for (i = 0; i < handle->cur_dynamic_params_count; i++) {
+        esp_cloud_dynamic_param_t *param = &handle->dynamic_cloud_params[i];
+#ifdef CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY
+        if (doc->all || (i < doc->state->count &&
+                (doc->state->params[i].report_flags & CLOUD_PARAM_FLAG_REMOTE_CHANGE))) {
+            json_obj_set_null(jstr, param->name);
+        }
+#else
+        if (esp_cloud_shadow_state_is_pending(doc->state, i)) {
+            esp_cloud_mqtt_shadow_set_val(jstr, param->name, &param->val);
+        }
+#endif
+    }
+    json_pop_object(jstr);
+    json_pop_object(jstr);
+    json_end_object(jstr);
+}
+
+/* The flags were taken for the report, which failed */
+static void esp_cloud_mqtt_shadow_report_failed(esp_cloud_mqtt_shadow_t *shadow)
+{
+    esp_cloud_internal_handle_t *handle = shadow->handle;
+    int i;
+    esp_cloud_shadow_state_updates_done(&shadow->state, true);
+    for (i = 0; i < handle->cur_dynamic_params_count && i < shadow->state.count; i++) {
+        handle->dynamic_cloud_params[i].flags |= shadow->state.params[i].report_flags;
+    }
+}
+
+esp_err_t esp_cloud_mqtt_shadow_report(esp_cloud_mqtt_shadow_t *shadow, bool all)
+{
+    if (!shadow || !shadow->update_topic) {
+        return ESP_FAIL;
+    }
+    esp_cloud_internal_handle_t *handle = shadow->handle;
+    esp_cloud_mqtt_shadow_doc_t doc = {
+        .handle = handle,
+        .state = &shadow->state,
+        .all = all || shadow->report_all,
+    };
+    /* Decided here, since the document is built twice. The flags are taken before sending,
+     * so that changes made meanwhile go in the next report.
+     */
+    bool changed = false;
+    int i;
+    for (i = 0; i < handle->cur_dynamic_params_count; i++) {
+        esp_cloud_dynamic_param_t *param = &handle->dynamic_cloud_params[i];
+        uint8_t flags = param->flags;
+        param->flags = 0;
+        if (i < shadow->state.count) {
+            shadow->state.params[i].report_flags = flags;
+        }
+        if (!esp_cloud_mqtt_shadow_param_changed(flags, doc.all)) {
+            continue;
+        }
+        if (esp_cloud_shadow_state_report(&shadow->state, i, &param->val)) {
+            changed = true;
+        }
+#ifdef CONFIG_ESP_CLOUD_SHADOW_REPORT_ONLY
+        if (doc.all || (flags & CLOUD_PARAM_FLAG_REMOTE_CHANGE)) {
+            changed = true;
+        }
+#endif
+    }
+    if (!changed) {
+        shadow->report_all = false;
+        return ESP_OK;
+    }
+    char *payload = esp_cloud_json_build(esp_cloud_mqtt_shadow_build_doc, &doc);
+    if (!payload) {
+        esp_cloud_mqtt_shadow_report_failed(shadow);
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_CLOUD_TRACE(SHADOW_UPDATE, strlen(payload), handle->cur_dynamic_params_count, 0);
+    ESP_LOGD(TAG, "Update Shadow: %s", payload);
+    esp_err_t err = esp_cloud_platform_publish(handle, shadow->update_topic, payload, ESP_CLOUD_MSG_CLASS_DEFAULT);
+    if (err == ESP_OK) {
+        /* The update/accepted topic is not subscribed to, so a successful publish is taken as
+         * the acknowledgement.
+         */
+        esp_cloud_shadow_state_updates_done(&shadow->state, false);
+        shadow->stats.updates++;
+        shadow->stats.tx_bytes += strlen(payload);
+        shadow->report_all = false;
+    } else {
+        ESP_LOGE(TAG, "Shadow update failed");
+        esp_cloud_mqtt_shadow_report_failed(shadow);
+    }
+    free(payload);
+    return err;
+}
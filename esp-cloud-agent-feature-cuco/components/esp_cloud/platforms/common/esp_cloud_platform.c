@@ -0,0 +1,174 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string.h>
+#include <sdkconfig.h>
+#include <esp_log.h>
+
+#include "esp_cloud_platform.h"
+
+static const char *TAG = "esp_cloud_platform";
+
+#define TRANSPORT_OP(handle, op)    ((handle) && (handle)->transport && (handle)->transport->op)
+
+static const esp_cloud_transport_t *esp_cloud_platform_get_transport(esp_cloud_transport_type_t type)
+{
+    if (type == ESP_CLOUD_TRANSPORT_DEFAULT) {
+#if defined(CONFIG_ESP_CLOUD_TRANSPORT_DEFAULT_ESP_MQTT)
+        type = ESP_CLOUD_TRANSPORT_ESP_MQTT;
+#elif defined(CONFIG_ESP_CLOUD_TRANSPORT_DEFAULT_LOOPBACK)
+        type = ESP_CLOUD_TRANSPORT_LOOPBACK;
+#else
+        type = ESP_CLOUD_TRANSPORT_AWS_IOT;
+#endif
+    }
+    switch (type) {
+#ifdef CONFIG_ESP_CLOUD_TRANSPORT_AWS_IOT
+        case ESP_CLOUD_TRANSPORT_AWS_IOT:
+            return &esp_cloud_transport_aws_iot;
+#endif
+#ifdef CONFIG_ESP_CLOUD_TRANSPORT_ESP_MQTT
+        case ESP_CLOUD_TRANSPORT_ESP_MQTT:
+            return &esp_cloud_transport_esp_mqtt;
+#endif
+#ifdef CONFIG_ESP_CLOUD_TRANSPORT_LOOPBACK
+        case ESP_CLOUD_TRANSPORT_LOOPBACK:
+            return &esp_cloud_transport_loopback;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+esp_err_t esp_cloud_platform_select(esp_cloud_internal_handle_t *handle, esp_cloud_transport_type_t type)
+{
+    if (!handle || handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    const esp_cloud_transport_t *transport = esp_cloud_platform_get_transport(type);
+    if (!transport) {
+        ESP_LOGE(TAG, "Transport %d not enabled in menuconfig", type);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    ESP_LOGI(TAG, "Using %s transport", transport->name);
+    handle->transport = transport;
+    return ESP_OK;
+}
+
+esp_err_t esp_cloud_platform_init(esp_cloud_internal_handle_t *handle)
+{
+    if (!TRANSPORT_OP(handle, init)) {
+        return ESP_FAIL;
+    }
+    return handle->transport->init(handle);
+}
+
+esp_err_t esp_cloud_platform_connect(esp_cloud_internal_handle_t *handle)
+{
+    if (!TRANSPORT_OP(handle, connect)) {
+        return ESP_FAIL;
+    }
+    return handle->transport->connect(handle);
+}
+
+esp_err_t esp_cloud_platform_wait(esp_cloud_internal_handle_t *handle)
+{
+    if (!TRANSPORT_OP(handle, wait)) {
+        return ESP_FAIL;
+    }
+    return handle->transport->wait(handle);
+}
+
+esp_err_t esp_cloud_platform_wake(esp_cloud_internal_handle_t *handle)
+{
+    if (!TRANSPORT_OP(handle, wake)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return handle->transport->wake(handle);
+}
+
+esp_err_t esp_cloud_platform_disconnect(esp_cloud_internal_handle_t *handle)
+{
+    if (!TRANSPORT_OP(handle, disconnect)) {
+        return ESP_FAIL;
+    }
+    return handle->transport->disconnect(handle);
+}
+
+esp_err_t esp_cloud_platform_report_state(esp_cloud_internal_handle_t *handle)
+{
+    if (!TRANSPORT_OP(handle, report_state)) {
+        return ESP_FAIL;
+    }
+    return handle->transport->report_state(handle);
+}
+
+esp_err_t esp_cloud_platform_register_dynamic_params(esp_cloud_internal_handle_t *handle)
+{
+    if (!TRANSPORT_OP(handle, register_dynamic_params)) {
+        return ESP_FAIL;
+    }
+    return handle->transport->register_dynamic_params(handle);
+}
+
+esp_err_t esp_cloud_platform_get_shadow_stats(esp_cloud_internal_handle_t *handle, esp_cloud_shadow_stats_t *stats)
+{
+    if (!TRANSPORT_OP(handle, get_shadow_stats)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return handle->transport->get_shadow_stats(handle, stats);
+}
+
+esp_err_t esp_cloud_platform_publish(esp_cloud_internal_handle_t *handle, const char *topic, const char *data,
+        esp_cloud_msg_class_t msg_class)
+{
+    if (!data) {
+        return ESP_FAIL;
+    }
+    return esp_cloud_platform_publish_data(handle, topic, data, strlen(data), msg_class);
+}
+
+esp_err_t esp_cloud_platform_publish_data(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+        size_t data_len, esp_cloud_msg_class_t msg_class)
+{
+    if (!TRANSPORT_OP(handle, publish)) {
+        return ESP_FAIL;
+    }
+    return handle->transport->publish(handle, topic, data, data_len, msg_class);
+}
+
+esp_err_t esp_cloud_platform_publish_async(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+        size_t data_len, esp_cloud_msg_class_t msg_class, int *msg_id)
+{
+    if (!TRANSPORT_OP(handle, publish_async)) {
+        return ESP_FAIL;
+    }
+    return handle->transport->publish_async(handle, topic, data, data_len, msg_class, msg_id);
+}
+
+esp_err_t esp_cloud_platform_subscribe(esp_cloud_internal_handle_t *handle, const char *topic,
+        esp_cloud_msg_class_t msg_class, esp_cloud_platform_subscribe_cb_t cb, void *priv_data)
+{
+    if (!TRANSPORT_OP(handle, subscribe)) {
+        return ESP_FAIL;
+    }
+    return handle->transport->subscribe(handle, topic, msg_class, cb, priv_data);
+}
+
+esp_err_t esp_cloud_platform_unsubscribe(esp_cloud_internal_handle_t *handle, const char *topic)
+{
+    if (!TRANSPORT_OP(handle, unsubscribe)) {
+        return ESP_FAIL;
+    }
+    return handle->transport->unsubscribe(handle, topic);
+}
@@ -0,0 +1,407 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <string.h>
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <esp_log.h>
+#include <mqtt_client.h>
+
+#include <esp_cloud_mem.h>
+#include <esp_cloud.h>
+#include <esp_cloud_storage.h>
+
+#include "esp_cloud_platform.h"
+#include "esp_cloud_mqtt_common.h"
+#include "esp_cloud_topic_router.h"
+#include "esp_cloud_trace_points.h"
+
+static const char *TAG = "esp_mqtt_cloud";
+
+#define ESP_MQTT_CLOUD_PORT             8883
+#define ESP_MQTT_CLOUD_BUFFER_SIZE      2048
+#define ESP_MQTT_CLOUD_CONNECT_TIMEOUT  (30 * 1000)
+#define ESP_MQTT_CLOUD_WAIT_MS          200
+
+#define CONNECTED_BIT   BIT0
+
+typedef struct {
+    esp_mqtt_client_handle_t client;
+    char *mqtt_uri;
+    char *client_cert;
+    char *client_key;
+    char *server_cert;
+    EventGroupHandle_t events;
+    QueueHandle_t rx_queue;
+    esp_cloud_topic_router_t *topic_router;
+    /* Set on reconnection, so that the cloud task subscribes again to all the topics */
+    bool resubscribe;
+    esp_cloud_mqtt_shadow_t shadow;
+} esp_mqtt_cloud_data_t;
+
+static int esp_mqtt_cloud_qos(esp_cloud_internal_handle_t *handle, esp_cloud_msg_class_t msg_class)
+{
+    return esp_cloud_msg_policy_get(handle, msg_class)->qos ? 1 : 0;
+}
+
+/* Runs in the MQTT client task. Everything is handed over to the cloud task */
+static esp_err_t esp_mqtt_cloud_event_handler(esp_mqtt_event_handle_t event)
+{
+    esp_cloud_internal_handle_t *handle = (esp_cloud_internal_handle_t *)event->user_context;
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    switch (event->event_id) {
+        case MQTT_EVENT_CONNECTED:
+            ESP_LOGI(TAG, "MQTT Connected");
+            if (!event->session_present) {
+                platform_data->resubscribe = true;
+            }
+            xEventGroupSetBits(platform_data->events, CONNECTED_BIT);
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            ESP_LOGW(TAG, "MQTT Disconnected. Attempting reconnection...");
+            xEventGroupClearBits(platform_data->events, CONNECTED_BIT);
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            esp_cloud_rx_queue_post_ack(platform_data->rx_queue, event->msg_id, ESP_OK);
+            break;
+        case MQTT_EVENT_DATA:
+            if (event->data_len != event->total_data_len) {
+                /* Larger than the MQTT buffer, so received in parts */
+                if (event->current_data_offset == 0) {
+                    ESP_LOGE(TAG, "Dropping %d byte message on %.*s", event->total_data_len,
+                            event->topic_len, event->topic);
+                }
+                break;
+            }
+            esp_cloud_rx_queue_post_msg(platform_data->rx_queue, event->topic, event->topic_len,
+                    event->data, event->data_len);
+            break;
+        default:
+            break;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t esp_mqtt_platform_subscribe(esp_cloud_internal_handle_t *handle, const char *topic,
+        esp_cloud_msg_class_t msg_class, esp_cloud_platform_subscribe_cb_t cb, void *priv_data)
+{
+    if (!handle || !topic || !cb || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    bool new_filter = false;
+    if (!esp_cloud_topic_router_add(platform_data->topic_router, topic, cb, priv_data, &new_filter)) {
+        return ESP_FAIL;
+    }
+    if (!new_filter) {
+        ESP_LOGI(TAG, "Added handler for topic: %s", topic);
+        return ESP_OK;
+    }
+    if (esp_mqtt_client_subscribe(platform_data->client, topic, esp_mqtt_cloud_qos(handle, msg_class)) < 0) {
+        ESP_LOGE(TAG, "esp_mqtt_client_subscribe failed for %s", topic);
+        esp_cloud_topic_router_remove(platform_data->topic_router, topic);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Subscribed to topic: %s", topic);
+    return ESP_OK;
+}
+
+static esp_err_t esp_mqtt_platform_unsubscribe(esp_cloud_internal_handle_t *handle, const char *topic)
+{
+    if (!handle || !topic || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    if (!esp_cloud_topic_router_find(platform_data->topic_router, topic)) {
+        return ESP_FAIL;
+    }
+    if (esp_mqtt_client_unsubscribe(platform_data->client, topic) < 0) {
+        ESP_LOGW(TAG, "Could not unsubscribe from topic: %s", topic);
+    }
+    return esp_cloud_topic_router_remove(platform_data->topic_router, topic);
+}
+
+static void esp_mqtt_cloud_resubscribe_filter(const char *filter, void *priv_data)
+{
+    esp_cloud_internal_handle_t *handle = (esp_cloud_internal_handle_t *)priv_data;
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    if (esp_mqtt_client_subscribe(platform_data->client, filter,
+                esp_mqtt_cloud_qos(handle, ESP_CLOUD_MSG_CLASS_REQUEST)) < 0) {
+        ESP_LOGE(TAG, "Could not subscribe again to %s", filter);
+    }
+}
+
+/* The client does not wait for the PUBACK, so this returns once the message is sent */
+static esp_err_t esp_mqtt_platform_publish_async(esp_cloud_internal_handle_t *handle, const char *topic,
+        const void *data, size_t data_len, esp_cloud_msg_class_t msg_class, int *msg_id)
+{
+    if (!handle || !topic || !data || !msg_id || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    if (!(xEventGroupGetBits(platform_data->events) & CONNECTED_BIT)) {
+        return ESP_FAIL;
+    }
+    const esp_cloud_msg_policy_t *policy = esp_cloud_msg_policy_get(handle, msg_class);
+    ESP_LOGD(TAG, "Publishing to: %s", topic);
+    ESP_LOGD(TAG, "Publish Data: %.*s", (int)data_len, (const char *)data);
+    int id = esp_mqtt_client_publish(platform_data->client, topic, data, data_len,
+            policy->qos ? 1 : 0, policy->retain ? 1 : 0);
+    if (id < 0) {
+        ESP_LOGE(TAG, "esp_mqtt_client_publish failed for %s", topic);
+        return ESP_FAIL;
+    }
+    *msg_id = id;
+    ESP_CLOUD_TRACE(PUBLISH_ASYNC, esp_cloud_trace_hash(topic, strlen(topic)), data_len, id);
+    return ESP_OK;
+}
+
+static esp_err_t esp_mqtt_platform_publish(esp_cloud_internal_handle_t *handle, const char *topic,
+        const void *data, size_t data_len, esp_cloud_msg_class_t msg_class)
+{
+    if (!handle || !topic || !data || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    const esp_cloud_msg_policy_t *policy = esp_cloud_msg_policy_get(handle, msg_class);
+    ESP_CLOUD_TRACE(PUBLISH, esp_cloud_trace_hash(topic, strlen(topic)), data_len, msg_class);
+    ESP_LOGD(TAG, "Publishing to: %s", topic);
+    ESP_LOGD(TAG, "Publish Data: %.*s", (int)data_len, (const char *)data);
+    if (esp_mqtt_client_publish(platform_data->client, topic, data, data_len,
+            policy->qos ? 1 : 0, policy->retain ? 1 : 0) < 0) {
+        ESP_LOGE(TAG, "esp_mqtt_client_publish failed for %s", topic);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t esp_mqtt_platform_connect(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .uri = platform_data->mqtt_uri,
+        .client_id = handle->device_id,
+        .cert_pem = platform_data->server_cert,
+        .client_cert_pem = platform_data->client_cert,
+        .client_key_pem = platform_data->client_key,
+        .buffer_size = ESP_MQTT_CLOUD_BUFFER_SIZE,
+        .event_handle = esp_mqtt_cloud_event_handler,
+        .user_context = handle,
+    };
+    platform_data->client = esp_mqtt_client_init(&mqtt_cfg);
+    if (!platform_data->client) {
+        ESP_LOGE(TAG, "esp_mqtt_client_init failed");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Connecting to %s", platform_data->mqtt_uri);
+    if (esp_mqtt_client_start(platform_data->client) != ESP_OK) {
+        goto connect_err;
+    }
+    /* The client keeps trying to connect in the background */
+    if (!(xEventGroupWaitBits(platform_data->events, CONNECTED_BIT, false, true,
+                    pdMS_TO_TICKS(ESP_MQTT_CLOUD_CONNECT_TIMEOUT)) & CONNECTED_BIT)) {
+        ESP_LOGE(TAG, "Could not connect to %s", platform_data->mqtt_uri);
+        esp_mqtt_client_stop(platform_data->client);
+        goto connect_err;
+    }
+    platform_data->resubscribe = false;
+    return ESP_OK;
+
+connect_err:
+    esp_mqtt_client_destroy(platform_data->client);
+    platform_data->client = NULL;
+    return ESP_FAIL;
+}
+
+static void esp_mqtt_cloud_unsubscribe_filter(const char *filter, void *priv_data)
+{
+    esp_mqtt_cloud_data_t *platform_data = (esp_mqtt_cloud_data_t *)priv_data;
+    esp_mqtt_client_unsubscribe(platform_data->client, filter);
+}
+
+static esp_err_t esp_mqtt_platform_disconnect(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    if (!platform_data->client) {
+        return ESP_FAIL;
+    }
+    esp_cloud_topic_router_foreach(platform_data->topic_router, esp_mqtt_cloud_unsubscribe_filter, platform_data);
+    esp_cloud_topic_router_clear(platform_data->topic_router);
+    esp_mqtt_client_stop(platform_data->client);
+    esp_mqtt_client_destroy(platform_data->client);
+    platform_data->client = NULL;
+    xEventGroupClearBits(platform_data->events, CONNECTED_BIT);
+    /* Drop whatever was received, but complete the pending acknowledgements */
+    esp_cloud_rx_queue_process(handle, platform_data->rx_queue, NULL, 0);
+    ESP_LOGI(TAG, "MQTT Disconnected.");
+    return ESP_OK;
+}
+
+static esp_err_t esp_mqtt_platform_register_dynamic_params(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    return esp_cloud_mqtt_shadow_register(&platform_data->shadow);
+}
+
+static esp_err_t esp_mqtt_platform_report_state(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    return esp_cloud_mqtt_shadow_report(&platform_data->shadow, true);
+}
+
+static esp_err_t esp_mqtt_platform_get_shadow_stats(esp_cloud_internal_handle_t *handle, esp_cloud_shadow_stats_t *stats)
+{
+    if (!handle || !handle->cloud_platform_priv || !stats) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    *stats = platform_data->shadow.stats;
+    return ESP_OK;
+}
+
+static esp_err_t esp_mqtt_platform_wait(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    esp_cloud_rx_queue_process(handle, platform_data->rx_queue, platform_data->topic_router,
+            pdMS_TO_TICKS(ESP_MQTT_CLOUD_WAIT_MS));
+    if (!(xEventGroupGetBits(platform_data->events) & CONNECTED_BIT)) {
+        return ESP_OK;
+    }
+    if (platform_data->resubscribe) {
+        platform_data->resubscribe = false;
+        esp_cloud_topic_router_foreach(platform_data->topic_router, esp_mqtt_cloud_resubscribe_filter, handle);
+    }
+    esp_cloud_mqtt_shadow_report(&platform_data->shadow, false);
+    return ESP_OK;
+}
+
+static esp_err_t esp_mqtt_platform_wake(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    return esp_cloud_rx_queue_wake(platform_data->rx_queue);
+}
+
+static void esp_mqtt_cloud_data_free(esp_mqtt_cloud_data_t *platform_data)
+{
+    esp_cloud_mqtt_shadow_deinit(&platform_data->shadow);
+    if (platform_data->topic_router) {
+        esp_cloud_topic_router_delete(platform_data->topic_router);
+    }
+    if (platform_data->rx_queue) {
+        esp_cloud_rx_queue_delete(platform_data->rx_queue);
+    }
+    if (platform_data->events) {
+        vEventGroupDelete(platform_data->events);
+    }
+    if (platform_data->server_cert) {
+        free(platform_data->server_cert);
+    }
+    if (platform_data->client_key) {
+        free(platform_data->client_key);
+    }
+    if (platform_data->client_cert) {
+        free(platform_data->client_cert);
+    }
+    if (platform_data->mqtt_uri) {
+        free(platform_data->mqtt_uri);
+    }
+    free(platform_data);
+}
+
+static esp_err_t esp_mqtt_platform_init(esp_cloud_internal_handle_t *handle)
+{
+    if (handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Initialising Cloud");
+    esp_mqtt_cloud_data_t *platform_data = esp_cloud_mem_calloc(1, sizeof(esp_mqtt_cloud_data_t));
+    if (!platform_data) {
+        return ESP_FAIL;
+    }
+    char *mqtt_host = esp_cloud_storage_get("mqtt_host");
+    if (!mqtt_host) {
+        goto init_err;
+    }
+    size_t uri_len = strlen("mqtts://:") + strlen(mqtt_host) + 6;
+    platform_data->mqtt_uri = esp_cloud_mem_malloc(uri_len);
+    if (platform_data->mqtt_uri) {
+        snprintf(platform_data->mqtt_uri, uri_len, "mqtts://%s:%d", mqtt_host, ESP_MQTT_CLOUD_PORT);
+    }
+    free(mqtt_host);
+    if (!platform_data->mqtt_uri) {
+        goto init_err;
+    }
+    if ((platform_data->client_cert = esp_cloud_storage_get("client_cert")) == NULL) {
+        goto init_err;
+    }
+    if ((platform_data->client_key = esp_cloud_storage_get("client_key")) == NULL) {
+        goto init_err;
+    }
+    if ((platform_data->server_cert = esp_cloud_storage_get("server_cert")) == NULL) {
+        goto init_err;
+    }
+    if ((platform_data->events = xEventGroupCreate()) == NULL) {
+        goto init_err;
+    }
+    if ((platform_data->rx_queue = esp_cloud_rx_queue_create()) == NULL) {
+        goto init_err;
+    }
+    if ((platform_data->topic_router = esp_cloud_topic_router_create()) == NULL) {
+        goto init_err;
+    }
+    if (esp_cloud_mqtt_shadow_init(&platform_data->shadow, handle) != ESP_OK) {
+        goto init_err;
+    }
+    handle->cloud_platform_priv = platform_data;
+    return ESP_OK;
+
+init_err:
+    esp_mqtt_cloud_data_free(platform_data);
+    return ESP_FAIL;
+}
+
+const esp_cloud_transport_t esp_cloud_transport_esp_mqtt = {
+    .name = "ESP MQTT",
+    .init = esp_mqtt_platform_init,
+    .connect = esp_mqtt_platform_connect,
+    .wait = esp_mqtt_platform_wait,
+    .wake = esp_mqtt_platform_wake,
+    .disconnect = esp_mqtt_platform_disconnect,
+    .report_state = esp_mqtt_platform_report_state,
+    .register_dynamic_params = esp_mqtt_platform_register_dynamic_params,
+    .get_shadow_stats = esp_mqtt_platform_get_shadow_stats,
+    .publish = esp_mqtt_platform_publish,
+    .publish_async = esp_mqtt_platform_publish_async,
+    .subscribe = esp_mqtt_platform_subscribe,
+    .unsubscribe = esp_mqtt_platform_unsubscribe,
+};
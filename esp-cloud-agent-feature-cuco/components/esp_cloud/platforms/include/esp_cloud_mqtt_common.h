@@ -0,0 +1,104 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include "esp_cloud_platform.h"
+
+/* Helpers for the transports on a plain MQTT client, which have no shadow support of their own */
+
+/* Messages and acknowledgements are received in the MQTT client's context, but handled in the
+ * cloud task, so that the subscribe handlers and publish completions run in the same context
+ * as with the AWS IoT transport.
+ */
+QueueHandle_t esp_cloud_rx_queue_create(void);
+void esp_cloud_rx_queue_delete(QueueHandle_t queue);
+esp_err_t esp_cloud_rx_queue_post_msg(QueueHandle_t queue, const char *topic, size_t topic_len,
+        const void *payload, size_t payload_len);
+esp_err_t esp_cloud_rx_queue_post_ack(QueueHandle_t queue, int msg_id, esp_err_t result);
+/* Make esp_cloud_rx_queue_process() return early, for the wake transport op */
+esp_err_t esp_cloud_rx_queue_wake(QueueHandle_t queue);
+/* Dispatch the received messages to the router and complete the acknowledged publishes.
+ * Waits for up to timeout for the first item. Messages are dropped if router is NULL.
+ */
+void esp_cloud_rx_queue_process(esp_cloud_internal_handle_t *handle, QueueHandle_t queue,
+        esp_cloud_topic_router_t *router, TickType_t timeout);
+
+/* Reported values which the shadow is known to have, so that they are not sent again. Used
+ * by all the transports, including AWS IoT with its own shadow client. A value is pending
+ * from the report which sends it until the shadow update is acknowledged.
+ */
+typedef struct {
+    bool acked_valid;
+    bool pending;
+    /* False if the pending value could not be copied, i.e. a string longer than val_size */
+    bool pending_valid;
+    esp_cloud_param_val_t acked;
+    esp_cloud_param_val_t pending_val;
+    /* Param flags taken by the report being built, for the MQTT shadow helper */
+    uint8_t report_flags;
+} esp_cloud_shadow_param_state_t;
+
+typedef struct {
+    /* The string copies are in the same allocation, right after the params */
+    esp_cloud_shadow_param_state_t *params;
+    size_t size;
+    uint8_t count;
+    esp_cloud_shadow_stats_t *stats;
+} esp_cloud_shadow_state_t;
+
+/* Set up the state for the current dynamic params, forgetting the acknowledged values. Called
+ * on every registration. The allocation is reused if it is large enough.
+ */
+esp_err_t esp_cloud_shadow_state_prepare(esp_cloud_shadow_state_t *state, esp_cloud_internal_handle_t *handle,
+        esp_cloud_shadow_stats_t *stats);
+void esp_cloud_shadow_state_free(esp_cloud_shadow_state_t *state);
+/* Check if the shadow is known to have this value of the param at index */
+bool esp_cloud_shadow_state_is_acked(esp_cloud_shadow_state_t *state, int index, const esp_cloud_param_val_t *val);
+/* Record a value read from the shadow document */
+void esp_cloud_shadow_state_set_acked(esp_cloud_shadow_state_t *state, int index, const esp_cloud_param_val_t *val);
+/* Drop the values read from the shadow, e.g. if the rest of the document turns out to be invalid */
+void esp_cloud_shadow_state_forget_acked(esp_cloud_shadow_state_t *state);
+/* Decide if a changed value should be reported. Returns false, counting the value as suppressed,
+ * if the shadow already has it. Otherwise the value becomes pending.
+ */
+bool esp_cloud_shadow_state_report(esp_cloud_shadow_state_t *state, int index, const esp_cloud_param_val_t *val);
+bool esp_cloud_shadow_state_is_pending(esp_cloud_shadow_state_t *state, int index);
+/* Called once the shadow updates sent are acknowledged, or have failed. After a failure, the
+ * shadow state is not known, and so the pending values will be reported again.
+ */
+void esp_cloud_shadow_state_updates_done(esp_cloud_shadow_state_t *state, bool failed);
+
+/* Device shadow over the AWS IoT shadow MQTT topics. The reported values are published
+ * with esp_cloud_platform_publish() and the delta is subscribed to with
+ * esp_cloud_platform_subscribe(), so this works with any transport.
+ */
+typedef struct {
+    esp_cloud_internal_handle_t *handle;
+    char *update_topic;
+    char *delta_topic;
+    bool report_all;
+    esp_cloud_shadow_state_t state;
+    esp_cloud_shadow_stats_t stats;
+} esp_cloud_mqtt_shadow_t;
+
+esp_err_t esp_cloud_mqtt_shadow_init(esp_cloud_mqtt_shadow_t *shadow, esp_cloud_internal_handle_t *handle);
+void esp_cloud_mqtt_shadow_deinit(esp_cloud_mqtt_shadow_t *shadow);
+/* Subscribe to the delta. All the params are reported on the next esp_cloud_mqtt_shadow_report() */
+esp_err_t esp_cloud_mqtt_shadow_register(esp_cloud_mqtt_shadow_t *shadow);
+/* Report the params changed locally or remotely since the last report, or all params. Values
+ * which the shadow already has are skipped, and counted in stats.suppressed.
+ */
+esp_err_t esp_cloud_mqtt_shadow_report(esp_cloud_mqtt_shadow_t *shadow, bool all);
@@ -12,18 +12,73 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #pragma once
+#include <sdkconfig.h>
 #include <esp_cloud.h>
 #include <esp_cloud_internal.h>
-typedef void (*esp_cloud_platform_subscribe_cb_t) (const char *topic, void *payload, size_t payload_len, void *priv_data);
+#include <esp_cloud_topic_router.h>
+typedef esp_cloud_topic_handler_t esp_cloud_platform_subscribe_cb_t;
+
+/* Operations of a transport backend. The esp_cloud_platform_*() APIs below call these
+ * for the transport selected in esp_cloud_platform_select().
+ */
+typedef struct esp_cloud_transport {
+    const char *name;
+    esp_err_t (*init)(esp_cloud_internal_handle_t *handle);
+    esp_err_t (*connect)(esp_cloud_internal_handle_t *handle);
+    esp_err_t (*wait)(esp_cloud_internal_handle_t *handle);
+    /* Optional. Makes a wait() in progress return early. Can be called from any task */
+    esp_err_t (*wake)(esp_cloud_internal_handle_t *handle);
+    esp_err_t (*disconnect)(esp_cloud_internal_handle_t *handle);
+    esp_err_t (*report_state)(esp_cloud_internal_handle_t *handle);
+    esp_err_t (*register_dynamic_params)(esp_cloud_internal_handle_t *handle);
+    esp_err_t (*get_shadow_stats)(esp_cloud_internal_handle_t *handle, esp_cloud_shadow_stats_t *stats);
+    esp_err_t (*publish)(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+            size_t data_len, esp_cloud_msg_class_t msg_class);
+    esp_err_t (*publish_async)(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+            size_t data_len, esp_cloud_msg_class_t msg_class, int *msg_id);
+    esp_err_t (*subscribe)(esp_cloud_internal_handle_t *handle, const char *topic,
+            esp_cloud_msg_class_t msg_class, esp_cloud_platform_subscribe_cb_t cb, void *priv_data);
+    esp_err_t (*unsubscribe)(esp_cloud_internal_handle_t *handle, const char *topic);
+} esp_cloud_transport_t;
+
+#ifdef CONFIG_ESP_CLOUD_TRANSPORT_AWS_IOT
+extern const esp_cloud_transport_t esp_cloud_transport_aws_iot;
+#endif
+#ifdef CONFIG_ESP_CLOUD_TRANSPORT_ESP_MQTT
+extern const esp_cloud_transport_t esp_cloud_transport_esp_mqtt;
+#endif
+#ifdef CONFIG_ESP_CLOUD_TRANSPORT_LOOPBACK
+extern const esp_cloud_transport_t esp_cloud_transport_loopback;
+#endif
+
+/* Select the transport to be used. Should be called before esp_cloud_platform_init() */
+esp_err_t esp_cloud_platform_select(esp_cloud_internal_handle_t *handle, esp_cloud_transport_type_t type);
 
 esp_err_t esp_cloud_platform_init(esp_cloud_internal_handle_t *handle);
 esp_err_t esp_cloud_platform_connect(esp_cloud_internal_handle_t *handle);
 esp_err_t esp_cloud_platform_wait(esp_cloud_internal_handle_t *handle);
+/* Wake up the cloud task from esp_cloud_platform_wait(). ESP_ERR_NOT_SUPPORTED if the
+ * transport cannot, in which case the wait runs till its timeout.
+ */
+esp_err_t esp_cloud_platform_wake(esp_cloud_internal_handle_t *handle);
 esp_err_t esp_cloud_platform_disconnect(esp_cloud_internal_handle_t *handle);
 
 esp_err_t esp_cloud_platform_report_state(esp_cloud_internal_handle_t *handle);
 esp_err_t esp_cloud_platform_register_dynamic_params(esp_cloud_internal_handle_t *handle);
+esp_err_t esp_cloud_platform_get_shadow_stats(esp_cloud_internal_handle_t *handle, esp_cloud_shadow_stats_t *stats);
 
-esp_err_t esp_cloud_platform_publish(esp_cloud_internal_handle_t *handle, const char *topic, const char *data);
-esp_err_t esp_cloud_platform_subscribe(esp_cloud_internal_handle_t *handle, const char *topic, esp_cloud_platform_subscribe_cb_t cb, void *priv_data);
+/* Publish a NULL terminated string */
+esp_err_t esp_cloud_platform_publish(esp_cloud_internal_handle_t *handle, const char *topic, const char *data,
+        esp_cloud_msg_class_t msg_class);
+/* Publish data which may not be a string, like a binary encoded message */
+esp_err_t esp_cloud_platform_publish_data(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+        size_t data_len, esp_cloud_msg_class_t msg_class);
+/* Publish without waiting for the acknowledgement. msg_id is set before the message can be
+ * acknowledged, and esp_cloud_publish_queue_complete() is called with it once it is. QoS0
+ * messages are not acknowledged, and the publish queue completes them once this returns.
+ */
+esp_err_t esp_cloud_platform_publish_async(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+        size_t data_len, esp_cloud_msg_class_t msg_class, int *msg_id);
+esp_err_t esp_cloud_platform_subscribe(esp_cloud_internal_handle_t *handle, const char *topic,
+        esp_cloud_msg_class_t msg_class, esp_cloud_platform_subscribe_cb_t cb, void *priv_data);
 esp_err_t esp_cloud_platform_unsubscribe(esp_cloud_internal_handle_t *handle, const char *topic);
@@ -0,0 +1,328 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string.h>
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+
+#include <esp_cloud_mem.h>
+#include <esp_cloud.h>
+#include <esp_cloud_loopback.h>
+
+#include "esp_cloud_platform.h"
+#include "esp_cloud_mqtt_common.h"
+#include "esp_cloud_publish_queue.h"
+#include "esp_cloud_topic_router.h"
+
+static const char *TAG = "loopback_cloud";
+
+#define LOOPBACK_WAIT_MS        200
+/* Same as the largest CONFIG_ESP_CLOUD_PUBLISH_WINDOW */
+#define LOOPBACK_MAX_ACKS       16
+
+typedef struct {
+    int msg_id;
+    TickType_t due;
+} loopback_ack_t;
+
+/* In-process broker. Messages published by the device go to the tap (the test harness
+ * playing the cloud) and to the device's own matching subscriptions.
+ */
+typedef struct {
+    QueueHandle_t rx_queue;
+    esp_cloud_topic_router_t *topic_router;
+    esp_cloud_mqtt_shadow_t shadow;
+    esp_cloud_loopback_tap_t tap;
+    void *tap_priv_data;
+    uint32_t ack_latency_ms;
+    bool connected;
+    int last_msg_id;
+    loopback_ack_t acks[LOOPBACK_MAX_ACKS];
+    int ack_count;
+} loopback_cloud_data_t;
+
+static loopback_cloud_data_t *loopback_get_data(esp_cloud_handle_t handle)
+{
+    esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
+    if (!int_handle || int_handle->transport != &esp_cloud_transport_loopback) {
+        return NULL;
+    }
+    return int_handle->cloud_platform_priv;
+}
+
+esp_err_t esp_cloud_loopback_set_tap(esp_cloud_handle_t handle, esp_cloud_loopback_tap_t tap, void *priv_data)
+{
+    loopback_cloud_data_t *platform_data = loopback_get_data(handle);
+    if (!platform_data) {
+        return ESP_FAIL;
+    }
+    platform_data->tap = tap;
+    platform_data->tap_priv_data = priv_data;
+    return ESP_OK;
+}
+
+esp_err_t esp_cloud_loopback_inject(esp_cloud_handle_t handle, const char *topic, const void *payload, size_t payload_len)
+{
+    loopback_cloud_data_t *platform_data = loopback_get_data(handle);
+    if (!platform_data || !topic) {
+        return ESP_FAIL;
+    }
+    return esp_cloud_rx_queue_post_msg(platform_data->rx_queue, topic, strlen(topic), payload, payload_len);
+}
+
+esp_err_t esp_cloud_loopback_set_ack_latency(esp_cloud_handle_t handle, uint32_t latency_ms)
+{
+    loopback_cloud_data_t *platform_data = loopback_get_data(handle);
+    if (!platform_data) {
+        return ESP_FAIL;
+    }
+    platform_data->ack_latency_ms = latency_ms;
+    return ESP_OK;
+}
+
+static esp_err_t loopback_deliver(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+        size_t data_len, int qos)
+{
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    if (!platform_data->connected) {
+        return ESP_FAIL;
+    }
+    ESP_LOGD(TAG, "Publishing to: %s", topic);
+    if (platform_data->tap) {
+        platform_data->tap(topic, data, data_len, qos, platform_data->tap_priv_data);
+    }
+    /* Dropped if the device has not subscribed to the topic */
+    esp_cloud_rx_queue_post_msg(platform_data->rx_queue, topic, strlen(topic), data, data_len);
+    return ESP_OK;
+}
+
+static esp_err_t loopback_platform_publish(esp_cloud_internal_handle_t *handle, const char *topic,
+        const void *data, size_t data_len, esp_cloud_msg_class_t msg_class)
+{
+    if (!handle || !topic || !data || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    int qos = esp_cloud_msg_policy_get(handle, msg_class)->qos;
+    esp_err_t err = loopback_deliver(handle, topic, data, data_len, qos);
+    if (err == ESP_OK && qos && platform_data->ack_latency_ms) {
+        /* Like the AWS IoT transport, wait for the PUBACK */
+        vTaskDelay(pdMS_TO_TICKS(platform_data->ack_latency_ms));
+    }
+    return err;
+}
+
+static esp_err_t loopback_platform_publish_async(esp_cloud_internal_handle_t *handle, const char *topic,
+        const void *data, size_t data_len, esp_cloud_msg_class_t msg_class, int *msg_id)
+{
+    if (!handle || !topic || !data || !msg_id || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    int qos = esp_cloud_msg_policy_get(handle, msg_class)->qos;
+    if (qos && platform_data->ack_latency_ms && platform_data->ack_count == LOOPBACK_MAX_ACKS) {
+        return ESP_FAIL;
+    }
+    esp_err_t err = loopback_deliver(handle, topic, data, data_len, qos);
+    if (err != ESP_OK) {
+        return err;
+    }
+    *msg_id = ++platform_data->last_msg_id;
+    /* QoS0 messages are not acknowledged */
+    if (qos && platform_data->ack_latency_ms) {
+        loopback_ack_t *ack = &platform_data->acks[platform_data->ack_count++];
+        ack->msg_id = *msg_id;
+        ack->due = xTaskGetTickCount() + pdMS_TO_TICKS(platform_data->ack_latency_ms);
+    } else if (qos) {
+        esp_cloud_publish_queue_complete(handle, *msg_id, ESP_OK);
+    }
+    return ESP_OK;
+}
+
+/* Acknowledge the messages whose round trip time has elapsed. Returns the ticks till the next one is due */
+static TickType_t loopback_process_acks(esp_cloud_internal_handle_t *handle)
+{
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    TickType_t now = xTaskGetTickCount();
+    TickType_t next = pdMS_TO_TICKS(LOOPBACK_WAIT_MS);
+    int i = 0;
+    while (i < platform_data->ack_count) {
+        loopback_ack_t *ack = &platform_data->acks[i];
+        TickType_t remaining = ack->due - now;
+        if ((int32_t)remaining <= 0) {
+            int msg_id = ack->msg_id;
+            platform_data->acks[i] = platform_data->acks[--platform_data->ack_count];
+            esp_cloud_publish_queue_complete(handle, msg_id, ESP_OK);
+            continue;
+        }
+        if (remaining < next) {
+            next = remaining;
+        }
+        i++;
+    }
+    return next;
+}
+
+static esp_err_t loopback_platform_subscribe(esp_cloud_internal_handle_t *handle, const char *topic,
+        esp_cloud_msg_class_t msg_class, esp_cloud_platform_subscribe_cb_t cb, void *priv_data)
+{
+    if (!handle || !topic || !cb || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    if (!esp_cloud_topic_router_add(platform_data->topic_router, topic, cb, priv_data, NULL)) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Subscribed to topic: %s", topic);
+    return ESP_OK;
+}
+
+static esp_err_t loopback_platform_unsubscribe(esp_cloud_internal_handle_t *handle, const char *topic)
+{
+    if (!handle || !topic || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    return esp_cloud_topic_router_remove(platform_data->topic_router, topic);
+}
+
+static esp_err_t loopback_platform_connect(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    platform_data->connected = true;
+    ESP_LOGI(TAG, "Loopback Connected.");
+    return ESP_OK;
+}
+
+static esp_err_t loopback_platform_disconnect(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    platform_data->connected = false;
+    esp_cloud_topic_router_clear(platform_data->topic_router);
+    /* The messages in flight are lost with the connection */
+    int i;
+    for (i = 0; i < platform_data->ack_count; i++) {
+        esp_cloud_publish_queue_complete(handle, platform_data->acks[i].msg_id, ESP_FAIL);
+    }
+    platform_data->ack_count = 0;
+    esp_cloud_rx_queue_process(handle, platform_data->rx_queue, NULL, 0);
+    ESP_LOGI(TAG, "Loopback Disconnected.");
+    return ESP_OK;
+}
+
+static esp_err_t loopback_platform_register_dynamic_params(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    return esp_cloud_mqtt_shadow_register(&platform_data->shadow);
+}
+
+static esp_err_t loopback_platform_report_state(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    return esp_cloud_mqtt_shadow_report(&platform_data->shadow, true);
+}
+
+static esp_err_t loopback_platform_get_shadow_stats(esp_cloud_internal_handle_t *handle, esp_cloud_shadow_stats_t *stats)
+{
+    if (!handle || !handle->cloud_platform_priv || !stats) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    *stats = platform_data->shadow.stats;
+    return ESP_OK;
+}
+
+static esp_err_t loopback_platform_wait(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    TickType_t timeout = loopback_process_acks(handle);
+    esp_cloud_rx_queue_process(handle, platform_data->rx_queue, platform_data->topic_router, timeout);
+    loopback_process_acks(handle);
+    esp_cloud_mqtt_shadow_report(&platform_data->shadow, false);
+    return ESP_OK;
+}
+
+static esp_err_t loopback_platform_wake(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    loopback_cloud_data_t *platform_data = handle->cloud_platform_priv;
+    return esp_cloud_rx_queue_wake(platform_data->rx_queue);
+}
+
+static esp_err_t loopback_platform_init(esp_cloud_internal_handle_t *handle)
+{
+    if (handle->cloud_platform_priv) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Initialising Loopback Cloud");
+    loopback_cloud_data_t *platform_data = esp_cloud_mem_calloc(1, sizeof(loopback_cloud_data_t));
+    if (!platform_data) {
+        return ESP_FAIL;
+    }
+    if ((platform_data->rx_queue = esp_cloud_rx_queue_create()) == NULL) {
+        goto init_err;
+    }
+    if ((platform_data->topic_router = esp_cloud_topic_router_create()) == NULL) {
+        goto init_err;
+    }
+    if (esp_cloud_mqtt_shadow_init(&platform_data->shadow, handle) != ESP_OK) {
+        goto init_err;
+    }
+    handle->cloud_platform_priv = platform_data;
+    return ESP_OK;
+
+init_err:
+    if (platform_data->topic_router) {
+        esp_cloud_topic_router_delete(platform_data->topic_router);
+    }
+    if (platform_data->rx_queue) {
+        esp_cloud_rx_queue_delete(platform_data->rx_queue);
+    }
+    free(platform_data);
+    return ESP_FAIL;
+}
+
+const esp_cloud_transport_t esp_cloud_transport_loopback = {
+    .name = "Loopback",
+    .init = loopback_platform_init,
+    .connect = loopback_platform_connect,
+    .wait = loopback_platform_wait,
+    .wake = loopback_platform_wake,
+    .disconnect = loopback_platform_disconnect,
+    .report_state = loopback_platform_report_state,
+    .register_dynamic_params = loopback_platform_register_dynamic_params,
+    .get_shadow_stats = loopback_platform_get_shadow_stats,
+    .publish = loopback_platform_publish,
+    .publish_async = loopback_platform_publish_async,
+    .subscribe = loopback_platform_subscribe,
+    .unsubscribe = loopback_platform_unsubscribe,
+};
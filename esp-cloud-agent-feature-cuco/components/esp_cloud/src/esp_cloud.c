@@ -16,7 +16,6 @@
 #include <freertos/task.h>
 #include <freertos/queue.h>
 #include <esp_log.h>
-#include <json_parser.h>
 #include <json_generator.h>
 
 #include "esp_cloud_mem.h"
@@ -24,6 +23,10 @@
 #include "esp_cloud_time_sync.h"
 #include "esp_cloud_storage.h"
 #include "esp_cloud_platform.h"
+#include "esp_cloud_publish_queue.h"
+#include "esp_cloud_app_msg.h"
+#include "esp_cloud_trace_points.h"
+#include "esp_cloud_topics.h"
 #include <freertos/event_groups.h>
 #include "app_auth_user.h"
 #include "app_auth.h"
@@ -36,7 +39,6 @@
 #include "esp_cloud_ota.h"
 static const char *TAG = "esp_cloud";
 
-#define INFO_TOPIC_SUFFIX       "device/info"
 
 #define DEFAULT_STATIC_PARAMS_COUNT         4
 #define DEFAULT_DYNAMIC_PARAMS_COUNT        3
@@ -47,8 +49,28 @@ static const char *TAG = "esp_cloud";
 
 #define ESP_CLOUD_TASK_STACK  6 * 1024
 
+#ifdef CONFIG_ESP_CLOUD_OTA_PROGRESS_INTERVAL_MS
+#define OTA_PROGRESS_INTERVAL_MS    CONFIG_ESP_CLOUD_OTA_PROGRESS_INTERVAL_MS
+#else
+#define OTA_PROGRESS_INTERVAL_MS    1000
+#endif
+#define OTA_PROGRESS_NONE           -1
+#define OTA_PROGRESS_FINAL          100
 
 
+
+/* Progress and diagnostics are superseded by the next update anyway, so they are not worth
+ * a PUBACK round trip and the broker session state.
+ */
+static const esp_cloud_msg_policy_t default_msg_policies[ESP_CLOUD_MSG_CLASS_MAX] = {
+    [ESP_CLOUD_MSG_CLASS_DEFAULT]       = { .qos = 1, .retain = false, .priority = ESP_CLOUD_MSG_PRIORITY_NORMAL },
+    [ESP_CLOUD_MSG_CLASS_DEVICE_INFO]   = { .qos = 1, .retain = false, .priority = ESP_CLOUD_MSG_PRIORITY_NORMAL },
+    [ESP_CLOUD_MSG_CLASS_EVENT]         = { .qos = 1, .retain = false, .priority = ESP_CLOUD_MSG_PRIORITY_HIGH },
+    [ESP_CLOUD_MSG_CLASS_PROGRESS]      = { .qos = 0, .retain = false, .priority = ESP_CLOUD_MSG_PRIORITY_NORMAL },
+    [ESP_CLOUD_MSG_CLASS_DIAGNOSTICS]   = { .qos = 0, .retain = false, .priority = ESP_CLOUD_MSG_PRIORITY_NORMAL },
+    [ESP_CLOUD_MSG_CLASS_REQUEST]       = { .qos = 1, .retain = false, .priority = ESP_CLOUD_MSG_PRIORITY_NORMAL },
+};
+
 extern int bind_status_code;    
 esp_cloud_internal_handle_t *g_cloud_handle;
 extern void app_aws_done_cb();
@@ -62,29 +84,42 @@ esp_err_t esp_cloud_init(esp_cloud_config_t *config, esp_cloud_handle_t *handle)
         return ESP_FAIL;
     }
     g_cloud_handle = esp_cloud_mem_calloc(1, sizeof(esp_cloud_internal_handle_t));
+    if (!g_cloud_handle) {
+        return ESP_ERR_NO_MEM;
+    }
     g_cloud_handle->device_id = esp_cloud_storage_get("device_id");
     if (!g_cloud_handle->device_id) {
-        free(g_cloud_handle);
-        g_cloud_handle = NULL;
-        return ESP_FAIL;
+        goto init_err;
     }
     ESP_LOGI(TAG, "Device UUID %s", g_cloud_handle->device_id);
+    memcpy(g_cloud_handle->msg_policies, default_msg_policies, sizeof(default_msg_policies));
+    g_cloud_handle->ota_progress_pending = OTA_PROGRESS_NONE;
+    if (esp_cloud_topics_init(g_cloud_handle) != ESP_OK) {
+        goto init_err;
+    }
+    if (esp_cloud_app_msg_init(g_cloud_handle) != ESP_OK) {
+        goto init_err;
+    }
 
     g_cloud_handle->work_queue = xQueueCreate(ESP_CLOUD_TASK_QUEUE_SIZE, sizeof(esp_cloud_work_queue_entry_t));
     if (!g_cloud_handle->work_queue) {
-        free(g_cloud_handle->device_id);
-        free(g_cloud_handle);
-        g_cloud_handle = NULL;
         ESP_LOGE(TAG, "ESP Cloud Task Queue Creation Failed");
-        return ESP_FAIL;
+        goto init_err;
     }
 
-    if (esp_cloud_platform_init(g_cloud_handle) != ESP_OK) {
-        vQueueDelete(g_cloud_handle->work_queue);
-        free(g_cloud_handle->device_id);
-        free(g_cloud_handle);
-        g_cloud_handle = NULL;
-        return ESP_FAIL;
+    if (esp_cloud_publish_queue_init(g_cloud_handle) != ESP_OK) {
+        goto init_err;
+    }
+
+    g_cloud_handle->cloud_task_done = xSemaphoreCreateBinary();
+    if (!g_cloud_handle->cloud_task_done) {
+        goto init_err;
+    }
+    xSemaphoreGive(g_cloud_handle->cloud_task_done);
+
+    if (esp_cloud_platform_select(g_cloud_handle, config->transport) != ESP_OK ||
+            esp_cloud_platform_init(g_cloud_handle) != ESP_OK) {
+        goto init_err;
     }
     
     g_cloud_handle->max_dynamic_params_count = config->dynamic_cloud_params_count + DEFAULT_DYNAMIC_PARAMS_COUNT;
@@ -100,6 +135,24 @@ esp_err_t esp_cloud_init(esp_cloud_config_t *config, esp_cloud_handle_t *handle)
     esp_cloud_add_static_string_param(*handle, "fw_version", config->id.fw_version);
     g_cloud_handle->fw_version = strdup(config->id.fw_version);
     return ESP_OK;
+
+init_err:
+    esp_cloud_publish_queue_deinit(g_cloud_handle);
+    if (g_cloud_handle->work_queue) {
+        vQueueDelete(g_cloud_handle->work_queue);
+    }
+    if (g_cloud_handle->cloud_task_done) {
+        vSemaphoreDelete(g_cloud_handle->cloud_task_done);
+    }
+    if (g_cloud_handle->app_tx_lock) {
+        vSemaphoreDelete(g_cloud_handle->app_tx_lock);
+    }
+    free(g_cloud_handle->app_tx_buf);
+    free(g_cloud_handle->topic_buf);
+    free(g_cloud_handle->device_id);
+    free(g_cloud_handle);
+    g_cloud_handle = NULL;
+    return ESP_FAIL;
 }
 
 /* Internal. Add a generic new Dynamic Cloud Parameter */
@@ -328,7 +381,7 @@ esp_err_t esp_cloud_update_float_param(esp_cloud_handle_t handle, const char *na
 
 esp_err_t esp_cloud_update_string_param(esp_cloud_handle_t handle, const char *name, char *val)
 {
-    esp_cloud_dynamic_param_t *param = esp_cloud_get_dynamic_param_by_name_and_type(name, CLOUD_PARAM_TYPE_INTEGER);
+    esp_cloud_dynamic_param_t *param = esp_cloud_get_dynamic_param_by_name_and_type(name, CLOUD_PARAM_TYPE_STRING);
     if (param) {
         if (param->val.val.s) {
             free(param->val.val.s);
@@ -366,113 +419,125 @@ static void esp_cloud_report_static_params(esp_cloud_internal_handle_t *handle,
     }
 }
 
-static esp_err_t esp_cloud_report_device_info(esp_cloud_internal_handle_t *handle)
+/* Generate a JSON string into a heap buffer of the exact required size.
+ * The builder is run twice, first with a NULL buffer just to get the length,
+ * and then to actually generate the string. The returned buffer must be freed
+ * using free().
+ */
+char *esp_cloud_json_build(esp_cloud_json_build_fn_t build_fn, void *priv_data)
 {
-    if (!handle) {
-        return ESP_FAIL;
-    }
-
-    char publish_payload[200];
     json_str_t jstr;
-    json_str_start(&jstr, publish_payload, sizeof(publish_payload), NULL, NULL);
-    json_start_object(&jstr);
-    json_obj_set_string(&jstr, "device_id", handle->device_id);
-    esp_cloud_report_static_params(handle, &jstr);
-    json_end_object(&jstr);
+    json_str_start(&jstr, NULL, 0, NULL, NULL);
+    build_fn(&jstr, priv_data);
+    int len = json_str_get_len(&jstr);
     json_str_end(&jstr);
-    char publish_topic[100];
-    snprintf(publish_topic, sizeof(publish_topic), "%s/%s", handle->device_id, INFO_TOPIC_SUFFIX);
 
-    return esp_cloud_platform_publish(handle, publish_topic, publish_payload);
+    char *buf = esp_cloud_mem_malloc(len + 1); /* + 1 for NULL termination */
+    if (!buf) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes for JSON string", len + 1);
+        return NULL;
+    }
+    json_str_start(&jstr, buf, len + 1, NULL, NULL);
+    build_fn(&jstr, priv_data);
+    json_str_end(&jstr);
+    return buf;
+}
 
+static void esp_cloud_build_device_info(json_str_t *jstr, void *priv_data)
+{
+    esp_cloud_internal_handle_t *handle = (esp_cloud_internal_handle_t *)priv_data;
+    json_start_object(jstr);
+    json_obj_set_string(jstr, "device_id", handle->device_id);
+#ifdef CONFIG_ESP_CLOUD_APP_MSG_CBOR
+    /* Lets the app know that it can send CBOR commands */
+    json_push_array(jstr, "app_encodings");
+    json_arr_set_string(jstr, "json");
+    json_arr_set_string(jstr, "cbor");
+    json_pop_array(jstr);
+#endif
+    esp_cloud_report_static_params(handle, jstr);
+    json_end_object(jstr);
 }
 
-static esp_err_t esp_cloud_report_user_bind_info(esp_cloud_internal_handle_t *handle,int code)
+static esp_err_t esp_cloud_report_device_info(esp_cloud_internal_handle_t *handle)
 {
     if (!handle) {
         return ESP_FAIL;
     }
 
-    char publish_payload[300];
-    json_str_t jstr;
-    json_str_start(&jstr, publish_payload, sizeof(publish_payload), NULL, NULL);
-    json_start_object(&jstr);
-    json_obj_set_string(&jstr, "cmd", "bind");
-    json_obj_set_string(&jstr, "source","device");
-    json_push_object(&jstr,"data");
-    json_obj_set_string(&jstr, "device_id", handle->device_id);
-    json_obj_set_string(&jstr, "func","bind");
-    json_obj_set_int(&jstr,"code",code);
-    json_obj_set_string(&jstr, "msg",((code==200) ? "bind success" : "bind fail"));
-    json_pop_object(&jstr);
-    json_end_object(&jstr);
-    json_str_end(&jstr);
-
-    char *app_topic = custom_config_storage_get("app_topic");
-    if (!app_topic) {
-        ESP_LOGE(TAG, "app_topic: fail");
-        return ESP_FAIL;
+    char *publish_payload = esp_cloud_json_build(esp_cloud_build_device_info, handle);
+    if (!publish_payload) {
+        return ESP_ERR_NO_MEM;
     }
-    esp_err_t err = esp_cloud_platform_publish(handle, app_topic,publish_payload);
-    free(app_topic);
+    esp_err_t err = esp_cloud_platform_publish(handle, esp_cloud_topic_get(handle, ESP_CLOUD_TOPIC_DEVICE_INFO),
+            publish_payload, ESP_CLOUD_MSG_CLASS_DEVICE_INFO);
+    free(publish_payload);
     return err;
 }
 
+static esp_err_t esp_cloud_report_user_bind_info(esp_cloud_internal_handle_t *handle,int code)
+{
+    return esp_cloud_app_msg_send(handle, ESP_CLOUD_APP_MSG_BIND, code,
+            ((code==200) ? "bind success" : "bind fail"));
+}
+
+/* The first and the final progress of an OTA are reported right away. The values in between
+ * just replace the one waiting in the mailbox, which the cloud task reports at most once every
+ * OTA_PROGRESS_INTERVAL_MS, so that the OTA download never waits for the message to be built.
+ */
 esp_err_t ota_report_progress_val_info(esp_cloud_internal_handle_t *handle,int progress_val)
 {
     if (!handle) {
         return ESP_FAIL;
     }
-
-    char publish_payload[200];
-    json_str_t jstr;
-    json_str_start(&jstr, publish_payload, sizeof(publish_payload), NULL, NULL);
-    json_start_object(&jstr);
-    json_obj_set_string(&jstr, "cmd", "ota_progress");
-    json_obj_set_string(&jstr, "source","device");
-    json_push_object(&jstr,"data");
-    json_obj_set_string(&jstr, "device_id", handle->device_id);
-    json_obj_set_int(&jstr, "ota_progress",progress_val);
-    json_pop_object(&jstr);
-    json_end_object(&jstr);
-    json_str_end(&jstr);
-
-    char *app_topic = custom_config_storage_get("app_topic");
-    if (!app_topic) {
-        ESP_LOGE(TAG, "app_topic: fail");
-        return ESP_FAIL;
+    if (handle->ota_progress_started && progress_val > 0 && progress_val < OTA_PROGRESS_FINAL) {
+        __atomic_store_n(&handle->ota_progress_pending, progress_val, __ATOMIC_RELAXED);
+        return ESP_OK;
     }
-    esp_err_t err = esp_cloud_platform_publish(handle, app_topic,publish_payload);
-    free(app_topic);
+    handle->ota_progress_started = (progress_val < OTA_PROGRESS_FINAL);
+    /* Holding the lock ensures that an older value being reported by the cloud task
+     * is not sent after this one
+     */
+    xSemaphoreTakeRecursive(handle->app_tx_lock, portMAX_DELAY);
+    __atomic_store_n(&handle->ota_progress_pending, OTA_PROGRESS_NONE, __ATOMIC_RELAXED);
+    esp_err_t err = esp_cloud_app_msg_send(handle, ESP_CLOUD_APP_MSG_OTA_PROGRESS, progress_val, NULL);
+    /* So that the next value is not reported right after this one */
+    handle->ota_progress_reported_at = xTaskGetTickCount();
+    xSemaphoreGiveRecursive(handle->app_tx_lock);
     return err;
 }
 
-esp_err_t ota_report_progress_val_msg(esp_cloud_internal_handle_t *handle,int result)
+static void esp_cloud_report_pending_ota_progress(esp_cloud_internal_handle_t *handle)
 {
-    if (!handle) {
-        return ESP_FAIL;
+    if (__atomic_load_n(&handle->ota_progress_pending, __ATOMIC_RELAXED) == OTA_PROGRESS_NONE) {
+        return;
     }
+    TickType_t now = xTaskGetTickCount();
+    if ((now - handle->ota_progress_reported_at) < pdMS_TO_TICKS(OTA_PROGRESS_INTERVAL_MS)) {
+        return;
+    }
+    xSemaphoreTakeRecursive(handle->app_tx_lock, portMAX_DELAY);
+    int progress_val = __atomic_exchange_n(&handle->ota_progress_pending, OTA_PROGRESS_NONE, __ATOMIC_RELAXED);
+    if (progress_val != OTA_PROGRESS_NONE) {
+        esp_cloud_app_msg_send(handle, ESP_CLOUD_APP_MSG_OTA_PROGRESS, progress_val, NULL);
+        handle->ota_progress_reported_at = now;
+    }
+    xSemaphoreGiveRecursive(handle->app_tx_lock);
+}
 
-    char publish_payload[200];
-    json_str_t jstr;
-    json_str_start(&jstr, publish_payload, sizeof(publish_payload), NULL, NULL);
-    json_start_object(&jstr);
-    json_obj_set_string(&jstr, "cmd", "ota_result");
-    json_obj_set_string(&jstr, "source","device");
-    json_push_object(&jstr,"data");
-    json_obj_set_string(&jstr, "device_id", handle->device_id);
-    json_obj_set_int(&jstr, "result",result);
-    json_pop_object(&jstr);
-    json_end_object(&jstr);
-    json_str_end(&jstr);
-
-    char *app_topic = custom_config_storage_get("app_topic");
-    if (!app_topic) {
-        ESP_LOGE(TAG, "app_topic: fail");
+/* The result ends the OTA, so any progress still in the mailbox is dropped rather than
+ * reported after it
+ */
+esp_err_t ota_report_progress_val_msg(esp_cloud_internal_handle_t *handle,int result)
+{
+    if (!handle) {
         return ESP_FAIL;
     }
-    esp_err_t err = esp_cloud_platform_publish(handle, app_topic,publish_payload);
-    free(app_topic);
+    xSemaphoreTakeRecursive(handle->app_tx_lock, portMAX_DELAY);
+    __atomic_store_n(&handle->ota_progress_pending, OTA_PROGRESS_NONE, __ATOMIC_RELAXED);
+    handle->ota_progress_started = false;
+    esp_err_t err = esp_cloud_app_msg_send(handle, ESP_CLOUD_APP_MSG_OTA_RESULT, result, NULL);
+    xSemaphoreGiveRecursive(handle->app_tx_lock);
     return err;
 }
 
@@ -496,33 +561,9 @@ void esp_cloud_handle_work_queue(esp_cloud_internal_handle_t *handle)
 
 esp_err_t esp_cloud_report_alexa_sign_in_status(esp_cloud_internal_handle_t *handle,int code, char *additional_info)
 {
-    if (!handle) {
-        return ESP_FAIL;
-    }
-
-    char publish_payload[200];
-    json_str_t jstr;
-    json_str_start(&jstr, publish_payload, sizeof(publish_payload), NULL, NULL);
-    json_start_object(&jstr);
-    json_obj_set_string(&jstr, "cmd","alexa_res");
-    json_obj_set_string(&jstr, "source","device");
-    json_push_object(&jstr,"data");
-    json_obj_set_string(&jstr, "device_id", handle->device_id);
-    json_obj_set_int(&jstr, "code",code);
-    json_obj_set_string(&jstr, "msg",additional_info);
-    json_pop_object(&jstr);
-    json_end_object(&jstr);
-    json_str_end(&jstr);
-
-    char *app_topic = custom_config_storage_get("app_topic");
-    if (!app_topic) {
-        ESP_LOGE(TAG, "app_topic: fail");
-        return ESP_FAIL;
-    }
-    esp_err_t err = esp_cloud_platform_publish(handle, app_topic,publish_payload);
-    free(app_topic);
+    esp_err_t err = esp_cloud_app_msg_send(handle, ESP_CLOUD_APP_MSG_ALEXA_RES, code, additional_info);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_cloud_platform_publish_data returned error %d",err);
+        ESP_LOGE(TAG, "esp_cloud_app_msg_send returned error %d",err);
         return ESP_FAIL;
     }
     return ESP_OK;
@@ -530,33 +571,9 @@ esp_err_t esp_cloud_report_alexa_sign_in_status(esp_cloud_internal_handle_t *han
 
 esp_err_t esp_cloud_report_alexa_sign_out_status(esp_cloud_internal_handle_t *handle,int code, char *additional_info)
 {
-    if (!handle) {
-        return ESP_FAIL;
-    }
-
-    char publish_payload[200];
-    json_str_t jstr;
-    json_str_start(&jstr, publish_payload, sizeof(publish_payload), NULL, NULL);
-    json_start_object(&jstr);
-    json_obj_set_string(&jstr, "cmd","alexa_unbind_res");
-    json_obj_set_string(&jstr, "source","device");
-    json_push_object(&jstr,"data");
-    json_obj_set_string(&jstr, "device_id", handle->device_id);
-    json_obj_set_int(&jstr, "code",code);
-    json_obj_set_string(&jstr, "msg",additional_info);
-    json_pop_object(&jstr);
-    json_end_object(&jstr);
-    json_str_end(&jstr);
-
-    char *app_topic = custom_config_storage_get("app_topic");
-    if (!app_topic) {
-        ESP_LOGE(TAG, "app_topic: fail");
-        return ESP_FAIL;
-    }
-    esp_err_t err = esp_cloud_platform_publish(handle, app_topic,publish_payload);
-    free(app_topic);
+    esp_err_t err = esp_cloud_app_msg_send(handle, ESP_CLOUD_APP_MSG_ALEXA_UNBIND_RES, code, additional_info);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_cloud_platform_publish_data returned error %d",err);
+        ESP_LOGE(TAG, "esp_cloud_app_msg_send returned error %d",err);
         return ESP_FAIL;
     }
     return ESP_OK;
@@ -565,180 +582,88 @@ esp_err_t esp_cloud_report_alexa_sign_out_status(esp_cloud_internal_handle_t *ha
 extern uint32_t app_to_current_val;
 extern int app_set_volume;
 char *ota_vertion = NULL;
-static void alexa_sign_in_handler(const char *topic, void *payload, size_t payload_len, void *priv_data)
+
+/* The Alexa sign in details are kept in static buffers, since the sign in may
+ * use them after the message handler returns.
+ */
+#define ALEXA_REDIRECT_URI_MAX_LEN  128
+#define ALEXA_AUTH_CODE_MAX_LEN     64
+#define ALEXA_CLIENT_ID_MAX_LEN     128
+static char alexa_redirect_uri[ALEXA_REDIRECT_URI_MAX_LEN];
+static char alexa_auth_code[ALEXA_AUTH_CODE_MAX_LEN];
+static char alexa_client_id[ALEXA_CLIENT_ID_MAX_LEN];
+static char ota_version_buf[MAX_VERSION_STRING_LEN];
+
+static void alexa_sign_in_handler(const char *topic, const void *payload, size_t payload_len, void *priv_data)
 {
-    int len = 0,cmp = 255;
-    jparse_ctx_t jctx;
+    esp_cloud_app_cmd_t cmd;
     auth_delegate_config_t cfg = {0};
     esp_cloud_internal_handle_t *handle = (esp_cloud_internal_handle_t *)priv_data;
 
-    printf("have app information------------------------------------------------------------------\r\n");
-    printf("%.*s\r\n",payload_len,(char *)payload);
-    int ret = json_parse_start(&jctx, (char *)payload, (int) payload_len);
-    if (ret != 0) {
+    if (esp_cloud_app_cmd_decode(payload, payload_len, &cmd) != ESP_OK) {
         return;
     }
-
-    ret = json_obj_get_object(&jctx,"data");
-    if (ret != 0) {
-        return;
+    if (cmd.encoding == ESP_CLOUD_APP_ENCODING_JSON) {
+        ESP_LOGD(TAG, "App message: %.*s", (int)payload_len, (const char *)payload);
     }
 
-    ret = json_obj_get_strlen(&jctx, "devcice_id", &len);
-    if (ret != ESP_OK) {
+    if (cmd.from_device || !cmd.device_id.str) {
         return;
     }
-    len++;
-    char *buf_id = esp_cloud_mem_calloc(1, len);
-    if (!buf_id) {
+    if (!esp_cloud_app_str_equals(&cmd.device_id, handle->device_id)) {
+        ESP_LOGD(TAG, "App message for another device: %.*s", (int)cmd.device_id.len, cmd.device_id.str);
         return;
     }
-    json_obj_get_string(&jctx, "devcice_id",buf_id, len);
-    ESP_LOGI(TAG, "devcice_id: %s", buf_id);
 
-    char * p_device_id = esp_cloud_storage_get("device_id");
-    if (p_device_id) {
-        cmp = strcmp(buf_id,p_device_id);
-        free(buf_id);
-        free(p_device_id);
-    }else{
-        ESP_LOGE(TAG, "p_device_id: fail");
+    if (!cmd.cmd.str) {
+        ESP_LOGD(TAG, "App message without cmd");
         return;
     }
-
-    ret = json_obj_leave_object(&jctx);
-     if (ret != 0) {
-        return;
-    }
-
-    if(!cmp){
-        ret = json_obj_get_strlen(&jctx, "cmd", &len);
-        if (ret != ESP_OK) {
-            printf("no find cmd--------------\r\n");
-            return;
-        }else{
-
-            len++;
-            char * p_cmd = esp_cloud_mem_calloc(1, len);
-            json_obj_get_string(&jctx, "cmd",p_cmd, len);
-
-            printf("cmd:%s-----------\r\n",p_cmd);
-
-            if(!strcmp(p_cmd,"alexa_unbind_req")){
-                Wait_for_alexa_out = NOT_LOG_OUT;
-                alexa_auth_delegate_signout();
-                printf("alexa_auth_delegate_signout\r\n");
+    ESP_CLOUD_TRACE(APP_CMD, esp_cloud_trace_hash(cmd.cmd.str, cmd.cmd.len), cmd.encoding, payload_len);
+    ESP_LOGD(TAG, "App cmd: %.*s", (int)cmd.cmd.len, cmd.cmd.str);
+    /* Responses to the app are sent in the encoding it used */
+    handle->app_encoding = cmd.encoding;
+
+    if (esp_cloud_app_str_equals(&cmd.cmd, "alexa_unbind_req")) {
+        Wait_for_alexa_out = NOT_LOG_OUT;
+        alexa_auth_delegate_signout();
+    } else if (esp_cloud_app_str_equals(&cmd.cmd, "alexa_req")) {
+        if(Wait_for_alexa_in == NOT_LOG_IN){
+            if (esp_cloud_app_str_copy(&cmd.redirect_uri, alexa_redirect_uri, sizeof(alexa_redirect_uri)) != ESP_OK ||
+                    esp_cloud_app_str_copy(&cmd.auth_code, alexa_auth_code, sizeof(alexa_auth_code)) != ESP_OK ||
+                    esp_cloud_app_str_copy(&cmd.client_id, alexa_client_id, sizeof(alexa_client_id)) != ESP_OK) {
+                ESP_LOGE(TAG, "Missing or too long Alexa sign in details");
                 return;
-            }else if(!strcmp(p_cmd,"alexa_req")){
-
-                printf("recive alexa_bind_req\r\n");
-                if(Wait_for_alexa_in == NOT_LOG_IN){
-                    printf("Wait_for_alexa_in\r\n");
-                    ret = json_obj_get_object(&jctx,"data");
-                    if (ret != 0) {
-                        return;
-                    }
-
-                    // //acquire redirect_uri-------------------------------------------------------------
-                    
-                    ret = json_obj_get_strlen(&jctx, "redirect_uri", &len);
-                    if (ret != ESP_OK) {
-                        return;
-                    }
-                    len++;
-                    cfg.u.comp_app.redirect_uri = esp_cloud_mem_calloc(1, len);
-                    if (!cfg.u.comp_app.redirect_uri) {
-                        return;
-                    }
-                    json_obj_get_string(&jctx, "redirect_uri",cfg.u.comp_app.redirect_uri, len);
-                    ESP_LOGI(TAG, "redirect_uri: %s", cfg.u.comp_app.redirect_uri);
-
-                    //acquire auth_code-------------------------------------------------------------
-                    len = 0;
-                    ret = json_obj_get_strlen(&jctx, "auth_code", &len);
-                    if (ret != ESP_OK) {
-                        return;
-                    }
-                    len++;
-                    cfg.u.comp_app.auth_code = esp_cloud_mem_calloc(1, len);
-                    if (!cfg.u.comp_app.auth_code) {
-                        return;
-                    }
-                    json_obj_get_string(&jctx, "auth_code", cfg.u.comp_app.auth_code, len);
-                    ESP_LOGI(TAG, "auth_code: %s", cfg.u.comp_app.auth_code);
-
-                    //acquire client_id-------------------------------------------------------------
-                    len = 0;
-                    ret = json_obj_get_strlen(&jctx, "client_id", &len);
-                    if (ret != ESP_OK) {
-                        return;
-                    }
-                    len++; 
-                    cfg.u.comp_app.client_id = esp_cloud_mem_calloc(1, len);
-                    if (!cfg.u.comp_app.client_id) {
-                        return;
-                    }
-                    json_obj_get_string(&jctx, "client_id", cfg.u.comp_app.client_id, len);
-                    ESP_LOGI(TAG, "client_id: %s", cfg.u.comp_app.client_id);
-
-                    json_obj_leave_object(&jctx);
-                    json_parse_end(&jctx);
-
-                    cfg.type = auth_type_comp_app;
-                    cfg.u.comp_app.code_verifier = "abcd1234";
-                    alexa_auth_delegate_signin(&cfg);  
-                }  
-            }
-            else if(!strcmp(p_cmd,"ota_upgrade")){
-                    char *url = NULL ;
-                    int ota_file_size = 0;
-                    printf("recive ota_upgrade\r\n");
-                    ret = json_obj_get_object(&jctx,"data");
-                    if (ret != 0) {
-                        return;
-                    }
-
-                    ret = json_obj_get_strlen(&jctx,"ota_url",&len);
-                    if (ret != ESP_OK) {
-                        return;
-                    }
-                    len++;
-                    url = esp_cloud_mem_calloc(1, len);
-                    if (!url) {
-                        return;
-                    }
-                    json_obj_get_string(&jctx, "ota_url",url, len);
-                    len = 0;  
-
-                    json_obj_get_int(&jctx, "ota_size",&ota_file_size);
-
-                    ret = json_obj_get_strlen(&jctx,"ota_version",&len);
-                    if (ret != ESP_OK) {
-                        return;
-                    }
-                    len++;
-                    ota_vertion = esp_cloud_mem_calloc(1, len);
-                    if (!ota_vertion) {
-                        return;
-                    }
-                    
-                    json_obj_get_string(&jctx, "ota_version",ota_vertion,len);
-                    len = 0; 
-                    json_obj_leave_object(&jctx);
-                    json_parse_end(&jctx);
-                    printf("url:%s file_size:%d  Ver:%s",url,ota_file_size,ota_vertion);
-                    app_publish_ota(url,ota_file_size,ota_vertion);
-            }
-            else{
-                printf("nothing-------------\r\n");
             }
+            ESP_LOGD(TAG, "redirect_uri: %s", alexa_redirect_uri);
+            ESP_LOGD(TAG, "auth_code: %s", alexa_auth_code);
+            ESP_LOGD(TAG, "client_id: %s", alexa_client_id);
+
+            cfg.type = auth_type_comp_app;
+            cfg.u.comp_app.redirect_uri = alexa_redirect_uri;
+            cfg.u.comp_app.auth_code = alexa_auth_code;
+            cfg.u.comp_app.client_id = alexa_client_id;
+            cfg.u.comp_app.code_verifier = "abcd1234";
+            alexa_auth_delegate_signin(&cfg);
+        }
+    } else if (esp_cloud_app_str_equals(&cmd.cmd, "ota_upgrade")) {
+        if (esp_cloud_app_str_copy(&cmd.ota_version, ota_version_buf, sizeof(ota_version_buf)) != ESP_OK) {
+            ESP_LOGE(TAG, "Missing or too long ota_version");
+            return;
+        }
+        /* Pre-signed URLs can be long, so the URL is not limited to a fixed buffer */
+        char *url = esp_cloud_app_str_dup(&cmd.ota_url);
+        if (!url) {
+            ESP_LOGE(TAG, "Missing ota_url, or no memory for it");
+            return;
         }
-    }else{
-         printf("no strcmp--------------\r\n");
+        ota_vertion = ota_version_buf;
+        ESP_LOGI(TAG, "OTA upgrade to %s, size %d, from %s", ota_vertion, cmd.ota_size, url);
+        app_publish_ota(url,cmd.ota_size,ota_vertion);
+        free(url);
+    } else {
+        ESP_LOGD(TAG, "Unhandled app cmd: %.*s", (int)cmd.cmd.len, cmd.cmd.str);
     }
-
- 
-    return;
 }
 
 
@@ -755,7 +680,7 @@ void test_alexa_sign_in(void){
 static esp_err_t esp_cloud_alexa_sign_in_topic(esp_cloud_handle_t handle, void *priv_data)
 {
     esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
-    char *app_topic = custom_config_storage_get("app_topic");
+    const char *app_topic = esp_cloud_topic_get(int_handle, ESP_CLOUD_TOPIC_APP);
     if (!app_topic) {
         ESP_LOGE(TAG, "app_topic: fail");
         return ESP_FAIL;
@@ -764,8 +689,8 @@ static esp_err_t esp_cloud_alexa_sign_in_topic(esp_cloud_handle_t handle, void *
     ESP_LOGI(TAG, "Subscribing to: %s", app_topic);
     /* First unsubscribing, in case there is a stale subscription */
     esp_cloud_platform_unsubscribe(int_handle, app_topic);
-    esp_err_t err = esp_cloud_platform_subscribe(int_handle, app_topic, alexa_sign_in_handler, priv_data);
-    free(app_topic);
+    esp_err_t err = esp_cloud_platform_subscribe(int_handle, app_topic, ESP_CLOUD_MSG_CLASS_REQUEST,
+            alexa_sign_in_handler, priv_data);
     if(err != ESP_OK) {
         ESP_LOGE(TAG, "OTA URL Subscription Error %d", err);
         return ESP_FAIL;
@@ -788,11 +713,13 @@ static void esp_cloud_task(void *param)
     }
     esp_cloud_internal_handle_t *handle = (esp_cloud_internal_handle_t *) param;
 
+    /* In case the app topic was not provisioned when the agent was initialised */
+    esp_cloud_topics_refresh(handle);
     esp_err_t err = esp_cloud_platform_connect(handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_cloud_platform_connect() returned %d. Aborting", err);
-        vTaskDelete(NULL);
-    }/* TODO: Error handling */
+        goto task_exit;
+    }
 
     esp_cloud_platform_register_dynamic_params(handle); /* TODO: Error handling */
     esp_cloud_report_device_info(handle);
@@ -806,6 +733,8 @@ static void esp_cloud_task(void *param)
     printf("------------------------------------------esp cloud init ok-----------------------------------------------\r\n");
     while (!handle->cloud_stop) {
         esp_cloud_handle_work_queue(handle);
+        esp_cloud_report_pending_ota_progress(handle);
+        esp_cloud_publish_queue_process(handle);
         esp_cloud_platform_wait(handle);
 
         if(Wait_for_alexa_in == LOGED_IN){
@@ -841,7 +770,11 @@ static void esp_cloud_task(void *param)
         }
     }
     esp_cloud_platform_disconnect(handle);
+    esp_cloud_publish_queue_flush(handle, ESP_FAIL);
+task_exit:
     handle->cloud_stop = false;
+    handle->cloud_task = NULL;
+    xSemaphoreGive(handle->cloud_task_done);
     vTaskDelete(NULL);
 }
 
@@ -869,6 +802,10 @@ esp_err_t esp_cloud_start(esp_cloud_handle_t handle)
         return ESP_FAIL;
     }
     esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
+    if (xSemaphoreTake(int_handle->cloud_task_done, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Cloud Agent already running");
+        return ESP_ERR_INVALID_STATE;
+    }
     int_ota_report_handle = (esp_cloud_internal_handle_t *)handle;
     if (int_handle->enable_time_sync) {
         esp_cloud_time_sync_init();
@@ -878,8 +815,10 @@ esp_err_t esp_cloud_start(esp_cloud_handle_t handle)
 
     ESP_LOGI(TAG, "Starting Cloud Agent");
 
-    if (xTaskCreate(&esp_cloud_task, "esp_cloud_task", ESP_CLOUD_TASK_STACK, int_handle, 5, NULL) != pdPASS) {
+    if (xTaskCreate(&esp_cloud_task, "esp_cloud_task", ESP_CLOUD_TASK_STACK, int_handle, 5,
+                &int_handle->cloud_task) != pdPASS) {
         ESP_LOGE(TAG, "Couldn't create cloud task");
+        xSemaphoreGive(int_handle->cloud_task_done);
         return ESP_FAIL;
     }
 
@@ -892,7 +831,20 @@ esp_err_t esp_cloud_stop(esp_cloud_handle_t handle)
         return ESP_FAIL;
     }
     esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
+    if (xTaskGetCurrentTaskHandle() == int_handle->cloud_task) {
+        /* Called from the cloud task, which exits once back in its loop */
+        int_handle->cloud_stop = true;
+        return ESP_OK;
+    }
+    if (xSemaphoreTake(int_handle->cloud_task_done, 0) == pdTRUE) {
+        /* Not running */
+        xSemaphoreGive(int_handle->cloud_task_done);
+        return ESP_OK;
+    }
     int_handle->cloud_stop = true;
+    esp_cloud_platform_wake(int_handle);
+    xSemaphoreTake(int_handle->cloud_task_done, portMAX_DELAY);
+    xSemaphoreGive(int_handle->cloud_task_done);
     return ESP_OK;
 }
 
@@ -901,6 +853,61 @@ esp_cloud_handle_t esp_cloud_get_handle()
     return (esp_cloud_handle_t)g_cloud_handle;
 }
 
+esp_err_t esp_cloud_get_shadow_stats(esp_cloud_handle_t handle, esp_cloud_shadow_stats_t *stats)
+{
+    if (!handle || !stats) {
+        return ESP_FAIL;
+    }
+    esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
+    return esp_cloud_platform_get_shadow_stats(int_handle, stats);
+}
+
+esp_err_t esp_cloud_get_publish_stats(esp_cloud_handle_t handle, esp_cloud_publish_stats_t *stats)
+{
+    if (!handle || !stats) {
+        return ESP_FAIL;
+    }
+    esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
+    return esp_cloud_publish_queue_get_stats(int_handle, stats);
+}
+
+const esp_cloud_msg_policy_t *esp_cloud_msg_policy_get(esp_cloud_internal_handle_t *handle, esp_cloud_msg_class_t msg_class)
+{
+    if (msg_class < 0 || msg_class >= ESP_CLOUD_MSG_CLASS_MAX) {
+        msg_class = ESP_CLOUD_MSG_CLASS_DEFAULT;
+    }
+    if (!handle) {
+        return &default_msg_policies[msg_class];
+    }
+    return &handle->msg_policies[msg_class];
+}
+
+esp_err_t esp_cloud_set_msg_policy(esp_cloud_handle_t handle, esp_cloud_msg_class_t msg_class,
+        const esp_cloud_msg_policy_t *policy)
+{
+    if (!handle || !policy || msg_class < 0 || msg_class >= ESP_CLOUD_MSG_CLASS_MAX) {
+        return ESP_FAIL;
+    }
+    if (policy->qos > 1) {
+        ESP_LOGE(TAG, "QoS %d not supported", policy->qos);
+        return ESP_FAIL;
+    }
+    esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
+    int_handle->msg_policies[msg_class] = *policy;
+    return ESP_OK;
+}
+
+esp_err_t esp_cloud_get_msg_policy(esp_cloud_handle_t handle, esp_cloud_msg_class_t msg_class,
+        esp_cloud_msg_policy_t *policy)
+{
+    if (!handle || !policy || msg_class < 0 || msg_class >= ESP_CLOUD_MSG_CLASS_MAX) {
+        return ESP_FAIL;
+    }
+    esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
+    *policy = int_handle->msg_policies[msg_class];
+    return ESP_OK;
+}
+
 char *esp_cloud_get_device_id(esp_cloud_handle_t handle)
 {
     if (!handle) {
@@ -0,0 +1,430 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string.h>
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <json_parser.h>
+#include <json_generator.h>
+
+#include "esp_cloud_mem.h"
+#include "esp_cloud_cbor.h"
+#include "esp_cloud_app_msg.h"
+#include "esp_cloud_platform.h"
+#include "esp_cloud_publish_queue.h"
+#include "esp_cloud_topics.h"
+
+#ifdef CONFIG_ESP_CLOUD_APP_TX_BUF_SIZE
+#define ESP_CLOUD_APP_TX_BUF_SIZE   CONFIG_ESP_CLOUD_APP_TX_BUF_SIZE
+#else
+#define ESP_CLOUD_APP_TX_BUF_SIZE   384
+#endif
+/* Enough for all the commands from the app, so that they are parsed without any allocation */
+#define APP_CMD_JSON_TOKENS         24
+
+static const char *TAG = "esp_cloud_app_msg";
+
+static const esp_cloud_app_msg_desc_t app_msg_table[ESP_CLOUD_APP_MSG_MAX] = {
+    [ESP_CLOUD_APP_MSG_BIND] = {
+        .cmd = "bind",
+        .msg_class = ESP_CLOUD_MSG_CLASS_EVENT,
+        .fields = {
+            {ESP_CLOUD_APP_FIELD_CONST, ESP_CLOUD_APP_KEY_FUNC, "func", "bind"},
+            {ESP_CLOUD_APP_FIELD_INT, ESP_CLOUD_APP_KEY_VALUE, "code"},
+            {ESP_CLOUD_APP_FIELD_STR, ESP_CLOUD_APP_KEY_MSG, "msg"},
+        },
+    },
+    [ESP_CLOUD_APP_MSG_OTA_PROGRESS] = {
+        .cmd = "ota_progress",
+        .msg_class = ESP_CLOUD_MSG_CLASS_PROGRESS,
+        .async = true,
+        .fields = {
+            {ESP_CLOUD_APP_FIELD_INT, ESP_CLOUD_APP_KEY_VALUE, "ota_progress"},
+        },
+    },
+    [ESP_CLOUD_APP_MSG_OTA_RESULT] = {
+        .cmd = "ota_result",
+        .msg_class = ESP_CLOUD_MSG_CLASS_EVENT,
+        .fields = {
+            {ESP_CLOUD_APP_FIELD_INT, ESP_CLOUD_APP_KEY_VALUE, "result"},
+        },
+    },
+    [ESP_CLOUD_APP_MSG_ALEXA_RES] = {
+        .cmd = "alexa_res",
+        .msg_class = ESP_CLOUD_MSG_CLASS_EVENT,
+        .fields = {
+            {ESP_CLOUD_APP_FIELD_INT, ESP_CLOUD_APP_KEY_VALUE, "code"},
+            {ESP_CLOUD_APP_FIELD_STR, ESP_CLOUD_APP_KEY_MSG, "msg"},
+        },
+    },
+    [ESP_CLOUD_APP_MSG_ALEXA_UNBIND_RES] = {
+        .cmd = "alexa_unbind_res",
+        .msg_class = ESP_CLOUD_MSG_CLASS_EVENT,
+        .fields = {
+            {ESP_CLOUD_APP_FIELD_INT, ESP_CLOUD_APP_KEY_VALUE, "code"},
+            {ESP_CLOUD_APP_FIELD_STR, ESP_CLOUD_APP_KEY_MSG, "msg"},
+        },
+    },
+};
+
+const esp_cloud_app_msg_desc_t *esp_cloud_app_msg_get_desc(esp_cloud_app_msg_id_t id)
+{
+    if (id < 0 || id >= ESP_CLOUD_APP_MSG_MAX) {
+        return NULL;
+    }
+    return &app_msg_table[id];
+}
+
+static void esp_cloud_app_msg_build_json(json_str_t *jstr, const esp_cloud_app_msg_desc_t *desc,
+        const char *device_id, int val, const char *msg)
+{
+    json_start_object(jstr);
+    json_obj_set_string(jstr, "cmd", (char *)desc->cmd);
+    json_obj_set_string(jstr, "source", "device");
+    json_push_object(jstr, "data");
+    json_obj_set_string(jstr, "device_id", (char *)device_id);
+    for (const esp_cloud_app_field_t *field = desc->fields; field->type != ESP_CLOUD_APP_FIELD_END; field++) {
+        switch (field->type) {
+            case ESP_CLOUD_APP_FIELD_CONST:
+                json_obj_set_string(jstr, (char *)field->name, (char *)field->val);
+                break;
+            case ESP_CLOUD_APP_FIELD_INT:
+                json_obj_set_int(jstr, (char *)field->name, val);
+                break;
+            case ESP_CLOUD_APP_FIELD_STR:
+                if (msg) {
+                    json_obj_set_string(jstr, (char *)field->name, (char *)msg);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    json_pop_object(jstr);
+    json_end_object(jstr);
+}
+
+static void esp_cloud_cbor_put_string(esp_cloud_cbor_writer_t *w, const char *str)
+{
+    esp_cloud_cbor_put_text(w, str, strlen(str));
+}
+
+static void esp_cloud_app_msg_build_cbor(esp_cloud_cbor_writer_t *w, const esp_cloud_app_msg_desc_t *desc,
+        const char *device_id, int val, const char *msg)
+{
+    const esp_cloud_app_field_t *field;
+    size_t pairs = 1;
+    for (field = desc->fields; field->type != ESP_CLOUD_APP_FIELD_END; field++) {
+        if (field->type != ESP_CLOUD_APP_FIELD_STR || msg) {
+            pairs++;
+        }
+    }
+    esp_cloud_cbor_put_map(w, 3);
+    esp_cloud_cbor_put_uint(w, ESP_CLOUD_APP_KEY_CMD);
+    esp_cloud_cbor_put_string(w, desc->cmd);
+    esp_cloud_cbor_put_uint(w, ESP_CLOUD_APP_KEY_SOURCE);
+    esp_cloud_cbor_put_uint(w, ESP_CLOUD_APP_SOURCE_DEVICE);
+    esp_cloud_cbor_put_uint(w, ESP_CLOUD_APP_KEY_DATA);
+    esp_cloud_cbor_put_map(w, pairs);
+    esp_cloud_cbor_put_uint(w, ESP_CLOUD_APP_KEY_DEVICE_ID);
+    esp_cloud_cbor_put_string(w, device_id);
+    for (field = desc->fields; field->type != ESP_CLOUD_APP_FIELD_END; field++) {
+        switch (field->type) {
+            case ESP_CLOUD_APP_FIELD_CONST:
+                esp_cloud_cbor_put_uint(w, field->key);
+                esp_cloud_cbor_put_string(w, field->val);
+                break;
+            case ESP_CLOUD_APP_FIELD_INT:
+                esp_cloud_cbor_put_uint(w, field->key);
+                esp_cloud_cbor_put_int(w, val);
+                break;
+            case ESP_CLOUD_APP_FIELD_STR:
+                if (msg) {
+                    esp_cloud_cbor_put_uint(w, field->key);
+                    esp_cloud_cbor_put_string(w, msg);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* The generator flushes out the buffer only if the message does not fit. That is found from
+ * the total length later, so the data need not be kept.
+ */
+static void esp_cloud_app_msg_json_discard(char *buf, void *priv)
+{
+}
+
+esp_err_t esp_cloud_app_msg_encode(const esp_cloud_app_msg_desc_t *desc, const char *device_id, int val,
+        const char *msg, esp_cloud_app_encoding_t encoding, void *buf, size_t buf_size, size_t *len)
+{
+    if (!desc || !device_id || !buf || !len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (encoding != ESP_CLOUD_APP_ENCODING_CBOR) {
+        json_str_t jstr;
+        json_str_start(&jstr, buf, buf_size, esp_cloud_app_msg_json_discard, NULL);
+        esp_cloud_app_msg_build_json(&jstr, desc, device_id, val, msg);
+        *len = json_str_get_len(&jstr);
+        json_str_end(&jstr);
+        /* One byte is required for the NULL termination */
+        return (*len < buf_size) ? ESP_OK : ESP_ERR_INVALID_SIZE;
+    }
+    esp_cloud_cbor_writer_t w;
+    esp_cloud_cbor_writer_init(&w, buf, buf_size);
+    esp_cloud_app_msg_build_cbor(&w, desc, device_id, val, msg);
+    /* The length is counted even on overflow */
+    *len = w.len;
+    return w.overflow ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+esp_err_t esp_cloud_app_msg_init(esp_cloud_internal_handle_t *handle)
+{
+    handle->app_tx_buf = esp_cloud_mem_malloc(ESP_CLOUD_APP_TX_BUF_SIZE);
+    if (!handle->app_tx_buf) {
+        ESP_LOGE(TAG, "Failed to allocate the app message buffer");
+        return ESP_ERR_NO_MEM;
+    }
+    handle->app_tx_lock = xSemaphoreCreateRecursiveMutex();
+    if (!handle->app_tx_lock) {
+        free(handle->app_tx_buf);
+        handle->app_tx_buf = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_cloud_app_msg_send(esp_cloud_internal_handle_t *handle, esp_cloud_app_msg_id_t id,
+        int val, const char *msg)
+{
+    const esp_cloud_app_msg_desc_t *desc = esp_cloud_app_msg_get_desc(id);
+    if (!handle || !desc) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const char *app_topic = esp_cloud_topic_get(handle, ESP_CLOUD_TOPIC_APP);
+    if (!app_topic) {
+        ESP_LOGE(TAG, "app_topic: fail");
+        return ESP_FAIL;
+    }
+    /* The buffer is free again once the message is published, or copied to the publish queue */
+    xSemaphoreTakeRecursive(handle->app_tx_lock, portMAX_DELAY);
+    size_t len;
+    esp_err_t err = esp_cloud_app_msg_encode(desc, handle->device_id, val, msg, handle->app_encoding,
+            handle->app_tx_buf, ESP_CLOUD_APP_TX_BUF_SIZE, &len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to encode %s, %d bytes required", desc->cmd, (int)len);
+    } else if (desc->async) {
+        err = esp_cloud_publish_data_async(handle, app_topic, handle->app_tx_buf, len, desc->msg_class, NULL, NULL);
+    } else {
+        err = esp_cloud_platform_publish_data(handle, app_topic, handle->app_tx_buf, len, desc->msg_class);
+    }
+    xSemaphoreGiveRecursive(handle->app_tx_lock);
+    return err;
+}
+
+static esp_err_t esp_cloud_app_cmd_decode_json(const char *payload, size_t payload_len, esp_cloud_app_cmd_t *cmd)
+{
+    jparse_ctx_t jctx;
+    json_tok_t tokens[APP_CMD_JSON_TOKENS];
+    if (json_parse_start_static(&jctx, payload, payload_len, tokens, APP_CMD_JSON_TOKENS) != 0) {
+        return ESP_FAIL;
+    }
+    esp_cloud_app_str_t source;
+    esp_cloud_app_str_t *strs[] = {
+        &cmd->cmd, &source, &cmd->device_id, &cmd->redirect_uri,
+        &cmd->auth_code, &cmd->client_id, &cmd->ota_url, &cmd->ota_version,
+    };
+    json_strptr_t strptrs[sizeof(strs) / sizeof(strs[0])];
+    /* The string fields are in the same order as strs[] */
+    const json_field_t fields[] = {
+        {"cmd", JSON_FIELD_STRPTR, &strptrs[0]},
+        {"source", JSON_FIELD_STRPTR, &strptrs[1]},
+        /* The app sends the device id with this spelling */
+        {"data.devcice_id", JSON_FIELD_STRPTR, &strptrs[2]},
+        {"data.redirect_uri", JSON_FIELD_STRPTR, &strptrs[3]},
+        {"data.auth_code", JSON_FIELD_STRPTR, &strptrs[4]},
+        {"data.client_id", JSON_FIELD_STRPTR, &strptrs[5]},
+        {"data.ota_url", JSON_FIELD_STRPTR, &strptrs[6]},
+        {"data.ota_version", JSON_FIELD_STRPTR, &strptrs[7]},
+        {"data.ota_size", JSON_FIELD_INT, &cmd->ota_size},
+    };
+    uint32_t present;
+    json_obj_get_fields(&jctx, fields, sizeof(fields) / sizeof(fields[0]), &present);
+    json_parse_end(&jctx);
+
+    size_t i;
+    for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+        if (present & (1 << i)) {
+            strs[i]->str = strptrs[i].str;
+            strs[i]->len = strptrs[i].len;
+        } else {
+            strs[i]->str = NULL;
+        }
+    }
+    cmd->from_device = esp_cloud_app_str_equals(&source, "device");
+    return ESP_OK;
+}
+
+#ifdef CONFIG_ESP_CLOUD_APP_MSG_CBOR
+static int esp_cloud_app_cbor_get_str(esp_cloud_cbor_reader_t *r, esp_cloud_app_str_t *app_str)
+{
+    return esp_cloud_cbor_get_text(r, &app_str->str, &app_str->len);
+}
+
+static int esp_cloud_app_cbor_decode_data(esp_cloud_cbor_reader_t *r, esp_cloud_app_cmd_t *cmd)
+{
+    size_t pairs;
+    if (esp_cloud_cbor_get_map(r, &pairs) != 0) {
+        return -1;
+    }
+    while (pairs--) {
+        uint64_t key;
+        int64_t val;
+        int ret;
+        if (esp_cloud_cbor_get_uint(r, &key) != 0) {
+            /* Keys from newer versions of the app may not be integers */
+            if (esp_cloud_cbor_skip(r) != 0) {
+                return -1;
+            }
+            key = UINT64_MAX;
+        }
+        switch (key) {
+            case ESP_CLOUD_APP_KEY_DEVICE_ID:
+                ret = esp_cloud_app_cbor_get_str(r, &cmd->device_id);
+                break;
+            case ESP_CLOUD_APP_KEY_REDIRECT_URI:
+                ret = esp_cloud_app_cbor_get_str(r, &cmd->redirect_uri);
+                break;
+            case ESP_CLOUD_APP_KEY_AUTH_CODE:
+                ret = esp_cloud_app_cbor_get_str(r, &cmd->auth_code);
+                break;
+            case ESP_CLOUD_APP_KEY_CLIENT_ID:
+                ret = esp_cloud_app_cbor_get_str(r, &cmd->client_id);
+                break;
+            case ESP_CLOUD_APP_KEY_OTA_URL:
+                ret = esp_cloud_app_cbor_get_str(r, &cmd->ota_url);
+                break;
+            case ESP_CLOUD_APP_KEY_OTA_VERSION:
+                ret = esp_cloud_app_cbor_get_str(r, &cmd->ota_version);
+                break;
+            case ESP_CLOUD_APP_KEY_OTA_SIZE:
+                ret = esp_cloud_cbor_get_int(r, &val);
+                if (ret == 0 && (val < 0 || val > INT32_MAX)) {
+                    ret = -1;
+                }
+                cmd->ota_size = val;
+                break;
+            default:
+                ret = esp_cloud_cbor_skip(r);
+                break;
+        }
+        if (ret != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static esp_err_t esp_cloud_app_cmd_decode_cbor(const void *payload, size_t payload_len, esp_cloud_app_cmd_t *cmd)
+{
+    esp_cloud_cbor_reader_t r;
+    size_t pairs;
+    esp_cloud_cbor_reader_init(&r, payload, payload_len);
+    if (esp_cloud_cbor_get_map(&r, &pairs) != 0) {
+        return ESP_FAIL;
+    }
+    while (pairs--) {
+        uint64_t key;
+        int ret;
+        if (esp_cloud_cbor_get_uint(&r, &key) != 0) {
+            if (esp_cloud_cbor_skip(&r) != 0) {
+                return ESP_FAIL;
+            }
+            key = UINT64_MAX;
+        }
+        switch (key) {
+            case ESP_CLOUD_APP_KEY_CMD:
+                ret = esp_cloud_app_cbor_get_str(&r, &cmd->cmd);
+                break;
+            case ESP_CLOUD_APP_KEY_SOURCE: {
+                uint64_t source;
+                ret = esp_cloud_cbor_get_uint(&r, &source);
+                cmd->from_device = (ret == 0 && source == ESP_CLOUD_APP_SOURCE_DEVICE);
+                break;
+            }
+            case ESP_CLOUD_APP_KEY_DATA:
+                ret = esp_cloud_app_cbor_decode_data(&r, cmd);
+                break;
+            default:
+                ret = esp_cloud_cbor_skip(&r);
+                break;
+        }
+        if (ret != 0) {
+            ESP_LOGE(TAG, "Malformed CBOR command");
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+#endif /* CONFIG_ESP_CLOUD_APP_MSG_CBOR */
+
+esp_err_t esp_cloud_app_cmd_decode(const void *payload, size_t payload_len, esp_cloud_app_cmd_t *cmd)
+{
+    if (!payload || !payload_len || !cmd) {
+        return ESP_FAIL;
+    }
+    memset(cmd, 0, sizeof(esp_cloud_app_cmd_t));
+    uint8_t first = *(const uint8_t *)payload;
+    /* A JSON object starts with '{' or whitespace, while a CBOR map is 0xa0 to 0xbf */
+    if ((first & 0xe0) == 0xa0) {
+#ifdef CONFIG_ESP_CLOUD_APP_MSG_CBOR
+        cmd->encoding = ESP_CLOUD_APP_ENCODING_CBOR;
+        return esp_cloud_app_cmd_decode_cbor(payload, payload_len, cmd);
+#else
+        ESP_LOGW(TAG, "CBOR app messages are not enabled");
+        return ESP_ERR_NOT_SUPPORTED;
+#endif
+    }
+    cmd->encoding = ESP_CLOUD_APP_ENCODING_JSON;
+    return esp_cloud_app_cmd_decode_json(payload, payload_len, cmd);
+}
+
+bool esp_cloud_app_str_equals(const esp_cloud_app_str_t *app_str, const char *str)
+{
+    return app_str->str && (strlen(str) == app_str->len) && (strncmp(app_str->str, str, app_str->len) == 0);
+}
+
+esp_err_t esp_cloud_app_str_copy(const esp_cloud_app_str_t *app_str, char *buf, size_t buf_size)
+{
+    if (!app_str->str || app_str->len >= buf_size) {
+        return ESP_FAIL;
+    }
+    memcpy(buf, app_str->str, app_str->len);
+    buf[app_str->len] = '\0';
+    return ESP_OK;
+}
+
+char *esp_cloud_app_str_dup(const esp_cloud_app_str_t *app_str)
+{
+    if (!app_str->str) {
+        return NULL;
+    }
+    char *str = esp_cloud_mem_malloc(app_str->len + 1);
+    if (str) {
+        memcpy(str, app_str->str, app_str->len);
+        str[app_str->len] = '\0';
+    }
+    return str;
+}
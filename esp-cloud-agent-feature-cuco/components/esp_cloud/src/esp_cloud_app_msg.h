@@ -0,0 +1,148 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include <esp_cloud.h>
+#include "esp_cloud_internal.h"
+
+/* Messages on the "app_topic" are JSON, or CBOR once the app has sent a CBOR command.
+ *
+ * In CBOR, the JSON keys are replaced by the integer keys below. For example,
+ *     {"cmd":"alexa_res","source":"device","data":{"device_id":"<id>","code":200,"msg":"ok"}}
+ * is sent as
+ *     {0:"alexa_res",1:0,2:{0:"<id>",3:200,4:"ok"}}
+ * The integer value of a device message, which has a cmd specific name in JSON ("code",
+ * "ota_progress", "result"), always uses the "value" key.
+ */
+#define ESP_CLOUD_APP_KEY_CMD           0
+#define ESP_CLOUD_APP_KEY_SOURCE        1
+#define ESP_CLOUD_APP_KEY_DATA          2
+
+/* Keys in the data map */
+#define ESP_CLOUD_APP_KEY_DEVICE_ID     0
+#define ESP_CLOUD_APP_KEY_FUNC          1
+#define ESP_CLOUD_APP_KEY_VALUE         3
+#define ESP_CLOUD_APP_KEY_MSG           4
+#define ESP_CLOUD_APP_KEY_REDIRECT_URI  5
+#define ESP_CLOUD_APP_KEY_AUTH_CODE     6
+#define ESP_CLOUD_APP_KEY_CLIENT_ID     7
+#define ESP_CLOUD_APP_KEY_OTA_URL       8
+#define ESP_CLOUD_APP_KEY_OTA_SIZE      9
+#define ESP_CLOUD_APP_KEY_OTA_VERSION   10
+
+/* Values of the source key */
+#define ESP_CLOUD_APP_SOURCE_DEVICE     0
+#define ESP_CLOUD_APP_SOURCE_APP        1
+
+/* Messages sent to the app on the "app_topic". The layout of each one is described by an entry
+ * in the table in esp_cloud_app_msg.c.
+ */
+typedef enum {
+    ESP_CLOUD_APP_MSG_BIND = 0,
+    ESP_CLOUD_APP_MSG_OTA_PROGRESS,
+    ESP_CLOUD_APP_MSG_OTA_RESULT,
+    ESP_CLOUD_APP_MSG_ALEXA_RES,
+    ESP_CLOUD_APP_MSG_ALEXA_UNBIND_RES,
+    ESP_CLOUD_APP_MSG_MAX,
+} esp_cloud_app_msg_id_t;
+
+/* Types of the fields in the data of a message, after the device id */
+typedef enum {
+    /* End of the field list */
+    ESP_CLOUD_APP_FIELD_END = 0,
+    /* String fixed by the message descriptor */
+    ESP_CLOUD_APP_FIELD_CONST,
+    /* The integer value passed while sending */
+    ESP_CLOUD_APP_FIELD_INT,
+    /* The string passed while sending. Not reported if it is NULL */
+    ESP_CLOUD_APP_FIELD_STR,
+} esp_cloud_app_field_type_t;
+
+typedef struct {
+    esp_cloud_app_field_type_t type;
+    /* Key in CBOR */
+    uint8_t key;
+    /* Key in JSON */
+    const char *name;
+    /* Value of an ESP_CLOUD_APP_FIELD_CONST field */
+    const char *val;
+} esp_cloud_app_field_t;
+
+#define ESP_CLOUD_APP_MSG_MAX_FIELDS    3
+
+typedef struct {
+    const char *cmd;
+    esp_cloud_msg_class_t msg_class;
+    /* Queued for the cloud task, instead of being published by the caller */
+    bool async;
+    esp_cloud_app_field_t fields[ESP_CLOUD_APP_MSG_MAX_FIELDS + 1];
+} esp_cloud_app_msg_desc_t;
+
+/* A string in a received message. It is not NULL terminated */
+typedef struct {
+    const char *str;
+    size_t len;
+} esp_cloud_app_str_t;
+
+/* Command received from the app on the "app_topic". The strings point into the received
+ * payload. Strings which are absent have a NULL str.
+ */
+typedef struct {
+    esp_cloud_app_encoding_t encoding;
+    /* Set for the messages sent by devices, which are also received on the topic */
+    bool from_device;
+    esp_cloud_app_str_t cmd;
+    esp_cloud_app_str_t device_id;
+    esp_cloud_app_str_t redirect_uri;
+    esp_cloud_app_str_t auth_code;
+    esp_cloud_app_str_t client_id;
+    esp_cloud_app_str_t ota_url;
+    esp_cloud_app_str_t ota_version;
+    int ota_size;
+} esp_cloud_app_cmd_t;
+
+/* The descriptor of a message, or NULL for an invalid id */
+const esp_cloud_app_msg_desc_t *esp_cloud_app_msg_get_desc(esp_cloud_app_msg_id_t id);
+
+/* Encode a message into buf, in a single pass. A JSON message is NULL terminated, but the
+ * NULL character is not counted in len. Returns ESP_ERR_INVALID_SIZE if it does not fit.
+ */
+esp_err_t esp_cloud_app_msg_encode(const esp_cloud_app_msg_desc_t *desc, const char *device_id, int val,
+        const char *msg, esp_cloud_app_encoding_t encoding, void *buf, size_t buf_size, size_t *len);
+
+/* Allocate the buffer shared by all the messages sent to the app */
+esp_err_t esp_cloud_app_msg_init(esp_cloud_internal_handle_t *handle);
+
+/* Encode a message in the encoding of the last command from the app, and publish it on the
+ * app topic as per its descriptor. Can be called from any task. Callers holding app_tx_lock
+ * (a recursive mutex) can send messages in a fixed order with respect to other tasks.
+ */
+esp_err_t esp_cloud_app_msg_send(esp_cloud_internal_handle_t *handle, esp_cloud_app_msg_id_t id,
+        int val, const char *msg);
+
+/* Decode a command, detecting its encoding from the first byte */
+esp_err_t esp_cloud_app_cmd_decode(const void *payload, size_t payload_len, esp_cloud_app_cmd_t *cmd);
+
+/* Compare a received string with a NULL terminated string */
+bool esp_cloud_app_str_equals(const esp_cloud_app_str_t *app_str, const char *str);
+
+/* Copy a received string to buf, with NULL termination. Fails if it is absent or does not fit */
+esp_err_t esp_cloud_app_str_copy(const esp_cloud_app_str_t *app_str, char *buf, size_t buf_size);
+
+/* Allocate a NULL terminated copy of a received string, for strings without a length limit.
+ * Returns NULL if it is absent or on allocation failure. The copy is released with free().
+ */
+char *esp_cloud_app_str_dup(const esp_cloud_app_str_t *app_str);
@@ -0,0 +1,306 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string.h>
+#include "esp_cloud_cbor.h"
+
+#define CBOR_MAJOR_UINT     0
+#define CBOR_MAJOR_NINT     1
+#define CBOR_MAJOR_BYTES    2
+#define CBOR_MAJOR_TEXT     3
+#define CBOR_MAJOR_ARRAY    4
+#define CBOR_MAJOR_MAP      5
+#define CBOR_MAJOR_TAG      6
+#define CBOR_MAJOR_SIMPLE   7
+
+#define CBOR_SIMPLE_FALSE   20
+#define CBOR_SIMPLE_TRUE    21
+
+/* Nesting limit while skipping items */
+#define CBOR_MAX_DEPTH      16
+
+void esp_cloud_cbor_writer_init(esp_cloud_cbor_writer_t *w, uint8_t *buf, size_t size)
+{
+    w->buf = buf;
+    w->size = buf ? size : 0;
+    w->len = 0;
+    w->overflow = false;
+}
+
+int esp_cloud_cbor_writer_get_len(esp_cloud_cbor_writer_t *w)
+{
+    if (w->overflow) {
+        return -1;
+    }
+    return w->len;
+}
+
+static void cbor_put_bytes(esp_cloud_cbor_writer_t *w, const void *data, size_t len)
+{
+    if (w->buf) {
+        if (w->len + len > w->size) {
+            w->overflow = true;
+        } else {
+            memcpy(w->buf + w->len, data, len);
+        }
+    }
+    w->len += len;
+}
+
+/* Writes the initial byte, with the argument in the shortest form */
+static void cbor_put_head(esp_cloud_cbor_writer_t *w, uint8_t major, uint64_t val)
+{
+    uint8_t head[9];
+    size_t len, i;
+    if (val < 24) {
+        head[0] = (major << 5) | val;
+        len = 1;
+    } else {
+        if (val <= 0xff) {
+            head[0] = (major << 5) | 24;
+            len = 2;
+        } else if (val <= 0xffff) {
+            head[0] = (major << 5) | 25;
+            len = 3;
+        } else if (val <= 0xffffffff) {
+            head[0] = (major << 5) | 26;
+            len = 5;
+        } else {
+            head[0] = (major << 5) | 27;
+            len = 9;
+        }
+        for (i = len - 1; i > 0; i--) {
+            head[i] = val & 0xff;
+            val >>= 8;
+        }
+    }
+    cbor_put_bytes(w, head, len);
+}
+
+void esp_cloud_cbor_put_map(esp_cloud_cbor_writer_t *w, size_t pairs)
+{
+    cbor_put_head(w, CBOR_MAJOR_MAP, pairs);
+}
+
+void esp_cloud_cbor_put_array(esp_cloud_cbor_writer_t *w, size_t items)
+{
+    cbor_put_head(w, CBOR_MAJOR_ARRAY, items);
+}
+
+void esp_cloud_cbor_put_uint(esp_cloud_cbor_writer_t *w, uint64_t val)
+{
+    cbor_put_head(w, CBOR_MAJOR_UINT, val);
+}
+
+void esp_cloud_cbor_put_int(esp_cloud_cbor_writer_t *w, int64_t val)
+{
+    if (val < 0) {
+        /* -1 - val, without overflowing for INT64_MIN */
+        cbor_put_head(w, CBOR_MAJOR_NINT, ~(uint64_t)val);
+    } else {
+        cbor_put_head(w, CBOR_MAJOR_UINT, val);
+    }
+}
+
+void esp_cloud_cbor_put_text(esp_cloud_cbor_writer_t *w, const char *str, size_t len)
+{
+    cbor_put_head(w, CBOR_MAJOR_TEXT, len);
+    cbor_put_bytes(w, str, len);
+}
+
+void esp_cloud_cbor_put_bool(esp_cloud_cbor_writer_t *w, bool val)
+{
+    cbor_put_head(w, CBOR_MAJOR_SIMPLE, val ? CBOR_SIMPLE_TRUE : CBOR_SIMPLE_FALSE);
+}
+
+void esp_cloud_cbor_reader_init(esp_cloud_cbor_reader_t *r, const void *data, size_t len)
+{
+    r->p = data;
+    r->end = r->p + len;
+}
+
+/* Decodes the head of the next item, without consuming it. Returns its length, or 0 if
+ * the item is malformed, truncated or uses an indefinite length.
+ */
+static size_t cbor_get_head(esp_cloud_cbor_reader_t *r, uint8_t *major, uint64_t *val)
+{
+    if (r->p >= r->end) {
+        return 0;
+    }
+    uint8_t info = r->p[0] & 0x1f;
+    size_t len, i;
+    *major = r->p[0] >> 5;
+    if (info < 24) {
+        *val = info;
+        return 1;
+    } else if (info <= 27) {
+        len = 1 + (1 << (info - 24));
+    } else {
+        return 0;
+    }
+    if ((size_t)(r->end - r->p) < len) {
+        return 0;
+    }
+    *val = 0;
+    for (i = 1; i < len; i++) {
+        *val = (*val << 8) | r->p[i];
+    }
+    return len;
+}
+
+esp_cloud_cbor_type_t esp_cloud_cbor_peek_type(esp_cloud_cbor_reader_t *r)
+{
+    uint8_t major;
+    uint64_t val;
+    if (!cbor_get_head(r, &major, &val)) {
+        return ESP_CLOUD_CBOR_TYPE_INVALID;
+    }
+    return ESP_CLOUD_CBOR_TYPE_UINT + major;
+}
+
+static int cbor_get_container(esp_cloud_cbor_reader_t *r, uint8_t expected, size_t *count)
+{
+    uint8_t major;
+    uint64_t val;
+    size_t len = cbor_get_head(r, &major, &val);
+    if (!len || major != expected || val > SIZE_MAX) {
+        return -1;
+    }
+    *count = val;
+    r->p += len;
+    return 0;
+}
+
+int esp_cloud_cbor_get_map(esp_cloud_cbor_reader_t *r, size_t *pairs)
+{
+    return cbor_get_container(r, CBOR_MAJOR_MAP, pairs);
+}
+
+int esp_cloud_cbor_get_array(esp_cloud_cbor_reader_t *r, size_t *items)
+{
+    return cbor_get_container(r, CBOR_MAJOR_ARRAY, items);
+}
+
+int esp_cloud_cbor_get_uint(esp_cloud_cbor_reader_t *r, uint64_t *val)
+{
+    uint8_t major;
+    size_t len = cbor_get_head(r, &major, val);
+    if (!len || major != CBOR_MAJOR_UINT) {
+        return -1;
+    }
+    r->p += len;
+    return 0;
+}
+
+int esp_cloud_cbor_get_int(esp_cloud_cbor_reader_t *r, int64_t *val)
+{
+    uint8_t major;
+    uint64_t arg;
+    size_t len = cbor_get_head(r, &major, &arg);
+    if (!len || arg > INT64_MAX) {
+        return -1;
+    }
+    if (major == CBOR_MAJOR_UINT) {
+        *val = arg;
+    } else if (major == CBOR_MAJOR_NINT) {
+        *val = -1 - (int64_t)arg;
+    } else {
+        return -1;
+    }
+    r->p += len;
+    return 0;
+}
+
+int esp_cloud_cbor_get_text(esp_cloud_cbor_reader_t *r, const char **str, size_t *str_len)
+{
+    uint8_t major;
+    uint64_t val;
+    size_t len = cbor_get_head(r, &major, &val);
+    if (!len || major != CBOR_MAJOR_TEXT || val > (uint64_t)(r->end - r->p - len)) {
+        return -1;
+    }
+    *str = (const char *)r->p + len;
+    *str_len = val;
+    r->p += len + val;
+    return 0;
+}
+
+int esp_cloud_cbor_get_bool(esp_cloud_cbor_reader_t *r, bool *val)
+{
+    uint8_t major;
+    uint64_t arg;
+    size_t len = cbor_get_head(r, &major, &arg);
+    if (len != 1 || major != CBOR_MAJOR_SIMPLE ||
+            (arg != CBOR_SIMPLE_FALSE && arg != CBOR_SIMPLE_TRUE)) {
+        return -1;
+    }
+    *val = (arg == CBOR_SIMPLE_TRUE);
+    r->p += len;
+    return 0;
+}
+
+int esp_cloud_cbor_skip(esp_cloud_cbor_reader_t *r)
+{
+    /* Number of items still to be skipped at each nesting level */
+    uint64_t remaining[CBOR_MAX_DEPTH];
+    int depth = 0;
+    const uint8_t *start = r->p;
+    remaining[0] = 1;
+    while (depth >= 0) {
+        if (remaining[depth] == 0) {
+            depth--;
+            continue;
+        }
+        remaining[depth]--;
+        uint8_t major;
+        uint64_t val;
+        size_t len = cbor_get_head(r, &major, &val);
+        if (!len) {
+            goto fail;
+        }
+        r->p += len;
+        switch (major) {
+            case CBOR_MAJOR_BYTES:
+            case CBOR_MAJOR_TEXT:
+                if (val > (uint64_t)(r->end - r->p)) {
+                    goto fail;
+                }
+                r->p += val;
+                break;
+            case CBOR_MAJOR_ARRAY:
+            case CBOR_MAJOR_MAP:
+            case CBOR_MAJOR_TAG:
+                if (++depth >= CBOR_MAX_DEPTH) {
+                    goto fail;
+                }
+                if (major == CBOR_MAJOR_MAP) {
+                    /* Every item in a map is a key value pair */
+                    if (val > UINT64_MAX / 2) {
+                        goto fail;
+                    }
+                    val *= 2;
+                } else if (major == CBOR_MAJOR_TAG) {
+                    /* A tag is followed by the single item it applies to */
+                    val = 1;
+                }
+                remaining[depth] = val;
+                break;
+            default:
+                break;
+        }
+    }
+    return 0;
+fail:
+    r->p = start;
+    return -1;
+}
@@ -0,0 +1,71 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Minimal CBOR (RFC 7049) encoder and decoder for the compact app messages. Only the
+ * major types used by them are supported: unsigned and negative integers, text strings,
+ * definite length maps and arrays, and the simple values false, true and null.
+ */
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} esp_cloud_cbor_writer_t;
+
+/* With buf as NULL, nothing is written, but the length is still counted */
+void esp_cloud_cbor_writer_init(esp_cloud_cbor_writer_t *w, uint8_t *buf, size_t size);
+/* Length of the encoded data. -1 if the buffer was too small */
+int esp_cloud_cbor_writer_get_len(esp_cloud_cbor_writer_t *w);
+void esp_cloud_cbor_put_map(esp_cloud_cbor_writer_t *w, size_t pairs);
+void esp_cloud_cbor_put_array(esp_cloud_cbor_writer_t *w, size_t items);
+void esp_cloud_cbor_put_uint(esp_cloud_cbor_writer_t *w, uint64_t val);
+void esp_cloud_cbor_put_int(esp_cloud_cbor_writer_t *w, int64_t val);
+void esp_cloud_cbor_put_text(esp_cloud_cbor_writer_t *w, const char *str, size_t len);
+void esp_cloud_cbor_put_bool(esp_cloud_cbor_writer_t *w, bool val);
+
+typedef enum {
+    ESP_CLOUD_CBOR_TYPE_INVALID = 0,
+    ESP_CLOUD_CBOR_TYPE_UINT,
+    ESP_CLOUD_CBOR_TYPE_NINT,
+    ESP_CLOUD_CBOR_TYPE_BYTES,
+    ESP_CLOUD_CBOR_TYPE_TEXT,
+    ESP_CLOUD_CBOR_TYPE_ARRAY,
+    ESP_CLOUD_CBOR_TYPE_MAP,
+    ESP_CLOUD_CBOR_TYPE_TAG,
+    ESP_CLOUD_CBOR_TYPE_SIMPLE,
+} esp_cloud_cbor_type_t;
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} esp_cloud_cbor_reader_t;
+
+void esp_cloud_cbor_reader_init(esp_cloud_cbor_reader_t *r, const void *data, size_t len);
+/* Type of the next item, without consuming it */
+esp_cloud_cbor_type_t esp_cloud_cbor_peek_type(esp_cloud_cbor_reader_t *r);
+/* The readers below return 0 on success and consume the item. On failure, nothing is consumed */
+int esp_cloud_cbor_get_map(esp_cloud_cbor_reader_t *r, size_t *pairs);
+int esp_cloud_cbor_get_array(esp_cloud_cbor_reader_t *r, size_t *items);
+int esp_cloud_cbor_get_uint(esp_cloud_cbor_reader_t *r, uint64_t *val);
+int esp_cloud_cbor_get_int(esp_cloud_cbor_reader_t *r, int64_t *val);
+/* str points into the data being read and is not NULL terminated */
+int esp_cloud_cbor_get_text(esp_cloud_cbor_reader_t *r, const char **str, size_t *len);
+int esp_cloud_cbor_get_bool(esp_cloud_cbor_reader_t *r, bool *val);
+/* Skip the next item, including everything nested in it */
+int esp_cloud_cbor_skip(esp_cloud_cbor_reader_t *r);
@@ -15,6 +15,9 @@
 #include <stdint.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <json_generator.h>
 
 typedef struct {
     uint8_t flags;
@@ -30,6 +33,25 @@ typedef struct {
     esp_cloud_param_val_t val;
 } esp_cloud_static_param_t;
 
+/* Encoding of the messages on the "app_topic" */
+typedef enum {
+    ESP_CLOUD_APP_ENCODING_JSON = 0,
+    ESP_CLOUD_APP_ENCODING_CBOR,
+} esp_cloud_app_encoding_t;
+
+/* Topics used by the agent. See esp_cloud_topics.h */
+typedef enum {
+    ESP_CLOUD_TOPIC_DEVICE_INFO,
+    ESP_CLOUD_TOPIC_USER_MAPPING,
+    ESP_CLOUD_TOPIC_DIAGNOSTICS,
+    ESP_CLOUD_TOPIC_OTA_URL,
+    ESP_CLOUD_TOPIC_OTA_FETCH,
+    ESP_CLOUD_TOPIC_OTA_STATUS,
+    /* Topic for the messages to and from the phone app */
+    ESP_CLOUD_TOPIC_APP,
+    ESP_CLOUD_TOPIC_MAX,
+} esp_cloud_topic_id_t;
+
 /* Handle to maintain internal information (will move to an internal file) */
 typedef struct {
     char *device_id;
@@ -42,9 +64,28 @@ typedef struct {
     uint8_t cur_static_params_count;
     esp_cloud_static_param_t *static_cloud_params;
     uint16_t reconnect_attempts;
+    const struct esp_cloud_transport *transport;
     void *cloud_platform_priv;
     bool cloud_stop;
+    TaskHandle_t cloud_task;
+    /* Available while the cloud task is not running. See esp_cloud_stop() */
+    SemaphoreHandle_t cloud_task_done;
     QueueHandle_t work_queue;
+    struct esp_cloud_publish_queue *publish_queue;
+    esp_cloud_msg_policy_t msg_policies[ESP_CLOUD_MSG_CLASS_MAX];
+    /* Encoding of the last command from the app, used for the messages sent to it */
+    esp_cloud_app_encoding_t app_encoding;
+    char *topic_buf;
+    const char *topics[ESP_CLOUD_TOPIC_MAX];
+    /* Buffer shared by the messages sent to the app. See esp_cloud_app_msg_send() */
+    SemaphoreHandle_t app_tx_lock;
+    uint8_t *app_tx_buf;
+    /* Latest OTA progress waiting to be reported by the cloud task, or -1.
+     * See ota_report_progress_val_info()
+     */
+    int ota_progress_pending;
+    bool ota_progress_started;
+    TickType_t ota_progress_reported_at;
 } esp_cloud_internal_handle_t;
 
 typedef struct {
@@ -52,6 +93,14 @@ typedef struct {
     void *priv_data;
 } esp_cloud_work_queue_entry_t;
 
+/* Builds a JSON string. Called between json_str_start() and json_str_end(), so it
+ * should only add the actual JSON elements.
+ */
+typedef void (*esp_cloud_json_build_fn_t)(json_str_t *jstr, void *priv_data);
+
 esp_cloud_dynamic_param_t *esp_cloud_get_dynamic_param_by_name(const char *name);
+/* Policy of a message class. Falls back to the default class for invalid classes */
+const esp_cloud_msg_policy_t *esp_cloud_msg_policy_get(esp_cloud_internal_handle_t *handle, esp_cloud_msg_class_t msg_class);
+char *esp_cloud_json_build(esp_cloud_json_build_fn_t build_fn, void *priv_data);
 #define CLOUD_PARAM_FLAG_LOCAL_CHANGE   0x01
 #define CLOUD_PARAM_FLAG_REMOTE_CHANGE  0x02
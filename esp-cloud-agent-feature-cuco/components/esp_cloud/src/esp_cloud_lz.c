@@ -0,0 +1,134 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string.h>
+#include "esp_cloud_lz.h"
+
+#define LZ_WINDOW_SIZE      (1 << ESP_CLOUD_LZ_WINDOW_BITS)
+#define LZ_MAX_MATCH        (1 << ESP_CLOUD_LZ_LOOKAHEAD_BITS)
+/* Shorter back references take more bits than the literals */
+#define LZ_MIN_MATCH        ((1 + ESP_CLOUD_LZ_WINDOW_BITS + ESP_CLOUD_LZ_LOOKAHEAD_BITS) / 8 + 1)
+
+void esp_cloud_lz_encoder_init(esp_cloud_lz_encoder_t *enc, esp_cloud_lz_write_fn_t write_fn, void *priv_data)
+{
+    enc->hist_len = 0;
+    enc->in_len = 0;
+    enc->out_byte = 0;
+    enc->out_bits = 0;
+    enc->err = ESP_OK;
+    enc->write_fn = write_fn;
+    enc->priv_data = priv_data;
+}
+
+static void lz_put_bits(esp_cloud_lz_encoder_t *enc, uint32_t val, int count)
+{
+    while (count--) {
+        enc->out_byte = (enc->out_byte << 1) | ((val >> count) & 1);
+        if (++enc->out_bits == 8) {
+            if (enc->err == ESP_OK && enc->write_fn(&enc->out_byte, 1, enc->priv_data) != 1) {
+                enc->err = ESP_ERR_NO_MEM;
+            }
+            enc->out_byte = 0;
+            enc->out_bits = 0;
+        }
+    }
+}
+
+/* Longest match for the input at pos, within the window before it. Matches may overlap
+ * pos, since the decoder copies a byte at a time.
+ */
+static size_t lz_find_match(const uint8_t *buf, size_t pos, size_t end, size_t *distance)
+{
+    size_t max_len = end - pos;
+    size_t best_len = 0;
+    size_t start = (pos > LZ_WINDOW_SIZE) ? pos - LZ_WINDOW_SIZE : 0;
+    size_t i;
+    if (max_len > LZ_MAX_MATCH) {
+        max_len = LZ_MAX_MATCH;
+    }
+    if (max_len < LZ_MIN_MATCH) {
+        return 0;
+    }
+    /* Nearest first, so that ties use the nearest match */
+    for (i = pos; i-- > start; ) {
+        /* Cheap check of the byte which would make this the best match so far */
+        if (buf[i + best_len] != buf[pos + best_len] || buf[i] != buf[pos]) {
+            continue;
+        }
+        size_t len = 1;
+        while (len < max_len && buf[i + len] == buf[pos + len]) {
+            len++;
+        }
+        if (len > best_len) {
+            best_len = len;
+            *distance = pos - i;
+            if (len == max_len) {
+                break;
+            }
+        }
+    }
+    return (best_len >= LZ_MIN_MATCH) ? best_len : 0;
+}
+
+/* Compress all the input in the buffer and make the most recent window the history */
+static void lz_compress_input(esp_cloud_lz_encoder_t *enc)
+{
+    size_t pos = enc->hist_len;
+    size_t end = enc->hist_len + enc->in_len;
+    while (pos < end) {
+        size_t distance = 0;
+        size_t len = lz_find_match(enc->buf, pos, end, &distance);
+        if (len) {
+            lz_put_bits(enc, 0, 1);
+            lz_put_bits(enc, distance - 1, ESP_CLOUD_LZ_WINDOW_BITS);
+            lz_put_bits(enc, len - 1, ESP_CLOUD_LZ_LOOKAHEAD_BITS);
+            pos += len;
+        } else {
+            lz_put_bits(enc, 1, 1);
+            lz_put_bits(enc, enc->buf[pos], 8);
+            pos++;
+        }
+    }
+    if (end > LZ_WINDOW_SIZE) {
+        memmove(enc->buf, enc->buf + end - LZ_WINDOW_SIZE, LZ_WINDOW_SIZE);
+        end = LZ_WINDOW_SIZE;
+    }
+    enc->hist_len = end;
+    enc->in_len = 0;
+}
+
+esp_err_t esp_cloud_lz_encoder_feed(esp_cloud_lz_encoder_t *enc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len && enc->err == ESP_OK) {
+        size_t room = sizeof(enc->buf) - enc->hist_len - enc->in_len;
+        size_t n = (len < room) ? len : room;
+        memcpy(enc->buf + enc->hist_len + enc->in_len, p, n);
+        enc->in_len += n;
+        p += n;
+        len -= n;
+        if (enc->hist_len + enc->in_len == sizeof(enc->buf)) {
+            lz_compress_input(enc);
+        }
+    }
+    return enc->err;
+}
+
+esp_err_t esp_cloud_lz_encoder_finish(esp_cloud_lz_encoder_t *enc)
+{
+    lz_compress_input(enc);
+    if (enc->out_bits) {
+        lz_put_bits(enc, 0, 8 - enc->out_bits);
+    }
+    return enc->err;
+}
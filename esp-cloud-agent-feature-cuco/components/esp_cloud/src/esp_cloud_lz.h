@@ -0,0 +1,56 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sdkconfig.h>
+#include <esp_err.h>
+
+/* Streaming LZSS compressor, producing the heatshrink bit stream, so that the data can
+ * be decompressed by any heatshrink decoder configured with the same window and lookahead.
+ *
+ * The stream is a sequence of
+ *     1 <8 bit literal>
+ *     0 <WINDOW_BITS bit distance - 1> <LOOKAHEAD_BITS bit length - 1>
+ * with the bits packed MSB first and the last byte padded with 0s.
+ *
+ * The working memory is the encoder structure, which is a little over 2 << WINDOW_BITS bytes.
+ */
+#ifdef CONFIG_ESP_CLOUD_DIAG_COMPRESSION_WINDOW_BITS
+#define ESP_CLOUD_LZ_WINDOW_BITS    CONFIG_ESP_CLOUD_DIAG_COMPRESSION_WINDOW_BITS
+#else
+#define ESP_CLOUD_LZ_WINDOW_BITS    8
+#endif
+#define ESP_CLOUD_LZ_LOOKAHEAD_BITS 4
+
+/* Returns the number of bytes written. Anything less than len aborts the compression */
+typedef size_t (*esp_cloud_lz_write_fn_t)(const uint8_t *data, size_t len, void *priv_data);
+
+typedef struct {
+    /* History (the window) followed by the input not yet compressed */
+    uint8_t buf[2 << ESP_CLOUD_LZ_WINDOW_BITS];
+    size_t hist_len;
+    size_t in_len;
+    uint8_t out_byte;
+    uint8_t out_bits;
+    esp_err_t err;
+    esp_cloud_lz_write_fn_t write_fn;
+    void *priv_data;
+} esp_cloud_lz_encoder_t;
+
+void esp_cloud_lz_encoder_init(esp_cloud_lz_encoder_t *enc, esp_cloud_lz_write_fn_t write_fn, void *priv_data);
+/* Compress data. It can be fed in any number of pieces */
+esp_err_t esp_cloud_lz_encoder_feed(esp_cloud_lz_encoder_t *enc, const void *data, size_t len);
+/* Compress the remaining input and flush the last byte */
+esp_err_t esp_cloud_lz_encoder_finish(esp_cloud_lz_encoder_t *enc);
@@ -0,0 +1,352 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string.h>
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+
+#include "esp_cloud_mem.h"
+#include "esp_cloud_platform.h"
+#include "esp_cloud_publish_queue.h"
+#include "esp_cloud_trace_points.h"
+
+static const char *TAG = "esp_cloud_publish";
+
+#ifdef CONFIG_ESP_CLOUD_PUBLISH_WINDOW
+#define PUBLISH_WINDOW          CONFIG_ESP_CLOUD_PUBLISH_WINDOW
+#else
+#define PUBLISH_WINDOW          4
+#endif
+#ifdef CONFIG_ESP_CLOUD_PUBLISH_QUEUE_SIZE
+#define PUBLISH_QUEUE_SIZE      CONFIG_ESP_CLOUD_PUBLISH_QUEUE_SIZE
+#else
+#define PUBLISH_QUEUE_SIZE      16
+#endif
+/* In-flight messages not acknowledged within this time are failed */
+#define PUBLISH_ACK_TIMEOUT_MS  30000
+
+/* The topic and data are stored right after this, in the same allocation */
+typedef struct {
+    esp_cloud_msg_class_t msg_class;
+    esp_cloud_publish_cb_t cb;
+    void *priv_data;
+    char *topic;
+    void *data;
+    size_t data_len;
+} esp_cloud_publish_msg_t;
+
+typedef struct {
+    esp_cloud_publish_msg_t *msg;
+    int msg_id;
+    TickType_t sent_at;
+} esp_cloud_publish_slot_t;
+
+struct esp_cloud_publish_queue {
+    /* Messages of high priority have their own queue, which is drained first, so that the
+     * messages of each priority are sent in the order they were queued.
+     */
+    QueueHandle_t pending_high;
+    QueueHandle_t pending;
+    /* Recursive, since the platform may complete a message before its publish call returns */
+    SemaphoreHandle_t lock;
+    esp_cloud_publish_slot_t in_flight[PUBLISH_WINDOW];
+    esp_cloud_publish_stats_t stats;
+};
+
+static esp_cloud_publish_msg_t *esp_cloud_publish_msg_create(const char *topic, const void *data, size_t data_len,
+        esp_cloud_msg_class_t msg_class, esp_cloud_publish_cb_t cb, void *priv_data)
+{
+    size_t topic_len = strlen(topic) + 1;
+    esp_cloud_publish_msg_t *msg = esp_cloud_mem_malloc(sizeof(esp_cloud_publish_msg_t) + topic_len + data_len);
+    if (!msg) {
+        return NULL;
+    }
+    msg->msg_class = msg_class;
+    msg->cb = cb;
+    msg->priv_data = priv_data;
+    msg->topic = (char *)(msg + 1);
+    msg->data = msg->topic + topic_len;
+    msg->data_len = data_len;
+    memcpy(msg->topic, topic, topic_len);
+    memcpy(msg->data, data, data_len);
+    return msg;
+}
+
+static void esp_cloud_publish_msg_done(esp_cloud_publish_msg_t *msg, esp_err_t result)
+{
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG, "Publish to %s failed", msg->topic);
+    }
+    if (msg->cb) {
+        msg->cb(result, msg->priv_data);
+    }
+    free(msg);
+}
+
+esp_err_t esp_cloud_publish_queue_init(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || handle->publish_queue) {
+        return ESP_FAIL;
+    }
+    struct esp_cloud_publish_queue *queue = esp_cloud_mem_calloc(1, sizeof(struct esp_cloud_publish_queue));
+    if (!queue) {
+        return ESP_FAIL;
+    }
+    queue->pending_high = xQueueCreate(PUBLISH_QUEUE_SIZE, sizeof(esp_cloud_publish_msg_t *));
+    queue->pending = xQueueCreate(PUBLISH_QUEUE_SIZE, sizeof(esp_cloud_publish_msg_t *));
+    queue->lock = xSemaphoreCreateRecursiveMutex();
+    handle->publish_queue = queue;
+    if (!queue->pending_high || !queue->pending || !queue->lock) {
+        ESP_LOGE(TAG, "Publish Queue Creation Failed");
+        esp_cloud_publish_queue_deinit(handle);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void esp_cloud_publish_queue_deinit(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->publish_queue) {
+        return;
+    }
+    struct esp_cloud_publish_queue *queue = handle->publish_queue;
+    esp_cloud_publish_msg_t *msg;
+    int i;
+    for (i = 0; i < PUBLISH_WINDOW; i++) {
+        free(queue->in_flight[i].msg);
+    }
+    if (queue->pending_high) {
+        while (xQueueReceive(queue->pending_high, &msg, 0) == pdTRUE) {
+            free(msg);
+        }
+        vQueueDelete(queue->pending_high);
+    }
+    if (queue->pending) {
+        while (xQueueReceive(queue->pending, &msg, 0) == pdTRUE) {
+            free(msg);
+        }
+        vQueueDelete(queue->pending);
+    }
+    if (queue->lock) {
+        vSemaphoreDelete(queue->lock);
+    }
+    free(queue);
+    handle->publish_queue = NULL;
+}
+
+esp_err_t esp_cloud_publish_async(esp_cloud_internal_handle_t *handle, const char *topic, const char *data,
+        esp_cloud_msg_class_t msg_class, esp_cloud_publish_cb_t cb, void *priv_data)
+{
+    if (!data) {
+        return ESP_FAIL;
+    }
+    return esp_cloud_publish_data_async(handle, topic, data, strlen(data), msg_class, cb, priv_data);
+}
+
+esp_err_t esp_cloud_publish_data_async(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+        size_t data_len, esp_cloud_msg_class_t msg_class, esp_cloud_publish_cb_t cb, void *priv_data)
+{
+    if (!handle || !handle->publish_queue || !topic || !data) {
+        return ESP_FAIL;
+    }
+    struct esp_cloud_publish_queue *queue = handle->publish_queue;
+    esp_cloud_publish_msg_t *msg = esp_cloud_publish_msg_create(topic, data, data_len, msg_class, cb, priv_data);
+    if (!msg) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = ESP_OK;
+    QueueHandle_t pending = queue->pending;
+    if (esp_cloud_msg_policy_get(handle, msg_class)->priority == ESP_CLOUD_MSG_PRIORITY_HIGH) {
+        pending = queue->pending_high;
+    }
+    if (xQueueSendToBack(pending, &msg, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Publish queue full. Dropping message for %s", topic);
+        free(msg);
+        err = ESP_FAIL;
+    }
+    xSemaphoreTakeRecursive(queue->lock, portMAX_DELAY);
+    if (err == ESP_OK) {
+        queue->stats.queued++;
+    } else {
+        queue->stats.dropped++;
+    }
+    xSemaphoreGiveRecursive(queue->lock);
+    /* Else the message waits till the transport's wait times out. Once is enough till the
+     * queue is emptied, and so the wake ups do not pile up while the cloud task is stopped.
+     */
+    if (err == ESP_OK && uxQueueMessagesWaiting(queue->pending_high) + uxQueueMessagesWaiting(queue->pending) == 1) {
+        esp_cloud_platform_wake(handle);
+    }
+    return err;
+}
+
+static esp_cloud_publish_slot_t *esp_cloud_publish_get_free_slot(struct esp_cloud_publish_queue *queue)
+{
+    int i;
+    for (i = 0; i < PUBLISH_WINDOW; i++) {
+        if (!queue->in_flight[i].msg) {
+            return &queue->in_flight[i];
+        }
+    }
+    return NULL;
+}
+
+/* Detaches and returns the message of a slot. Should be called with the lock held */
+static esp_cloud_publish_msg_t *esp_cloud_publish_slot_release(struct esp_cloud_publish_queue *queue,
+        esp_cloud_publish_slot_t *slot, esp_err_t result)
+{
+    esp_cloud_publish_msg_t *msg = slot->msg;
+    slot->msg = NULL;
+    slot->msg_id = -1;
+    queue->stats.in_flight--;
+    if (result == ESP_OK) {
+        queue->stats.acked++;
+    } else {
+        queue->stats.failed++;
+    }
+    return msg;
+}
+
+static void esp_cloud_publish_check_timeouts(struct esp_cloud_publish_queue *queue)
+{
+    TickType_t now = xTaskGetTickCount();
+    int i;
+    for (i = 0; i < PUBLISH_WINDOW; i++) {
+        esp_cloud_publish_msg_t *msg = NULL;
+        xSemaphoreTakeRecursive(queue->lock, portMAX_DELAY);
+        esp_cloud_publish_slot_t *slot = &queue->in_flight[i];
+        if (slot->msg && (now - slot->sent_at) > pdMS_TO_TICKS(PUBLISH_ACK_TIMEOUT_MS)) {
+            msg = esp_cloud_publish_slot_release(queue, slot, ESP_ERR_TIMEOUT);
+        }
+        xSemaphoreGiveRecursive(queue->lock);
+        if (msg) {
+            esp_cloud_publish_msg_done(msg, ESP_ERR_TIMEOUT);
+        }
+    }
+}
+
+void esp_cloud_publish_queue_process(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->publish_queue) {
+        return;
+    }
+    struct esp_cloud_publish_queue *queue = handle->publish_queue;
+    esp_cloud_publish_check_timeouts(queue);
+    while (1) {
+        xSemaphoreTakeRecursive(queue->lock, portMAX_DELAY);
+        esp_cloud_publish_slot_t *slot = esp_cloud_publish_get_free_slot(queue);
+        esp_cloud_publish_msg_t *msg = NULL;
+        if (!slot || (xQueueReceive(queue->pending_high, &msg, 0) != pdTRUE &&
+                    xQueueReceive(queue->pending, &msg, 0) != pdTRUE)) {
+            xSemaphoreGiveRecursive(queue->lock);
+            return;
+        }
+        slot->msg = msg;
+        slot->msg_id = -1;
+        slot->sent_at = xTaskGetTickCount();
+        queue->stats.sent++;
+        queue->stats.in_flight++;
+        if (queue->stats.in_flight > queue->stats.max_in_flight) {
+            queue->stats.max_in_flight = queue->stats.in_flight;
+        }
+        /* The lock is held so that an acknowledgement from another task cannot look for the
+         * slot before the platform has set its msg_id.
+         */
+        uint8_t qos = esp_cloud_msg_policy_get(handle, msg->msg_class)->qos;
+        esp_err_t err = esp_cloud_platform_publish_async(handle, msg->topic, msg->data, msg->data_len,
+                msg->msg_class, &slot->msg_id);
+        /* A QoS0 message gets no PUBACK, so it is complete once sent. This goes by the slot,
+         * as QoS0 messages need not have distinct ids.
+         */
+        bool done = (err != ESP_OK || qos == 0);
+        if (done && slot->msg == msg) {
+            esp_cloud_publish_slot_release(queue, slot, err);
+        } else {
+            /* Waiting for the PUBACK, or already completed by the platform */
+            msg = NULL;
+        }
+        xSemaphoreGiveRecursive(queue->lock);
+        if (msg) {
+            esp_cloud_publish_msg_done(msg, err);
+        }
+    }
+}
+
+void esp_cloud_publish_queue_complete(esp_cloud_internal_handle_t *handle, int msg_id, esp_err_t result)
+{
+    if (!handle || !handle->publish_queue) {
+        return;
+    }
+    struct esp_cloud_publish_queue *queue = handle->publish_queue;
+    esp_cloud_publish_msg_t *msg = NULL;
+    int i;
+    ESP_CLOUD_TRACE(PUBLISH_DONE, msg_id, result, 0);
+    xSemaphoreTakeRecursive(queue->lock, portMAX_DELAY);
+    for (i = 0; i < PUBLISH_WINDOW; i++) {
+        if (queue->in_flight[i].msg && queue->in_flight[i].msg_id == msg_id) {
+            msg = esp_cloud_publish_slot_release(queue, &queue->in_flight[i], result);
+            break;
+        }
+    }
+    xSemaphoreGiveRecursive(queue->lock);
+    if (msg) {
+        esp_cloud_publish_msg_done(msg, result);
+    } else {
+        ESP_LOGD(TAG, "No in-flight message with id %d", msg_id);
+    }
+}
+
+void esp_cloud_publish_queue_flush(esp_cloud_internal_handle_t *handle, esp_err_t result)
+{
+    if (!handle || !handle->publish_queue) {
+        return;
+    }
+    struct esp_cloud_publish_queue *queue = handle->publish_queue;
+    esp_cloud_publish_msg_t *msg;
+    int i;
+    for (i = 0; i < PUBLISH_WINDOW; i++) {
+        msg = NULL;
+        xSemaphoreTakeRecursive(queue->lock, portMAX_DELAY);
+        if (queue->in_flight[i].msg) {
+            msg = esp_cloud_publish_slot_release(queue, &queue->in_flight[i], result);
+        }
+        xSemaphoreGiveRecursive(queue->lock);
+        if (msg) {
+            esp_cloud_publish_msg_done(msg, result);
+        }
+    }
+    while (xQueueReceive(queue->pending_high, &msg, 0) == pdTRUE ||
+            xQueueReceive(queue->pending, &msg, 0) == pdTRUE) {
+        xSemaphoreTakeRecursive(queue->lock, portMAX_DELAY);
+        queue->stats.failed++;
+        xSemaphoreGiveRecursive(queue->lock);
+        esp_cloud_publish_msg_done(msg, result);
+    }
+}
+
+esp_err_t esp_cloud_publish_queue_get_stats(esp_cloud_internal_handle_t *handle, esp_cloud_publish_stats_t *stats)
+{
+    if (!handle || !handle->publish_queue || !stats) {
+        return ESP_FAIL;
+    }
+    struct esp_cloud_publish_queue *queue = handle->publish_queue;
+    xSemaphoreTakeRecursive(queue->lock, portMAX_DELAY);
+    memcpy(stats, &queue->stats, sizeof(esp_cloud_publish_stats_t));
+    xSemaphoreGiveRecursive(queue->lock);
+    stats->pending = uxQueueMessagesWaiting(queue->pending_high) + uxQueueMessagesWaiting(queue->pending);
+    return ESP_OK;
+}
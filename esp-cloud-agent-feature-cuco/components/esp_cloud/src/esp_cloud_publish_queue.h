@@ -0,0 +1,52 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <esp_err.h>
+#include <esp_cloud.h>
+#include "esp_cloud_internal.h"
+
+/* Called once a queued message is acknowledged by the broker (ESP_OK), or sent in case of
+ * QoS0, or cannot be delivered. This runs in the context which completed the message, so it
+ * should be short.
+ */
+typedef void (*esp_cloud_publish_cb_t)(esp_err_t result, void *priv_data);
+
+esp_err_t esp_cloud_publish_queue_init(esp_cloud_internal_handle_t *handle);
+/* Free the queue. Any messages still in it are dropped without calling their callbacks */
+void esp_cloud_publish_queue_deinit(esp_cloud_internal_handle_t *handle);
+
+/* Queue a message for publishing from the cloud task, as per the policy of its class. The topic
+ * and data are copied, so the caller can free them as soon as this returns. Can be called from
+ * any task.
+ */
+esp_err_t esp_cloud_publish_async(esp_cloud_internal_handle_t *handle, const char *topic, const char *data,
+        esp_cloud_msg_class_t msg_class, esp_cloud_publish_cb_t cb, void *priv_data);
+/* Same as esp_cloud_publish_async(), for data which may not be a string */
+esp_err_t esp_cloud_publish_data_async(esp_cloud_internal_handle_t *handle, const char *topic, const void *data,
+        size_t data_len, esp_cloud_msg_class_t msg_class, esp_cloud_publish_cb_t cb, void *priv_data);
+
+/* Called from the cloud task. Publishes queued messages while the in-flight window has
+ * room, and fails the in-flight messages which were not acknowledged in time.
+ */
+void esp_cloud_publish_queue_process(esp_cloud_internal_handle_t *handle);
+
+/* Called by the platform when the broker acknowledges a message (or the platform gives up
+ * on it). msg_id is the one returned by esp_cloud_platform_publish_async().
+ */
+void esp_cloud_publish_queue_complete(esp_cloud_internal_handle_t *handle, int msg_id, esp_err_t result);
+
+/* Fail all the pending and in-flight messages, e.g. when the connection is closed for good */
+void esp_cloud_publish_queue_flush(esp_cloud_internal_handle_t *handle, esp_err_t result);
+
+esp_err_t esp_cloud_publish_queue_get_stats(esp_cloud_internal_handle_t *handle, esp_cloud_publish_stats_t *stats);
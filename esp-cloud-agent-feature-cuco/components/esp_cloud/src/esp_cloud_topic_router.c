@@ -0,0 +1,459 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+
+#include "esp_cloud_mem.h"
+#include "esp_cloud_topic_router.h"
+
+static const char *TAG = "esp_cloud_topic_router";
+
+#define TOPIC_ROUTER_INITIAL_BUCKETS    8
+
+typedef struct topic_handler {
+    esp_cloud_topic_handler_t handler;
+    void *priv_data;
+    struct topic_handler *next;
+} topic_handler_t;
+
+struct esp_cloud_topic_filter {
+    char *filter;
+    size_t filter_len;
+    uint32_t hash;
+    bool wildcard;
+    topic_handler_t *handlers;
+    /* Next filter in the same hash bucket. Used only for filters without wildcards */
+    esp_cloud_topic_filter_t *hash_next;
+    /* Next filter in the list of all the filters */
+    esp_cloud_topic_filter_t *list_next;
+};
+
+/* Node of the wildcard filter trie. Each node is a single topic level */
+typedef struct topic_node {
+    char *level;
+    size_t level_len;
+    struct topic_node *children;
+    struct topic_node *next;
+    /* Filter ending at this level, if any */
+    esp_cloud_topic_filter_t *filter;
+} topic_node_t;
+
+struct esp_cloud_topic_router {
+    esp_cloud_topic_filter_t **buckets;
+    uint32_t num_buckets;
+    uint32_t num_exact_filters;
+    topic_node_t root;
+    esp_cloud_topic_filter_t *filters;
+};
+
+static uint32_t topic_hash(const char *topic, size_t len)
+{
+    uint32_t hash = 2166136261U;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hash ^= (uint8_t)topic[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/* '+' must be a complete topic level, and '#' the complete last level */
+static bool topic_filter_is_valid(const char *filter, bool *wildcard)
+{
+    *wildcard = false;
+    if (!filter[0]) {
+        return false;
+    }
+    const char *p;
+    for (p = filter; *p; p++) {
+        if (*p == '+' || *p == '#') {
+            bool level_start = (p == filter) || (*(p - 1) == '/');
+            bool level_end = (*(p + 1) == '\0') || (*(p + 1) == '/');
+            if (!level_start || !level_end || (*p == '#' && *(p + 1) != '\0')) {
+                return false;
+            }
+            *wildcard = true;
+        }
+    }
+    return true;
+}
+
+static esp_cloud_topic_filter_t *topic_router_find_exact(esp_cloud_topic_router_t *router,
+        const char *topic, size_t topic_len, uint32_t hash)
+{
+    esp_cloud_topic_filter_t *topic_filter = router->buckets[hash & (router->num_buckets - 1)];
+    for (; topic_filter; topic_filter = topic_filter->hash_next) {
+        if (topic_filter->hash == hash && topic_filter->filter_len == topic_len &&
+                memcmp(topic_filter->filter, topic, topic_len) == 0) {
+            return topic_filter;
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t topic_router_grow(esp_cloud_topic_router_t *router)
+{
+    uint32_t num_buckets = router->num_buckets * 2;
+    esp_cloud_topic_filter_t **buckets = esp_cloud_mem_calloc(num_buckets, sizeof(esp_cloud_topic_filter_t *));
+    if (!buckets) {
+        return ESP_ERR_NO_MEM;
+    }
+    uint32_t i;
+    for (i = 0; i < router->num_buckets; i++) {
+        esp_cloud_topic_filter_t *topic_filter = router->buckets[i];
+        while (topic_filter) {
+            esp_cloud_topic_filter_t *next = topic_filter->hash_next;
+            uint32_t index = topic_filter->hash & (num_buckets - 1);
+            topic_filter->hash_next = buckets[index];
+            buckets[index] = topic_filter;
+            topic_filter = next;
+        }
+    }
+    free(router->buckets);
+    router->buckets = buckets;
+    router->num_buckets = num_buckets;
+    return ESP_OK;
+}
+
+static topic_node_t *topic_node_get_child(topic_node_t *node, const char *level, size_t level_len, bool create)
+{
+    topic_node_t *child;
+    for (child = node->children; child; child = child->next) {
+        if (child->level_len == level_len && memcmp(child->level, level, level_len) == 0) {
+            return child;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    child = esp_cloud_mem_calloc(1, sizeof(topic_node_t) + level_len + 1);
+    if (!child) {
+        return NULL;
+    }
+    child->level = (char *)(child + 1);
+    memcpy(child->level, level, level_len);
+    child->level_len = level_len;
+    child->next = node->children;
+    node->children = child;
+    return child;
+}
+
+static topic_node_t *topic_trie_get_node(topic_node_t *root, const char *filter, bool create)
+{
+    topic_node_t *node = root;
+    const char *level = filter;
+    while (node) {
+        const char *level_end = strchr(level, '/');
+        size_t level_len = level_end ? (size_t)(level_end - level) : strlen(level);
+        node = topic_node_get_child(node, level, level_len, create);
+        if (!level_end) {
+            break;
+        }
+        level = level_end + 1;
+    }
+    return node;
+}
+
+/* Free the nodes which have neither a filter nor any children */
+static void topic_node_prune(topic_node_t *node)
+{
+    topic_node_t **child_ptr = &node->children;
+    while (*child_ptr) {
+        topic_node_t *child = *child_ptr;
+        topic_node_prune(child);
+        if (!child->filter && !child->children) {
+            *child_ptr = child->next;
+            free(child);
+        } else {
+            child_ptr = &child->next;
+        }
+    }
+}
+
+static void topic_node_free_children(topic_node_t *node)
+{
+    topic_node_t *child = node->children;
+    while (child) {
+        topic_node_t *next = child->next;
+        topic_node_free_children(child);
+        free(child);
+        child = next;
+    }
+    node->children = NULL;
+}
+
+static bool topic_node_is_wildcard(topic_node_t *node, char wildcard)
+{
+    return node->level_len == 1 && node->level[0] == wildcard;
+}
+
+/* Dispatch to the wildcard filters matching the topic, starting at the given level */
+static int topic_node_dispatch(topic_node_t *node, const char *topic, const char *level, const char *topic_end,
+        const void *payload, size_t payload_len)
+{
+    int count = 0;
+    const char *level_end = memchr(level, '/', topic_end - level);
+    size_t level_len = level_end ? (size_t)(level_end - level) : (size_t)(topic_end - level);
+    /* Wildcards at the first level do not match topics starting with '$' */
+    bool system_topic = (level == topic) && (level_len > 0) && (level[0] == '$');
+    topic_node_t *child;
+    for (child = node->children; child; child = child->next) {
+        bool plus = topic_node_is_wildcard(child, '+');
+        bool hash = topic_node_is_wildcard(child, '#');
+        if ((plus || hash) && system_topic) {
+            continue;
+        }
+        if (hash) {
+            count += esp_cloud_topic_filter_dispatch(child->filter, topic, payload, payload_len);
+            continue;
+        }
+        if (!plus && !(child->level_len == level_len && memcmp(child->level, level, level_len) == 0)) {
+            continue;
+        }
+        if (level_end) {
+            count += topic_node_dispatch(child, topic, level_end + 1, topic_end, payload, payload_len);
+        } else {
+            count += esp_cloud_topic_filter_dispatch(child->filter, topic, payload, payload_len);
+            /* "a/#" matches "a" as well */
+            topic_node_t *hash_child = topic_node_get_child(child, "#", 1, false);
+            if (hash_child) {
+                count += esp_cloud_topic_filter_dispatch(hash_child->filter, topic, payload, payload_len);
+            }
+        }
+    }
+    return count;
+}
+
+static esp_cloud_topic_filter_t *topic_router_add_filter(esp_cloud_topic_router_t *router, const char *filter,
+        bool wildcard)
+{
+    size_t filter_len = strlen(filter);
+    esp_cloud_topic_filter_t *topic_filter = esp_cloud_mem_calloc(1, sizeof(esp_cloud_topic_filter_t) + filter_len + 1);
+    if (!topic_filter) {
+        return NULL;
+    }
+    topic_filter->filter = (char *)(topic_filter + 1);
+    memcpy(topic_filter->filter, filter, filter_len + 1);
+    topic_filter->filter_len = filter_len;
+    topic_filter->hash = topic_hash(filter, filter_len);
+    topic_filter->wildcard = wildcard;
+
+    if (wildcard) {
+        topic_node_t *node = topic_trie_get_node(&router->root, filter, true);
+        if (!node) {
+            topic_node_prune(&router->root);
+            free(topic_filter);
+            return NULL;
+        }
+        node->filter = topic_filter;
+    } else {
+        if (router->num_exact_filters >= router->num_buckets) {
+            if (topic_router_grow(router) != ESP_OK) {
+                ESP_LOGW(TAG, "Could not grow the topic table");
+            }
+        }
+        uint32_t index = topic_filter->hash & (router->num_buckets - 1);
+        topic_filter->hash_next = router->buckets[index];
+        router->buckets[index] = topic_filter;
+        router->num_exact_filters++;
+    }
+    topic_filter->list_next = router->filters;
+    router->filters = topic_filter;
+    return topic_filter;
+}
+
+static void topic_filter_free(esp_cloud_topic_filter_t *topic_filter)
+{
+    topic_handler_t *topic_handler = topic_filter->handlers;
+    while (topic_handler) {
+        topic_handler_t *next = topic_handler->next;
+        free(topic_handler);
+        topic_handler = next;
+    }
+    free(topic_filter);
+}
+
+esp_cloud_topic_router_t *esp_cloud_topic_router_create(void)
+{
+    esp_cloud_topic_router_t *router = esp_cloud_mem_calloc(1, sizeof(esp_cloud_topic_router_t));
+    if (!router) {
+        return NULL;
+    }
+    router->buckets = esp_cloud_mem_calloc(TOPIC_ROUTER_INITIAL_BUCKETS, sizeof(esp_cloud_topic_filter_t *));
+    if (!router->buckets) {
+        free(router);
+        return NULL;
+    }
+    router->num_buckets = TOPIC_ROUTER_INITIAL_BUCKETS;
+    return router;
+}
+
+void esp_cloud_topic_router_clear(esp_cloud_topic_router_t *router)
+{
+    if (!router) {
+        return;
+    }
+    esp_cloud_topic_filter_t *topic_filter = router->filters;
+    while (topic_filter) {
+        esp_cloud_topic_filter_t *next = topic_filter->list_next;
+        topic_filter_free(topic_filter);
+        topic_filter = next;
+    }
+    router->filters = NULL;
+    topic_node_free_children(&router->root);
+    memset(router->buckets, 0, router->num_buckets * sizeof(esp_cloud_topic_filter_t *));
+    router->num_exact_filters = 0;
+}
+
+void esp_cloud_topic_router_delete(esp_cloud_topic_router_t *router)
+{
+    if (!router) {
+        return;
+    }
+    esp_cloud_topic_router_clear(router);
+    free(router->buckets);
+    free(router);
+}
+
+esp_cloud_topic_filter_t *esp_cloud_topic_router_find(esp_cloud_topic_router_t *router, const char *filter)
+{
+    bool wildcard;
+    if (!router || !filter || !topic_filter_is_valid(filter, &wildcard)) {
+        return NULL;
+    }
+    if (wildcard) {
+        topic_node_t *node = topic_trie_get_node(&router->root, filter, false);
+        return node ? node->filter : NULL;
+    }
+    size_t filter_len = strlen(filter);
+    return topic_router_find_exact(router, filter, filter_len, topic_hash(filter, filter_len));
+}
+
+esp_cloud_topic_filter_t *esp_cloud_topic_router_add(esp_cloud_topic_router_t *router, const char *filter,
+        esp_cloud_topic_handler_t handler, void *priv_data, bool *new_filter)
+{
+    bool wildcard;
+    if (!router || !filter || !handler) {
+        return NULL;
+    }
+    if (!topic_filter_is_valid(filter, &wildcard)) {
+        ESP_LOGE(TAG, "Invalid topic filter %s", filter);
+        return NULL;
+    }
+    topic_handler_t *topic_handler = esp_cloud_mem_calloc(1, sizeof(topic_handler_t));
+    if (!topic_handler) {
+        return NULL;
+    }
+    topic_handler->handler = handler;
+    topic_handler->priv_data = priv_data;
+
+    esp_cloud_topic_filter_t *topic_filter = esp_cloud_topic_router_find(router, filter);
+    if (new_filter) {
+        *new_filter = (topic_filter == NULL);
+    }
+    if (!topic_filter) {
+        topic_filter = topic_router_add_filter(router, filter, wildcard);
+        if (!topic_filter) {
+            free(topic_handler);
+            return NULL;
+        }
+    }
+    /* Handlers are called in the order in which they were added */
+    topic_handler_t **last = &topic_filter->handlers;
+    while (*last) {
+        last = &(*last)->next;
+    }
+    *last = topic_handler;
+    return topic_filter;
+}
+
+esp_err_t esp_cloud_topic_router_remove(esp_cloud_topic_router_t *router, const char *filter)
+{
+    esp_cloud_topic_filter_t *topic_filter = esp_cloud_topic_router_find(router, filter);
+    if (!topic_filter) {
+        return ESP_FAIL;
+    }
+    if (topic_filter->wildcard) {
+        topic_node_t *node = topic_trie_get_node(&router->root, filter, false);
+        node->filter = NULL;
+        topic_node_prune(&router->root);
+    } else {
+        esp_cloud_topic_filter_t **ptr = &router->buckets[topic_filter->hash & (router->num_buckets - 1)];
+        while (*ptr != topic_filter) {
+            ptr = &(*ptr)->hash_next;
+        }
+        *ptr = topic_filter->hash_next;
+        router->num_exact_filters--;
+    }
+    esp_cloud_topic_filter_t **ptr = &router->filters;
+    while (*ptr != topic_filter) {
+        ptr = &(*ptr)->list_next;
+    }
+    *ptr = topic_filter->list_next;
+    topic_filter_free(topic_filter);
+    return ESP_OK;
+}
+
+void esp_cloud_topic_router_foreach(esp_cloud_topic_router_t *router, esp_cloud_topic_filter_fn_t fn, void *priv_data)
+{
+    if (!router || !fn) {
+        return;
+    }
+    esp_cloud_topic_filter_t *topic_filter = router->filters;
+    while (topic_filter) {
+        /* The function may remove the filter it is given */
+        esp_cloud_topic_filter_t *next = topic_filter->list_next;
+        fn(topic_filter->filter, priv_data);
+        topic_filter = next;
+    }
+}
+
+int esp_cloud_topic_router_dispatch(esp_cloud_topic_router_t *router, const char *topic, size_t topic_len,
+        const void *payload, size_t payload_len)
+{
+    if (!router || !topic) {
+        return 0;
+    }
+    int count = 0;
+    esp_cloud_topic_filter_t *topic_filter = topic_router_find_exact(router, topic, topic_len,
+            topic_hash(topic, topic_len));
+    if (topic_filter) {
+        count += esp_cloud_topic_filter_dispatch(topic_filter, topic, payload, payload_len);
+    }
+    if (router->root.children) {
+        count += topic_node_dispatch(&router->root, topic, topic, topic + topic_len, payload, payload_len);
+    }
+    return count;
+}
+
+const char *esp_cloud_topic_filter_get_name(esp_cloud_topic_filter_t *filter)
+{
+    return filter ? filter->filter : NULL;
+}
+
+int esp_cloud_topic_filter_dispatch(esp_cloud_topic_filter_t *filter, const char *topic,
+        const void *payload, size_t payload_len)
+{
+    if (!filter) {
+        return 0;
+    }
+    int count = 0;
+    topic_handler_t *topic_handler;
+    for (topic_handler = filter->handlers; topic_handler; topic_handler = topic_handler->next) {
+        topic_handler->handler(topic, payload, payload_len, topic_handler->priv_data);
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,59 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/* Handler for messages received on a topic. The topic need not be NULL terminated. The payload
+ * is a read-only view of the receive buffer, valid only till the handler returns.
+ */
+typedef void (*esp_cloud_topic_handler_t)(const char *topic, const void *payload, size_t payload_len, void *priv_data);
+
+typedef struct esp_cloud_topic_router esp_cloud_topic_router_t;
+typedef struct esp_cloud_topic_filter esp_cloud_topic_filter_t;
+
+typedef void (*esp_cloud_topic_filter_fn_t)(const char *filter, void *priv_data);
+
+/* Routes messages to the handlers registered for MQTT topic filters. Topics without
+ * wildcards are looked up in a hash table and filters with '+' or '#' wildcards in a
+ * trie of topic levels, so the lookup cost does not depend on the number of filters.
+ * Any number of handlers can be added for a filter.
+ */
+esp_cloud_topic_router_t *esp_cloud_topic_router_create(void);
+void esp_cloud_topic_router_delete(esp_cloud_topic_router_t *router);
+/* Remove all the filters. The router itself is kept for reuse */
+void esp_cloud_topic_router_clear(esp_cloud_topic_router_t *router);
+
+/* Add a handler for a topic filter. new_filter (optional) is set to true if the filter was
+ * not present earlier, i.e. if a new MQTT subscription is required for it.
+ */
+esp_cloud_topic_filter_t *esp_cloud_topic_router_add(esp_cloud_topic_router_t *router, const char *filter,
+        esp_cloud_topic_handler_t handler, void *priv_data, bool *new_filter);
+/* Remove a topic filter along with all its handlers */
+esp_err_t esp_cloud_topic_router_remove(esp_cloud_topic_router_t *router, const char *filter);
+esp_cloud_topic_filter_t *esp_cloud_topic_router_find(esp_cloud_topic_router_t *router, const char *filter);
+/* Call fn for each filter. fn may remove the filter it is given, but no other */
+void esp_cloud_topic_router_foreach(esp_cloud_topic_router_t *router, esp_cloud_topic_filter_fn_t fn, void *priv_data);
+
+/* Call the handlers of all the filters matching the topic. Returns the number of handlers called */
+int esp_cloud_topic_router_dispatch(esp_cloud_topic_router_t *router, const char *topic, size_t topic_len,
+        const void *payload, size_t payload_len);
+
+/* The filter string. This stays valid till the filter is removed */
+const char *esp_cloud_topic_filter_get_name(esp_cloud_topic_filter_t *filter);
+/* Call the handlers of a single filter. Returns the number of handlers called */
+int esp_cloud_topic_filter_dispatch(esp_cloud_topic_filter_t *filter, const char *topic,
+        const void *payload, size_t payload_len);
@@ -0,0 +1,91 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string.h>
+#include <esp_log.h>
+
+#include "esp_cloud_mem.h"
+#include "esp_cloud_topics.h"
+#include "app_auth_user.h"
+
+static const char *TAG = "esp_cloud_topics";
+
+/* Suffixes of the topics which are "<device_id>/<suffix>". NULL for other topics */
+static const char *device_topic_suffixes[ESP_CLOUD_TOPIC_MAX] = {
+    [ESP_CLOUD_TOPIC_DEVICE_INFO]   = "device/info",
+    [ESP_CLOUD_TOPIC_USER_MAPPING]  = "device/user/mapping",
+    [ESP_CLOUD_TOPIC_DIAGNOSTICS]   = "device/diagnostics",
+    [ESP_CLOUD_TOPIC_OTA_URL]       = "device/otaurl",
+    [ESP_CLOUD_TOPIC_OTA_FETCH]     = "device/otafetch",
+    [ESP_CLOUD_TOPIC_OTA_STATUS]    = "device/otastatus",
+};
+
+esp_err_t esp_cloud_topics_init(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || !handle->device_id) {
+        return ESP_FAIL;
+    }
+    if (handle->topic_buf) {
+        return ESP_OK;
+    }
+    size_t device_id_len = strlen(handle->device_id);
+    size_t buf_size = 0;
+    int i;
+    for (i = 0; i < ESP_CLOUD_TOPIC_MAX; i++) {
+        if (device_topic_suffixes[i]) {
+            buf_size += device_id_len + 1 + strlen(device_topic_suffixes[i]) + 1;
+        }
+    }
+    /* All the topics are in a single allocation */
+    char *buf = esp_cloud_mem_malloc(buf_size);
+    if (!buf) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes for topics", (int)buf_size);
+        return ESP_ERR_NO_MEM;
+    }
+    handle->topic_buf = buf;
+    for (i = 0; i < ESP_CLOUD_TOPIC_MAX; i++) {
+        if (!device_topic_suffixes[i]) {
+            continue;
+        }
+        size_t suffix_len = strlen(device_topic_suffixes[i]);
+        memcpy(buf, handle->device_id, device_id_len);
+        buf[device_id_len] = '/';
+        memcpy(buf + device_id_len + 1, device_topic_suffixes[i], suffix_len + 1);
+        handle->topics[i] = buf;
+        buf += device_id_len + 1 + suffix_len + 1;
+    }
+    esp_cloud_topics_refresh(handle);
+    return ESP_OK;
+}
+
+void esp_cloud_topics_refresh(esp_cloud_internal_handle_t *handle)
+{
+    if (!handle || handle->topics[ESP_CLOUD_TOPIC_APP]) {
+        return;
+    }
+    /* Allocated by the storage, and kept for the lifetime of the agent */
+    char *app_topic = custom_config_storage_get("app_topic");
+    if (!app_topic) {
+        ESP_LOGW(TAG, "app_topic not found");
+        return;
+    }
+    handle->topics[ESP_CLOUD_TOPIC_APP] = app_topic;
+}
+
+const char *esp_cloud_topic_get(esp_cloud_internal_handle_t *handle, esp_cloud_topic_id_t id)
+{
+    if (!handle || id >= ESP_CLOUD_TOPIC_MAX) {
+        return NULL;
+    }
+    return handle->topics[id];
+}
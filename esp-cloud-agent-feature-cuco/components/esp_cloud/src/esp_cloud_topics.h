@@ -0,0 +1,31 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <esp_err.h>
+#include <esp_cloud.h>
+#include "esp_cloud_internal.h"
+
+/* All the topics used by the agent are built once, by esp_cloud_topics_init(), and then
+ * referred to by their id, so that publishing needs no string formatting or NVS access.
+ */
+
+/* Build the topics. The app topic comes from NVS and, if it is not there yet, it is
+ * looked for again by esp_cloud_topics_refresh().
+ */
+esp_err_t esp_cloud_topics_init(esp_cloud_internal_handle_t *handle);
+/* Load the topics which were not available earlier. Called by the cloud task before connecting */
+void esp_cloud_topics_refresh(esp_cloud_internal_handle_t *handle);
+
+/* The topic, or NULL if it is not available. This stays valid for the lifetime of the agent */
+const char *esp_cloud_topic_get(esp_cloud_internal_handle_t *handle, esp_cloud_topic_id_t id);
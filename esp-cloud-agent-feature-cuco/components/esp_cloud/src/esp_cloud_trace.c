@@ -0,0 +1,127 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sdkconfig.h>
+#include <esp_timer.h>
+
+#include "esp_cloud_trace_points.h"
+
+#ifdef CONFIG_ESP_CLOUD_TRACE_RECORDS
+#define TRACE_RECORDS   CONFIG_ESP_CLOUD_TRACE_RECORDS
+#else
+#define TRACE_RECORDS   64
+#endif
+
+uint32_t esp_cloud_trace_hash(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261U;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+#ifdef CONFIG_ESP_CLOUD_TRACE
+static esp_cloud_trace_record_t trace_ring[TRACE_RECORDS];
+/* Number of records written so far. Writers claim a slot by incrementing this, so that
+ * any task or core can record without a lock. A record is lost if the ring wraps around
+ * completely while it is being written.
+ */
+static uint32_t trace_head;
+
+void esp_cloud_trace_record(esp_cloud_trace_id_t id, uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+    uint32_t seq = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    esp_cloud_trace_record_t *record = &trace_ring[seq % TRACE_RECORDS];
+    /* Marks the record invalid for readers till it is complete */
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->timestamp = (uint32_t)esp_timer_get_time();
+    record->id = id;
+    record->reserved = 0;
+    record->args[0] = arg0;
+    record->args[1] = arg1;
+    record->args[2] = arg2;
+    __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy the record with the given sequence number. Fails if it was overwritten */
+static bool trace_read_record(uint32_t seq, esp_cloud_trace_record_t *out)
+{
+    esp_cloud_trace_record_t *record = &trace_ring[(seq - 1) % TRACE_RECORDS];
+    if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != seq) {
+        return false;
+    }
+    memcpy(out, record, sizeof(esp_cloud_trace_record_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) == seq) && (out->seq == seq);
+}
+
+/* Sequence number of the oldest record which may still be in the ring */
+static uint32_t trace_first_seq(uint32_t head)
+{
+    return (head > TRACE_RECORDS) ? head - TRACE_RECORDS + 1 : 1;
+}
+
+size_t esp_cloud_trace_read(esp_cloud_trace_record_t *records, size_t max_records)
+{
+    if (!records || !max_records) {
+        return 0;
+    }
+    uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+    uint32_t seq = trace_first_seq(head);
+    if (head - seq + 1 > max_records) {
+        seq = head - max_records + 1;
+    }
+    size_t count = 0;
+    for (; seq <= head && seq != 0; seq++) {
+        if (trace_read_record(seq, &records[count])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void esp_cloud_trace_dump(void)
+{
+    uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+    uint32_t seq;
+    for (seq = trace_first_seq(head); seq <= head && seq != 0; seq++) {
+        esp_cloud_trace_record_t record;
+        if (!trace_read_record(seq, &record)) {
+            continue;
+        }
+        const uint8_t *p = (const uint8_t *)&record;
+        char line[sizeof(record) * 2 + 1];
+        size_t i;
+        for (i = 0; i < sizeof(record); i++) {
+            sprintf(&line[i * 2], "%02x", p[i]);
+        }
+        printf("ESPTRACE %s\n", line);
+    }
+}
+#else
+size_t esp_cloud_trace_read(esp_cloud_trace_record_t *records, size_t max_records)
+{
+    return 0;
+}
+
+void esp_cloud_trace_dump(void)
+{
+}
+#endif /* CONFIG_ESP_CLOUD_TRACE */
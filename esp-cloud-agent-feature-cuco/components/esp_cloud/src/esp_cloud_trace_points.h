@@ -0,0 +1,58 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sdkconfig.h>
+#include <esp_cloud_trace.h>
+
+/* Trace points, as (name, format). The id of a trace point is its position in this list,
+ * so new ones should be added at the end. tools/esp_cloud_trace_decode.py reads the
+ * formats from this file. Formats can have up to 3 integer conversions. Topics and other
+ * strings are recorded as their 32 bit FNV-1a hash (see esp_cloud_trace_hash()), which the
+ * decoder can map back to the strings given to it.
+ */
+#define ESP_CLOUD_TRACE_POINTS(X) \
+    X(PUBLISH,              "publish topic=%08x len=%u class=%u") \
+    X(PUBLISH_ASYNC,        "publish async topic=%08x len=%u msg_id=%d") \
+    X(PUBLISH_DONE,         "publish done msg_id=%d err=0x%x") \
+    X(RX,                   "rx topic=%08x len=%u handlers=%u") \
+    X(SHADOW_UPDATE,        "shadow update len=%u reported=%u desired=%u") \
+    X(SHADOW_UPDATE_ACK,    "shadow update ack status=%u version=%u in_flight=%u") \
+    X(SHADOW_DELTA,         "shadow delta key=%08x len=%u") \
+    X(REPORT_STATE,         "report state reported=%u desired=%u") \
+    X(APP_CMD,              "app cmd=%08x encoding=%u len=%u") \
+
+typedef enum {
+#define ESP_CLOUD_TRACE_ENUM(name, fmt) ESP_CLOUD_TRACE_##name,
+    ESP_CLOUD_TRACE_POINTS(ESP_CLOUD_TRACE_ENUM)
+#undef ESP_CLOUD_TRACE_ENUM
+    ESP_CLOUD_TRACE_MAX,
+} esp_cloud_trace_id_t;
+
+#ifdef CONFIG_ESP_CLOUD_TRACE
+void esp_cloud_trace_record(esp_cloud_trace_id_t id, uint32_t arg0, uint32_t arg1, uint32_t arg2);
+#define ESP_CLOUD_TRACE(name, arg0, arg1, arg2) \
+    esp_cloud_trace_record(ESP_CLOUD_TRACE_##name, (uint32_t)(arg0), (uint32_t)(arg1), (uint32_t)(arg2))
+#else
+/* The arguments are not evaluated */
+#define ESP_CLOUD_TRACE(name, arg0, arg1, arg2) do { \
+        if (0) { \
+            (void)(arg0); (void)(arg1); (void)(arg2); \
+        } \
+    } while (0)
+#endif
+
+/* FNV-1a hash, for recording strings */
+uint32_t esp_cloud_trace_hash(const char *str, size_t len);
@@ -0,0 +1,8 @@
+#
+# Component Makefile for the esp_cloud unit tests, run with the ESP-IDF unit test app with
+# the loopback transport enabled. The same tests can be built and run on a Linux host with
+# host/Makefile.
+#
+COMPONENT_ADD_LDFLAGS = -Wl,--whole-archive -l$(COMPONENT_NAME) -Wl,--no-whole-archive
+# The tests use the internal headers of the agent, like the publish queue
+COMPONENT_PRIV_INCLUDEDIRS := ../src ../platforms/include
@@ -0,0 +1,78 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <esp_cloud_mem.h>
+#include "app_auth_user.h"
+#include "app_prov_handlers.h"
+#include "alexa.h"
+
+/* Stand-ins for the application symbols the agent core links against */
+
+int user_bind_flag;
+int bind_status_code;
+int Wait_for_alexa_in = NOT_LOG_IN;
+int Wait_for_alexa_out = LOGED__OUT;
+int ota_size;
+int ota_filesize;
+char ota_ver[10];
+char ota_url[255];
+uint32_t app_to_current_val;
+int app_set_volume;
+const int AWS_IOT_DONE_BIT = 1 << 0;
+
+void app_aws_done_cb(void)
+{
+}
+
+void aws_iot_done_cb(void)
+{
+}
+
+void test_alexa_mem(void)
+{
+}
+
+char *custom_config_storage_get(const char *key)
+{
+    if (strcmp(key, "app_topic") == 0) {
+        return esp_cloud_mem_strdup("host/app");
+    }
+    return NULL;
+}
+
+uint8_t custom_config_storage_get_u8(const char *key)
+{
+    return CUSTOM_INIT;
+}
+
+esp_err_t custom_config_storage_set_u8(const char *key, uint8_t val)
+{
+    return ESP_OK;
+}
+
+void report_device_info_to_server(int type, int source, char *version, bool success, char *info)
+{
+}
+
+int alexa_auth_delegate_signin(auth_delegate_config_t *cfg)
+{
+    return 0;
+}
+
+int alexa_auth_delegate_signout(void)
+{
+    return 0;
+}
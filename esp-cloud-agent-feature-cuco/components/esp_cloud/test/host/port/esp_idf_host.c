@@ -0,0 +1,175 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <nvs.h>
+#include <nvs_flash.h>
+#include <lwip/apps/sntp.h>
+
+/* The ESP-IDF services esp_cloud uses: logging, timer, heap accounting and a read-only NVS
+ * with the factory device_id.
+ */
+
+#define HOST_HEAP_SIZE      (4 * 1024 * 1024)
+#define HOST_DEVICE_ID      "host-device"
+
+static esp_log_level_t host_log_level = ESP_LOG_WARN;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    /* Per tag levels are not needed by the tests */
+    host_log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    if (level > host_log_level) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%c (%s) ", letters[level], tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void esp_restart(void)
+{
+    fprintf(stderr, "esp_restart() called\n");
+    exit(1);
+}
+
+/* Keep every thread on the main arena so that mallinfo2() sees all allocations */
+static void __attribute__((constructor)) host_heap_init(void)
+{
+    mallopt(M_ARENA_MAX, 1);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    return HOST_HEAP_SIZE - (uint32_t)info.uordblks;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    return calloc(n, size);
+}
+
+void sntp_setoperatingmode(unsigned char operating_mode)
+{
+}
+
+void sntp_setservername(unsigned char idx, const char *server)
+{
+}
+
+static unsigned char host_sntp_enabled;
+
+void sntp_init(void)
+{
+    host_sntp_enabled = 1;
+}
+
+void sntp_stop(void)
+{
+    host_sntp_enabled = 0;
+}
+
+unsigned char sntp_enabled(void)
+{
+    return host_sntp_enabled;
+}
+
+esp_err_t nvs_flash_init_partition(const char *partition_label)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_open_from_partition(const char *part_name, const char *name, nvs_open_mode open_mode,
+        nvs_handle *out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length)
+{
+    if (strcmp(key, "device_id") != 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value) {
+        if (*length < strlen(HOST_DEVICE_ID)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(out_value, HOST_DEVICE_ID, strlen(HOST_DEVICE_ID));
+    }
+    *length = strlen(HOST_DEVICE_ID);
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle)
+{
+}
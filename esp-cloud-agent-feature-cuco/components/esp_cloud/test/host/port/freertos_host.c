@@ -0,0 +1,548 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <freertos/timers.h>
+
+/* FreeRTOS tasks, queues, semaphores, event groups and timers on POSIX threads. Each
+ * object has a mutex and a condition variable on the monotonic clock, which is also the
+ * tick count.
+ */
+
+static void host_time_now(struct timespec *ts)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    host_time_now(&ts);
+    return (TickType_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void host_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Absolute deadline for a timeout in ticks. Not used for portMAX_DELAY */
+static void host_deadline(TickType_t timeout, struct timespec *deadline)
+{
+    host_time_now(deadline);
+    uint64_t nsec = deadline->tv_nsec + (uint64_t)timeout * (1000000000 / configTICK_RATE_HZ);
+    deadline->tv_sec += nsec / 1000000000;
+    deadline->tv_nsec = nsec % 1000000000;
+}
+
+/* Waits on cond till signalled or the deadline. Returns false on a timeout */
+static bool host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t timeout,
+        const struct timespec *deadline)
+{
+    if (timeout == 0) {
+        return false;
+    }
+    if (timeout == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+/* Tasks */
+
+struct host_task {
+    TaskFunction_t fn;
+    void *param;
+};
+
+static __thread struct host_task *host_current_task;
+static struct host_task host_main_task;
+
+static void *host_task_thread(void *arg)
+{
+    host_current_task = (struct host_task *)arg;
+    host_current_task->fn(host_current_task->param);
+    fprintf(stderr, "Task returned without calling vTaskDelete()\n");
+    abort();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+        UBaseType_t priority, TaskHandle_t *created_task)
+{
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+    if (!task) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->param = param;
+    /* Set before the task runs, as with FreeRTOS */
+    if (created_task) {
+        *created_task = task;
+    }
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int ret = pthread_create(&thread, &attr, host_task_thread, task);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        if (created_task) {
+            *created_task = NULL;
+        }
+        free(task);
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task && task != host_current_task) {
+        fprintf(stderr, "Deleting another task is not supported\n");
+        abort();
+    }
+    if (host_current_task == NULL || host_current_task == &host_main_task) {
+        fprintf(stderr, "vTaskDelete(NULL) outside of a task\n");
+        abort();
+    }
+    free(host_current_task);
+    host_current_task = NULL;
+    pthread_exit(NULL);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return host_current_task ? host_current_task : &host_main_task;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = {
+        .tv_sec = ticks / configTICK_RATE_HZ,
+        .tv_nsec = (ticks % configTICK_RATE_HZ) * (1000000000 / configTICK_RATE_HZ),
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+/* Queues */
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t *items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue) + length * item_size);
+    if (!queue) {
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    host_cond_init(&queue->not_empty);
+    host_cond_init(&queue->not_full);
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->items = (uint8_t *)(queue + 1);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+static BaseType_t host_queue_send(QueueHandle_t queue, const void *item, TickType_t timeout, bool front)
+{
+    struct timespec deadline;
+    host_deadline(timeout, &deadline);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (!host_cond_wait(&queue->not_full, &queue->lock, timeout, &deadline)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    UBaseType_t index;
+    if (front) {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        index = queue->head;
+    } else {
+        index = (queue->head + queue->count) % queue->length;
+    }
+    memcpy(queue->items + index * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t timeout)
+{
+    return host_queue_send(queue, item, timeout, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t timeout)
+{
+    return host_queue_send(queue, item, timeout, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t timeout)
+{
+    struct timespec deadline;
+    host_deadline(timeout, &deadline);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (!host_cond_wait(&queue->not_empty, &queue->lock, timeout, &deadline)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+/* Semaphores and mutexes. A mutex is a semaphore with a maximum count of 1 which starts
+ * available, and a recursive mutex also tracks its holder.
+ */
+
+struct host_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    UBaseType_t count;
+    UBaseType_t max_count;
+    bool recursive;
+    TaskHandle_t holder;
+    UBaseType_t depth;
+};
+
+static SemaphoreHandle_t host_semaphore_create(UBaseType_t max_count, UBaseType_t initial_count, bool recursive)
+{
+    struct host_semaphore *sem = calloc(1, sizeof(struct host_semaphore));
+    if (!sem) {
+        return NULL;
+    }
+    pthread_mutex_init(&sem->lock, NULL);
+    host_cond_init(&sem->available);
+    sem->max_count = max_count;
+    sem->count = initial_count;
+    sem->recursive = recursive;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return host_semaphore_create(1, 0, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    return host_semaphore_create(max_count, initial_count, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return host_semaphore_create(1, 1, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return host_semaphore_create(1, 1, true);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_cond_destroy(&sem->available);
+    pthread_mutex_destroy(&sem->lock);
+    free(sem);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout)
+{
+    struct timespec deadline;
+    host_deadline(timeout, &deadline);
+    pthread_mutex_lock(&sem->lock);
+    while (sem->count == 0) {
+        if (!host_cond_wait(&sem->available, &sem->lock, timeout, &deadline)) {
+            pthread_mutex_unlock(&sem->lock);
+            return pdFALSE;
+        }
+    }
+    sem->count--;
+    pthread_mutex_unlock(&sem->lock);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    if (sem->count == sem->max_count) {
+        pthread_mutex_unlock(&sem->lock);
+        return pdFALSE;
+    }
+    sem->count++;
+    pthread_cond_signal(&sem->available);
+    pthread_mutex_unlock(&sem->lock);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t timeout)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    pthread_mutex_lock(&sem->lock);
+    if (sem->depth && sem->holder == self) {
+        sem->depth++;
+        pthread_mutex_unlock(&sem->lock);
+        return pdTRUE;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    if (xSemaphoreTake(sem, timeout) != pdTRUE) {
+        return pdFALSE;
+    }
+    pthread_mutex_lock(&sem->lock);
+    sem->holder = self;
+    sem->depth = 1;
+    pthread_mutex_unlock(&sem->lock);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    if (sem->depth == 0 || sem->holder != xTaskGetCurrentTaskHandle()) {
+        pthread_mutex_unlock(&sem->lock);
+        return pdFALSE;
+    }
+    if (--sem->depth) {
+        pthread_mutex_unlock(&sem->lock);
+        return pdTRUE;
+    }
+    sem->holder = NULL;
+    pthread_mutex_unlock(&sem->lock);
+    return xSemaphoreGive(sem);
+}
+
+/* Event groups */
+
+struct host_event_group {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct host_event_group *group = calloc(1, sizeof(struct host_event_group));
+    if (!group) {
+        return NULL;
+    }
+    pthread_mutex_init(&group->lock, NULL);
+    host_cond_init(&group->changed);
+    return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    pthread_cond_destroy(&group->changed);
+    pthread_mutex_destroy(&group->lock);
+    free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    EventBits_t ret = group->bits;
+    pthread_cond_broadcast(&group->changed);
+    pthread_mutex_unlock(&group->lock);
+    return ret;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    /* The bits before they were cleared, as with FreeRTOS */
+    EventBits_t ret = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return ret;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t ret = group->bits;
+    pthread_mutex_unlock(&group->lock);
+    return ret;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+        BaseType_t wait_for_all, TickType_t timeout)
+{
+    struct timespec deadline;
+    host_deadline(timeout, &deadline);
+    pthread_mutex_lock(&group->lock);
+    while (1) {
+        EventBits_t set = group->bits & bits;
+        if (wait_for_all ? (set == bits) : (set != 0)) {
+            break;
+        }
+        if (!host_cond_wait(&group->changed, &group->lock, timeout, &deadline)) {
+            break;
+        }
+    }
+    EventBits_t ret = group->bits;
+    EventBits_t set = group->bits & bits;
+    if (clear_on_exit && (wait_for_all ? (set == bits) : (set != 0))) {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&group->lock);
+    return ret;
+}
+
+/* Timers */
+
+struct host_timer {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+    bool thread_started;
+    bool running;
+    bool deleted;
+    TickType_t period;
+    bool auto_reload;
+    void *timer_id;
+    TimerCallbackFunction_t cb;
+};
+
+static void *host_timer_thread(void *arg)
+{
+    struct host_timer *timer = (struct host_timer *)arg;
+    struct timespec deadline;
+    pthread_mutex_lock(&timer->lock);
+    while (!timer->deleted) {
+        if (!timer->running) {
+            pthread_cond_wait(&timer->changed, &timer->lock);
+            continue;
+        }
+        host_deadline(timer->period, &deadline);
+        if (host_cond_wait(&timer->changed, &timer->lock, timer->period, &deadline)) {
+            /* Stopped, restarted or deleted */
+            continue;
+        }
+        timer->running = timer->auto_reload;
+        pthread_mutex_unlock(&timer->lock);
+        timer->cb(timer);
+        pthread_mutex_lock(&timer->lock);
+    }
+    pthread_mutex_unlock(&timer->lock);
+    return NULL;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload, void *timer_id,
+        TimerCallbackFunction_t cb)
+{
+    struct host_timer *timer = calloc(1, sizeof(struct host_timer));
+    if (!timer) {
+        return NULL;
+    }
+    pthread_mutex_init(&timer->lock, NULL);
+    host_cond_init(&timer->changed);
+    timer->period = period;
+    timer->auto_reload = auto_reload;
+    timer->timer_id = timer_id;
+    timer->cb = cb;
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t timeout)
+{
+    pthread_mutex_lock(&timer->lock);
+    if (!timer->thread_started) {
+        if (pthread_create(&timer->thread, NULL, host_timer_thread, timer) != 0) {
+            pthread_mutex_unlock(&timer->lock);
+            return pdFAIL;
+        }
+        timer->thread_started = true;
+    }
+    timer->running = true;
+    pthread_cond_signal(&timer->changed);
+    pthread_mutex_unlock(&timer->lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t timeout)
+{
+    pthread_mutex_lock(&timer->lock);
+    timer->running = false;
+    pthread_cond_signal(&timer->changed);
+    pthread_mutex_unlock(&timer->lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t timeout)
+{
+    pthread_mutex_lock(&timer->lock);
+    timer->deleted = true;
+    pthread_cond_signal(&timer->changed);
+    bool thread_started = timer->thread_started;
+    pthread_mutex_unlock(&timer->lock);
+    if (thread_started) {
+        pthread_join(timer->thread, NULL);
+    }
+    pthread_cond_destroy(&timer->changed);
+    pthread_mutex_destroy(&timer->lock);
+    free(timer);
+    return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->timer_id;
+}
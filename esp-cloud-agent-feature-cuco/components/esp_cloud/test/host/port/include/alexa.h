@@ -0,0 +1,35 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+/* Stand-in for the Alexa sign in API of the product application. See app_host.c */
+
+enum {
+    auth_type_comp_app = 1,
+};
+
+typedef struct {
+    int type;
+    union {
+        struct {
+            char *redirect_uri;
+            char *auth_code;
+            char *client_id;
+            char *code_verifier;
+        } comp_app;
+    } u;
+} auth_delegate_config_t;
+
+int alexa_auth_delegate_signin(auth_delegate_config_t *cfg);
+int alexa_auth_delegate_signout(void);
@@ -0,0 +1,54 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+/* Stand-ins for the declarations of the product application which esp_cloud uses. The
+ * application is not part of this repository. See app_host.c
+ */
+
+enum {
+    NOTICE_BINDED = 1,
+};
+
+/* Values of the "OTA_F" flag in the custom config storage */
+enum {
+    CUSTOM_INIT = 0,
+    APP_OTA_OK,
+    APP_OTA_FAIL,
+    FORCE_OTA_INIT,
+    FORCE_OTA_START,
+    FORCE_OTA_FINISH,
+    FORCE_OTA_UPDATE,
+    MAX_OTA_CUSTOM,
+    CUSTOM_INVALID = 0xff,
+};
+
+enum {
+    OTA_UPDATE,
+};
+
+enum {
+    APP_TYPE,
+    SERVER_TYPE,
+};
+
+extern int user_bind_flag;
+
+char *custom_config_storage_get(const char *key);
+uint8_t custom_config_storage_get_u8(const char *key);
+esp_err_t custom_config_storage_set_u8(const char *key, uint8_t val);
+void report_device_info_to_server(int type, int source, char *version, bool success, char *info);
@@ -0,0 +1,30 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+/* Stand-in for the provisioning state of the product application. See app_host.c */
+
+enum {
+    NOT_LOG_IN,
+    LOGED_IN,
+    LOGED_IN_NOTIVE,
+};
+
+enum {
+    NOT_LOG_OUT,
+    LOGED__OUT,
+};
+
+extern int Wait_for_alexa_in;
+extern int Wait_for_alexa_out;
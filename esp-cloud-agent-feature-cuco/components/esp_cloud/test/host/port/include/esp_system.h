@@ -0,0 +1,23 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Exits the test program, since nothing on the host can restart it */
+void esp_restart(void) __attribute__((noreturn));
+/* Bytes in use on the host heap, subtracted from a nominal heap size, so that this changes
+ * like the ESP32 free heap does
+ */
+uint32_t esp_get_free_heap_size(void);
@@ -0,0 +1,30 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+/* SNTP is not used on the host, where the system time is already set. Like the lwIP
+ * header, this brings in the time, FreeRTOS and error code declarations.
+ */
+#include <time.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define SNTP_OPMODE_POLL    0
+
+void sntp_setoperatingmode(unsigned char operating_mode);
+void sntp_setservername(unsigned char idx, const char *server);
+void sntp_init(void);
+void sntp_stop(void);
+unsigned char sntp_enabled(void);
@@ -0,0 +1,32 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+/* Configuration of the host build: the Kconfig defaults, with the loopback transport as the
+ * only one, and with diagnostics compression enabled so that it is built and tested too.
+ */
+
+#define CONFIG_ESP_CLOUD_OTA_USE_DYNAMIC_PARAMS         1
+#define CONFIG_ESP_CLOUD_SHADOW_REPORT_MIRROR           1
+#define CONFIG_ESP_CLOUD_TRANSPORT_DEFAULT_LOOPBACK     1
+#define CONFIG_ESP_CLOUD_TRANSPORT_LOOPBACK             1
+#define CONFIG_ESP_CLOUD_APP_MSG_CBOR                   1
+#define CONFIG_ESP_CLOUD_APP_TX_BUF_SIZE                384
+#define CONFIG_ESP_CLOUD_OTA_PROGRESS_INTERVAL_MS       1000
+#define CONFIG_ESP_CLOUD_DIAG_COMPRESSION               1
+#define CONFIG_ESP_CLOUD_DIAG_COMPRESSION_WINDOW_BITS   8
+#define CONFIG_ESP_CLOUD_TRACE                          1
+#define CONFIG_ESP_CLOUD_TRACE_RECORDS                  64
+#define CONFIG_ESP_CLOUD_PUBLISH_WINDOW                 4
+#define CONFIG_ESP_CLOUD_PUBLISH_QUEUE_SIZE             16
@@ -0,0 +1,233 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sdkconfig.h>
+#include "esp_cloud_app_msg.h"
+#include "esp_cloud_cbor.h"
+#include "unity.h"
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef CONFIG_ESP_CLOUD_APP_MSG_CBOR
+
+/* Tests of the app topic messages in CBOR against the same messages in JSON: the commands
+ * must decode to the same fields, and the benchmark compares the size and the CPU time.
+ */
+
+#define APP_TEST_BUF_SIZE       384
+#define APP_TEST_DEVICE_ID      "240ac4123456"
+#ifdef ESP_PLATFORM
+#define APP_BENCH_RUNS          10000
+#else
+#define APP_BENCH_RUNS          1000000
+#endif
+
+typedef struct {
+    const char *name;
+    const char *json;
+    uint8_t cbor[APP_TEST_BUF_SIZE];
+    size_t cbor_len;
+} app_test_cmd_t;
+
+static app_test_cmd_t app_test_cmds[] = {
+    {
+        .name = "alexa_req",
+        .json = "{\"cmd\":\"alexa_req\",\"source\":\"app\",\"data\":{\"devcice_id\":\"" APP_TEST_DEVICE_ID "\","
+                "\"redirect_uri\":\"amzn://apps/android?signature=abc\",\"auth_code\":\"ANdNAVhyhqirUelHGEHA\","
+                "\"client_id\":\"amzn1.application-oa2-client.0123456789abcdef\"}}",
+    },
+    {
+        .name = "ota_upgrade",
+        .json = "{\"cmd\":\"ota_upgrade\",\"source\":\"app\",\"data\":{\"devcice_id\":\"" APP_TEST_DEVICE_ID "\","
+                "\"ota_url\":\"https://ota.example.com/firmware/1.2.3/app.bin\",\"ota_version\":\"1.2.3\","
+                "\"ota_size\":1048576}}",
+    },
+};
+
+static void app_test_put_text(esp_cloud_cbor_writer_t *w, const char *str)
+{
+    esp_cloud_cbor_put_text(w, str, strlen(str));
+}
+
+/* The CBOR form of app_test_cmds[], as the app sends them */
+static void app_test_build_cbor_cmds(void)
+{
+    esp_cloud_cbor_writer_t w;
+    app_test_cmd_t *cmd = &app_test_cmds[0];
+    esp_cloud_cbor_writer_init(&w, cmd->cbor, sizeof(cmd->cbor));
+    esp_cloud_cbor_put_map(&w, 3);
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_CMD);
+    app_test_put_text(&w, "alexa_req");
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_SOURCE);
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_SOURCE_APP);
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_DATA);
+    esp_cloud_cbor_put_map(&w, 4);
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_DEVICE_ID);
+    app_test_put_text(&w, APP_TEST_DEVICE_ID);
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_REDIRECT_URI);
+    app_test_put_text(&w, "amzn://apps/android?signature=abc");
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_AUTH_CODE);
+    app_test_put_text(&w, "ANdNAVhyhqirUelHGEHA");
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_CLIENT_ID);
+    app_test_put_text(&w, "amzn1.application-oa2-client.0123456789abcdef");
+    TEST_ASSERT_TRUE(esp_cloud_cbor_writer_get_len(&w) > 0);
+    cmd->cbor_len = esp_cloud_cbor_writer_get_len(&w);
+
+    cmd = &app_test_cmds[1];
+    esp_cloud_cbor_writer_init(&w, cmd->cbor, sizeof(cmd->cbor));
+    esp_cloud_cbor_put_map(&w, 3);
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_CMD);
+    app_test_put_text(&w, "ota_upgrade");
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_SOURCE);
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_SOURCE_APP);
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_DATA);
+    esp_cloud_cbor_put_map(&w, 4);
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_DEVICE_ID);
+    app_test_put_text(&w, APP_TEST_DEVICE_ID);
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_OTA_URL);
+    app_test_put_text(&w, "https://ota.example.com/firmware/1.2.3/app.bin");
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_OTA_VERSION);
+    app_test_put_text(&w, "1.2.3");
+    esp_cloud_cbor_put_uint(&w, ESP_CLOUD_APP_KEY_OTA_SIZE);
+    esp_cloud_cbor_put_uint(&w, 1048576);
+    TEST_ASSERT_TRUE(esp_cloud_cbor_writer_get_len(&w) > 0);
+    cmd->cbor_len = esp_cloud_cbor_writer_get_len(&w);
+}
+
+static void app_test_assert_str_equal(const esp_cloud_app_str_t *expected, const esp_cloud_app_str_t *actual)
+{
+    TEST_ASSERT_EQUAL(expected->str == NULL, actual->str == NULL);
+    if (expected->str) {
+        TEST_ASSERT_EQUAL(expected->len, actual->len);
+        TEST_ASSERT_TRUE(memcmp(expected->str, actual->str, expected->len) == 0);
+    }
+}
+
+/* The value and message passed while sending each device message */
+static const struct {
+    int val;
+    const char *msg;
+} app_test_msg_args[ESP_CLOUD_APP_MSG_MAX] = {
+    [ESP_CLOUD_APP_MSG_BIND] = {200, "bind success"},
+    [ESP_CLOUD_APP_MSG_OTA_PROGRESS] = {42, NULL},
+    [ESP_CLOUD_APP_MSG_OTA_RESULT] = {2, NULL},
+    [ESP_CLOUD_APP_MSG_ALEXA_RES] = {200, "ok"},
+    [ESP_CLOUD_APP_MSG_ALEXA_UNBIND_RES] = {200, "ok"},
+};
+
+TEST_CASE("app commands and messages decode the same from JSON and CBOR", "[esp_cloud][app_msg]")
+{
+    app_test_build_cbor_cmds();
+    int i;
+    for (i = 0; i < sizeof(app_test_cmds) / sizeof(app_test_cmds[0]); i++) {
+        esp_cloud_app_cmd_t json_cmd, cbor_cmd;
+        TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_app_cmd_decode(app_test_cmds[i].json, strlen(app_test_cmds[i].json),
+                    &json_cmd));
+        TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_app_cmd_decode(app_test_cmds[i].cbor, app_test_cmds[i].cbor_len,
+                    &cbor_cmd));
+        TEST_ASSERT_EQUAL(ESP_CLOUD_APP_ENCODING_JSON, json_cmd.encoding);
+        TEST_ASSERT_EQUAL(ESP_CLOUD_APP_ENCODING_CBOR, cbor_cmd.encoding);
+        TEST_ASSERT_TRUE(esp_cloud_app_str_equals(&json_cmd.cmd, app_test_cmds[i].name));
+        TEST_ASSERT_FALSE(json_cmd.from_device);
+        TEST_ASSERT_FALSE(cbor_cmd.from_device);
+        app_test_assert_str_equal(&json_cmd.cmd, &cbor_cmd.cmd);
+        app_test_assert_str_equal(&json_cmd.device_id, &cbor_cmd.device_id);
+        app_test_assert_str_equal(&json_cmd.redirect_uri, &cbor_cmd.redirect_uri);
+        app_test_assert_str_equal(&json_cmd.auth_code, &cbor_cmd.auth_code);
+        app_test_assert_str_equal(&json_cmd.client_id, &cbor_cmd.client_id);
+        app_test_assert_str_equal(&json_cmd.ota_url, &cbor_cmd.ota_url);
+        app_test_assert_str_equal(&json_cmd.ota_version, &cbor_cmd.ota_version);
+        TEST_ASSERT_EQUAL(json_cmd.ota_size, cbor_cmd.ota_size);
+    }
+
+    /* The messages of the device are received on the same topic, and are told apart */
+    for (i = 0; i < ESP_CLOUD_APP_MSG_MAX; i++) {
+        const esp_cloud_app_msg_desc_t *desc = esp_cloud_app_msg_get_desc(i);
+        esp_cloud_app_encoding_t encoding;
+        for (encoding = ESP_CLOUD_APP_ENCODING_JSON; encoding <= ESP_CLOUD_APP_ENCODING_CBOR; encoding++) {
+            uint8_t buf[APP_TEST_BUF_SIZE];
+            size_t len;
+            esp_cloud_app_cmd_t cmd;
+            TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_app_msg_encode(desc, APP_TEST_DEVICE_ID, app_test_msg_args[i].val,
+                        app_test_msg_args[i].msg, encoding, buf, sizeof(buf), &len));
+            TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_app_cmd_decode(buf, len, &cmd));
+            TEST_ASSERT_EQUAL(encoding, cmd.encoding);
+            TEST_ASSERT_TRUE(cmd.from_device);
+            TEST_ASSERT_TRUE(esp_cloud_app_str_equals(&cmd.cmd, desc->cmd));
+        }
+    }
+}
+
+static int64_t app_test_time_us(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+TEST_CASE("app message size and CPU time in JSON and CBOR", "[esp_cloud][app_msg][perf]")
+{
+    app_test_build_cbor_cmds();
+    int i, run;
+    static uint8_t buf[APP_TEST_BUF_SIZE];
+    size_t len[2];
+    int64_t elapsed[2];
+    esp_cloud_app_encoding_t encoding;
+
+    printf("Encoding the device messages, bytes and ns per message, JSON against CBOR:\n");
+    for (i = 0; i < ESP_CLOUD_APP_MSG_MAX; i++) {
+        const esp_cloud_app_msg_desc_t *desc = esp_cloud_app_msg_get_desc(i);
+        for (encoding = ESP_CLOUD_APP_ENCODING_JSON; encoding <= ESP_CLOUD_APP_ENCODING_CBOR; encoding++) {
+            int64_t start = app_test_time_us();
+            for (run = 0; run < APP_BENCH_RUNS; run++) {
+                TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_app_msg_encode(desc, APP_TEST_DEVICE_ID,
+                            app_test_msg_args[i].val, app_test_msg_args[i].msg, encoding, buf, sizeof(buf),
+                            &len[encoding]));
+            }
+            elapsed[encoding] = app_test_time_us() - start;
+        }
+        printf("%-16s %3d / %3d bytes, %5.0f / %5.0f ns\n", desc->cmd, (int)len[0], (int)len[1],
+                (double)elapsed[0] * 1000 / APP_BENCH_RUNS, (double)elapsed[1] * 1000 / APP_BENCH_RUNS);
+        TEST_ASSERT_TRUE(len[1] < len[0]);
+    }
+
+    printf("Decoding the app commands, bytes and ns per command, JSON against CBOR:\n");
+    for (i = 0; i < sizeof(app_test_cmds) / sizeof(app_test_cmds[0]); i++) {
+        esp_cloud_app_cmd_t cmd;
+        const void *payloads[2] = {app_test_cmds[i].json, app_test_cmds[i].cbor};
+        len[0] = strlen(app_test_cmds[i].json);
+        len[1] = app_test_cmds[i].cbor_len;
+        for (encoding = ESP_CLOUD_APP_ENCODING_JSON; encoding <= ESP_CLOUD_APP_ENCODING_CBOR; encoding++) {
+            int64_t start = app_test_time_us();
+            for (run = 0; run < APP_BENCH_RUNS; run++) {
+                TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_app_cmd_decode(payloads[encoding], len[encoding], &cmd));
+            }
+            elapsed[encoding] = app_test_time_us() - start;
+        }
+        printf("%-16s %3d / %3d bytes, %5.0f / %5.0f ns\n", app_test_cmds[i].name, (int)len[0], (int)len[1],
+                (double)elapsed[0] * 1000 / APP_BENCH_RUNS, (double)elapsed[1] * 1000 / APP_BENCH_RUNS);
+        TEST_ASSERT_TRUE(len[1] < len[0]);
+    }
+}
+
+#endif /* CONFIG_ESP_CLOUD_APP_MSG_CBOR */
@@ -0,0 +1,580 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_system.h>
+#include <esp_cloud.h>
+#include <esp_cloud_loopback.h>
+#include "esp_cloud_publish_queue.h"
+#include "esp_cloud_platform.h"
+#include "esp_cloud_topics.h"
+#include "esp_cloud_app_msg.h"
+#include "unity.h"
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#include <tcpip_adapter.h>
+#else
+#include <time.h>
+#endif
+
+/* Tests of the agent against the loopback transport. The tap plays the cloud, and messages
+ * are injected as if received from it.
+ */
+
+#define LOOPBACK_TEST_TIMEOUT_MS    2000
+#define LOOPBACK_TEST_PAYLOAD_SIZE  256
+/* Twice the largest publish window */
+#define LOOPBACK_TEST_BURST         32
+#define LOOPBACK_TEST_SOAK_CYCLES   1000
+#define LOOPBACK_TEST_SOAK_WARMUP   10
+#define LOOPBACK_TEST_RATE_MSGS     64
+/* Broker round trip time for the throughput benchmark */
+#define LOOPBACK_TEST_RATE_RTT_MS   20
+#define LOOPBACK_TEST_OTA_IMAGE_LEN (512 * 1024)
+/* Read at a time, like the esp_https_ota buffer */
+#define LOOPBACK_TEST_OTA_CHUNK_LEN 1024
+#define LOOPBACK_TEST_OTA_RTT_MS    10
+/* Heap which may stay in use over the soak cycles without a leak. The host C library keeps
+ * the TLS block of an exited thread cached with its stack. A leak in every cycle would add
+ * up to far more.
+ */
+#ifdef ESP_PLATFORM
+#define LOOPBACK_TEST_SOAK_SLACK    0
+#else
+#define LOOPBACK_TEST_SOAK_SLACK    1024
+#endif
+
+typedef struct {
+    SemaphoreHandle_t lock;
+    /* Given on every shadow update */
+    SemaphoreHandle_t shadow_updated;
+    /* Given when the "level" param is set from the cloud */
+    SemaphoreHandle_t level_set;
+    int device_info_count;
+    int shadow_update_count;
+    char update_topic[96];
+    char last_shadow[LOOPBACK_TEST_PAYLOAD_SIZE];
+    int level;
+} loopback_test_cloud_t;
+
+static loopback_test_cloud_t loopback_test_cloud;
+
+static void loopback_test_tap(const char *topic, const void *data, size_t data_len, int qos, void *priv_data)
+{
+    loopback_test_cloud_t *cloud = (loopback_test_cloud_t *)priv_data;
+    size_t topic_len = strlen(topic);
+    xSemaphoreTake(cloud->lock, portMAX_DELAY);
+    if (topic_len > strlen("/device/info") && strcmp(topic + topic_len - strlen("/device/info"), "/device/info") == 0) {
+        cloud->device_info_count++;
+    } else if (topic_len > strlen("/shadow/update") &&
+            strcmp(topic + topic_len - strlen("/shadow/update"), "/shadow/update") == 0) {
+        cloud->shadow_update_count++;
+        snprintf(cloud->update_topic, sizeof(cloud->update_topic), "%s", topic);
+        if (data_len >= sizeof(cloud->last_shadow)) {
+            data_len = sizeof(cloud->last_shadow) - 1;
+        }
+        memcpy(cloud->last_shadow, data, data_len);
+        cloud->last_shadow[data_len] = '\0';
+        xSemaphoreGive(cloud->shadow_updated);
+    }
+    xSemaphoreGive(cloud->lock);
+}
+
+static esp_err_t loopback_test_level_cb(const char *name, esp_cloud_param_val_t *param, void *priv_data)
+{
+    loopback_test_cloud_t *cloud = (loopback_test_cloud_t *)priv_data;
+    cloud->level = param->val.i;
+    xSemaphoreGive(cloud->level_set);
+    return ESP_OK;
+}
+
+/* The agent is initialised once and shared by the test cases, as there is no deinit */
+static esp_cloud_handle_t loopback_test_get_handle(void)
+{
+    esp_cloud_handle_t handle = esp_cloud_get_handle();
+    if (handle) {
+        return handle;
+    }
+    loopback_test_cloud_t *cloud = &loopback_test_cloud;
+    cloud->lock = xSemaphoreCreateMutex();
+    cloud->shadow_updated = xSemaphoreCreateBinary();
+    cloud->level_set = xSemaphoreCreateBinary();
+    TEST_ASSERT_TRUE(cloud->lock && cloud->shadow_updated && cloud->level_set);
+    esp_cloud_config_t config = {
+        .id = {
+            .name = "loopback",
+            .type = "test",
+            .model = "host",
+            .fw_version = "1.0.0",
+        },
+        .dynamic_cloud_params_count = 1,
+        .transport = ESP_CLOUD_TRANSPORT_LOOPBACK,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_init(&config, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_add_dynamic_int_param(handle, "level", 0, loopback_test_level_cb, cloud));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_loopback_set_tap(handle, loopback_test_tap, cloud));
+    return handle;
+}
+
+static void loopback_test_reset(loopback_test_cloud_t *cloud)
+{
+    xSemaphoreTake(cloud->lock, portMAX_DELAY);
+    cloud->device_info_count = 0;
+    cloud->shadow_update_count = 0;
+    cloud->last_shadow[0] = '\0';
+    xSemaphoreTake(cloud->shadow_updated, 0);
+    xSemaphoreTake(cloud->level_set, 0);
+    xSemaphoreGive(cloud->lock);
+}
+
+TEST_CASE("agent connects, reports and applies a delta over loopback", "[esp_cloud][loopback]")
+{
+    esp_cloud_handle_t handle = loopback_test_get_handle();
+    loopback_test_cloud_t *cloud = &loopback_test_cloud;
+    loopback_test_reset(cloud);
+
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_start(handle));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_cloud_start(handle));
+    /* All the params are reported after connecting */
+    TEST_ASSERT_TRUE(xSemaphoreTake(cloud->shadow_updated, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    xSemaphoreTake(cloud->lock, portMAX_DELAY);
+    TEST_ASSERT_EQUAL(1, cloud->device_info_count);
+    TEST_ASSERT_TRUE(strstr(cloud->last_shadow, "\"reported\":{\"level\":0}") != NULL);
+    char delta_topic[sizeof(cloud->update_topic) + sizeof("/delta")];
+    strcpy(delta_topic, cloud->update_topic);
+    strcat(delta_topic, "/delta");
+    xSemaphoreGive(cloud->lock);
+
+    const char *delta = "{\"version\":1,\"state\":{\"level\":5}}";
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_loopback_inject(handle, delta_topic, delta, strlen(delta)));
+    TEST_ASSERT_TRUE(xSemaphoreTake(cloud->level_set, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    TEST_ASSERT_EQUAL(5, cloud->level);
+    /* The new value is reported back */
+    TEST_ASSERT_TRUE(xSemaphoreTake(cloud->shadow_updated, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    xSemaphoreTake(cloud->lock, portMAX_DELAY);
+    TEST_ASSERT_TRUE(strstr(cloud->last_shadow, "\"reported\":{\"level\":5}") != NULL);
+    xSemaphoreGive(cloud->lock);
+
+    /* Returns once the task has exited, and stopping again does nothing */
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_stop(handle));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_stop(handle));
+}
+
+TEST_CASE("values which the shadow already has are not reported again", "[esp_cloud][loopback]")
+{
+    esp_cloud_handle_t handle = loopback_test_get_handle();
+    loopback_test_cloud_t *cloud = &loopback_test_cloud;
+    loopback_test_reset(cloud);
+
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_start(handle));
+    TEST_ASSERT_TRUE(xSemaphoreTake(cloud->shadow_updated, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_update_int_param(handle, "level", 7));
+    TEST_ASSERT_TRUE(xSemaphoreTake(cloud->shadow_updated, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+
+    esp_cloud_shadow_stats_t before, after;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_get_shadow_stats(handle, &before));
+    xSemaphoreTake(cloud->lock, portMAX_DELAY);
+    int update_count = cloud->shadow_update_count;
+    xSemaphoreGive(cloud->lock);
+    /* Setting the same value again only counts as suppressed */
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_update_int_param(handle, "level", 7));
+    int waited_ms = 0;
+    do {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        waited_ms += 10;
+        TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_get_shadow_stats(handle, &after));
+    } while (after.suppressed == before.suppressed && waited_ms < LOOPBACK_TEST_TIMEOUT_MS);
+    TEST_ASSERT_EQUAL(before.suppressed + 1, after.suppressed);
+
+    /* A different value is reported as usual, and is the only update since */
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_update_int_param(handle, "level", 8));
+    TEST_ASSERT_TRUE(xSemaphoreTake(cloud->shadow_updated, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    xSemaphoreTake(cloud->lock, portMAX_DELAY);
+    TEST_ASSERT_EQUAL(update_count + 1, cloud->shadow_update_count);
+    TEST_ASSERT_TRUE(strstr(cloud->last_shadow, "\"reported\":{\"level\":8}") != NULL);
+    xSemaphoreGive(cloud->lock);
+
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_stop(handle));
+}
+
+typedef struct {
+    SemaphoreHandle_t done;
+    int calls[LOOPBACK_TEST_BURST];
+    esp_err_t results[LOOPBACK_TEST_BURST];
+} loopback_test_burst_t;
+
+static loopback_test_burst_t *loopback_test_burst;
+
+static void loopback_test_burst_cb(esp_err_t result, void *priv_data)
+{
+    int i = (intptr_t)priv_data;
+    loopback_test_burst->calls[i]++;
+    loopback_test_burst->results[i] = result;
+    xSemaphoreGive(loopback_test_burst->done);
+}
+
+TEST_CASE("background QoS0 publishes each complete their own callback", "[esp_cloud][loopback]")
+{
+    esp_cloud_handle_t handle = loopback_test_get_handle();
+    loopback_test_cloud_t *cloud = &loopback_test_cloud;
+    loopback_test_reset(cloud);
+    static loopback_test_burst_t burst;
+    memset(&burst, 0, sizeof(burst));
+    burst.done = xSemaphoreCreateCounting(LOOPBACK_TEST_BURST, 0);
+    TEST_ASSERT_NOT_NULL(burst.done);
+    loopback_test_burst = &burst;
+    esp_cloud_msg_policy_t policy;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_get_msg_policy(handle, ESP_CLOUD_MSG_CLASS_DIAGNOSTICS, &policy));
+    TEST_ASSERT_EQUAL(0, policy.qos);
+    esp_cloud_publish_stats_t before, after;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_get_publish_stats(handle, &before));
+
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_start(handle));
+    TEST_ASSERT_TRUE(xSemaphoreTake(cloud->shadow_updated, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    int i;
+    int completed = 0;
+    for (i = 0; i < LOOPBACK_TEST_BURST; i++) {
+        char data[16];
+        snprintf(data, sizeof(data), "{\"n\":%d}", i);
+        /* Queued faster than they are sent. Once the queue is full, one more is queued
+         * for each one completed.
+         */
+        while (esp_cloud_publish_async(handle, "loopback/test/burst", data, ESP_CLOUD_MSG_CLASS_DIAGNOSTICS,
+                    loopback_test_burst_cb, (void *)(intptr_t)i) != ESP_OK) {
+            TEST_ASSERT_TRUE(xSemaphoreTake(burst.done, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+            completed++;
+        }
+    }
+    for (; completed < LOOPBACK_TEST_BURST; completed++) {
+        TEST_ASSERT_TRUE(xSemaphoreTake(burst.done, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_stop(handle));
+    for (i = 0; i < LOOPBACK_TEST_BURST; i++) {
+        TEST_ASSERT_EQUAL(1, burst.calls[i]);
+        TEST_ASSERT_EQUAL(ESP_OK, burst.results[i]);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_get_publish_stats(handle, &after));
+    TEST_ASSERT_EQUAL(before.acked + LOOPBACK_TEST_BURST, after.acked);
+    TEST_ASSERT_EQUAL(before.failed, after.failed);
+    TEST_ASSERT_EQUAL(0, after.in_flight);
+    vSemaphoreDelete(burst.done);
+}
+
+/* Connect, report and disconnect once */
+static void loopback_test_cycle(esp_cloud_handle_t handle, loopback_test_cloud_t *cloud)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_start(handle));
+    TEST_ASSERT_TRUE(xSemaphoreTake(cloud->shadow_updated, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_stop(handle));
+}
+
+TEST_CASE("heap is flat over repeated connect and disconnect cycles", "[esp_cloud][loopback][soak]")
+{
+    esp_cloud_handle_t handle = loopback_test_get_handle();
+    loopback_test_cloud_t *cloud = &loopback_test_cloud;
+    loopback_test_reset(cloud);
+
+    /* The first cycles allocate what is kept for the later ones */
+    int i;
+    for (i = 0; i < LOOPBACK_TEST_SOAK_WARMUP; i++) {
+        loopback_test_cycle(handle, cloud);
+    }
+    /* Let the idle task free the TCB and stack of the deleted cloud task */
+    vTaskDelay(pdMS_TO_TICKS(100));
+    uint32_t free_heap = esp_get_free_heap_size();
+    for (i = 0; i < LOOPBACK_TEST_SOAK_CYCLES; i++) {
+        loopback_test_cycle(handle, cloud);
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+    int lost = (int)(free_heap - esp_get_free_heap_size());
+    printf("Heap lost over %d connect cycles: %d bytes\n", LOOPBACK_TEST_SOAK_CYCLES, lost);
+    TEST_ASSERT_TRUE_MESSAGE(lost <= LOOPBACK_TEST_SOAK_SLACK, "Heap leaked over the connect cycles");
+    xSemaphoreTake(cloud->lock, portMAX_DELAY);
+    TEST_ASSERT_EQUAL(LOOPBACK_TEST_SOAK_WARMUP + LOOPBACK_TEST_SOAK_CYCLES, cloud->device_info_count);
+    xSemaphoreGive(cloud->lock);
+}
+
+static int64_t loopback_test_time_us(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+typedef struct {
+    SemaphoreHandle_t done;
+    int64_t queued_at[LOOPBACK_TEST_RATE_MSGS];
+    int64_t latency[LOOPBACK_TEST_RATE_MSGS];
+    esp_err_t results[LOOPBACK_TEST_RATE_MSGS];
+} loopback_test_rate_t;
+
+static loopback_test_rate_t *loopback_test_rate;
+
+static void loopback_test_rate_cb(esp_err_t result, void *priv_data)
+{
+    int i = (intptr_t)priv_data;
+    loopback_test_rate->latency[i] = loopback_test_time_us() - loopback_test_rate->queued_at[i];
+    loopback_test_rate->results[i] = result;
+    xSemaphoreGive(loopback_test_rate->done);
+}
+
+/* Publish all the messages, with up to window of them awaiting the PUBACK at a time, and
+ * return the time taken in us
+ */
+static int64_t loopback_test_rate_run(esp_cloud_handle_t handle, loopback_test_rate_t *rate, int window)
+{
+    int i, completed = 0;
+    int64_t start = loopback_test_time_us();
+    for (i = 0; i < LOOPBACK_TEST_RATE_MSGS; i++) {
+        char data[16];
+        snprintf(data, sizeof(data), "{\"n\":%d}", i);
+        while (i - completed >= window) {
+            TEST_ASSERT_TRUE(xSemaphoreTake(rate->done, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+            completed++;
+        }
+        rate->queued_at[i] = loopback_test_time_us();
+        while (esp_cloud_publish_async(handle, "loopback/test/rate", data, ESP_CLOUD_MSG_CLASS_DIAGNOSTICS,
+                    loopback_test_rate_cb, (void *)(intptr_t)i) != ESP_OK) {
+            TEST_ASSERT_TRUE(xSemaphoreTake(rate->done, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+            completed++;
+        }
+    }
+    for (; completed < LOOPBACK_TEST_RATE_MSGS; completed++) {
+        TEST_ASSERT_TRUE(xSemaphoreTake(rate->done, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    }
+    int64_t elapsed = loopback_test_time_us() - start;
+    int64_t total_latency = 0, max_latency = 0;
+    for (i = 0; i < LOOPBACK_TEST_RATE_MSGS; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, rate->results[i]);
+        total_latency += rate->latency[i];
+        if (rate->latency[i] > max_latency) {
+            max_latency = rate->latency[i];
+        }
+    }
+    printf("%s: %.1f msgs/s, ack latency %.1f ms average, %.1f ms max\n",
+            window == 1 ? "One at a time" : "Pipelined", (double)LOOPBACK_TEST_RATE_MSGS * 1000000 / elapsed,
+            (double)total_latency / LOOPBACK_TEST_RATE_MSGS / 1000, (double)max_latency / 1000);
+    return elapsed;
+}
+
+/* QoS1 messages published one at a time, waiting for each PUBACK like a blocking publish,
+ * against the publish queue keeping CONFIG_ESP_CLOUD_PUBLISH_WINDOW of them in flight
+ */
+TEST_CASE("QoS1 publish throughput with a broker round trip", "[esp_cloud][loopback][perf]")
+{
+    esp_cloud_handle_t handle = loopback_test_get_handle();
+    loopback_test_cloud_t *cloud = &loopback_test_cloud;
+    loopback_test_reset(cloud);
+    static loopback_test_rate_t rate;
+    memset(&rate, 0, sizeof(rate));
+    rate.done = xSemaphoreCreateCounting(LOOPBACK_TEST_RATE_MSGS, 0);
+    TEST_ASSERT_NOT_NULL(rate.done);
+    loopback_test_rate = &rate;
+    esp_cloud_msg_policy_t policy, qos1_policy;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_get_msg_policy(handle, ESP_CLOUD_MSG_CLASS_DIAGNOSTICS, &policy));
+    qos1_policy = policy;
+    qos1_policy.qos = 1;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_set_msg_policy(handle, ESP_CLOUD_MSG_CLASS_DIAGNOSTICS, &qos1_policy));
+
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_start(handle));
+    TEST_ASSERT_TRUE(xSemaphoreTake(cloud->shadow_updated, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_loopback_set_ack_latency(handle, LOOPBACK_TEST_RATE_RTT_MS));
+    printf("%d QoS1 messages with a round trip time of %d ms\n", LOOPBACK_TEST_RATE_MSGS,
+            LOOPBACK_TEST_RATE_RTT_MS);
+    int64_t serial_time = loopback_test_rate_run(handle, &rate, 1);
+    /* As many outstanding as the queue takes, so that none is dropped */
+    int64_t pipelined_time = loopback_test_rate_run(handle, &rate, CONFIG_ESP_CLOUD_PUBLISH_QUEUE_SIZE);
+    esp_cloud_publish_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_get_publish_stats(handle, &stats));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_loopback_set_ack_latency(handle, 0));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_stop(handle));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_set_msg_policy(handle, ESP_CLOUD_MSG_CLASS_DIAGNOSTICS, &policy));
+    vSemaphoreDelete(rate.done);
+
+    printf("Most messages in flight: %u\n", stats.max_in_flight);
+    TEST_ASSERT_TRUE(stats.max_in_flight > 1);
+    /* Several round trips overlap, so the burst takes a fraction of the time */
+    TEST_ASSERT_TRUE(pipelined_time * 2 < serial_time);
+}
+
+/* Local HTTP stand-in for the OTA server, which serves one request for the image */
+typedef struct {
+    int listen_fd;
+    SemaphoreHandle_t done;
+} loopback_test_http_t;
+
+static void loopback_test_http_task(void *arg)
+{
+    loopback_test_http_t *http = arg;
+    int fd = accept(http->listen_fd, NULL, NULL);
+    if (fd >= 0) {
+        static char body[1460];
+        char req[256];
+        memset(body, 0xa5, sizeof(body));
+        /* The request fits in one segment, and its contents do not matter */
+        recv(fd, req, sizeof(req), 0);
+        int len = snprintf(req, sizeof(req), "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n",
+                LOOPBACK_TEST_OTA_IMAGE_LEN);
+        int sent = send(fd, req, len, 0);
+        int remaining = LOOPBACK_TEST_OTA_IMAGE_LEN;
+        while (sent > 0 && remaining > 0) {
+            sent = send(fd, body, remaining < sizeof(body) ? remaining : sizeof(body), 0);
+            remaining -= sent;
+        }
+        close(fd);
+    }
+    xSemaphoreGive(http->done);
+    vTaskDelete(NULL);
+}
+
+static int loopback_test_sync_msgs;
+
+typedef void (*loopback_test_progress_fn_t)(esp_cloud_handle_t handle, int progress_val);
+
+/* How the OTA progress was reported before the mailbox: the message is built and published,
+ * waiting for the PUBACK, in the task doing the download
+ */
+static void loopback_test_progress_sync(esp_cloud_handle_t handle, int progress_val)
+{
+    esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
+    const esp_cloud_app_msg_desc_t *desc = esp_cloud_app_msg_get_desc(ESP_CLOUD_APP_MSG_OTA_PROGRESS);
+    char buf[LOOPBACK_TEST_PAYLOAD_SIZE];
+    size_t len;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_app_msg_encode(desc, int_handle->device_id, progress_val, NULL,
+                ESP_CLOUD_APP_ENCODING_JSON, buf, sizeof(buf), &len));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_platform_publish_data(int_handle,
+                esp_cloud_topic_get(int_handle, ESP_CLOUD_TOPIC_APP), buf, len, ESP_CLOUD_MSG_CLASS_PROGRESS));
+    loopback_test_sync_msgs++;
+}
+
+static void loopback_test_progress_mailbox(esp_cloud_handle_t handle, int progress_val)
+{
+    ota_report_progress_val_to_app(progress_val);
+}
+
+/* Download the image from the HTTP stand-in, reporting every change in the percentage with
+ * progress, if not NULL. Returns the time taken in us.
+ */
+static int64_t loopback_test_ota_download(esp_cloud_handle_t handle, loopback_test_progress_fn_t progress)
+{
+    static char buf[LOOPBACK_TEST_OTA_CHUNK_LEN];
+    loopback_test_http_t http;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addr_len = sizeof(addr);
+    http.done = xSemaphoreCreateBinary();
+    TEST_ASSERT_NOT_NULL(http.done);
+    http.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    TEST_ASSERT_TRUE(http.listen_fd >= 0);
+    /* Any free port */
+    TEST_ASSERT_EQUAL(0, bind(http.listen_fd, (struct sockaddr *)&addr, sizeof(addr)));
+    TEST_ASSERT_EQUAL(0, listen(http.listen_fd, 1));
+    TEST_ASSERT_EQUAL(0, getsockname(http.listen_fd, (struct sockaddr *)&addr, &addr_len));
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(loopback_test_http_task, "test_http", 4096, &http, 5, NULL));
+
+    int64_t start = loopback_test_time_us();
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL(0, connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+    const char *req = "GET /firmware.bin HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    TEST_ASSERT_EQUAL(strlen(req), send(fd, req, strlen(req), 0));
+    /* Skip the headers. The body starts right after them in the same read. */
+    int len = 0, received = 0, last_val = -1;
+    char *body = NULL;
+    while (!body) {
+        int n = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+        TEST_ASSERT_TRUE(n > 0);
+        len += n;
+        buf[len] = '\0';
+        body = strstr(buf, "\r\n\r\n");
+    }
+    received = len - (body + 4 - buf);
+    do {
+        int progress_val = (int)((int64_t)received * 100 / LOOPBACK_TEST_OTA_IMAGE_LEN);
+        if (progress && progress_val != last_val) {
+            progress(handle, progress_val);
+            last_val = progress_val;
+        }
+        if (received == LOOPBACK_TEST_OTA_IMAGE_LEN) {
+            break;
+        }
+        int n = recv(fd, buf, sizeof(buf), 0);
+        TEST_ASSERT_TRUE(n > 0);
+        received += n;
+    } while (1);
+    int64_t elapsed = loopback_test_time_us() - start;
+    close(fd);
+    TEST_ASSERT_TRUE(xSemaphoreTake(http.done, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    close(http.listen_fd);
+    vSemaphoreDelete(http.done);
+    return elapsed;
+}
+
+TEST_CASE("OTA download throughput with progress reports", "[esp_cloud][loopback][perf]")
+{
+#ifdef ESP_PLATFORM
+    tcpip_adapter_init();
+#endif
+    esp_cloud_handle_t handle = loopback_test_get_handle();
+    loopback_test_cloud_t *cloud = &loopback_test_cloud;
+    loopback_test_reset(cloud);
+    /* Every publish used to be QoS1 */
+    esp_cloud_msg_policy_t policy, qos1_policy;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_get_msg_policy(handle, ESP_CLOUD_MSG_CLASS_PROGRESS, &policy));
+    qos1_policy = policy;
+    qos1_policy.qos = 1;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_set_msg_policy(handle, ESP_CLOUD_MSG_CLASS_PROGRESS, &qos1_policy));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_start(handle));
+    TEST_ASSERT_TRUE(xSemaphoreTake(cloud->shadow_updated, pdMS_TO_TICKS(LOOPBACK_TEST_TIMEOUT_MS)) == pdTRUE);
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_loopback_set_ack_latency(handle, LOOPBACK_TEST_OTA_RTT_MS));
+
+    printf("OTA image of %d KB in %d byte reads, broker round trip of %d ms\n",
+            LOOPBACK_TEST_OTA_IMAGE_LEN / 1024, LOOPBACK_TEST_OTA_CHUNK_LEN, LOOPBACK_TEST_OTA_RTT_MS);
+    int64_t plain_time = loopback_test_ota_download(handle, NULL);
+    loopback_test_sync_msgs = 0;
+    int64_t sync_time = loopback_test_ota_download(handle, loopback_test_progress_sync);
+    esp_cloud_publish_stats_t before, after;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_get_publish_stats(handle, &before));
+    int64_t mailbox_time = loopback_test_ota_download(handle, loopback_test_progress_mailbox);
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_get_publish_stats(handle, &after));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_loopback_set_ack_latency(handle, 0));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_stop(handle));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_set_msg_policy(handle, ESP_CLOUD_MSG_CLASS_PROGRESS, &policy));
+
+    int mailbox_msgs = after.queued - before.queued;
+    printf("No progress reports: %.2f MB/s\n", (double)LOOPBACK_TEST_OTA_IMAGE_LEN / plain_time);
+    printf("Published from the download: %.2f MB/s, %d progress messages\n",
+            (double)LOOPBACK_TEST_OTA_IMAGE_LEN / sync_time, loopback_test_sync_msgs);
+    printf("Mailbox: %.2f MB/s, %d progress messages\n", (double)LOOPBACK_TEST_OTA_IMAGE_LEN / mailbox_time,
+            mailbox_msgs);
+    /* At least the first and the final value, and no more than one per interval besides */
+    TEST_ASSERT_TRUE(mailbox_msgs >= 2);
+    TEST_ASSERT_TRUE(mailbox_msgs <= 2 + mailbox_time / 1000 / CONFIG_ESP_CLOUD_OTA_PROGRESS_INTERVAL_MS + 1);
+    TEST_ASSERT_TRUE(mailbox_time < sync_time);
+}
@@ -0,0 +1,356 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_cloud_lz.h"
+#include "unity.h"
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+/* Tests of the LZSS compressor. The output is checked with a decoder for the heatshrink bit
+ * stream written from its description in esp_cloud_lz.h, on payloads like the diagnostics
+ * and shadow documents the agent sends.
+ */
+
+#define LZ_TEST_PAYLOAD_SIZE    4096
+#ifdef ESP_PLATFORM
+#define LZ_BENCH_RUNS           100
+#else
+#define LZ_BENCH_RUNS           10000
+#endif
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    /* Writes attempted after one did not fit */
+    int writes_after_full;
+    bool full;
+} lz_test_out_t;
+
+/* The encoder is a little over 2 << ESP_CLOUD_LZ_WINDOW_BITS bytes, so it is not kept on the stack */
+static esp_cloud_lz_encoder_t lz_test_enc;
+
+static size_t lz_test_write(const uint8_t *data, size_t len, void *priv_data)
+{
+    lz_test_out_t *out = (lz_test_out_t *)priv_data;
+    if (out->full) {
+        out->writes_after_full++;
+        return 0;
+    }
+    if (out->len + len > out->size) {
+        out->full = true;
+        return 0;
+    }
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+    return len;
+}
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t bit_pos;
+} lz_test_bits_t;
+
+static int lz_test_get_bits(lz_test_bits_t *in, int count, uint32_t *val)
+{
+    if (in->bit_pos + count > in->len * 8) {
+        return -1;
+    }
+    *val = 0;
+    while (count--) {
+        *val = (*val << 1) | ((in->data[in->bit_pos / 8] >> (7 - in->bit_pos % 8)) & 1);
+        in->bit_pos++;
+    }
+    return 0;
+}
+
+/* Returns the decoded length, or -1 if the stream is invalid or the output does not fit.
+ * A token cut short can only be the padding of the last byte.
+ */
+static int lz_test_decode(const uint8_t *data, size_t len, uint8_t *out, size_t out_size)
+{
+    lz_test_bits_t in = {
+        .data = data,
+        .len = len,
+    };
+    size_t out_len = 0;
+    uint32_t flag, val, distance, count;
+    while (lz_test_get_bits(&in, 1, &flag) == 0) {
+        if (flag) {
+            if (lz_test_get_bits(&in, 8, &val) != 0) {
+                break;
+            }
+            if (out_len >= out_size) {
+                return -1;
+            }
+            out[out_len++] = val;
+        } else {
+            if (lz_test_get_bits(&in, ESP_CLOUD_LZ_WINDOW_BITS, &distance) != 0 ||
+                    lz_test_get_bits(&in, ESP_CLOUD_LZ_LOOKAHEAD_BITS, &count) != 0) {
+                break;
+            }
+            distance++;
+            count++;
+            if (distance > out_len || out_len + count > out_size) {
+                return -1;
+            }
+            /* A byte at a time, since the match may overlap the bytes being written */
+            while (count--) {
+                out[out_len] = out[out_len - distance];
+                out_len++;
+            }
+        }
+    }
+    if (len * 8 - in.bit_pos >= 8) {
+        return -1;
+    }
+    return out_len;
+}
+
+/* Compress data, fed in pieces of piece_len bytes, into out, which is allocated with room for
+ * the worst case. Returns the compressed length after checking that it decodes to data.
+ */
+static size_t lz_test_round_trip(const uint8_t *data, size_t len, size_t piece_len, uint8_t **out_buf)
+{
+    lz_test_out_t out = {
+        .size = len + len / 8 + 1,
+    };
+    out.buf = malloc(out.size);
+    uint8_t *decoded = malloc(len + 1);
+    TEST_ASSERT_TRUE(out.buf && decoded);
+    esp_cloud_lz_encoder_init(&lz_test_enc, lz_test_write, &out);
+    size_t pos = 0;
+    while (pos < len) {
+        size_t n = (len - pos < piece_len) ? len - pos : piece_len;
+        TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_lz_encoder_feed(&lz_test_enc, data + pos, n));
+        pos += n;
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_lz_encoder_finish(&lz_test_enc));
+    /* Literals take 9 bits, so nothing grows by more than that */
+    TEST_ASSERT_TRUE(out.len <= (len * 9 + 7) / 8);
+    TEST_ASSERT_EQUAL((int)len, lz_test_decode(out.buf, out.len, decoded, len + 1));
+    TEST_ASSERT_TRUE(memcmp(data, decoded, len) == 0);
+    free(decoded);
+    if (out_buf) {
+        *out_buf = out.buf;
+    } else {
+        free(out.buf);
+    }
+    return out.len;
+}
+
+/* Periodic diagnostics, like the heap and task reports of the applications */
+static size_t lz_test_diagnostics(char *buf, size_t size)
+{
+    static const char *tasks[] = {"cloud", "mqtt_task", "tiT", "wifi", "app_main", "button"};
+    size_t len = snprintf(buf, size, "{\"ts\":1571234567,\"heap\":{\"free\":%d,\"min_free\":%d,"
+            "\"largest_block\":%d},\"tasks\":[", 123456, 98304, 65536);
+    int i;
+    for (i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++) {
+        len += snprintf(buf + len, size - len, "%s{\"name\":\"%s\",\"stack_hwm\":%d,\"prio\":%d,"
+                "\"state\":\"blocked\"}", i ? "," : "", tasks[i], 512 + 128 * i, 5 + i % 3);
+    }
+    len += snprintf(buf + len, size - len, "],\"wifi\":{\"rssi\":-61,\"channel\":6,"
+            "\"disconnects\":2},\"reboot_reason\":\"ESP_RST_POWERON\"}");
+    return len;
+}
+
+/* A log dump, longer than the window */
+static size_t lz_test_log(char *buf, size_t size)
+{
+    static const char *lines[] = {
+        "I (%d) esp_cloud: Connecting to the cloud\n",
+        "I (%d) esp_cloud_mqtt: MQTT connected\n",
+        "W (%d) esp_cloud_publish: Publish of 212 bytes timed out, retrying\n",
+        "I (%d) esp_cloud: Shadow update accepted, version %d\n",
+    };
+    size_t len = 0;
+    int i;
+    for (i = 0; len + 80 < size; i++) {
+        len += snprintf(buf + len, size - len, lines[i % 4], 1000 + 37 * i, i);
+    }
+    return len;
+}
+
+/* A full shadow report of a device with a handful of params */
+static size_t lz_test_shadow(char *buf, size_t size)
+{
+    return snprintf(buf, size, "{\"state\":{\"reported\":{\"power\":true,\"brightness\":80,"
+            "\"hue\":180,\"saturation\":100,\"color_temperature\":4000,\"name\":\"Living Room Lamp\","
+            "\"ota_status\":\"idle\",\"ota_info\":\"\"},\"desired\":{\"power\":true,\"brightness\":80,"
+            "\"hue\":180,\"saturation\":100,\"color_temperature\":4000,\"name\":\"Living Room Lamp\","
+            "\"ota_status\":\"idle\",\"ota_info\":\"\"}}}");
+}
+
+/* Bytes which do not repeat, from xorshift32 */
+static void lz_test_random(uint8_t *buf, size_t len, uint32_t seed)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        buf[i] = seed;
+    }
+}
+
+typedef size_t (*lz_test_payload_fn_t)(char *buf, size_t size);
+
+static const struct {
+    const char *name;
+    lz_test_payload_fn_t fn;
+} lz_test_payloads[] = {
+    {"diagnostics", lz_test_diagnostics},
+    {"log dump", lz_test_log},
+    {"shadow report", lz_test_shadow},
+};
+
+TEST_CASE("lz round trips diagnostics, logs and shadow reports", "[esp_cloud][lz]")
+{
+    char *buf = malloc(LZ_TEST_PAYLOAD_SIZE);
+    TEST_ASSERT_NOT_NULL(buf);
+    int i;
+    for (i = 0; i < sizeof(lz_test_payloads) / sizeof(lz_test_payloads[0]); i++) {
+        size_t len = lz_test_payloads[i].fn(buf, LZ_TEST_PAYLOAD_SIZE);
+        size_t compressed_len = lz_test_round_trip((uint8_t *)buf, len, len, NULL);
+        TEST_ASSERT_TRUE_MESSAGE(compressed_len < len, lz_test_payloads[i].name);
+    }
+    free(buf);
+}
+
+TEST_CASE("lz compresses empty input to nothing", "[esp_cloud][lz]")
+{
+    uint8_t buf[1];
+    lz_test_out_t out = {
+        .buf = buf,
+        .size = sizeof(buf),
+    };
+    esp_cloud_lz_encoder_init(&lz_test_enc, lz_test_write, &out);
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_lz_encoder_feed(&lz_test_enc, "", 0));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_cloud_lz_encoder_finish(&lz_test_enc));
+    TEST_ASSERT_EQUAL(0, out.len);
+    TEST_ASSERT_EQUAL(0, lz_test_decode(out.buf, out.len, buf, sizeof(buf)));
+}
+
+TEST_CASE("lz round trips incompressible input", "[esp_cloud][lz]")
+{
+    static uint8_t data[1000];
+    lz_test_random(data, sizeof(data), 0x12345678);
+    size_t compressed_len = lz_test_round_trip(data, sizeof(data), sizeof(data), NULL);
+    /* Mostly literals */
+    TEST_ASSERT_TRUE(compressed_len > sizeof(data));
+}
+
+TEST_CASE("lz input larger than the window gives the same output in any pieces", "[esp_cloud][lz]")
+{
+    const size_t window = 1 << ESP_CLOUD_LZ_WINDOW_BITS;
+    uint8_t *data = malloc(LZ_TEST_PAYLOAD_SIZE);
+    TEST_ASSERT_NOT_NULL(data);
+    /* A log dump, a run of one byte with overlapping matches, and a block which repeats only
+     * beyond the window
+     */
+    size_t len = lz_test_log((char *)data, LZ_TEST_PAYLOAD_SIZE / 2);
+    memset(data + len, '=', window + 3);
+    len += window + 3;
+    size_t block_len = (LZ_TEST_PAYLOAD_SIZE - len) / 3;
+    TEST_ASSERT_TRUE(block_len > 2 * ESP_CLOUD_LZ_WINDOW_BITS);
+    lz_test_random(data + len, 2 * block_len, 0xcafe);
+    memcpy(data + len + 2 * block_len, data + len, block_len);
+    len += 3 * block_len;
+
+    uint8_t *whole;
+    size_t whole_len = lz_test_round_trip(data, len, len, &whole);
+    static const size_t pieces[] = {1, 7, 255, 257};
+    int i;
+    for (i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+        uint8_t *out;
+        TEST_ASSERT_EQUAL(whole_len, lz_test_round_trip(data, len, pieces[i], &out));
+        TEST_ASSERT_TRUE(memcmp(whole, out, whole_len) == 0);
+        free(out);
+    }
+    free(whole);
+    free(data);
+}
+
+TEST_CASE("lz stops writing once the output is full", "[esp_cloud][lz]")
+{
+    static uint8_t data[1000];
+    uint8_t buf[64];
+    lz_test_random(data, sizeof(data), 0x9e3779b9);
+    lz_test_out_t out = {
+        .buf = buf,
+        .size = sizeof(buf),
+    };
+    esp_cloud_lz_encoder_init(&lz_test_enc, lz_test_write, &out);
+    esp_err_t err = esp_cloud_lz_encoder_feed(&lz_test_enc, data, sizeof(data));
+    if (err == ESP_OK) {
+        err = esp_cloud_lz_encoder_finish(&lz_test_enc);
+    }
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, err);
+    TEST_ASSERT_EQUAL(sizeof(buf), out.len);
+    TEST_ASSERT_EQUAL(0, out.writes_after_full);
+    /* The error sticks */
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, esp_cloud_lz_encoder_feed(&lz_test_enc, data, 1));
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, esp_cloud_lz_encoder_finish(&lz_test_enc));
+    TEST_ASSERT_EQUAL(0, out.writes_after_full);
+}
+
+static int64_t lz_time_us(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+TEST_CASE("lz compression ratio and speed", "[esp_cloud][perf]")
+{
+    char *buf = malloc(LZ_TEST_PAYLOAD_SIZE);
+    uint8_t *out_buf = malloc(LZ_TEST_PAYLOAD_SIZE * 2);
+    TEST_ASSERT_TRUE(buf && out_buf);
+    printf("Window %d bytes, encoder %d bytes\n", 1 << ESP_CLOUD_LZ_WINDOW_BITS,
+            (int)sizeof(esp_cloud_lz_encoder_t));
+    int i, run;
+    for (i = 0; i < sizeof(lz_test_payloads) / sizeof(lz_test_payloads[0]); i++) {
+        size_t len = lz_test_payloads[i].fn(buf, LZ_TEST_PAYLOAD_SIZE);
+        lz_test_out_t out = {
+            .buf = out_buf,
+            .size = LZ_TEST_PAYLOAD_SIZE * 2,
+        };
+        int64_t start = lz_time_us();
+        for (run = 0; run < LZ_BENCH_RUNS; run++) {
+            out.len = 0;
+            esp_cloud_lz_encoder_init(&lz_test_enc, lz_test_write, &out);
+            esp_cloud_lz_encoder_feed(&lz_test_enc, buf, len);
+            esp_cloud_lz_encoder_finish(&lz_test_enc);
+        }
+        int64_t elapsed = lz_time_us() - start;
+        TEST_ASSERT_FALSE(out.full);
+        printf("%s: %d to %d bytes (%d%%), %.1f us per compression, %.1f us per KB\n",
+                lz_test_payloads[i].name, (int)len, (int)out.len, (int)(out.len * 100 / len),
+                (double)elapsed / LZ_BENCH_RUNS, (double)elapsed * 1024 / LZ_BENCH_RUNS / len);
+    }
+    free(out_buf);
+    free(buf);
+}
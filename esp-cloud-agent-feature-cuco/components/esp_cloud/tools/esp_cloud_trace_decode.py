@@ -0,0 +1,122 @@
+#!/usr/bin/env python
+#
+# Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Decode ESP Cloud binary trace records.
+
+The input is either a console log with the "ESPTRACE <hex>" lines printed by
+esp_cloud_trace_dump(), or a binary file with the records copied by
+esp_cloud_trace_read(). The trace point formats are read from
+esp_cloud_trace_points.h, which should be from the same firmware version.
+
+Topics and other strings are recorded as hashes. Pass the strings with -s (or
+a file of strings, one per line, with -S) to see them instead of the hashes.
+"""
+
+from __future__ import print_function
+import argparse
+import os
+import re
+import struct
+import sys
+
+RECORD = struct.Struct('<IIHH3I')
+TRACE_PREFIX = 'ESPTRACE '
+DEFAULT_POINTS_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                   '..', 'src', 'esp_cloud_trace_points.h')
+
+
+def fnv1a(data):
+    h = 2166136261
+    for b in bytearray(data):
+        h = ((h ^ b) * 16777619) & 0xffffffff
+    return h
+
+
+def load_trace_points(path):
+    with open(path) as f:
+        text = f.read()
+    return re.findall(r'X\((\w+),\s*"((?:[^"\\]|\\.)*)"\)', text)
+
+
+def read_records(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if TRACE_PREFIX.encode() in data:
+        for line in data.decode('utf-8', 'replace').splitlines():
+            pos = line.find(TRACE_PREFIX)
+            if pos < 0:
+                continue
+            hexstr = line[pos + len(TRACE_PREFIX):].strip()
+            try:
+                raw = bytearray.fromhex(hexstr)
+            except ValueError:
+                continue
+            if len(raw) == RECORD.size:
+                yield RECORD.unpack(bytes(raw))
+    else:
+        for offset in range(0, len(data) - RECORD.size + 1, RECORD.size):
+            yield RECORD.unpack_from(data, offset)
+
+
+def format_record(points, names, record):
+    seq, timestamp, point_id, _, arg0, arg1, arg2 = record
+    if point_id >= len(points):
+        return '{:10d} {:12.6f} unknown trace point {} args {:#x} {:#x} {:#x}'.format(
+            seq, timestamp / 1e6, point_id, arg0, arg1, arg2)
+    name, fmt = points[point_id]
+    out = []
+    record_args = [arg0, arg1, arg2]
+    for part in re.split(r'(%0?\d*[dux])', fmt):
+        if not part.startswith('%') or not record_args:
+            out.append(part)
+            continue
+        arg = record_args.pop(0)
+        if part.endswith('d') and arg & 0x80000000:
+            arg -= 1 << 32
+        if part == '%08x' and arg in names:
+            # Hash of a known string
+            out.append('"{}"'.format(names[arg]))
+        else:
+            out.append(part % arg)
+    return '{:10d} {:12.6f} {:<18} {}'.format(seq, timestamp / 1e6, name, ''.join(out))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='console log or binary trace file')
+    parser.add_argument('-p', '--points', default=DEFAULT_POINTS_FILE, help='path of esp_cloud_trace_points.h')
+    parser.add_argument('-s', '--string', action='append', default=[], help='string to show instead of its hash')
+    parser.add_argument('-S', '--strings-file', help='file with strings to show instead of their hashes')
+    args = parser.parse_args()
+
+    points = load_trace_points(args.points)
+    if not points:
+        sys.exit('No trace points found in {}'.format(args.points))
+    strings = list(args.string)
+    if args.strings_file:
+        with open(args.strings_file) as f:
+            strings.extend(line.rstrip('\n') for line in f if line.strip())
+    names = dict((fnv1a(s.encode('utf-8')), s) for s in strings)
+
+    records = sorted(read_records(args.input), key=lambda r: r[0])
+    for record in records:
+        if record[0] == 0:
+            continue
+        print(format_record(points, names, record))
+
+
+if __name__ == '__main__':
+    main()
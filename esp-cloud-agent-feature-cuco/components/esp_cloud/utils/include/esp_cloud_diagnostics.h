@@ -36,6 +36,12 @@ esp_err_t esp_cloud_diagnostics_register_periodic_handler(esp_cloud_handle_t han
 /** Send Diagnostics Data
  *
  * This should be used only from the handler registered using esp_cloud_diagnostics_register_periodic_handler().
+ * The data is copied and published in the background, so it can be freed as soon as this returns.
+ *
+ * With CONFIG_ESP_CLOUD_DIAG_COMPRESSION, data which gets smaller on compression is sent in the
+ * heatshrink format, preceded by an 8 byte header: a 0 byte (which a string cannot start with),
+ * "HS", a byte with the window bits in the upper nibble and the lookahead bits in the lower
+ * nibble, and the uncompressed length as a 32 bit big endian value.
  *
  * @param[in] handle The ESP Cloud Handle
  * @param[in] data NULL terminated data string to be reported
@@ -14,6 +14,7 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdint.h>
 
 void *esp_cloud_mem_malloc(int size);
 void *esp_cloud_mem_calloc(int n, int size);
@@ -23,3 +24,6 @@ char *esp_cloud_mem_strdup(const char *str);
 void *esp_cloud_mem_alloc_dma(int n, int size);
 
 void esp_cloud_mem_free(void *ptr);
+
+/* Number of allocations made using the esp_cloud_mem APIs since boot */
+uint32_t esp_cloud_mem_get_alloc_count(void);
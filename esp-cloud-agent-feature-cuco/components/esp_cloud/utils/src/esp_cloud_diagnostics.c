@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include <stdint.h>
+#include <string.h>
+#include <sdkconfig.h>
 #include <json_parser.h>
 #include <json_generator.h>
 #include <esp_log.h>
@@ -24,10 +26,20 @@
 #include "esp_cloud_mem.h"
 #include "esp_cloud_internal.h"
 #include "esp_cloud_platform.h"
+#include "esp_cloud_topics.h"
+#include "esp_cloud_publish_queue.h"
+#ifdef CONFIG_ESP_CLOUD_DIAG_COMPRESSION
+#include "esp_cloud_lz.h"
+#endif
 
 static const char *TAG = "esp_cloud_diagnostics";
 
-#define DIAGNOSTICS_TOPIC_SUFFIX     "device/diagnostics"
+#ifdef CONFIG_ESP_CLOUD_DIAG_COMPRESSION
+/* See esp_cloud_diagnostics_send_data() for the header format */
+#define DIAG_COMPRESSED_HEADER_LEN   8
+/* Smaller data is not worth compressing */
+#define DIAG_COMPRESSION_MIN_LEN     64
+#endif
 
 typedef struct esp_cloud_diag_entry {
     esp_cloud_work_fn_t work_fn;
@@ -70,18 +82,89 @@ static esp_err_t esp_cloud_diagnostics_add_entry(esp_cloud_diag_entry_t *new_ent
     return esp_cloud_queue_work(esp_cloud_get_handle(), esp_cloud_diagnostics_first_call, (void *)new_entry);
 }
 
+#ifdef CONFIG_ESP_CLOUD_DIAG_COMPRESSION
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+} esp_cloud_diag_out_buf_t;
+
+static size_t esp_cloud_diag_out_buf_write(const uint8_t *data, size_t len, void *priv_data)
+{
+    esp_cloud_diag_out_buf_t *out = (esp_cloud_diag_out_buf_t *)priv_data;
+    if (out->len + len > out->size) {
+        return 0;
+    }
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+    return len;
+}
+
+/* Returns the compressed data, with the header, only if it is smaller than the original */
+static uint8_t *esp_cloud_diag_compress(const char *data, size_t data_len, size_t *out_len)
+{
+    esp_cloud_lz_encoder_t *enc = esp_cloud_mem_malloc(sizeof(esp_cloud_lz_encoder_t));
+    uint8_t *buf = esp_cloud_mem_malloc(data_len);
+    if (!enc || !buf) {
+        goto fail;
+    }
+    buf[0] = 0;
+    buf[1] = 'H';
+    buf[2] = 'S';
+    buf[3] = (ESP_CLOUD_LZ_WINDOW_BITS << 4) | ESP_CLOUD_LZ_LOOKAHEAD_BITS;
+    buf[4] = data_len >> 24;
+    buf[5] = data_len >> 16;
+    buf[6] = data_len >> 8;
+    buf[7] = data_len;
+    esp_cloud_diag_out_buf_t out = {
+        .buf = buf,
+        .size = data_len,
+        .len = DIAG_COMPRESSED_HEADER_LEN,
+    };
+    esp_cloud_lz_encoder_init(enc, esp_cloud_diag_out_buf_write, &out);
+    if (esp_cloud_lz_encoder_feed(enc, data, data_len) != ESP_OK ||
+            esp_cloud_lz_encoder_finish(enc) != ESP_OK) {
+        /* Did not fit in the original length */
+        goto fail;
+    }
+    ESP_LOGD(TAG, "Compressed diagnostics from %d to %d bytes", (int)data_len, (int)out.len);
+    free(enc);
+    *out_len = out.len;
+    return buf;
+fail:
+    free(enc);
+    free(buf);
+    return NULL;
+}
+#endif /* CONFIG_ESP_CLOUD_DIAG_COMPRESSION */
+
 esp_err_t esp_cloud_diagnostics_send_data(esp_cloud_handle_t handle, char *data)
 {
     if (!handle || !data) {
         return ESP_FAIL;
     }
     esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
-    char publish_topic[100];
-
-    snprintf(publish_topic, sizeof(publish_topic), "%s/%s", int_handle->device_id, DIAGNOSTICS_TOPIC_SUFFIX);
-    esp_err_t err = esp_cloud_platform_publish(int_handle, publish_topic, data);
+    const char *publish_topic = esp_cloud_topic_get(int_handle, ESP_CLOUD_TOPIC_DIAGNOSTICS);
+    const void *payload = data;
+    size_t payload_len = strlen(data);
+#ifdef CONFIG_ESP_CLOUD_DIAG_COMPRESSION
+    size_t compressed_len;
+    uint8_t *compressed = NULL;
+    if (payload_len >= DIAG_COMPRESSION_MIN_LEN) {
+        compressed = esp_cloud_diag_compress(data, payload_len, &compressed_len);
+    }
+    if (compressed) {
+        payload = compressed;
+        payload_len = compressed_len;
+    }
+#endif
+    esp_err_t err = esp_cloud_publish_data_async(int_handle, publish_topic, payload, payload_len,
+            ESP_CLOUD_MSG_CLASS_DIAGNOSTICS, NULL, NULL);
+#ifdef CONFIG_ESP_CLOUD_DIAG_COMPRESSION
+    free(compressed);
+#endif
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_cloud_platform_publish_data returned error %d", err);
+        ESP_LOGE(TAG, "esp_cloud_publish_async returned error %d", err);
     }
     return err;
 }
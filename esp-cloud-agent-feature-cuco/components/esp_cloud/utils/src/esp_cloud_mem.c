@@ -18,9 +18,12 @@
 #include <sdkconfig.h>
 #include <esp_heap_caps.h>
 
+static uint32_t esp_cloud_mem_alloc_count;
+
 void *esp_cloud_mem_malloc(int size)
 {
     void *data;
+    esp_cloud_mem_alloc_count++;
 #if (CONFIG_ESP_CLOUD_USE_SPIRAM_FOR_ALLOCATIONS && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
     data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
 #else
@@ -32,6 +35,7 @@ void *esp_cloud_mem_malloc(int size)
 void *esp_cloud_mem_calloc(int n, int size)
 {
     void *data;
+    esp_cloud_mem_alloc_count++;
 #if (CONFIG_ESP_CLOUD_USE_SPIRAM_FOR_ALLOCATIONS && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
     data = heap_caps_calloc(n, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
 #else
@@ -57,6 +61,7 @@ void *esp_cloud_mem_realloc(void *old_ptr, int old_size, int new_size)
 void *esp_cloud_mem_alloc_dma(int n, int size)
 {
     void *data =  NULL;
+    esp_cloud_mem_alloc_count++;
     data = heap_caps_malloc(n * size, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
     if (data) {
         memset(data, 0, n * size);
@@ -66,6 +71,7 @@ void *esp_cloud_mem_alloc_dma(int n, int size)
 
 char *esp_cloud_mem_strdup(const char *str)
 {
+    esp_cloud_mem_alloc_count++;
 #if (CONFIG_ESP_CLOUD_USE_SPIRAM_FOR_ALLOCATIONS && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
     char *copy = heap_caps_malloc(strlen(str) + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT); //1 extra for the '\0' NULL character
 #else
@@ -81,3 +87,8 @@ void esp_cloud_mem_free(void *ptr)
 {
     free(ptr);
 }
+
+uint32_t esp_cloud_mem_get_alloc_count(void)
+{
+    return esp_cloud_mem_alloc_count;
+}
@@ -23,6 +23,7 @@
 #include "esp_cloud_mem.h"
 #include "esp_cloud_internal.h"
 #include "esp_cloud_platform.h"
+#include "esp_cloud_topics.h"
 #include <esp_cloud_storage.h>
 #include "app_auth_user.h"
 #include "freertos/task.h"
@@ -30,15 +31,13 @@
 #include "app_prov_handlers.h"
 static const char *TAG = "esp_cloud_ota";
 
-#define OTAURL_TOPIC_SUFFIX     "device/otaurl"
-#define OTAFETCH_TOPIC_SUFFIX   "device/otafetch"
-#define OTASTATUS_TOPIC_SUFFIX  "device/otastatus"
+#define OTA_URL_JSON_TOKENS     16
 
 typedef struct {
     esp_cloud_handle_t handle;
     esp_cloud_ota_callback_t ota_cb;
     void *ota_priv;
-    char *ota_version;
+    char ota_version[MAX_VERSION_STRING_LEN];
     bool ota_in_progress;
     ota_status_t last_reported_status;
 } esp_cloud_ota_t;
@@ -62,6 +61,24 @@ static char *ota_status_to_string(ota_status_t status)
     return "invalid";
 }
 
+typedef struct {
+    char *device_id;
+    char *ota_version;
+    ota_status_t status;
+    char *additional_info;
+} esp_cloud_ota_status_msg_t;
+
+static void esp_cloud_build_ota_status(json_str_t *jstr, void *priv_data)
+{
+    esp_cloud_ota_status_msg_t *status_msg = (esp_cloud_ota_status_msg_t *)priv_data;
+    json_start_object(jstr);
+    json_obj_set_string(jstr, "device_id", status_msg->device_id);
+    json_obj_set_string(jstr, "ota_version", status_msg->ota_version);
+    json_obj_set_string(jstr, "device_otastatus", ota_status_to_string(status_msg->status));
+    json_obj_set_string(jstr, "additional_info", status_msg->additional_info);
+    json_end_object(jstr);
+}
+
 esp_err_t esp_cloud_report_ota_status(esp_cloud_ota_handle_t ota_handle, ota_status_t status, char *additional_info)
 {
     if (!ota_handle) {
@@ -69,20 +86,20 @@ esp_err_t esp_cloud_report_ota_status(esp_cloud_ota_handle_t ota_handle, ota_sta
     }
     esp_cloud_ota_t *ota = (esp_cloud_ota_t *)ota_handle;
     esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)ota->handle;
-    char publish_payload[200];
-    json_str_t jstr;
-    json_str_start(&jstr, publish_payload, sizeof(publish_payload), NULL, NULL);
-    json_start_object(&jstr);
-    json_obj_set_string(&jstr, "device_id", int_handle->device_id);
-    json_obj_set_int(&jstr, "ota_version", ota->ota_version);
-    json_obj_set_string(&jstr, "device_otastatus", ota_status_to_string(status));
-    json_obj_set_string(&jstr, "additional_info", additional_info);
-    json_end_object(&jstr);
-    json_str_end(&jstr);
-
-    char publish_topic[100];
-    snprintf(publish_topic, sizeof(publish_topic), "%s/%s", int_handle->device_id, OTASTATUS_TOPIC_SUFFIX);
-    esp_err_t err = esp_cloud_platform_publish(int_handle, publish_topic, publish_payload);
+    esp_cloud_ota_status_msg_t status_msg = {
+        .device_id = int_handle->device_id,
+        .ota_version = ota->ota_version,
+        .status = status,
+        .additional_info = additional_info,
+    };
+    char *publish_payload = esp_cloud_json_build(esp_cloud_build_ota_status, &status_msg);
+    if (!publish_payload) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = esp_cloud_platform_publish(int_handle, esp_cloud_topic_get(int_handle, ESP_CLOUD_TOPIC_OTA_STATUS),
+            publish_payload, ESP_CLOUD_MSG_CLASS_EVENT);
+    free(publish_payload);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_cloud_platform_publish_data returned error %d",err);
         return ESP_FAIL;
@@ -92,7 +109,7 @@ esp_err_t esp_cloud_report_ota_status(esp_cloud_ota_handle_t ota_handle, ota_sta
 }
 
 extern int ota_filesize;
-static void ota_url_handler(const char *topic, void *payload, size_t payload_len, void *priv_data)
+static void ota_url_handler(const char *topic, const void *payload, size_t payload_len, void *priv_data)
 {
     bool update_flag=false;
     int R_Main_version = 0, R_feature_version = 0,R_fix_version = 0;
@@ -109,27 +126,35 @@ static void ota_url_handler(const char *topic, void *payload, size_t payload_len
         return;
     }
     ota->ota_in_progress = true;
-    ESP_LOGI(TAG, "Upgrade Handler got:%.*s\n", (int) payload_len, (char *)payload);
+    ESP_LOGI(TAG, "Upgrade Handler got:%.*s\n", (int) payload_len, (const char *)payload);
 
     jparse_ctx_t jctx;
+    json_tok_t tokens[OTA_URL_JSON_TOKENS];
+    /* Pre-signed URLs can be long, so the URL is copied from the payload only once its
+     * length is known
+     */
+    json_strptr_t url_ptr;
     char *url = NULL;
-    int ret = json_parse_start(&jctx, (char *)payload, (int) payload_len);
+    int ret = json_parse_start_static(&jctx, (const char *)payload, (int) payload_len, tokens, OTA_URL_JSON_TOKENS);
     if (ret != 0) {
         ota_report_msg_status_val_to_app(OTA_FAIL_1);
         ota->ota_in_progress = false;
         return;
     }
 
-    int len = 0;
-    ret = json_obj_get_strlen(&jctx, "ota_version", &len);
-    if (ret != ESP_OK) {
-        ota_report_msg_status_val_to_app(OTA_FAIL_1);
-        goto end;
-    }
-    len++; /* Increment for NULL character */
-    ota->ota_version = esp_cloud_mem_calloc(1, len);
-
-    ret = json_obj_get_string(&jctx, "ota_version", ota->ota_version,len);
+    enum {
+        OTA_FIELD_VERSION,
+        OTA_FIELD_URL,
+        OTA_FIELD_FILE_SIZE,
+    };
+    int file_size;
+    const json_field_t fields[] = {
+        [OTA_FIELD_VERSION] = {"ota_version", JSON_FIELD_STRING, ota->ota_version, sizeof(ota->ota_version), true},
+        [OTA_FIELD_URL] = {"url", JSON_FIELD_STRPTR, &url_ptr},
+        [OTA_FIELD_FILE_SIZE] = {"file_size", JSON_FIELD_INT, &file_size},
+    };
+    uint32_t present;
+    ret = json_obj_get_fields(&jctx, fields, sizeof(fields) / sizeof(fields[0]), &present);
      if (ret != ESP_OK) {
         ota_report_msg_status_val_to_app(OTA_FAIL_1);
         goto end;
@@ -187,22 +212,22 @@ static void ota_url_handler(const char *topic, void *payload, size_t payload_len
 
     if(update_flag == true){
         update_flag=false;
-        len = 0;
-        ret = json_obj_get_strlen(&jctx, "url", &len);
-        if (ret != ESP_OK) {
+        if (!(present & (1 << OTA_FIELD_URL))) {
             ota_report_msg_status_val_to_app(OTA_FAIL_1);
             goto end;
         }
-        len++; /* Increment for NULL character */
-        url = esp_cloud_mem_calloc(1, len);
+        url = esp_cloud_mem_malloc(url_ptr.len + 1);
         if (!url) {
-            ota_report_msg_status_val_to_app(OTA_FAIL_1);
+            ESP_LOGE(TAG, "Failed to allocate %d bytes for the URL", url_ptr.len + 1);
             goto end;
         }
-        json_obj_get_string(&jctx, "url", url, len);
+        memcpy(url, url_ptr.str, url_ptr.len);
+        url[url_ptr.len] = '\0';
         ESP_LOGI(TAG, "URL: %s", url);
 
-        json_obj_get_int(&jctx, "file_size", &ota_filesize);
+        if (present & (1 << OTA_FIELD_FILE_SIZE)) {
+            ota_filesize = file_size;
+        }
         ESP_LOGI(TAG, "File Size: %d", ota_filesize);
 
         json_parse_end(&jctx);
@@ -221,9 +246,7 @@ static void ota_url_handler(const char *topic, void *payload, size_t payload_len
 
 end: 
     ota_report_msg_status_val_to_app(OTA_FAIL_1);
-    if (url) {
-        free(url);
-    }
+    free(url);
     json_parse_end(&jctx);
     ota->ota_in_progress = false;
      vTaskDelay(100/ portTICK_PERIOD_MS);
@@ -232,17 +255,26 @@ end:
 }
 
 esp_cloud_internal_handle_t *int_app_handle;
+static void esp_cloud_build_ota_fetch(json_str_t *jstr, void *priv_data)
+{
+    esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)priv_data;
+    json_start_object(jstr);
+    json_obj_set_string(jstr, "device_id", int_handle->device_id);
+    json_obj_set_string(jstr, "fw_version", int_handle->fw_version);
+    json_end_object(jstr);
+}
+
 static esp_err_t esp_cloud_ota_check(esp_cloud_handle_t handle, void *priv_data)
 {
-    char subscribe_topic[100]={0};
     esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
     int_app_handle = (esp_cloud_internal_handle_t *)handle;
-    snprintf(subscribe_topic, sizeof(subscribe_topic),"%s/%s", int_handle->device_id, OTAURL_TOPIC_SUFFIX);
+    const char *subscribe_topic = esp_cloud_topic_get(int_handle, ESP_CLOUD_TOPIC_OTA_URL);
 
     ESP_LOGI(TAG, "Subscribing to: %s", subscribe_topic);
     /* First unsubscribing, in case there is a stale subscription */
     esp_cloud_platform_unsubscribe(int_handle, subscribe_topic);
-    esp_err_t err = esp_cloud_platform_subscribe(int_handle, subscribe_topic, ota_url_handler, priv_data);
+    esp_err_t err = esp_cloud_platform_subscribe(int_handle, subscribe_topic, ESP_CLOUD_MSG_CLASS_REQUEST,
+            ota_url_handler, priv_data);
     if(err != ESP_OK) {
         ESP_LOGE(TAG, "OTA URL Subscription Error %d", err);
         return ESP_FAIL;
@@ -277,36 +309,48 @@ static esp_err_t esp_cloud_ota_check(esp_cloud_handle_t handle, void *priv_data)
     }
 
 
-    char publish_payload[150];
-    json_str_t jstr;
-    json_str_start(&jstr, publish_payload, sizeof(publish_payload), NULL, NULL);
-    json_start_object(&jstr);
-    json_obj_set_string(&jstr, "device_id", int_handle->device_id);
-    json_obj_set_string(&jstr, "fw_version", int_handle->fw_version);
-    json_end_object(&jstr);
-    json_str_end(&jstr);
-    char publish_topic[100]={0};
-    snprintf(publish_topic, sizeof(publish_topic), "%s/%s", int_handle->device_id, OTAFETCH_TOPIC_SUFFIX);
-    err = esp_cloud_platform_publish(int_handle, publish_topic, publish_payload);
+    char *publish_payload = esp_cloud_json_build(esp_cloud_build_ota_fetch, int_handle);
+    if (!publish_payload) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = esp_cloud_platform_publish(int_handle, esp_cloud_topic_get(int_handle, ESP_CLOUD_TOPIC_OTA_FETCH),
+            publish_payload, ESP_CLOUD_MSG_CLASS_EVENT);
+    free(publish_payload);
     if (err != ESP_OK) {                                                            
         ESP_LOGE(TAG, "OTA Fetch Publish Error %d", err);
     }
     return err;                                                                                                                                                             
 }
 
+typedef struct {
+    char *url;
+    int file_size;
+    char *ota_version;
+} esp_cloud_ota_url_msg_t;
+
+static void esp_cloud_build_ota_url(json_str_t *jstr, void *priv_data)
+{
+    esp_cloud_ota_url_msg_t *url_msg = (esp_cloud_ota_url_msg_t *)priv_data;
+    json_start_object(jstr);
+    json_obj_set_string(jstr, "url", url_msg->url);
+    json_obj_set_int(jstr, "file_size", url_msg->file_size);
+    json_obj_set_string(jstr, "ota_version", url_msg->ota_version);
+    json_end_object(jstr);
+}
+
 esp_err_t app_publish_ota(char *url,int file_size,char * ota_version){
-    char publish_payload[200];
-    json_str_t jstr;
-    json_str_start(&jstr, publish_payload, sizeof(publish_payload), NULL, NULL);
-    json_start_object(&jstr);
-    json_obj_set_string(&jstr, "url",url);
-    json_obj_set_int(&jstr, "file_size", file_size);
-     json_obj_set_string(&jstr, "ota_version",ota_version);
-    json_end_object(&jstr);
-    json_str_end(&jstr);
-    char publish_topic[100]={0};
-    snprintf(publish_topic, sizeof(publish_topic), "%s/%s", int_app_handle->device_id, OTAURL_TOPIC_SUFFIX);
-    esp_err_t err = esp_cloud_platform_publish(int_app_handle, publish_topic, publish_payload);
+    esp_cloud_ota_url_msg_t url_msg = {
+        .url = url,
+        .file_size = file_size,
+        .ota_version = ota_version,
+    };
+    char *publish_payload = esp_cloud_json_build(esp_cloud_build_ota_url, &url_msg);
+    if (!publish_payload) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = esp_cloud_platform_publish(int_app_handle, esp_cloud_topic_get(int_app_handle, ESP_CLOUD_TOPIC_OTA_URL),
+            publish_payload, ESP_CLOUD_MSG_CLASS_EVENT);
+    free(publish_payload);
     if (err != ESP_OK) {                                                            
         ESP_LOGE(TAG, "OTA Fetch Publish Error %d", err);
     }
@@ -20,31 +20,36 @@
 
 #include "cloud.pb-c.h"
 #include "esp_cloud_platform.h"
+#include "esp_cloud_topics.h"
 
 static const char *TAG = "esp_cloud_ota";
 
-#define USER_ASSOC_TOPIC_SUFFIX "device/user/mapping"
 
 typedef struct {
     char *user_id;
     char *secret_key;
 } esp_cloud_user_assoc_data_t;
+static void esp_cloud_build_user_assoc(json_str_t *jstr, void *priv_data)
+{
+    esp_cloud_user_assoc_data_t *data = (esp_cloud_user_assoc_data_t *)priv_data;
+    json_start_object(jstr);
+    json_obj_set_string(jstr, "device_id", esp_cloud_get_device_id(esp_cloud_get_handle()));
+    json_obj_set_string(jstr, "user_id", data->user_id);
+    json_obj_set_string(jstr, "secret_key", data->secret_key);
+    json_end_object(jstr);
+}
+
 void esp_cloud_report_user_assoc(esp_cloud_handle_t handle, void *priv_data)
 {
     esp_cloud_internal_handle_t *int_handle = (esp_cloud_internal_handle_t *)handle;
     esp_cloud_user_assoc_data_t *data = (esp_cloud_user_assoc_data_t *)priv_data;
-    char publish_payload[150];
-    json_str_t jstr;
-    json_str_start(&jstr, publish_payload, sizeof(publish_payload), NULL, NULL);
-    json_start_object(&jstr);
-    json_obj_set_string(&jstr, "device_id", int_handle->device_id);
-    json_obj_set_string(&jstr, "user_id", data->user_id);
-    json_obj_set_string(&jstr, "secret_key", data->secret_key);
-    json_end_object(&jstr);
-    json_str_end(&jstr);
-    char publish_topic[100];
-    snprintf(publish_topic, sizeof(publish_topic), "%s/%s", int_handle->device_id, USER_ASSOC_TOPIC_SUFFIX);
-    esp_err_t err = esp_cloud_platform_publish(int_handle, publish_topic, publish_payload);
+    char *publish_payload = esp_cloud_json_build(esp_cloud_build_user_assoc, data);
+    if (!publish_payload) {
+        return;
+    }
+    esp_err_t err = esp_cloud_platform_publish(int_handle, esp_cloud_topic_get(int_handle, ESP_CLOUD_TOPIC_USER_MAPPING),
+            publish_payload, ESP_CLOUD_MSG_CLASS_EVENT);
+    free(publish_payload);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "User Assoc Publish Error %d", err);
     }
@@ -3,32 +3,38 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <float.h>
+#include <math.h>
 
 #include <json_generator.h>
 
-#define MAX_INT_IN_STR  	24
-#define MAX_FLOAT_IN_STR 	30
-
 static inline int json_get_empty_len(json_str_t *jstr)
 {
 	return (jstr->buf_size - (jstr->free_ptr - jstr->buf) - 1);
 }
 
-/* This will add the incoming string to the JSON string buffer
- * and flush it out if the buffer is full. Note that the data being
+/* This will add len bytes of the incoming string to the JSON string
+ * buffer and flush it out if the buffer is full. Note that the data being
  * flushed out will always be equal to the size of the buffer unless
  * this is the last chunk being flushed out on json_end_str()
  */
-static int json_add_to_str(json_str_t *jstr, char *str)
-{
-    if (!str)
-        return 0;
-	int len = strlen(str);
-	char *cur_ptr = str;
+static int json_add_to_str_len(json_str_t *jstr, const char *str, int len)
+{
+	jstr->total_len += len;
+	/* Only the length is being computed */
+	if (!jstr->buf)
+		return 0;
+	/* Common case, when it fits without a flush */
+	if (len <= json_get_empty_len(jstr)) {
+		memcpy(jstr->free_ptr, str, len);
+		jstr->free_ptr += len;
+		return 0;
+	}
+	const char *cur_ptr = str;
 	while (1) {
 		int len_remaining = json_get_empty_len(jstr);
 		int copy_len = len_remaining > len ? len : len_remaining;
-		memmove(jstr->free_ptr, cur_ptr, copy_len);
+		memcpy(jstr->free_ptr, cur_ptr, copy_len);
 		cur_ptr += copy_len;
 		jstr->free_ptr += copy_len;
 		len -= copy_len;
@@ -49,6 +55,115 @@ static int json_add_to_str(json_str_t *jstr, char *str)
 	return 0;
 }
 
+static int json_add_to_str(json_str_t *jstr, const char *str)
+{
+	if (!str)
+		return 0;
+	return json_add_to_str_len(jstr, str, strlen(str));
+}
+
+static inline int json_add_char(json_str_t *jstr, char c)
+{
+	if (jstr->buf && json_get_empty_len(jstr) > 0) {
+		jstr->total_len++;
+		*jstr->free_ptr++ = c;
+		return 0;
+	}
+	return json_add_to_str_len(jstr, &c, 1);
+}
+
+/* Characters which cannot be in a JSON string as they are */
+static inline bool json_needs_escape(char c)
+{
+	return (unsigned char)c < 0x20 || c == '"' || c == '\\';
+}
+
+/* Add str, escaping the quotes, backslashes and control characters in it */
+static int json_add_escaped(json_str_t *jstr, const char *str)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *run = str;
+	int ret = 0;
+	for (; *str; str++) {
+		if (!json_needs_escape(*str))
+			continue;
+		ret |= json_add_to_str_len(jstr, run, str - run);
+		char esc[6] = {'\\', *str};
+		int esc_len = 2;
+		switch (*str) {
+		case '"':
+		case '\\':
+			break;
+		case '\b':
+			esc[1] = 'b';
+			break;
+		case '\f':
+			esc[1] = 'f';
+			break;
+		case '\n':
+			esc[1] = 'n';
+			break;
+		case '\r':
+			esc[1] = 'r';
+			break;
+		case '\t':
+			esc[1] = 't';
+			break;
+		default:
+			esc[1] = 'u';
+			esc[2] = '0';
+			esc[3] = '0';
+			esc[4] = hex[(unsigned char)*str >> 4];
+			esc[5] = hex[*str & 0xf];
+			esc_len = 6;
+			break;
+		}
+		ret |= json_add_to_str_len(jstr, esc, esc_len);
+		run = str + 1;
+	}
+	return ret | json_add_to_str_len(jstr, run, str - run);
+}
+
+/* Add "str", with the prefix and suffix characters (if not 0) around it, using a
+ * single copy if it all fits in the buffer and nothing needs to be escaped. A NULL
+ * str is added as "".
+ */
+static int json_add_quoted(json_str_t *jstr, char prefix, const char *str, char suffix)
+{
+	if (!str)
+		str = "";
+	bool escape = false;
+	int len;
+	for (len = 0; str[len]; len++)
+		escape |= json_needs_escape(str[len]);
+	int total_len = len + 2 + (prefix != 0) + (suffix != 0);
+	if (escape || !jstr->buf || total_len > json_get_empty_len(jstr)) {
+		int ret;
+		if (prefix)
+			json_add_char(jstr, prefix);
+		json_add_char(jstr, '"');
+		if (escape)
+			json_add_escaped(jstr, str);
+		else
+			json_add_to_str_len(jstr, str, len);
+		ret = json_add_char(jstr, '"');
+		if (suffix)
+			ret = json_add_char(jstr, suffix);
+		return ret;
+	}
+	char *ptr = jstr->free_ptr;
+	if (prefix)
+		*ptr++ = prefix;
+	*ptr++ = '"';
+	memcpy(ptr, str, len);
+	ptr += len;
+	*ptr++ = '"';
+	if (suffix)
+		*ptr++ = suffix;
+	jstr->free_ptr = ptr;
+	jstr->total_len += total_len;
+	return 0;
+}
 
 void json_str_start(json_str_t *jstr, char *buf, int buf_size,
 		json_flush_cb_t flush_cb, void *priv)
@@ -63,24 +178,29 @@ void json_str_start(json_str_t *jstr, char *buf, int buf_size,
 
 void json_str_end(json_str_t *jstr)
 {
-	*jstr->free_ptr = '\0';
-	if (jstr->flush_cb)
-		jstr->flush_cb(jstr->buf, jstr->priv);
+	if (jstr->buf) {
+		*jstr->free_ptr = '\0';
+		if (jstr->flush_cb)
+			jstr->flush_cb(jstr->buf, jstr->priv);
+	}
 	memset(jstr, 0, sizeof(json_str_t));
 }
 
+int json_str_get_len(json_str_t *jstr)
+{
+	return jstr->total_len;
+}
+
 static inline void json_handle_comma(json_str_t *jstr)
 {
 	if (jstr->comma_req)
-		json_add_to_str(jstr, ",");
+		json_add_char(jstr, ',');
 }
 
-
+/* Adds the comma, if required, along with the name */
 static int json_handle_name(json_str_t *jstr, char *name)
 {
-	json_add_to_str(jstr, "\"");
-	json_add_to_str(jstr, name);
-	return json_add_to_str(jstr, "\":");
+	return json_add_quoted(jstr, jstr->comma_req ? ',' : 0, name, ':');
 }
 
 
@@ -88,13 +208,13 @@ int json_start_object(json_str_t *jstr)
 {
 	json_handle_comma(jstr);
 	jstr->comma_req = false;
-	return json_add_to_str(jstr, "{");
+	return json_add_char(jstr, '{');
 }
 
 int json_end_object(json_str_t *jstr)
 {
 	jstr->comma_req = true;
-	return json_add_to_str(jstr, "}");
+	return json_add_char(jstr, '}');
 }
 
 
@@ -102,51 +222,48 @@ int json_start_array(json_str_t *jstr)
 {
 	json_handle_comma(jstr);
 	jstr->comma_req = false;
-	return json_add_to_str(jstr, "[");
+	return json_add_char(jstr, '[');
 }
 
 int json_end_array(json_str_t *jstr)
 {
 	jstr->comma_req = true;
-	return json_add_to_str(jstr, "]");
+	return json_add_char(jstr, ']');
 }
 
 int json_push_object(json_str_t *jstr, char *name)
 {
-	json_handle_comma(jstr);
 	json_handle_name(jstr, name);
 	jstr->comma_req = false;
-	return json_add_to_str(jstr, "{");
+	return json_add_char(jstr, '{');
 }
 int json_pop_object(json_str_t *jstr)
 {
 	jstr->comma_req = true;
-	return json_add_to_str(jstr, "}");
+	return json_add_char(jstr, '}');
 }
 int json_push_array(json_str_t *jstr, char *name)
 {
-	json_handle_comma(jstr);
 	json_handle_name(jstr, name);
 	jstr->comma_req = false;
-	return json_add_to_str(jstr, "[");
+	return json_add_char(jstr, '[');
 }
 int json_pop_array(json_str_t *jstr)
 {
 	jstr->comma_req = true;
-	return json_add_to_str(jstr, "]");
+	return json_add_char(jstr, ']');
 }
 
 static int json_set_bool(json_str_t *jstr, bool val)
 {
 	jstr->comma_req = true;
 	if (val)
-		return json_add_to_str(jstr, "true");
+		return json_add_to_str_len(jstr, "true", 4);
 	else
-		return json_add_to_str(jstr, "false");
+		return json_add_to_str_len(jstr, "false", 5);
 }
 int json_obj_set_bool(json_str_t *jstr, char *name, bool val)
 {
-	json_handle_comma(jstr);
 	json_handle_name(jstr, name);
 	return json_set_bool(jstr, val);
 }
@@ -157,17 +274,164 @@ int json_arr_set_bool(json_str_t *jstr, bool val)
 	return json_set_bool(jstr, val);
 }
 
+int json_format_uint(char *buf, uint32_t val)
+{
+	char tmp[JSON_INT_STR_MAX];
+	char *ptr = tmp + sizeof(tmp);
+	do {
+		*--ptr = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	int len = tmp + sizeof(tmp) - ptr;
+	memcpy(buf, ptr, len);
+	buf[len] = '\0';
+	return len;
+}
+
+int json_format_int(char *buf, int32_t val)
+{
+	if (val < 0) {
+		*buf = '-';
+		/* Negated as unsigned, so that INT32_MIN works too */
+		return json_format_uint(buf + 1, -(uint32_t)val) + 1;
+	}
+	return json_format_uint(buf, val);
+}
+
+/* 10^n for the n for which it is exactly representable as a double */
+static const double json_pow10_tbl[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/* v * 10^n, exact (correctly rounded) if |n| <= 22 */
+static double json_scale10(double v, int n)
+{
+	for (; n > 22; n -= 22)
+		v *= json_pow10_tbl[22];
+	for (; n < -22; n += 22)
+		v /= json_pow10_tbl[22];
+	return n >= 0 ? v * json_pow10_tbl[n] : v / json_pow10_tbl[-n];
+}
+
+static const uint32_t json_pow10_u32[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+/* Digits of a float to 9 significant digits, which always round trip, are found
+ * using double arithmetic. The shortest rounding of those which still converts
+ * back to the same float is then printed, as fixed point if the exponent is
+ * within [-5, 9], else in exponential notation.
+ */
+int json_format_float(char *buf, float val)
+{
+	char *ptr = buf;
+	if (val != val || val > FLT_MAX || val < -FLT_MAX) {
+		/* JSON has no NaN or infinity */
+		memcpy(buf, "null", 5);
+		return 4;
+	}
+	/* signbit(), so that -0 is written as -0 and round trips */
+	if (signbit(val)) {
+		*ptr++ = '-';
+		val = -val;
+	}
+	if (val == 0) {
+		*ptr++ = '0';
+		*ptr = '\0';
+		return ptr - buf;
+	}
+
+	/* Estimate the decimal exponent from the binary one, then correct it */
+	int exp2;
+	frexp(val, &exp2);
+	int exp10 = ((exp2 - 1) * 78913) >> 18;
+	double scaled = json_scale10(val, 8 - exp10);
+	if (scaled >= 1e9) {
+		exp10++;
+		scaled = json_scale10(val, 8 - exp10);
+	} else if (scaled < 1e8) {
+		exp10--;
+		scaled = json_scale10(val, 8 - exp10);
+	}
+	uint32_t digits9 = (uint32_t)(scaled + 0.5);
+	if (digits9 >= 1000000000) {
+		digits9 /= 10;
+		exp10++;
+	}
+
+	uint32_t digits = digits9;
+	int num_digits;
+	for (num_digits = 1; num_digits < 9; num_digits++) {
+		uint32_t div = json_pow10_u32[9 - num_digits];
+		/* Try the nearest rounding first, then the other one */
+		uint32_t nearest = (digits9 + div / 2) / div;
+		uint32_t other = (nearest * div > digits9) ? nearest - 1 : nearest + 1;
+		if ((float)json_scale10(nearest, exp10 - num_digits + 1) == val) {
+			digits = nearest;
+			break;
+		}
+		if ((float)json_scale10(other, exp10 - num_digits + 1) == val) {
+			digits = other;
+			break;
+		}
+	}
+	if (digits == json_pow10_u32[num_digits]) {
+		/* Rounded up to the next power of 10 */
+		digits /= 10;
+		exp10++;
+	}
+	while (num_digits > 1 && digits % 10 == 0) {
+		digits /= 10;
+		num_digits--;
+	}
+
+	char str[10];
+	json_format_uint(str, digits);
+	if (exp10 >= 0 && exp10 <= 9) {
+		int int_digits = exp10 + 1;
+		if (num_digits <= int_digits) {
+			memcpy(ptr, str, num_digits);
+			memset(ptr + num_digits, '0', int_digits - num_digits);
+			ptr += int_digits;
+		} else {
+			memcpy(ptr, str, int_digits);
+			ptr += int_digits;
+			*ptr++ = '.';
+			memcpy(ptr, str + int_digits, num_digits - int_digits);
+			ptr += num_digits - int_digits;
+		}
+	} else if (exp10 < 0 && exp10 >= -5) {
+		*ptr++ = '0';
+		*ptr++ = '.';
+		memset(ptr, '0', -exp10 - 1);
+		ptr += -exp10 - 1;
+		memcpy(ptr, str, num_digits);
+		ptr += num_digits;
+	} else {
+		*ptr++ = str[0];
+		if (num_digits > 1) {
+			*ptr++ = '.';
+			memcpy(ptr, str + 1, num_digits - 1);
+			ptr += num_digits - 1;
+		}
+		*ptr++ = 'e';
+		ptr += json_format_int(ptr, exp10);
+	}
+	*ptr = '\0';
+	return ptr - buf;
+}
+
 static int json_set_int(json_str_t *jstr, int val)
 {
 	jstr->comma_req = true;
-	char str[MAX_INT_IN_STR];
-	snprintf(str, MAX_INT_IN_STR, "%d", val);
-	return json_add_to_str(jstr, str);
+	char str[JSON_INT_STR_MAX];
+	int len = json_format_int(str, val);
+	return json_add_to_str_len(jstr, str, len);
 }
 
 int json_obj_set_int(json_str_t *jstr, char *name, int val)
 {
-	json_handle_comma(jstr);
 	json_handle_name(jstr, name);
 	return json_set_int(jstr, val);
 }
@@ -182,13 +446,12 @@ int json_arr_set_int(json_str_t *jstr, int val)
 static int json_set_float(json_str_t *jstr, float val)
 {
 	jstr->comma_req = true;
-	char str[MAX_FLOAT_IN_STR];
-	snprintf(str, MAX_FLOAT_IN_STR, "%.*f", JSON_FLOAT_PRECISION, val);
-	return json_add_to_str(jstr, str);
+	char str[JSON_FLOAT_STR_MAX];
+	int len = json_format_float(str, val);
+	return json_add_to_str_len(jstr, str, len);
 }
 int json_obj_set_float(json_str_t *jstr, char *name, float val)
 {
-	json_handle_comma(jstr);
 	json_handle_name(jstr, name);
 	return json_set_float(jstr, val);
 }
@@ -198,37 +461,29 @@ int json_arr_set_float(json_str_t *jstr, float val)
 	return json_set_float(jstr, val);
 }
 
-static int json_set_string(json_str_t *jstr, char *val)
-{
-	jstr->comma_req = true;
-	json_add_to_str(jstr, "\"");
-	json_add_to_str(jstr, val);
-	return json_add_to_str(jstr, "\"");
-}
-
 int json_obj_set_string(json_str_t *jstr, char *name, char *val)
 {
-	json_handle_comma(jstr);
 	json_handle_name(jstr, name);
-	return json_set_string(jstr, val);
+	jstr->comma_req = true;
+	return json_add_quoted(jstr, 0, val, 0);
 }
 
 int json_arr_set_string(json_str_t *jstr, char *val)
 {
-	json_handle_comma(jstr);
-	return json_set_string(jstr, val);
+	char prefix = jstr->comma_req ? ',' : 0;
+	jstr->comma_req = true;
+	return json_add_quoted(jstr, prefix, val, 0);
 }
 
 static int json_set_long_string(json_str_t *jstr, char *val)
 {
 	jstr->comma_req = true;
-	json_add_to_str(jstr, "\"");
+	json_add_char(jstr, '"');
 	return json_add_to_str(jstr, val);
 }
 
 int json_obj_start_long_string(json_str_t *jstr, char *name, char *val)
 {
-	json_handle_comma(jstr);
 	json_handle_name(jstr, name);
     return json_set_long_string(jstr, val);
 }
@@ -246,16 +501,15 @@ int json_add_to_long_string(json_str_t *jstr, char *val)
 
 int json_end_long_string(json_str_t *jstr)
 {
-    return json_add_to_str(jstr, "\"");
+    return json_add_char(jstr, '"');
 }
 static int json_set_null(json_str_t *jstr)
 {
 	jstr->comma_req = true;
-	return json_add_to_str(jstr, "null");
+	return json_add_to_str_len(jstr, "null", 4);
 }
 int json_obj_set_null(json_str_t *jstr, char *name)
 {
-	json_handle_comma(jstr);
 	json_handle_name(jstr, name);
 	return json_set_null(jstr);
 }
@@ -13,8 +13,17 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* Not used any more. Floats are written with the fewest digits which convert
+ * back to the same value (see json_format_float())
+ */
 #define JSON_FLOAT_PRECISION 5
 
+/* Buffer sizes, including the NULL termination, for json_format_int()/json_format_uint()
+ * and json_format_float()
+ */
+#define JSON_INT_STR_MAX	12
+#define JSON_FLOAT_STR_MAX	20
+
 /** JSON string flush callback prototype
  *
  * This is a prototype of the function that needs to be passed to
@@ -39,6 +48,7 @@ typedef struct {
 	void *priv;
 	bool comma_req;
 	char *free_ptr;
+	int total_len;
 } json_str_t;
 
 /** Start a JSON String
@@ -51,7 +61,8 @@ typedef struct {
  * This will be initialised internally and needs to be passed to all
  * subsequent function calls
  * \param[out] buf Pointer to an allocated buffer into which the JSON
- * string will be written
+ * string will be written. Can be NULL to just compute the length of the
+ * string (see json_str_get_len()), without writing it anywhere
  * \param[in] buf_size Size of the buffer
  * \param[in] Pointer to the flushing function of type \ref json_flush_cb_t
  * which will be invoked either when the buffer is full or when json_str_end()
@@ -72,6 +83,22 @@ void json_str_start(json_str_t *jstr, char *buf, int buf_size,
  */
 void json_str_end(json_str_t *jstr);
 
+/** Get JSON string length
+ *
+ * This gives the total length of the JSON string generated so far, including
+ * any data already flushed out, but excluding the NULL termination. If json_str_start()
+ * was called with a NULL buffer, this can be used to find the exact buffer size
+ * required (length + 1) before generating the actual string.
+ *
+ * \note This must be called before json_str_end()
+ *
+ * \param[in] jstr Pointer to the \ref json_str_t structure initilised by
+ * json_str_start()
+ *
+ * \return Length of the JSON string generated so far
+ */
+int json_str_get_len(json_str_t *jstr);
+
 /** Start a JSON object
  *
  * This starts a JSON object by adding a '{'
@@ -255,7 +282,8 @@ int json_obj_set_float(json_str_t *jstr, char *name, float val);
  * \param[in] jstr Pointer to the \ref json_str_t structure initilised by
  * json_str_start()
  * \param[in] name Name of the element
- * \param[in] val Null terminated string value of the element
+ * \param[in] val Null terminated string value of the element. Quotes, backslashes
+ * and control characters in it are escaped
  *
  * \return 0 on Success
  * \return -1 if buffer is out of space (possible only if no callback function
@@ -337,7 +365,8 @@ int json_arr_set_float(json_str_t *jstr, float val);
  *
  * \param[in] jstr Pointer to the \ref json_str_t structure initilised by
  * json_str_start()
- * \param[in] val Null terminated string value of the element
+ * \param[in] val Null terminated string value of the element. Quotes, backslashes
+ * and control characters in it are escaped
  *
  * \return 0 on Success
  * \return -1 if buffer is out of space (possible only if no callback function
@@ -435,4 +464,32 @@ int json_add_to_long_string(json_str_t *jstr, char *val);
  */
 int json_end_long_string(json_str_t *jstr);
 
+/** Format an integer as a JSON number
+ *
+ * \param[out] buf Buffer of at least \ref JSON_INT_STR_MAX bytes
+ * \param[in] val Value to be formatted
+ *
+ * \return Length of the NULL terminated string written to buf
+ */
+int json_format_int(char *buf, int32_t val);
+
+/** Format an unsigned integer as a JSON number
+ *
+ * Same as json_format_int(), for an unsigned value
+ */
+int json_format_uint(char *buf, uint32_t val);
+
+/** Format a float as a JSON number
+ *
+ * This writes the fewest significant digits (up to 9) which convert back to
+ * the same float. Eg. 5 instead of 5.00000, 0.1, 23.8, 1.5e-7. NaN and infinity,
+ * which JSON cannot represent, are written as null. -0 is written as -0.
+ *
+ * \param[out] buf Buffer of at least \ref JSON_FLOAT_STR_MAX bytes
+ * \param[in] val Value to be formatted
+ *
+ * \return Length of the NULL terminated string written to buf
+ */
+int json_format_float(char *buf, float val);
+
 #endif
@@ -0,0 +1,231 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <json_generator.h>
+#include "unity.h"
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+/* Tests for json_format_float(). The output must convert back to the same float with
+ * strtof(), with no more significant digits than the shortest "%.<n>g" output which does so.
+ */
+
+#define FLOAT_SAMPLES		100000
+#ifdef ESP_PLATFORM
+#define FLOAT_BENCH_RUNS	10000
+#else
+#define FLOAT_BENCH_RUNS	1000000
+#endif
+
+static uint32_t float_seed = 1;
+
+static uint32_t float_rand(void)
+{
+	float_seed = float_seed * 1103515245 + 12345;
+	return float_seed >> 1;
+}
+
+static float float_from_bits(uint32_t bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static bool float_same(float a, float b)
+{
+	return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+/* Fewest significant digits with which "%.<n>g" gives back val */
+static int float_shortest_digits(float val)
+{
+	char str[JSON_FLOAT_STR_MAX + 8];
+	int precision;
+	for (precision = 1; precision < 9; precision++) {
+		snprintf(str, sizeof(str), "%.*g", precision, val);
+		if (float_same(strtof(str, NULL), val)) {
+			break;
+		}
+	}
+	return precision;
+}
+
+/* Significant digits in a number, without the leading and trailing zeros */
+static int float_digits(const char *str)
+{
+	const char *first = NULL, *last = NULL;
+	int digits = 0;
+	for (; *str && *str != 'e'; str++) {
+		if (*str >= '1' && *str <= '9') {
+			first = first ? first : str;
+			last = str;
+		}
+	}
+	for (str = first; str && str <= last; str++) {
+		digits += (*str != '.');
+	}
+	return first ? digits : 1;
+}
+
+static bool float_check(float val)
+{
+	char str[JSON_FLOAT_STR_MAX];
+	int len = json_format_float(str, val);
+	if (len != strlen(str) || len >= JSON_FLOAT_STR_MAX) {
+		printf("%.9g: bad length %d for %s\n", val, len, str);
+		return false;
+	}
+	if (!float_same(strtof(str, NULL), val)) {
+		printf("%.9g: %s does not round trip\n", val, str);
+		return false;
+	}
+	if (float_digits(str) > float_shortest_digits(val)) {
+		printf("%.9g: %s has more digits than needed\n", val, str);
+		return false;
+	}
+	return true;
+}
+
+TEST_CASE("json_generator float formatting", "[json_generator]")
+{
+	static const struct {
+		float val;
+		const char *str;
+	} cases[] = {
+		{0.0f, "0"}, {-0.0f, "-0"}, {1.0f, "1"}, {-1.5f, "-1.5"}, {0.1f, "0.1"},
+		{23.5f, "23.5"}, {5.0f, "5"}, {100.0f, "100"}, {123456789.0f, "123456790"},
+		{1e9f, "1000000000"}, {9.9999999e9f, "1e10"}, {1e10f, "1e10"},
+		{1e-5f, "0.00001"}, {1.5e-5f, "0.000015"}, {1e-6f, "1e-6"},
+		{FLT_MAX, "3.4028235e38"}, {-FLT_MAX, "-3.4028235e38"}, {FLT_MIN, "1.1754944e-38"},
+		{1.4e-45f, "1e-45"}, {-1.4e-45f, "-1e-45"},
+	};
+	char str[JSON_FLOAT_STR_MAX];
+	int i;
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		json_format_float(str, cases[i].val);
+		TEST_ASSERT_TRUE_MESSAGE(strcmp(cases[i].str, str) == 0, str);
+		TEST_ASSERT_TRUE_MESSAGE(float_check(cases[i].val), cases[i].str);
+	}
+}
+
+TEST_CASE("json_generator float NaN and infinity are null", "[json_generator]")
+{
+	float vals[] = {NAN, -NAN, INFINITY, -INFINITY};
+	char str[JSON_FLOAT_STR_MAX];
+	int i;
+	for (i = 0; i < sizeof(vals) / sizeof(vals[0]); i++) {
+		TEST_ASSERT_EQUAL(4, json_format_float(str, vals[i]));
+		TEST_ASSERT_EQUAL_STRING("null", str);
+	}
+}
+
+TEST_CASE("json_generator float exponent boundaries", "[json_generator]")
+{
+	/* The powers of 10 where the output switches between fixed point and exponential
+	 * notation, or between fixed point lengths, and the floats on either side of them
+	 */
+	static const float pow10[] = {1e-7f, 1e-6f, 1e-5f, 1e-4f, 1e-1f, 1e0f, 1e1f, 1e8f, 1e9f, 1e10f, 1e11f};
+	int i;
+	for (i = 0; i < sizeof(pow10) / sizeof(pow10[0]); i++) {
+		float vals[] = {pow10[i], nextafterf(pow10[i], 0), nextafterf(pow10[i], INFINITY)};
+		int j;
+		for (j = 0; j < 3; j++) {
+			TEST_ASSERT_TRUE(float_check(vals[j]));
+			TEST_ASSERT_TRUE(float_check(-vals[j]));
+		}
+	}
+	char str[JSON_FLOAT_STR_MAX];
+	json_format_float(str, nextafterf(1e10f, 0));
+	TEST_ASSERT_EQUAL_STRING("9999999000", str);
+}
+
+TEST_CASE("json_generator float subnormals", "[json_generator]")
+{
+	uint32_t bits;
+	/* Every subnormal with few mantissa bits, and a step through the rest */
+	for (bits = 1; bits < 0x800000; bits = (bits < 4096) ? bits + 1 : bits + 997) {
+		TEST_ASSERT_TRUE(float_check(float_from_bits(bits)));
+		TEST_ASSERT_TRUE(float_check(float_from_bits(bits | 0x80000000)));
+	}
+	TEST_ASSERT_TRUE(float_check(float_from_bits(0x7fffff)));
+}
+
+TEST_CASE("json_generator float round trips", "[json_generator]")
+{
+	int i, bad = 0;
+	float_seed = 1;
+	for (i = 0; i < FLOAT_SAMPLES; i++) {
+		float val = float_from_bits((float_rand() << 16) ^ float_rand());
+		if (isnan(val) || isinf(val)) {
+			continue;
+		}
+		if (!float_check(val) && ++bad > 10) {
+			break;
+		}
+	}
+	TEST_ASSERT_EQUAL(0, bad);
+}
+
+static int64_t float_time_us(void)
+{
+#ifdef ESP_PLATFORM
+	return esp_timer_get_time();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+TEST_CASE("json_generator float formatting speed and size", "[json_generator][perf]")
+{
+	/* Values like those in shadow reports, compared with the "%.5f" output used before */
+	static const float vals[] = {23.5f, 0.1f, 100.0f, -4.25f, 3.14159f, 1013.25f, 0.005f, 65535.0f};
+	const int num_vals = sizeof(vals) / sizeof(vals[0]);
+	char str[JSON_FLOAT_STR_MAX + 32];
+	int i, run;
+	int bytes = 0, printf_bytes = 0;
+	for (i = 0; i < num_vals; i++) {
+		bytes += json_format_float(str, vals[i]);
+		printf_bytes += snprintf(str, sizeof(str), "%.*f", JSON_FLOAT_PRECISION, vals[i]);
+	}
+	printf("Bytes for %d values: %d, %d with \"%%.%df\"\n", num_vals, bytes, printf_bytes,
+			JSON_FLOAT_PRECISION);
+
+	int len = 0;
+	int64_t start = float_time_us();
+	for (run = 0; run < FLOAT_BENCH_RUNS; run++) {
+		len += json_format_float(str, vals[run % num_vals]);
+	}
+	int64_t elapsed = float_time_us() - start;
+	int64_t printf_start = float_time_us();
+	for (run = 0; run < FLOAT_BENCH_RUNS; run++) {
+		len += snprintf(str, sizeof(str), "%.*f", JSON_FLOAT_PRECISION, vals[run % num_vals]);
+	}
+	int64_t printf_elapsed = float_time_us() - printf_start;
+	TEST_ASSERT_TRUE(len > 0);
+	printf("json_format_float: %.1f ns per number, \"%%.%df\": %.1f ns per number\n",
+			(double)elapsed * 1000 / FLOAT_BENCH_RUNS, JSON_FLOAT_PRECISION,
+			(double)printf_elapsed * 1000 / FLOAT_BENCH_RUNS);
+}
@@ -0,0 +1,297 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <json_generator.h>
+#include "unity.h"
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+/* Tests for the JSON generator: integer formatting, string escaping, the length only pass
+ * and flushing. The documents built are like the device info and shadow reports of esp_cloud.
+ */
+
+#define GEN_BUF_SIZE		512
+#ifdef ESP_PLATFORM
+#define GEN_BENCH_RUNS		10000
+#else
+#define GEN_BENCH_RUNS		1000000
+#endif
+
+typedef void (*gen_build_fn_t)(json_str_t *jstr);
+
+static void gen_build_device_info(json_str_t *jstr)
+{
+	json_start_object(jstr);
+	json_obj_set_string(jstr, "device_id", "24:0A:C4:12:34:56");
+	json_push_array(jstr, "app_encodings");
+	json_arr_set_string(jstr, "json");
+	json_arr_set_string(jstr, "cbor");
+	json_pop_array(jstr);
+	json_obj_set_string(jstr, "fw_version", "1.2.3");
+	json_obj_set_string(jstr, "model", "smart-plug");
+	json_obj_set_int(jstr, "free_heap", 123456);
+	json_obj_set_bool(jstr, "alexa_bound", false);
+	json_end_object(jstr);
+}
+
+static void gen_build_shadow(json_str_t *jstr)
+{
+	json_start_object(jstr);
+	json_push_object(jstr, "state");
+	json_push_object(jstr, "reported");
+	json_obj_set_bool(jstr, "power", true);
+	json_obj_set_int(jstr, "brightness", 75);
+	json_obj_set_float(jstr, "temperature", 23.5f);
+	json_obj_set_int(jstr, "energy", -2147483647 - 1);
+	json_obj_set_string(jstr, "name", "Living room");
+	json_obj_set_null(jstr, "schedule");
+	json_pop_object(jstr);
+	json_pop_object(jstr);
+	json_obj_set_int(jstr, "version", 1024);
+	json_end_object(jstr);
+}
+
+static const char *gen_device_info_str = "{\"device_id\":\"24:0A:C4:12:34:56\","
+	"\"app_encodings\":[\"json\",\"cbor\"],\"fw_version\":\"1.2.3\",\"model\":\"smart-plug\","
+	"\"free_heap\":123456,\"alexa_bound\":false}";
+static const char *gen_shadow_str = "{\"state\":{\"reported\":{\"power\":true,\"brightness\":75,"
+	"\"temperature\":23.5,\"energy\":-2147483648,\"name\":\"Living room\",\"schedule\":null}},"
+	"\"version\":1024}";
+
+/* Builds into buf, returning the length reported by json_str_get_len() */
+static int gen_build(gen_build_fn_t build_fn, char *buf, int buf_size)
+{
+	json_str_t jstr;
+	json_str_start(&jstr, buf, buf_size, NULL, NULL);
+	build_fn(&jstr);
+	int len = json_str_get_len(&jstr);
+	json_str_end(&jstr);
+	return len;
+}
+
+static int gen_get_len(gen_build_fn_t build_fn)
+{
+	return gen_build(build_fn, NULL, 0);
+}
+
+typedef struct {
+	char out[GEN_BUF_SIZE];
+	int len;
+	int flushes;
+} gen_flush_t;
+
+static void gen_flush_cb(char *buf, void *priv)
+{
+	gen_flush_t *flush = (gen_flush_t *)priv;
+	int len = strlen(buf);
+	memcpy(flush->out + flush->len, buf, len + 1);
+	flush->len += len;
+	flush->flushes++;
+}
+
+/* Builds with a buffer of buf_size and a flush callback, which collects the output */
+static void gen_build_flushed(gen_build_fn_t build_fn, int buf_size, gen_flush_t *flush)
+{
+	char buf[GEN_BUF_SIZE];
+	json_str_t jstr;
+	memset(flush, 0, sizeof(gen_flush_t));
+	json_str_start(&jstr, buf, buf_size, gen_flush_cb, flush);
+	build_fn(&jstr);
+	/* What was flushed, and what is still in the buffer */
+	TEST_ASSERT_EQUAL(flush->len + (int)(jstr.free_ptr - buf), json_str_get_len(&jstr));
+	json_str_end(&jstr);
+}
+
+TEST_CASE("json_generator int formatting", "[json_generator]")
+{
+	static const struct {
+		int32_t val;
+		const char *str;
+	} cases[] = {
+		{0, "0"}, {1, "1"}, {-1, "-1"}, {9, "9"}, {10, "10"}, {-10, "-10"},
+		{1000000000, "1000000000"}, {INT32_MAX, "2147483647"}, {INT32_MIN, "-2147483648"},
+		{INT32_MIN + 1, "-2147483647"},
+	};
+	char buf[JSON_INT_STR_MAX];
+	int i;
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		memset(buf, 'x', sizeof(buf));
+		int len = json_format_int(buf, cases[i].val);
+		TEST_ASSERT_EQUAL_STRING(cases[i].str, buf);
+		TEST_ASSERT_EQUAL_MESSAGE((int)strlen(cases[i].str), len, cases[i].str);
+	}
+	/* Every length, compared with printf() */
+	char expected[JSON_INT_STR_MAX];
+	int32_t val = 7;
+	for (i = 0; i < 10; i++, val *= 10) {
+		int32_t vals[] = {val, -val, val - 1, 1 - val};
+		int j;
+		for (j = 0; j < 4; j++) {
+			snprintf(expected, sizeof(expected), "%d", (int)vals[j]);
+			TEST_ASSERT_EQUAL_MESSAGE((int)strlen(expected), json_format_int(buf, vals[j]), expected);
+			TEST_ASSERT_EQUAL_STRING(expected, buf);
+		}
+		if (val > INT32_MAX / 10) {
+			break;
+		}
+	}
+}
+
+TEST_CASE("json_generator uint formatting", "[json_generator]")
+{
+	static const struct {
+		uint32_t val;
+		const char *str;
+	} cases[] = {
+		{0, "0"}, {1, "1"}, {10, "10"}, {4294967, "4294967"}, {2147483648U, "2147483648"},
+		{UINT32_MAX - 1, "4294967294"}, {UINT32_MAX, "4294967295"},
+	};
+	char buf[JSON_INT_STR_MAX];
+	int i;
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		memset(buf, 'x', sizeof(buf));
+		int len = json_format_uint(buf, cases[i].val);
+		TEST_ASSERT_EQUAL_STRING(cases[i].str, buf);
+		TEST_ASSERT_EQUAL_MESSAGE((int)strlen(cases[i].str), len, cases[i].str);
+	}
+}
+
+static void gen_build_escaped(json_str_t *jstr)
+{
+	json_start_object(jstr);
+	json_obj_set_string(jstr, "quote\"key", "say \"hi\"");
+	json_obj_set_string(jstr, "path", "C:\\dir\\file");
+	json_obj_set_string(jstr, "ctrl", "a\b\f\n\r\tb");
+	json_obj_set_string(jstr, "raw", "\x01\x1f\x7f");
+	json_push_array(jstr, "arr");
+	json_arr_set_string(jstr, "\"");
+	json_arr_set_string(jstr, "\\");
+	json_arr_set_string(jstr, "");
+	json_arr_set_string(jstr, NULL);
+	json_pop_array(jstr);
+	json_end_object(jstr);
+}
+
+static const char *gen_escaped_str = "{\"quote\\\"key\":\"say \\\"hi\\\"\","
+	"\"path\":\"C:\\\\dir\\\\file\",\"ctrl\":\"a\\b\\f\\n\\r\\tb\","
+	"\"raw\":\"\\u0001\\u001f\x7f\",\"arr\":[\"\\\"\",\"\\\\\",\"\",\"\"]}";
+
+TEST_CASE("json_generator escapes strings", "[json_generator]")
+{
+	char buf[GEN_BUF_SIZE];
+	int len = gen_build(gen_build_escaped, buf, sizeof(buf));
+	TEST_ASSERT_EQUAL_STRING(gen_escaped_str, buf);
+	TEST_ASSERT_EQUAL((int)strlen(gen_escaped_str), len);
+}
+
+TEST_CASE("json_generator builds the expected documents", "[json_generator]")
+{
+	char buf[GEN_BUF_SIZE];
+	TEST_ASSERT_EQUAL((int)strlen(gen_device_info_str), gen_build(gen_build_device_info, buf, sizeof(buf)));
+	TEST_ASSERT_EQUAL_STRING(gen_device_info_str, buf);
+	TEST_ASSERT_EQUAL((int)strlen(gen_shadow_str), gen_build(gen_build_shadow, buf, sizeof(buf)));
+	TEST_ASSERT_EQUAL_STRING(gen_shadow_str, buf);
+}
+
+TEST_CASE("json_generator length only pass matches the build", "[json_generator]")
+{
+	static const struct {
+		gen_build_fn_t fn;
+		const char **str;
+	} docs[] = {
+		{gen_build_device_info, &gen_device_info_str},
+		{gen_build_shadow, &gen_shadow_str},
+		{gen_build_escaped, &gen_escaped_str},
+	};
+	char buf[GEN_BUF_SIZE];
+	int i;
+	for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+		int len = gen_get_len(docs[i].fn);
+		TEST_ASSERT_EQUAL_MESSAGE((int)strlen(*docs[i].str), len, *docs[i].str);
+		/* A buffer of exactly length + 1, as esp_cloud allocates, is enough */
+		TEST_ASSERT_EQUAL(len, gen_build(docs[i].fn, buf, len + 1));
+		TEST_ASSERT_EQUAL_STRING(*docs[i].str, buf);
+	}
+}
+
+TEST_CASE("json_generator flushes a full buffer", "[json_generator]")
+{
+	static const struct {
+		gen_build_fn_t fn;
+		const char **str;
+	} docs[] = {
+		{gen_build_device_info, &gen_device_info_str},
+		{gen_build_shadow, &gen_shadow_str},
+		{gen_build_escaped, &gen_escaped_str},
+	};
+	gen_flush_t flush;
+	int i, buf_size;
+	for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+		/* Every buffer size from 2 (1 byte and the NULL termination) up */
+		for (buf_size = 2; buf_size < 64; buf_size++) {
+			gen_build_flushed(docs[i].fn, buf_size, &flush);
+			TEST_ASSERT_EQUAL_STRING(*docs[i].str, flush.out);
+		}
+	}
+	/* Without a flush callback, running out of space is an error */
+	char buf[16];
+	json_str_t jstr;
+	json_str_start(&jstr, buf, sizeof(buf), NULL, NULL);
+	json_start_object(&jstr);
+	TEST_ASSERT_EQUAL(-1, json_obj_set_string(&jstr, "device_id", "24:0A:C4:12:34:56"));
+	json_str_end(&jstr);
+}
+
+static int64_t gen_time_us(void)
+{
+#ifdef ESP_PLATFORM
+	return esp_timer_get_time();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+TEST_CASE("json_generator build throughput", "[json_generator][perf]")
+{
+	static const struct {
+		const char *name;
+		gen_build_fn_t fn;
+	} docs[] = {
+		{"device info", gen_build_device_info},
+		{"shadow report", gen_build_shadow},
+	};
+	char buf[GEN_BUF_SIZE];
+	int i, run;
+	for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+		int len = 0;
+		int64_t start = gen_time_us();
+		for (run = 0; run < GEN_BENCH_RUNS; run++) {
+			len += gen_build(docs[i].fn, buf, sizeof(buf));
+		}
+		int64_t elapsed = gen_time_us() - start;
+		TEST_ASSERT_EQUAL(len, (int)strlen(buf) * GEN_BENCH_RUNS);
+		printf("%s of %d bytes, built %d times: %lld us, %.1f ns per build\n", docs[i].name,
+				(int)strlen(buf), GEN_BENCH_RUNS, (long long)elapsed,
+				(double)elapsed * 1000 / GEN_BENCH_RUNS);
+	}
+}
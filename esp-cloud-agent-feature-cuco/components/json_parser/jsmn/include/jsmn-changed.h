@@ -32,15 +32,30 @@
 #define __JSMN_CHANGED_H_
 
 #include <stddef.h>
+#include <stdint.h>
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 
-#define JSMN_PARENT_LINKS
+#define JSMN_SIBLING_LINKS
 #define JSMN_STRICT
 
+#ifdef CONFIG_JSON_PARSER_COMPACT_TOKENS
+#define JSMN_COMPACT_TOKENS
+#endif
+
+/* Maximum nesting of objects and arrays */
+#ifdef CONFIG_JSON_PARSER_MAX_DEPTH
+#define JSMN_MAX_DEPTH		CONFIG_JSON_PARSER_MAX_DEPTH
+#else
+#define JSMN_MAX_DEPTH		16
+#endif
+
 /**
  * JSON type identifier. Basic types are:
  * 	o Object
@@ -62,22 +77,50 @@ enum jsmnerr {
 	/* Invalid character inside JSON string */
 	JSMN_ERROR_INVAL = -2,
 	/* The string is not a full JSON packet, more bytes expected */
-	JSMN_ERROR_PART = -3
+	JSMN_ERROR_PART = -3,
+	/* The JSON is too long for the compact tokens, or nested deeper than JSMN_MAX_DEPTH */
+	JSMN_ERROR_LIMIT = -4,
+	/* The json_sax callback stopped the parsing. Defined here, since json_sax returns
+	 * errors from this same space
+	 */
+	JSMN_ERROR_ABORTED = -5
 };
 
+#ifdef JSMN_COMPACT_TOKENS
+/* Offsets and token indices are 16 bit, with the type packed along with the size */
+typedef uint16_t jsmn_pos_t;
+typedef int16_t jsmn_idx_t;
+#define JSMN_MAX_LEN		0xfffe
+#define JSMN_MAX_TOKENS		INT16_MAX
+#define JSMN_MAX_SIZE		0x1fff
+#else
+typedef int jsmn_pos_t;
+typedef int jsmn_idx_t;
+#endif
+/* start/end of a token which is not yet known */
+#define JSMN_POS_UNSET		((jsmn_pos_t)-1)
+
 /**
  * JSON token description.
  * @param		type	type (object, array, string etc.)
  * @param		start	start position in JSON data string
  * @param		end		end position in JSON data string
+ * @param		size	number of keys of an object, elements of an array, or 1 for a key
+ * @param		next	index of the token after this one and all its children, i.e. of
+ * 						its next sibling. For a key, this is the token after its value.
  */
 typedef struct {
+#ifdef JSMN_COMPACT_TOKENS
+	uint16_t type : 3;
+	uint16_t size : 13;
+#else
 	_jsmntype_t type;
-	int start;
-	int end;
 	int size;
-#ifdef JSMN_PARENT_LINKS
-	int parent;
+#endif
+	jsmn_pos_t start;
+	jsmn_pos_t end;
+#ifdef JSMN_SIBLING_LINKS
+	jsmn_idx_t next;
 #endif
 } _jsmntok_t;
 
@@ -89,6 +132,8 @@ typedef struct {
 	unsigned int pos; /* offset in the JSON string */
 	unsigned int toknext; /* next token to allocate */
 	int toksuper; /* superior token node, e.g parent object or array */
+	unsigned int depth; /* number of open objects and arrays */
+	jsmn_idx_t open[JSMN_MAX_DEPTH]; /* open objects and arrays, innermost last */
 } _jsmn_parser;
 
 /**
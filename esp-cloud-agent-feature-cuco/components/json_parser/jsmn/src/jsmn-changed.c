@@ -28,8 +28,106 @@
  * @see http://zserge.com/jsmn.html
  */
 
+#include <stdint.h>
 #include "jsmn-changed.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Scanning of string bodies and whitespace, more than a byte at a time. SSE2 is
+ * used on x86 (host) builds. Elsewhere (e.g. ESP32), aligned machine words are
+ * checked with the SWAR "has zero byte" test, which has no false negatives.
+ */
+typedef size_t __attribute__((__may_alias__)) jsmn_word_t;
+
+#define JSMN_WORD_ONES		((size_t)-1 / 0xff)
+#define JSMN_WORD_HIGHS		(JSMN_WORD_ONES * 0x80)
+#define JSMN_WORD_HAS_ZERO(w)	(((w) - JSMN_WORD_ONES) & ~(w) & JSMN_WORD_HIGHS)
+#define JSMN_WORD_HAS_BYTE(w, b)	JSMN_WORD_HAS_ZERO((w) ^ (JSMN_WORD_ONES * (b)))
+
+static inline int jsmn_is_string_special(char c) {
+	return c == '\"' || c == '\\' || c == '\0';
+}
+
+/**
+ * Number of bytes from js, up to len, before a quote, a backslash or a NULL.
+ */
+static size_t jsmn_string_run(const char *js, size_t len) {
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i quote = _mm_set1_epi8('\"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(js + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+				_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+				_mm_cmpeq_epi8(v, zero)));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#else
+	/* Words are read only when aligned */
+	for (; i < len && ((uintptr_t)(js + i) % sizeof(jsmn_word_t)); i++) {
+		if (jsmn_is_string_special(js[i])) {
+			return i;
+		}
+	}
+	for (; i + sizeof(jsmn_word_t) <= len; i += sizeof(jsmn_word_t)) {
+		jsmn_word_t w = *(const jsmn_word_t *)(js + i);
+		if (JSMN_WORD_HAS_ZERO(w) | JSMN_WORD_HAS_BYTE(w, '\"') |
+				JSMN_WORD_HAS_BYTE(w, '\\')) {
+			break;
+		}
+	}
+#endif
+	for (; i < len && !jsmn_is_string_special(js[i]); i++);
+	return i;
+}
+
+static inline int jsmn_is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/**
+ * Number of whitespace bytes from js, up to len.
+ */
+static size_t jsmn_space_run(const char *js, size_t len) {
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(js + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr))));
+		if (mask != 0xffff) {
+			return i + __builtin_ctz(~mask);
+		}
+	}
+#else
+	/* Only runs of spaces, as used for indentation, are skipped a word at a time */
+	for (; i < len && ((uintptr_t)(js + i) % sizeof(jsmn_word_t)); i++) {
+		if (!jsmn_is_space(js[i])) {
+			return i;
+		}
+	}
+	for (; i + sizeof(jsmn_word_t) <= len; i += sizeof(jsmn_word_t)) {
+		if (*(const jsmn_word_t *)(js + i) != JSMN_WORD_ONES * ' ') {
+			break;
+		}
+	}
+#endif
+	for (; i < len && jsmn_is_space(js[i]); i++);
+	return i;
+}
+
 /**
  * Allocates a fresh unused token from the token pull.
  */
@@ -40,14 +138,59 @@ static _jsmntok_t *jsmn_alloc_token(_jsmn_parser *parser,
 		return NULL;
 	}
 	tok = &tokens[parser->toknext++];
-	tok->start = tok->end = -1;
+	tok->start = tok->end = JSMN_POS_UNSET;
 	tok->size = 0;
-#ifdef JSMN_PARENT_LINKS
-	tok->parent = -1;
+#ifdef JSMN_SIBLING_LINKS
+	tok->next = -1;
 #endif
 	return tok;
 }
 
+#ifdef JSMN_SIBLING_LINKS
+/**
+ * Called once a token and all its children are parsed. If it is the value of
+ * a key, the key ends here too.
+ */
+static void jsmn_set_next(_jsmn_parser *parser, _jsmntok_t *tokens,
+		_jsmntok_t *token, int parent) {
+	token->next = parser->toknext;
+	if (parent != -1 && tokens[parent].type == JSMN_STRING) {
+		tokens[parent].next = parser->toknext;
+	}
+}
+#endif
+
+/**
+ * The token which a just closed object or array belongs to: its key if it is in an
+ * object, else the enclosing array, or -1 at the top level.
+ */
+static int jsmn_parent(_jsmn_parser *parser, _jsmntok_t *tokens,
+		_jsmntok_t *token) {
+	int super;
+	if (parser->depth == 0) {
+		return -1;
+	}
+	super = parser->open[parser->depth - 1];
+	if (tokens[super].type == JSMN_OBJECT) {
+		/* The key is the token right before its value */
+		return (token - tokens) - 1;
+	}
+	return super;
+}
+
+/**
+ * Counts one more key or element of a container, or the value of a key.
+ */
+static int jsmn_add_child(_jsmntok_t *token) {
+#ifdef JSMN_COMPACT_TOKENS
+	if (token->size == JSMN_MAX_SIZE) {
+		return JSMN_ERROR_LIMIT;
+	}
+#endif
+	token->size++;
+	return 0;
+}
+
 /**
  * Fills token type and boundaries.
  */
@@ -101,8 +244,8 @@ found:
 		return JSMN_ERROR_NOMEM;
 	}
 	jsmn_fill_token(token, JSMN_PRIMITIVE, start, parser->pos);
-#ifdef JSMN_PARENT_LINKS
-	token->parent = parser->toksuper;
+#ifdef JSMN_SIBLING_LINKS
+	jsmn_set_next(parser, tokens, token, parser->toksuper);
 #endif
 	parser->pos--;
 	return 0;
@@ -121,7 +264,14 @@ static int jsmn_parse_string(_jsmn_parser *parser, const char *js,
 
 	/* Skip starting quote */
 	for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
-		char c = js[parser->pos];
+		char c;
+
+		/* Skip the plain characters up to the next quote or backslash */
+		parser->pos += jsmn_string_run(js + parser->pos, len - parser->pos);
+		if (parser->pos >= len || js[parser->pos] == '\0') {
+			break;
+		}
+		c = js[parser->pos];
 
 		/* Quote: end of string */
 		if (c == '\"') {
@@ -134,8 +284,9 @@ static int jsmn_parse_string(_jsmn_parser *parser, const char *js,
 				return JSMN_ERROR_NOMEM;
 			}
 			jsmn_fill_token(token, JSMN_STRING, start+1, parser->pos);
-#ifdef JSMN_PARENT_LINKS
-			token->parent = parser->toksuper;
+#ifdef JSMN_SIBLING_LINKS
+			/* For a key, this is updated once its value is parsed */
+			jsmn_set_next(parser, tokens, token, parser->toksuper);
 #endif
 			return 0;
 		}
@@ -181,10 +332,15 @@ static int jsmn_parse_string(_jsmn_parser *parser, const char *js,
 int __jsmn_parse(_jsmn_parser *parser, const char *js, size_t len,
 		_jsmntok_t *tokens, unsigned int num_tokens) {
 	int r;
-	int i;
 	_jsmntok_t *token;
 	int count = parser->toknext;
 
+#ifdef JSMN_COMPACT_TOKENS
+	/* This also bounds the number of tokens to (len + 1) / 2, so they fit jsmn_idx_t */
+	if (len > JSMN_MAX_LEN) {
+		return JSMN_ERROR_LIMIT;
+	}
+#endif
 	for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
 		char c;
 		_jsmntype_t type;
@@ -200,69 +356,48 @@ int __jsmn_parse(_jsmn_parser *parser, const char *js, size_t len,
 				if (token == NULL)
 					return JSMN_ERROR_NOMEM;
 				if (parser->toksuper != -1) {
-					tokens[parser->toksuper].size++;
-#ifdef JSMN_PARENT_LINKS
-					token->parent = parser->toksuper;
-#endif
+					r = jsmn_add_child(&tokens[parser->toksuper]);
+					if (r < 0) return r;
+				}
+				if (parser->depth == JSMN_MAX_DEPTH) {
+					return JSMN_ERROR_LIMIT;
 				}
 				token->type = (c == '{' ? JSMN_OBJECT : JSMN_ARRAY);
 				token->start = parser->pos;
 				parser->toksuper = parser->toknext - 1;
+				parser->open[parser->depth++] = parser->toksuper;
 				break;
 			case '}': case ']':
 				if (tokens == NULL)
 					break;
 				type = (c == '}' ? JSMN_OBJECT : JSMN_ARRAY);
-#ifdef JSMN_PARENT_LINKS
-				if (parser->toknext < 1) {
+				/* Error if unmatched closing bracket */
+				if (parser->depth == 0) {
 					return JSMN_ERROR_INVAL;
 				}
-				token = &tokens[parser->toknext - 1];
-				for (;;) {
-					if (token->start != -1 && token->end == -1) {
-						if (token->type != type) {
-							return JSMN_ERROR_INVAL;
-						}
-						token->end = parser->pos + 1;
-						parser->toksuper = token->parent;
-						break;
-					}
-					if (token->parent == -1) {
-						break;
-					}
-					token = &tokens[token->parent];
-				}
-#else
-				for (i = parser->toknext - 1; i >= 0; i--) {
-					token = &tokens[i];
-					if (token->start != -1 && token->end == -1) {
-						if (token->type != type) {
-							return JSMN_ERROR_INVAL;
-						}
-						parser->toksuper = -1;
-						token->end = parser->pos + 1;
-						break;
-					}
-				}
-				/* Error if unmatched closing bracket */
-				if (i == -1) return JSMN_ERROR_INVAL;
-				for (; i >= 0; i--) {
-					token = &tokens[i];
-					if (token->start != -1 && token->end == -1) {
-						parser->toksuper = i;
-						break;
-					}
+				token = &tokens[parser->open[--parser->depth]];
+				if (token->type != type) {
+					return JSMN_ERROR_INVAL;
 				}
+				token->end = parser->pos + 1;
+				parser->toksuper = jsmn_parent(parser, tokens, token);
+#ifdef JSMN_SIBLING_LINKS
+				jsmn_set_next(parser, tokens, token, parser->toksuper);
 #endif
 				break;
 			case '\"':
 				r = jsmn_parse_string(parser, js, len, tokens, num_tokens);
 				if (r < 0) return r;
 				count++;
-				if (parser->toksuper != -1 && tokens != NULL)
-					tokens[parser->toksuper].size++;
+				if (parser->toksuper != -1 && tokens != NULL) {
+					r = jsmn_add_child(&tokens[parser->toksuper]);
+					if (r < 0) return r;
+				}
 				break;
 			case '\t' : case '\r' : case '\n' : case ' ':
+				/* Skip the rest of the whitespace, leaving pos at its last byte */
+				parser->pos += jsmn_space_run(js + parser->pos + 1,
+						len - parser->pos - 1);
 				break;
 			case ':':
 				parser->toksuper = parser->toknext - 1;
@@ -271,18 +406,8 @@ int __jsmn_parse(_jsmn_parser *parser, const char *js, size_t len,
 				if (tokens != NULL && parser->toksuper != -1 &&
 						tokens[parser->toksuper].type != JSMN_ARRAY &&
 						tokens[parser->toksuper].type != JSMN_OBJECT) {
-#ifdef JSMN_PARENT_LINKS
-					parser->toksuper = tokens[parser->toksuper].parent;
-#else
-					for (i = parser->toknext - 1; i >= 0; i--) {
-						if (tokens[i].type == JSMN_ARRAY || tokens[i].type == JSMN_OBJECT) {
-							if (tokens[i].start != -1 && tokens[i].end == -1) {
-								parser->toksuper = i;
-								break;
-							}
-						}
-					}
-#endif
+					/* Back from the key to the object it is in */
+					parser->toksuper = parser->depth ? parser->open[parser->depth - 1] : -1;
 				}
 				break;
 #ifdef JSMN_STRICT
@@ -305,8 +430,10 @@ int __jsmn_parse(_jsmn_parser *parser, const char *js, size_t len,
 				r = jsmn_parse_primitive(parser, js, len, tokens, num_tokens);
 				if (r < 0) return r;
 				count++;
-				if (parser->toksuper != -1 && tokens != NULL)
-					tokens[parser->toksuper].size++;
+				if (parser->toksuper != -1 && tokens != NULL) {
+					r = jsmn_add_child(&tokens[parser->toksuper]);
+					if (r < 0) return r;
+				}
 				break;
 
 #ifdef JSMN_STRICT
@@ -317,13 +444,9 @@ int __jsmn_parse(_jsmn_parser *parser, const char *js, size_t len,
 		}
 	}
 
-	if (tokens != NULL) {
-		for (i = parser->toknext - 1; i >= 0; i--) {
-			/* Unmatched opened object or array */
-			if (tokens[i].start != -1 && tokens[i].end == -1) {
-				return JSMN_ERROR_PART;
-			}
-		}
+	/* Unmatched opened object or array */
+	if (tokens != NULL && parser->depth != 0) {
+		return JSMN_ERROR_PART;
 	}
 
 	return count;
@@ -337,5 +460,6 @@ void __jsmn_init(_jsmn_parser *parser) {
 	parser->pos = 0;
 	parser->toknext = 0;
 	parser->toksuper = -1;
+	parser->depth = 0;
 }
 
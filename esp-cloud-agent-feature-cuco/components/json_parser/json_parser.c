@@ -3,78 +3,190 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <float.h>
 
 #include <esp_cloud_mem.h>
 
 #include <jsmn-changed.h>
 #include <json_parser.h>
 
-static bool token_matches_str(jparse_ctx_t *ctx, json_tok_t *tok, char *str)
+static bool token_matches_strn(jparse_ctx_t *ctx, json_tok_t *tok, const char *str, size_t len)
 {
-	char *js = ctx->js;
-	return ((strncmp(js + tok->start, str, strlen(str)) == 0)
-			&& (strlen(str) == (size_t) (tok->end - tok->start)));
+	return ((size_t) (tok->end - tok->start) == len)
+			&& (memcmp(ctx->js + tok->start, str, len) == 0);
 }
 
-static json_tok_t *json_skip_elem(json_tok_t *token)
+/* The next sibling of a token, i.e. the token after all its children */
+static json_tok_t *json_next_elem(jparse_ctx_t *jctx, json_tok_t *token)
 {
-	json_tok_t *cur = token;
-	int cnt = cur->size;
-	while (cnt--) {
-		cur++;
-		cur = json_skip_elem(cur);
+	return &jctx->tokens[token->next];
+}
+
+static inline unsigned json_digit(char c)
+{
+	/* Anything other than '0' to '9' becomes > 9 */
+	return (unsigned)(c - '0');
+}
+
+/* Parse an integer which spans exactly [str, end). Unlike strtol(), this fails on
+ * overflow, does not look beyond end and does not depend on the locale.
+ */
+static int json_str_to_int(const char *str, const char *end, int64_t min, int64_t max, int64_t *val)
+{
+	bool neg = false;
+	if (str < end && *str == '-') {
+		neg = true;
+		str++;
+	}
+	/* JSON does not allow leading zeros, as in 01 */
+	if (str == end || (*str == '0' && str + 1 < end))
+		return -OS_FAIL;
+	uint64_t limit = neg ? (uint64_t)(-(min + 1)) + 1 : (uint64_t)max;
+	uint64_t v = 0;
+	for (; str < end; str++) {
+		unsigned d = json_digit(*str);
+		if (d > 9 || v > (limit - d) / 10)
+			return -OS_FAIL;
+		v = v * 10 + d;
 	}
-	return cur;
+	/* Written so as to not overflow for the minimum value */
+	*val = neg ? -(int64_t)(v - 1) - 1 : (int64_t)v;
+	return OS_SUCCESS;
 }
 
-static int json_tok_to_bool(jparse_ctx_t *jctx, json_tok_t *tok, bool *val)
+/* 10^n for the n for which it is exactly representable as a double */
+static const double json_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+#define JSON_POW10_MAX		22
+#define JSON_MANTISSA_DIGITS	19
+
+/* Parse a JSON number which spans exactly [str, end), failing if it is out of the range of
+ * a float. Up to 19 significant digits are used. A mantissa below 2^53 with an exponent
+ * within +/-22 needs a single exact multiplication or division, so the result is the
+ * same as that of strtod(), converted to float.
+ */
+static int json_str_to_float(const char *str, const char *end, float *val)
+{
+	bool neg = false;
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exp10 = 0;
+	const char *start;
+	unsigned d;
+
+	if (str < end && *str == '-') {
+		neg = true;
+		str++;
+	}
+	for (start = str; str < end && (d = json_digit(*str)) <= 9; str++) {
+		if (digits < JSON_MANTISSA_DIGITS) {
+			mantissa = mantissa * 10 + d;
+			digits += (mantissa != 0);
+		} else {
+			exp10++;
+		}
+	}
+	if (str == start || (*start == '0' && str - start > 1))
+		return -OS_FAIL;
+	if (str < end && *str == '.') {
+		for (start = ++str; str < end && (d = json_digit(*str)) <= 9; str++) {
+			if (digits < JSON_MANTISSA_DIGITS) {
+				mantissa = mantissa * 10 + d;
+				digits += (mantissa != 0);
+				exp10--;
+			}
+		}
+		if (str == start)
+			return -OS_FAIL;
+	}
+	if (str < end && (*str == 'e' || *str == 'E')) {
+		bool exp_neg = false;
+		int exp = 0;
+		str++;
+		if (str < end && (*str == '+' || *str == '-'))
+			exp_neg = (*str++ == '-');
+		for (start = str; str < end && (d = json_digit(*str)) <= 9; str++) {
+			if (exp < 100000)
+				exp = exp * 10 + d;
+		}
+		if (str == start)
+			return -OS_FAIL;
+		exp10 += exp_neg ? -exp : exp;
+	}
+	if (str != end)
+		return -OS_FAIL;
+
+	double v = (double)mantissa;
+	if (mantissa) {
+		/* The loops stop once the value is out of the range of a double anyway */
+		for (; exp10 > JSON_POW10_MAX && v <= 1e308; exp10 -= JSON_POW10_MAX)
+			v *= json_pow10[JSON_POW10_MAX];
+		for (; exp10 < -JSON_POW10_MAX && v != 0; exp10 += JSON_POW10_MAX)
+			v /= json_pow10[JSON_POW10_MAX];
+		if (exp10 > JSON_POW10_MAX)
+			return -OS_FAIL;
+		if (exp10 >= 0)
+			v *= json_pow10[exp10];
+		else if (exp10 >= -JSON_POW10_MAX)
+			v /= json_pow10[-exp10];
+	}
+	float f = (float)v;
+	if (f > FLT_MAX)
+		return -OS_FAIL;
+	*val = neg ? -f : f;
+	return OS_SUCCESS;
+}
+
+static bool json_str_matches(const char *str, int len, const char *match)
+{
+	return ((size_t)len == strlen(match)) && (memcmp(str, match, len) == 0);
+}
+
+int json_primitive_get_bool(const char *str, int len, bool *val)
 {
-	if (token_matches_str(jctx, tok, "true") || token_matches_str(jctx, tok, "1")) {
+	if (json_str_matches(str, len, "true") || json_str_matches(str, len, "1")) {
 		*val = true;
-	} else if  (token_matches_str(jctx, tok, "false") || token_matches_str(jctx, tok, "0")) {
+	} else if (json_str_matches(str, len, "false") || json_str_matches(str, len, "0")) {
 		*val = false;
 	} else
 		return -OS_FAIL;
 	return OS_SUCCESS;
 }
 
+int json_primitive_get_int(const char *str, int len, int *val)
+{
+	int64_t i64;
+	if (json_str_to_int(str, str + len, INT32_MIN, INT32_MAX, &i64) != OS_SUCCESS)
+		return -OS_FAIL;
+	*val = i64;
+	return OS_SUCCESS;
+}
+
+int json_primitive_get_float(const char *str, int len, float *val)
+{
+	return json_str_to_float(str, str + len, val);
+}
+
+static int json_tok_to_bool(jparse_ctx_t *jctx, json_tok_t *tok, bool *val)
+{
+	return json_primitive_get_bool(&jctx->js[tok->start], tok->end - tok->start, val);
+}
+
 static int json_tok_to_int(jparse_ctx_t *jctx, json_tok_t *tok, int *val)
 {
-	char *tok_start = &jctx->js[tok->start];
-	char *tok_end = &jctx->js[tok->end];
-	char *endptr;
-	int i = strtoul(tok_start, &endptr, 10);
-	if (endptr == tok_end) {
-		*val = i;
-		return OS_SUCCESS;
-	}
-	return -OS_FAIL;
+	return json_primitive_get_int(&jctx->js[tok->start], tok->end - tok->start, val);
 }
 
 static int json_tok_to_int64(jparse_ctx_t *jctx, json_tok_t *tok, int64_t *val)
 {
-	char *tok_start = &jctx->js[tok->start];
-	char *tok_end = &jctx->js[tok->end];
-	char *endptr;
-	int64_t i64 = strtoull(tok_start, &endptr, 10);
-	if (endptr == tok_end) {
-		*val = i64;
-		return OS_SUCCESS;
-	}
-	return -OS_FAIL;
+	return json_str_to_int(&jctx->js[tok->start], &jctx->js[tok->end], INT64_MIN, INT64_MAX, val);
 }
 
 static int json_tok_to_float(jparse_ctx_t *jctx, json_tok_t *tok, float *val)
 {
-	char *tok_start = &jctx->js[tok->start];
-	char *tok_end = &jctx->js[tok->end];
-	char *endptr;
-	float f = strtof(tok_start, &endptr);
-	if (endptr == tok_end) {
-		*val = f;
-		return OS_SUCCESS;
-	}
-	return -OS_FAIL;
+	return json_primitive_get_float(&jctx->js[tok->start], tok->end - tok->start, val);
 }
 
 static int json_tok_to_string(jparse_ctx_t *jctx, json_tok_t *tok, char *val, int size)
@@ -86,6 +198,59 @@ static int json_tok_to_string(jparse_ctx_t *jctx, json_tok_t *tok, char *val, in
 	return OS_SUCCESS;
 }
 
+static int json_tok_to_strptr(jparse_ctx_t *jctx, json_tok_t *tok, const char **str, int *len)
+{
+	*str = jctx->js + tok->start;
+	*len = tok->end - tok->start;
+	return OS_SUCCESS;
+}
+
+#ifdef JSON_PARSER_KEY_HASH
+/* FNV-1a */
+static uint32_t json_key_hash(const char *str, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	while (len--) {
+		hash ^= (uint8_t)*str++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bool json_obj_hash_keys(jparse_ctx_t *jctx, json_tok_t *obj)
+{
+	if (obj->size < JSON_KEY_HASH_MIN_KEYS || obj->size > (JSON_KEY_HASH_SLOTS * 3 / 4)
+			|| jctx->num_tokens > UINT16_MAX)
+		return false;
+	memset(jctx->key_hash, 0, sizeof(jctx->key_hash));
+	json_tok_t *tok = obj + 1;
+	int size = obj->size;
+	while (size--) {
+		uint32_t slot = json_key_hash(jctx->js + tok->start, tok->end - tok->start);
+		/* Linear probing. The first of duplicate keys is found first, like in a search */
+		while (jctx->key_hash[slot % JSON_KEY_HASH_SLOTS])
+			slot++;
+		jctx->key_hash[slot % JSON_KEY_HASH_SLOTS] = (tok - jctx->tokens) + 1;
+		tok = json_next_elem(jctx, tok);
+	}
+	jctx->hashed_obj = obj;
+	return true;
+}
+
+static json_tok_t *json_obj_hash_lookup(jparse_ctx_t *jctx, const char *key, size_t len)
+{
+	uint32_t slot = json_key_hash(key, len);
+	uint16_t idx;
+	while ((idx = jctx->key_hash[slot % JSON_KEY_HASH_SLOTS]) != 0) {
+		json_tok_t *tok = &jctx->tokens[idx - 1];
+		if (token_matches_strn(jctx, tok, key, len))
+			return tok;
+		slot++;
+	}
+	return NULL;
+}
+#endif /* JSON_PARSER_KEY_HASH */
+
 static json_tok_t *json_obj_search(jparse_ctx_t *jctx, char *key)
 {
 	json_tok_t *tok = jctx->cur;
@@ -95,11 +260,16 @@ static json_tok_t *json_obj_search(jparse_ctx_t *jctx, char *key)
 	if (tok->type != JSMN_OBJECT)
 		return NULL;
 
+	size_t len = strlen(key);
+#ifdef JSON_PARSER_KEY_HASH
+	if (jctx->hashed_obj == tok || json_obj_hash_keys(jctx, tok))
+		return json_obj_hash_lookup(jctx, key, len);
+#endif
+	tok++;
 	while (size--) {
-		tok++;
-		if (token_matches_str(jctx, tok, key))
+		if (token_matches_strn(jctx, tok, key, len))
 			return tok;
-		tok = json_skip_elem(tok);
+		tok = json_next_elem(jctx, tok);
 	}
 	return NULL;
 }
@@ -115,51 +285,51 @@ static json_tok_t *json_obj_get_val_tok(jparse_ctx_t *jctx, char *name, _jsmntyp
 	return tok;
 }
 
-int json_obj_get_array(jparse_ctx_t *jctx, char *name, int *num_elem)
+/* Make tok the current object or array, remembering the one to go back to */
+static int json_enter(jparse_ctx_t *jctx, json_tok_t *tok)
 {
-	json_tok_t *tok = json_obj_get_val_tok(jctx, name, JSMN_ARRAY);
-	if (!tok)
+	if (jctx->depth == JSMN_MAX_DEPTH)
 		return -OS_FAIL;
+	jctx->outer[jctx->depth++] = jctx->cur - jctx->tokens;
 	jctx->cur = tok;
-	*num_elem = tok->size;
 	return OS_SUCCESS;
 }
 
-int json_obj_leave_array(jparse_ctx_t *jctx)
+static int json_leave(jparse_ctx_t *jctx)
 {
-	/* The array's parent will be the key */
-	if (jctx->cur->parent < 0)
+	if (jctx->depth == 0)
 		return -OS_FAIL;
-	jctx->cur = &jctx->tokens[jctx->cur->parent];
+	jctx->cur = &jctx->tokens[jctx->outer[--jctx->depth]];
+	return OS_SUCCESS;
+}
 
-	/* The key's parent will be the actual parent object */
-	if (jctx->cur->parent < 0)
+int json_obj_get_array(jparse_ctx_t *jctx, char *name, int *num_elem)
+{
+	json_tok_t *tok = json_obj_get_val_tok(jctx, name, JSMN_ARRAY);
+	if (!tok)
+		return -OS_FAIL;
+	if (json_enter(jctx, tok) != OS_SUCCESS)
 		return -OS_FAIL;
-	jctx->cur = &jctx->tokens[jctx->cur->parent];
+	*num_elem = tok->size;
 	return OS_SUCCESS;
 }
 
+int json_obj_leave_array(jparse_ctx_t *jctx)
+{
+	return json_leave(jctx);
+}
+
 int json_obj_get_object(jparse_ctx_t *jctx, char *name)
 {
 	json_tok_t *tok = json_obj_get_val_tok(jctx, name, JSMN_OBJECT);
 	if (!tok)
 		return -OS_FAIL;
-	jctx->cur = tok;
-	return OS_SUCCESS;
+	return json_enter(jctx, tok);
 }
 
 int json_obj_leave_object(jparse_ctx_t *jctx)
 {
-	/* The objects's parent will be the key */
-	if (jctx->cur->parent < 0)
-		return -OS_FAIL;
-	jctx->cur = &jctx->tokens[jctx->cur->parent];
-
-	/* The key's parent will be the actual parent object */
-	if (jctx->cur->parent < 0)
-		return -OS_FAIL;
-	jctx->cur = &jctx->tokens[jctx->cur->parent];
-	return OS_SUCCESS;
+	return json_leave(jctx);
 }
 
 int json_obj_get_bool(jparse_ctx_t *jctx, char *name, bool *val)
@@ -211,6 +381,14 @@ int json_obj_get_strlen(jparse_ctx_t *jctx, char *name, int *strlen)
 	return OS_SUCCESS;
 }
 
+int json_obj_get_strptr(jparse_ctx_t *jctx, char *name, const char **str, int *len)
+{
+	json_tok_t *tok = json_obj_get_val_tok(jctx, name, JSMN_STRING);
+	if (!tok)
+		return -OS_FAIL;
+	return json_tok_to_strptr(jctx, tok, str, len);
+}
+
 static json_tok_t *json_arr_search(jparse_ctx_t *ctx, uint32_t index)
 {
 	json_tok_t *tok = ctx->cur;
@@ -220,10 +398,8 @@ static json_tok_t *json_arr_search(jparse_ctx_t *ctx, uint32_t index)
 		return NULL;
 	/* Increment by 1, so that token points to index 0 */
 	tok++;
-	while (index--) {
-		tok = json_skip_elem(tok);
-		tok++;
-	}
+	while (index--)
+		tok = json_next_elem(ctx, tok);
 	return tok;
 }
 static json_tok_t *json_arr_get_val_tok(jparse_ctx_t *jctx, uint32_t index, _jsmntype_t type)
@@ -241,16 +417,12 @@ int json_arr_get_array(jparse_ctx_t *jctx, uint32_t index)
 	json_tok_t *tok = json_arr_get_val_tok(jctx, index, JSMN_ARRAY);
 	if (!tok)
 		return -OS_FAIL;
-	jctx->cur = tok;
-	return OS_SUCCESS;
+	return json_enter(jctx, tok);
 }
 
 int json_arr_leave_array(jparse_ctx_t *jctx)
 {
-	if (jctx->cur->parent < 0)
-		return -OS_FAIL;
-	jctx->cur = &jctx->tokens[jctx->cur->parent];
-	return OS_SUCCESS;
+	return json_leave(jctx);
 }
 
 int json_arr_get_object(jparse_ctx_t *jctx, uint32_t index)
@@ -258,16 +430,12 @@ int json_arr_get_object(jparse_ctx_t *jctx, uint32_t index)
 	json_tok_t *tok = json_arr_get_val_tok(jctx, index, JSMN_OBJECT);
 	if (!tok)
 		return -OS_FAIL;
-	jctx->cur = tok;
-	return OS_SUCCESS;
+	return json_enter(jctx, tok);
 }
 
 int json_arr_leave_object(jparse_ctx_t *jctx)
 {
-	if (jctx->cur->parent < 0)
-		return -OS_FAIL;
-	jctx->cur = &jctx->tokens[jctx->cur->parent];
-	return OS_SUCCESS;
+	return json_leave(jctx);
 }
 
 int json_arr_get_bool(jparse_ctx_t *jctx, uint32_t index, bool *val)
@@ -319,7 +487,106 @@ int json_arr_get_strlen(jparse_ctx_t *jctx, uint32_t index, int *strlen)
 	return OS_SUCCESS;
 }
 
-int json_parse_start(jparse_ctx_t *jctx, char *js, int len)
+int json_arr_get_strptr(jparse_ctx_t *jctx, uint32_t index, const char **str, int *len)
+{
+	json_tok_t *tok = json_arr_get_val_tok(jctx, index, JSMN_STRING);
+	if (!tok)
+		return -OS_FAIL;
+	return json_tok_to_strptr(jctx, tok, str, len);
+}
+
+static int json_field_get_val(jparse_ctx_t *jctx, json_tok_t *tok, const json_field_t *field)
+{
+	switch (field->type) {
+	case JSON_FIELD_BOOL:
+		if (tok->type != JSMN_PRIMITIVE)
+			return -OS_FAIL;
+		return json_tok_to_bool(jctx, tok, field->val);
+	case JSON_FIELD_INT:
+		if (tok->type != JSMN_PRIMITIVE)
+			return -OS_FAIL;
+		return json_tok_to_int(jctx, tok, field->val);
+	case JSON_FIELD_INT64:
+		if (tok->type != JSMN_PRIMITIVE)
+			return -OS_FAIL;
+		return json_tok_to_int64(jctx, tok, field->val);
+	case JSON_FIELD_FLOAT:
+		if (tok->type != JSMN_PRIMITIVE)
+			return -OS_FAIL;
+		return json_tok_to_float(jctx, tok, field->val);
+	case JSON_FIELD_STRING:
+		if (tok->type != JSMN_STRING)
+			return -OS_FAIL;
+		return json_tok_to_string(jctx, tok, field->val, field->val_size);
+	case JSON_FIELD_STRPTR: {
+		if (tok->type != JSMN_STRING)
+			return -OS_FAIL;
+		json_strptr_t *strptr = field->val;
+		return json_tok_to_strptr(jctx, tok, &strptr->str, &strptr->len);
+	}
+	default:
+		return -OS_FAIL;
+	}
+}
+
+/* Match the keys of obj against the path segments at seg_start[] of the fields in mask.
+ * Fields with more segments are looked for in the nested objects, which are walked
+ * just once for all of them.
+ */
+static void json_fields_walk(jparse_ctx_t *jctx, json_tok_t *obj, const json_field_t *fields,
+		int num_fields, uint32_t mask, int *seg_start, uint32_t *present)
+{
+	json_tok_t *key = obj + 1;
+	int size = obj->size;
+	while (size-- && mask) {
+		json_tok_t *val = key + 1;
+		uint32_t child_mask = 0;
+		int i;
+		for (i = 0; i < num_fields; i++) {
+			if (!(mask & (1u << i)))
+				continue;
+			const char *seg = fields[i].path + seg_start[i];
+			const char *dot = strchr(seg, '.');
+			size_t seg_len = dot ? (size_t)(dot - seg) : strlen(seg);
+			if (!token_matches_strn(jctx, key, seg, seg_len))
+				continue;
+			/* Only the first of duplicate keys is considered */
+			mask &= ~(1u << i);
+			if (dot) {
+				if (val->type == JSMN_OBJECT) {
+					child_mask |= (1u << i);
+					seg_start[i] += seg_len + 1;
+				}
+			} else if (json_field_get_val(jctx, val, &fields[i]) == OS_SUCCESS) {
+				*present |= (1u << i);
+			}
+		}
+		if (child_mask)
+			json_fields_walk(jctx, val, fields, num_fields, child_mask, seg_start, present);
+		key = json_next_elem(jctx, key);
+	}
+}
+
+int json_obj_get_fields(jparse_ctx_t *jctx, const json_field_t *fields, int num_fields,
+		uint32_t *present)
+{
+	if (!fields || num_fields <= 0 || num_fields > JSON_MAX_FIELDS || jctx->cur->type != JSMN_OBJECT)
+		return -OS_FAIL;
+	int seg_start[JSON_MAX_FIELDS] = {0};
+	uint32_t mask = (num_fields == 32) ? UINT32_MAX : ((1u << num_fields) - 1);
+	uint32_t found = 0;
+	json_fields_walk(jctx, jctx->cur, fields, num_fields, mask, seg_start, &found);
+	if (present)
+		*present = found;
+	int i;
+	for (i = 0; i < num_fields; i++) {
+		if (fields[i].required && !(found & (1u << i)))
+			return -OS_FAIL;
+	}
+	return OS_SUCCESS;
+}
+
+int json_parse_start(jparse_ctx_t *jctx, const char *js, int len)
 {
 	memset(jctx, 0, sizeof(jparse_ctx_t));
 	__jsmn_init(&jctx->parser);
@@ -330,6 +597,7 @@ int json_parse_start(jparse_ctx_t *jctx, char *js, int len)
 	jctx->tokens = esp_cloud_mem_calloc(num_tokens, sizeof(json_tok_t));
 	if (!jctx->tokens)
 		return -OS_FAIL;
+	jctx->tokens_allocated = true;
 	jctx->js = js;
 	__jsmn_init(&jctx->parser);
 	int ret = __jsmn_parse(&jctx->parser, js, len, jctx->tokens, jctx->num_tokens);
@@ -342,9 +610,30 @@ int json_parse_start(jparse_ctx_t *jctx, char *js, int len)
 	return OS_SUCCESS;
 }
 
+int json_parse_start_static(jparse_ctx_t *jctx, const char *js, int len,
+		json_tok_t *tokens, int num_tokens)
+{
+	if (!tokens || num_tokens <= 0)
+		return json_parse_start(jctx, js, len);
+	memset(jctx, 0, sizeof(jparse_ctx_t));
+	__jsmn_init(&jctx->parser);
+	int ret = __jsmn_parse(&jctx->parser, js, len, tokens, num_tokens);
+	if (ret == JSMN_ERROR_NOMEM)
+		return json_parse_start(jctx, js, len);
+	if (ret <= 0) {
+		memset(jctx, 0, sizeof(jparse_ctx_t));
+		return -OS_FAIL;
+	}
+	jctx->js = js;
+	jctx->tokens = tokens;
+	jctx->num_tokens = ret;
+	jctx->cur = jctx->tokens;
+	return OS_SUCCESS;
+}
+
 int json_parse_end(jparse_ctx_t *jctx)
 {
-	if (jctx->tokens)
+	if (jctx->tokens_allocated)
 		free(jctx->tokens);
 	memset(jctx, 0, sizeof(jparse_ctx_t));
 	return OS_SUCCESS;
@@ -12,15 +12,38 @@
 typedef _jsmn_parser json_parser_t;
 typedef _jsmntok_t json_tok_t;
 
+/* Hash the keys of an object on the first lookup in it, so that further lookups in the
+ * same object do not have to compare all its keys. Objects with fewer than
+ * JSON_KEY_HASH_MIN_KEYS keys are just searched.
+ */
+#define JSON_PARSER_KEY_HASH
+#define JSON_KEY_HASH_SLOTS	32
+#define JSON_KEY_HASH_MIN_KEYS	4
+
 typedef struct {
 	json_parser_t parser;
-	char *js;
+	const char *js;
 	json_tok_t *tokens;
 	json_tok_t *cur;
+	/* Objects and arrays entered to get to cur, innermost last */
+	jsmn_idx_t outer[JSMN_MAX_DEPTH];
+	int depth;
 	int num_tokens;
+	bool tokens_allocated;
+#ifdef JSON_PARSER_KEY_HASH
+	/* Object whose keys are in key_hash. The slots have token index + 1, or 0 if empty */
+	json_tok_t *hashed_obj;
+	uint16_t key_hash[JSON_KEY_HASH_SLOTS];
+#endif
 } jparse_ctx_t;
 
-int json_parse_start(jparse_ctx_t *jctx, char *js, int len);
+int json_parse_start(jparse_ctx_t *jctx, const char *js, int len);
+/* Parse using a token pool provided by the caller, e.g. on the stack, in a single pass.
+ * If the JSON has more tokens than the pool, they are allocated like json_parse_start()
+ * does. json_parse_end() must be called in either case.
+ */
+int json_parse_start_static(jparse_ctx_t *jctx, const char *js, int len,
+		json_tok_t *tokens, int num_tokens);
 int json_parse_end(jparse_ctx_t *jctx);
 
 int json_obj_get_array(jparse_ctx_t *jctx, char *name, int *num_elem);
@@ -33,6 +56,10 @@ int json_obj_get_int64(jparse_ctx_t *jctx, char *name, int64_t *val);
 int json_obj_get_float(jparse_ctx_t *jctx, char *name, float *val);
 int json_obj_get_string(jparse_ctx_t *jctx, char *name, char *val, int size);
 int json_obj_get_strlen(jparse_ctx_t *jctx, char *name, int *strlen);
+/* Get a pointer to the string within the JSON buffer, instead of a copy.
+ * The string is not NULL terminated.
+ */
+int json_obj_get_strptr(jparse_ctx_t *jctx, char *name, const char **str, int *len);
 
 int json_arr_get_array(jparse_ctx_t *jctx, uint32_t index);
 int json_arr_leave_array(jparse_ctx_t *jctx);
@@ -44,5 +71,50 @@ int json_arr_get_int64(jparse_ctx_t *jctx, uint32_t index, int64_t *val);
 int json_arr_get_float(jparse_ctx_t *jctx, uint32_t index, float *val);
 int json_arr_get_string(jparse_ctx_t *jctx, uint32_t index, char *val, int size);
 int json_arr_get_strlen(jparse_ctx_t *jctx, uint32_t index, int *strlen);
+int json_arr_get_strptr(jparse_ctx_t *jctx, uint32_t index, const char **str, int *len);
+
+/* Convert a primitive of len bytes, which need not be NULL terminated, with the same rules
+ * as json_obj_get_bool(), json_obj_get_int() and json_obj_get_float(). For values which
+ * are not in a parsed document, like those reported by json_sax.
+ */
+int json_primitive_get_bool(const char *str, int len, bool *val);
+int json_primitive_get_int(const char *str, int len, int *val);
+int json_primitive_get_float(const char *str, int len, float *val);
+
+typedef enum {
+	JSON_FIELD_BOOL,	/* val is a bool * */
+	JSON_FIELD_INT,		/* val is an int * */
+	JSON_FIELD_INT64,	/* val is an int64_t * */
+	JSON_FIELD_FLOAT,	/* val is a float * */
+	JSON_FIELD_STRING,	/* val is a char buffer of val_size bytes */
+	JSON_FIELD_STRPTR,	/* val is a json_strptr_t *, pointing into the JSON */
+} json_field_type_t;
+
+/* A string within the JSON buffer. It is not NULL terminated */
+typedef struct {
+	const char *str;
+	int len;
+} json_strptr_t;
+
+typedef struct {
+	/* Key in the current object. Keys of nested objects are separated by '.',
+	 * e.g. "data.auth_code"
+	 */
+	const char *path;
+	json_field_type_t type;
+	void *val;
+	int val_size;
+	bool required;
+} json_field_t;
+
+#define JSON_MAX_FIELDS		32
+
+/* Get up to JSON_MAX_FIELDS fields of the current object in a single walk over its
+ * tokens. Bit i of present (optional) is set if fields[i] was found with a value of its
+ * type. For duplicate keys, the first one is used, like for json_obj_get_*().
+ * Returns -OS_FAIL if any of the required fields was not found.
+ */
+int json_obj_get_fields(jparse_ctx_t *jctx, const json_field_t *fields, int num_fields,
+		uint32_t *present);
 
 #endif /* _JSON_PARSER_H_ */
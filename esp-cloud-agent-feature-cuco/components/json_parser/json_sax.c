@@ -0,0 +1,255 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <json_sax.h>
+
+enum {
+	SAX_VALUE,		/* At the start, after ':' and after ',' in an array */
+	SAX_VALUE_OR_END,	/* After '[' */
+	SAX_KEY,		/* After ',' in an object */
+	SAX_KEY_OR_END,		/* After '{' */
+	SAX_COLON,
+	SAX_NEXT,		/* After a value in an object or array */
+	SAX_STRING,
+	SAX_ESCAPE,
+	SAX_UNICODE,
+	SAX_PRIMITIVE,
+	SAX_DONE,
+};
+
+void json_sax_start(json_sax_ctx_t *ctx, char *buf, int buf_size, json_sax_cb_t cb, void *priv)
+{
+	memset(ctx, 0, sizeof(json_sax_ctx_t));
+	ctx->buf = buf;
+	ctx->buf_size = buf_size;
+	ctx->cb = cb;
+	ctx->priv = priv;
+	ctx->state = SAX_VALUE;
+}
+
+static inline bool json_sax_in_object(json_sax_ctx_t *ctx)
+{
+	return ctx->depth && (ctx->obj_stack & (1u << (ctx->depth - 1)));
+}
+
+static inline bool json_sax_is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* The value being read is stored after the key, if any */
+static inline char *json_sax_val_buf(json_sax_ctx_t *ctx)
+{
+	return ctx->has_key ? ctx->buf + ctx->key_len + 1 : ctx->buf;
+}
+
+static int json_sax_put(json_sax_ctx_t *ctx, char c)
+{
+	int *len = ctx->in_key ? &ctx->key_len : &ctx->val_len;
+	char *buf = ctx->in_key ? ctx->buf : json_sax_val_buf(ctx);
+	/* Room is required for the NULL termination */
+	if (buf + *len + 1 >= ctx->buf + ctx->buf_size)
+		return JSMN_ERROR_NOMEM;
+	buf[(*len)++] = c;
+	return 0;
+}
+
+static int json_sax_emit(json_sax_ctx_t *ctx, json_sax_event_t event, bool with_val)
+{
+	const char *key = NULL;
+	const char *val = NULL;
+	if (ctx->has_key) {
+		ctx->buf[ctx->key_len] = '\0';
+		key = ctx->buf;
+	}
+	if (with_val) {
+		char *val_buf = json_sax_val_buf(ctx);
+		val_buf[ctx->val_len] = '\0';
+		val = val_buf;
+	}
+	int ret = ctx->cb(event, key, val, with_val ? ctx->val_len : 0, ctx->depth, ctx->priv);
+	/* The key is used up by its value */
+	ctx->has_key = false;
+	return ret ? JSON_SAX_ERROR_ABORTED : 0;
+}
+
+static void json_sax_value_done(json_sax_ctx_t *ctx)
+{
+	ctx->state = ctx->depth ? SAX_NEXT : SAX_DONE;
+}
+
+static int json_sax_open(json_sax_ctx_t *ctx, bool is_object)
+{
+	if (ctx->depth >= JSON_SAX_MAX_DEPTH)
+		return JSMN_ERROR_NOMEM;
+	int ret = json_sax_emit(ctx, is_object ? JSON_SAX_OBJECT_START : JSON_SAX_ARRAY_START, false);
+	if (is_object)
+		ctx->obj_stack |= (1u << ctx->depth);
+	else
+		ctx->obj_stack &= ~(1u << ctx->depth);
+	ctx->depth++;
+	ctx->state = is_object ? SAX_KEY_OR_END : SAX_VALUE_OR_END;
+	return ret;
+}
+
+static int json_sax_close(json_sax_ctx_t *ctx, bool is_object)
+{
+	if (!ctx->depth || json_sax_in_object(ctx) != is_object)
+		return JSMN_ERROR_INVAL;
+	ctx->depth--;
+	json_sax_value_done(ctx);
+	return json_sax_emit(ctx, is_object ? JSON_SAX_OBJECT_END : JSON_SAX_ARRAY_END, false);
+}
+
+static int json_sax_start_value(json_sax_ctx_t *ctx, char c)
+{
+	switch (c) {
+	case '{': case '[':
+		return json_sax_open(ctx, c == '{');
+	case '\"':
+		ctx->in_key = false;
+		ctx->val_len = 0;
+		ctx->state = SAX_STRING;
+		return 0;
+	/* In strict mode primitives are: numbers and booleans */
+	case '-': case '0': case '1' : case '2': case '3' : case '4':
+	case '5': case '6': case '7' : case '8': case '9':
+	case 't': case 'f': case 'n' :
+		ctx->in_key = false;
+		ctx->val_len = 0;
+		ctx->state = SAX_PRIMITIVE;
+		return json_sax_put(ctx, c);
+	default:
+		return JSMN_ERROR_INVAL;
+	}
+}
+
+static int json_sax_char(json_sax_ctx_t *ctx, char c)
+{
+	int ret;
+	switch (ctx->state) {
+	case SAX_VALUE:
+	case SAX_VALUE_OR_END:
+		if (json_sax_is_space(c))
+			return 0;
+		if (c == ']' && ctx->state == SAX_VALUE_OR_END)
+			return json_sax_close(ctx, false);
+		return json_sax_start_value(ctx, c);
+	case SAX_KEY:
+	case SAX_KEY_OR_END:
+		if (json_sax_is_space(c))
+			return 0;
+		if (c == '}' && ctx->state == SAX_KEY_OR_END)
+			return json_sax_close(ctx, true);
+		if (c != '\"')
+			return JSMN_ERROR_INVAL;
+		ctx->in_key = true;
+		ctx->key_len = 0;
+		ctx->state = SAX_STRING;
+		return 0;
+	case SAX_COLON:
+		if (json_sax_is_space(c))
+			return 0;
+		if (c != ':')
+			return JSMN_ERROR_INVAL;
+		ctx->state = SAX_VALUE;
+		return 0;
+	case SAX_NEXT:
+		if (json_sax_is_space(c))
+			return 0;
+		if (c == ',') {
+			ctx->state = json_sax_in_object(ctx) ? SAX_KEY : SAX_VALUE;
+			return 0;
+		}
+		if (c == '}' || c == ']')
+			return json_sax_close(ctx, c == '}');
+		return JSMN_ERROR_INVAL;
+	case SAX_STRING:
+		if (c == '\"') {
+			if (ctx->in_key) {
+				ctx->has_key = true;
+				ctx->in_key = false;
+				ctx->state = SAX_COLON;
+				return 0;
+			}
+			json_sax_value_done(ctx);
+			return json_sax_emit(ctx, JSON_SAX_STRING, true);
+		}
+		if (c == '\\')
+			ctx->state = SAX_ESCAPE;
+		return json_sax_put(ctx, c);
+	case SAX_ESCAPE:
+		switch (c) {
+		/* Allowed escaped symbols */
+		case '\"': case '/' : case '\\' : case 'b' :
+		case 'f' : case 'r' : case 'n'  : case 't' :
+			ctx->state = SAX_STRING;
+			break;
+		/* Allows escaped symbol \uXXXX */
+		case 'u':
+			ctx->hex_remaining = 4;
+			ctx->state = SAX_UNICODE;
+			break;
+		default:
+			return JSMN_ERROR_INVAL;
+		}
+		return json_sax_put(ctx, c);
+	case SAX_UNICODE:
+		if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f')))
+			return JSMN_ERROR_INVAL;
+		if (--ctx->hex_remaining == 0)
+			ctx->state = SAX_STRING;
+		return json_sax_put(ctx, c);
+	case SAX_PRIMITIVE:
+		if (json_sax_is_space(c) || c == ',' || c == ']' || c == '}') {
+			/* The primitive is complete, and the character is handled in the next state */
+			json_sax_value_done(ctx);
+			ret = json_sax_emit(ctx, JSON_SAX_PRIMITIVE, true);
+			if (ret)
+				return ret;
+			return json_sax_char(ctx, c);
+		}
+		if (c < 32 || c >= 127)
+			return JSMN_ERROR_INVAL;
+		return json_sax_put(ctx, c);
+	case SAX_DONE:
+	default:
+		return json_sax_is_space(c) ? 0 : JSMN_ERROR_INVAL;
+	}
+}
+
+int json_sax_feed(json_sax_ctx_t *ctx, const char *data, int len)
+{
+	int i;
+	for (i = 0; i < len && !ctx->err; i++)
+		ctx->err = json_sax_char(ctx, data[i]);
+	return ctx->err;
+}
+
+int json_sax_end(json_sax_ctx_t *ctx)
+{
+	if (ctx->err)
+		return ctx->err;
+	/* A primitive at the top level ends with the document */
+	if (ctx->state == SAX_PRIMITIVE && ctx->depth == 0) {
+		ctx->state = SAX_DONE;
+		ctx->err = json_sax_emit(ctx, JSON_SAX_PRIMITIVE, true);
+		if (ctx->err)
+			return ctx->err;
+	}
+	return (ctx->state == SAX_DONE) ? 0 : JSMN_ERROR_PART;
+}
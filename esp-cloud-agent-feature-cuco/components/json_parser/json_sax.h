@@ -0,0 +1,81 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef _JSON_SAX_H_
+#define _JSON_SAX_H_
+
+#include <jsmn-changed.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Event driven parsing of JSON which is received in chunks. Unlike json_parse_start(),
+ * neither the whole document nor tokens for it are kept in memory. Only the current key
+ * and value are buffered, in a buffer provided by the caller. The grammar is the same as
+ * that of jsmn in strict mode, and the strings are reported as is, without unescaping.
+ */
+
+/* Maximum nesting of objects and arrays */
+#define JSON_SAX_MAX_DEPTH	32
+
+/* Returned if the callback stops the parsing. The other errors are the jsmnerr ones:
+ * JSMN_ERROR_NOMEM if a key or value does not fit in the buffer or the nesting is too
+ * deep, JSMN_ERROR_INVAL for invalid JSON and JSMN_ERROR_PART if the document is not
+ * complete at json_sax_end().
+ */
+#define JSON_SAX_ERROR_ABORTED	JSMN_ERROR_ABORTED
+
+typedef enum {
+	JSON_SAX_OBJECT_START,
+	JSON_SAX_OBJECT_END,
+	JSON_SAX_ARRAY_START,
+	JSON_SAX_ARRAY_END,
+	JSON_SAX_STRING,
+	/* Number, true, false or null */
+	JSON_SAX_PRIMITIVE,
+} json_sax_event_t;
+
+/* Called for every element. key is the NULL terminated key of the element, or NULL if it
+ * is not in an object. val (of val_len bytes, NULL terminated) is set only for strings and
+ * primitives. depth is 1 for the elements of the top level object or array. Both key and
+ * val are valid only till the callback returns. A non zero return stops the parsing.
+ */
+typedef int (*json_sax_cb_t)(json_sax_event_t event, const char *key, const char *val,
+		int val_len, int depth, void *priv);
+
+typedef struct {
+	json_sax_cb_t cb;
+	void *priv;
+	char *buf;
+	int buf_size;
+	int key_len;
+	int val_len;
+	int err;
+	uint8_t state;
+	uint8_t depth;
+	uint8_t hex_remaining;
+	bool in_key;
+	bool has_key;
+	/* Bit set for the nesting levels which are objects */
+	uint32_t obj_stack;
+} json_sax_ctx_t;
+
+/* buf holds the current key and the current string or primitive value, both NULL
+ * terminated, so it limits their combined length.
+ */
+void json_sax_start(json_sax_ctx_t *ctx, char *buf, int buf_size, json_sax_cb_t cb, void *priv);
+/* Parse the next chunk. Returns 0, or an error, after which the rest is ignored */
+int json_sax_feed(json_sax_ctx_t *ctx, const char *data, int len);
+/* Returns 0 if a complete JSON document was parsed */
+int json_sax_end(json_sax_ctx_t *ctx);
+
+#endif /* _JSON_SAX_H_ */
@@ -0,0 +1,5 @@
+#
+# Component Makefile for the json_parser unit tests, run with the ESP-IDF unit test app.
+# The same tests can be built and run on a Linux host with host/Makefile.
+#
+COMPONENT_ADD_LDFLAGS = -Wl,--whole-archive -l$(COMPONENT_NAME) -Wl,--no-whole-archive
@@ -0,0 +1,37 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdlib.h>
+#include <string.h>
+#include <esp_cloud_mem.h>
+
+/* The esp_cloud_mem APIs used by json_parser, on the host heap */
+
+static uint32_t alloc_count;
+
+void *esp_cloud_mem_malloc(int size)
+{
+	alloc_count++;
+	return malloc(size);
+}
+
+void *esp_cloud_mem_calloc(int n, int size)
+{
+	alloc_count++;
+	return calloc(n, size);
+}
+
+uint32_t esp_cloud_mem_get_alloc_count(void)
+{
+	return alloc_count;
+}
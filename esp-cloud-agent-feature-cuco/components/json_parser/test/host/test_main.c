@@ -0,0 +1,71 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "unity.h"
+
+/* Runs all the registered test cases, or those with the given tag, e.g. "[json_sax]" */
+
+#define UNITY_HOST_MAX_TESTS	64
+
+typedef struct {
+	const char *name;
+	const char *tags;
+	unity_host_fn_t fn;
+} unity_host_test_t;
+
+static unity_host_test_t tests[UNITY_HOST_MAX_TESTS];
+static int test_count;
+static jmp_buf test_jmp;
+
+void unity_host_register(const char *name, const char *tags, unity_host_fn_t fn)
+{
+	if (test_count == UNITY_HOST_MAX_TESTS) {
+		fprintf(stderr, "Too many test cases. Skipping %s\n", name);
+		return;
+	}
+	tests[test_count].name = name;
+	tests[test_count].tags = tags;
+	tests[test_count].fn = fn;
+	test_count++;
+}
+
+void unity_host_fail(const char *file, int line, const char *msg)
+{
+	printf("%s:%d: FAIL: %s\n", file, line, msg);
+	longjmp(test_jmp, 1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *tag = argc > 1 ? argv[1] : NULL;
+	int run = 0, failed = 0;
+	int i;
+	for (i = 0; i < test_count; i++) {
+		if (tag && !strstr(tests[i].tags, tag)) {
+			continue;
+		}
+		printf("Running %s...\n", tests[i].name);
+		run++;
+		if (setjmp(test_jmp) == 0) {
+			tests[i].fn();
+		} else {
+			failed++;
+		}
+	}
+	printf("%d Tests %d Failures\n", run, failed);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,53 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <stdio.h>
+#include <setjmp.h>
+
+/* The subset of Unity used by the json_parser tests, for running them on a Linux host
+ * without ESP-IDF. Test cases register themselves before main(), like with the ESP-IDF
+ * unit test app, and a failed assertion ends the test case.
+ */
+
+typedef void (*unity_host_fn_t)(void);
+
+void unity_host_register(const char *name, const char *tags, unity_host_fn_t fn);
+void unity_host_fail(const char *file, int line, const char *msg);
+
+#define UNITY_HOST_CAT_(a, b)	a##b
+#define UNITY_HOST_CAT(a, b)	UNITY_HOST_CAT_(a, b)
+#define UNITY_HOST_FN		UNITY_HOST_CAT(unity_host_test_, __LINE__)
+#define UNITY_HOST_REG		UNITY_HOST_CAT(unity_host_reg_, __LINE__)
+
+#define TEST_CASE(name, tags) \
+	static void UNITY_HOST_FN(void); \
+	static void __attribute__((constructor)) UNITY_HOST_REG(void) \
+	{ \
+		unity_host_register(name, tags, UNITY_HOST_FN); \
+	} \
+	static void UNITY_HOST_FN(void)
+
+#define TEST_FAIL_MESSAGE(msg)	unity_host_fail(__FILE__, __LINE__, msg)
+#define TEST_ASSERT_TRUE_MESSAGE(cond, msg) \
+	do { if (!(cond)) unity_host_fail(__FILE__, __LINE__, msg); } while (0)
+#define TEST_ASSERT_TRUE(cond)	TEST_ASSERT_TRUE_MESSAGE(cond, #cond)
+#define TEST_ASSERT_FALSE(cond)	TEST_ASSERT_TRUE_MESSAGE(!(cond), "!(" #cond ")")
+#define TEST_ASSERT_EQUAL_MESSAGE(expected, actual, msg) \
+	TEST_ASSERT_TRUE_MESSAGE((expected) == (actual), msg)
+#define TEST_ASSERT_EQUAL(expected, actual) \
+	TEST_ASSERT_EQUAL_MESSAGE(expected, actual, #expected " == " #actual)
+#define TEST_ASSERT_EQUAL_INT(expected, actual)	TEST_ASSERT_EQUAL(expected, actual)
+#define TEST_ASSERT_NOT_NULL(ptr)	TEST_ASSERT_TRUE_MESSAGE((ptr) != NULL, #ptr " != NULL")
+#define TEST_ASSERT_EQUAL_STRING(expected, actual) \
+	TEST_ASSERT_TRUE_MESSAGE(strcmp(expected, actual) == 0, #expected " == " #actual)
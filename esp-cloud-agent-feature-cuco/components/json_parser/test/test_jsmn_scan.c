@@ -0,0 +1,319 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <jsmn-changed.h>
+#include "unity.h"
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+/* Tests for the scanning of string bodies and whitespace in jsmn, which is done more than a
+ * byte at a time (SSE2 on the host, SWAR words on the ESP32). Random documents are generated
+ * along with the tokens expected for them, and parsed at every alignment of the buffer, so
+ * that runs of every length end at every position within a vector or word.
+ */
+
+#define SCAN_DOC_MAX_LEN	2048
+#define SCAN_MAX_TOKENS		256
+#define SCAN_MAX_DEPTH		6
+#define SCAN_MAX_ALIGN		16
+#define SCAN_DOCS		300
+
+typedef struct {
+	int type;
+	int start;
+	int end;
+	int size;
+} scan_tok_t;
+
+typedef struct {
+	uint32_t seed;
+	char *doc;
+	int len;
+	scan_tok_t toks[SCAN_MAX_TOKENS];
+	int num_toks;
+} scan_gen_t;
+
+static uint32_t scan_rand(scan_gen_t *gen, uint32_t n)
+{
+	gen->seed = gen->seed * 1103515245 + 12345;
+	return (gen->seed >> 8) % n;
+}
+
+static void scan_put(scan_gen_t *gen, const char *str)
+{
+	int len = strlen(str);
+	memcpy(gen->doc + gen->len, str, len);
+	gen->len += len;
+}
+
+static int scan_add_tok(scan_gen_t *gen, int type, int start)
+{
+	scan_tok_t *tok = &gen->toks[gen->num_toks];
+	tok->type = type;
+	tok->start = start;
+	tok->end = -1;
+	tok->size = 0;
+	return gen->num_toks++;
+}
+
+/* Mostly nothing, otherwise runs of up to 40 bytes. The long runs are mostly spaces, as
+ * in indentation, which the SWAR scanning skips a word at a time.
+ */
+static void scan_gen_space(scan_gen_t *gen)
+{
+	int kind = scan_rand(gen, 8);
+	if (kind < 4) {
+		return;
+	}
+	int n = scan_rand(gen, kind == 7 ? 41 : 4);
+	while (n--) {
+		gen->doc[gen->len++] = " \t\n\r"[kind == 6 ? scan_rand(gen, 4) : 0];
+	}
+}
+
+/* The body has plain characters, including the ones next to '"' and '\\' and bytes with
+ * the top bit set, as well as escapes, which end a run.
+ */
+static void scan_gen_string(scan_gen_t *gen, int size)
+{
+	static const char plain[] = "abcxyzAZ09!#[]^ ~";
+	int tok = scan_add_tok(gen, JSMN_STRING, gen->len + 1);
+	gen->toks[tok].size = size;
+	gen->doc[gen->len++] = '\"';
+	int n = scan_rand(gen, scan_rand(gen, 4) == 0 ? 100 : 12);
+	while (n--) {
+		switch (scan_rand(gen, 24)) {
+			case 0:
+				scan_put(gen, "\\\"");
+				break;
+			case 1:
+				scan_put(gen, "\\\\");
+				break;
+			case 2:
+				scan_put(gen, "\\u00e9");
+				break;
+			case 3:
+				scan_put(gen, "\xc3\xa9");
+				break;
+			case 4:
+				gen->doc[gen->len++] = (char)(0x80 + scan_rand(gen, 0x80));
+				break;
+			default:
+				gen->doc[gen->len++] = plain[scan_rand(gen, sizeof(plain) - 1)];
+				break;
+		}
+	}
+	gen->toks[tok].end = gen->len;
+	gen->doc[gen->len++] = '\"';
+}
+
+static void scan_gen_value(scan_gen_t *gen, int depth)
+{
+	static const char *primitives[] = {"0", "-12", "3.5e-7", "true", "false", "null"};
+	int kind = scan_rand(gen, 10);
+	/* Keep space for the closing brackets and the largest value */
+	bool room = (gen->len < SCAN_DOC_MAX_LEN - 1024) && (gen->num_toks < SCAN_MAX_TOKENS - 16);
+	if (room && depth < SCAN_MAX_DEPTH && kind < 4) {
+		bool object = (kind < 2);
+		int tok = scan_add_tok(gen, object ? JSMN_OBJECT : JSMN_ARRAY, gen->len);
+		int n = scan_rand(gen, 6);
+		int i;
+		gen->doc[gen->len++] = object ? '{' : '[';
+		for (i = 0; i < n; i++) {
+			if (i) {
+				gen->doc[gen->len++] = ',';
+			}
+			scan_gen_space(gen);
+			if (object) {
+				scan_gen_string(gen, 1);
+				scan_gen_space(gen);
+				gen->doc[gen->len++] = ':';
+				scan_gen_space(gen);
+			}
+			scan_gen_value(gen, depth + 1);
+			scan_gen_space(gen);
+		}
+		gen->doc[gen->len++] = object ? '}' : ']';
+		gen->toks[tok].size = n;
+		gen->toks[tok].end = gen->len;
+	} else if (kind < 7) {
+		scan_gen_string(gen, 0);
+	} else {
+		int tok = scan_add_tok(gen, JSMN_PRIMITIVE, gen->len);
+		scan_put(gen, primitives[scan_rand(gen, sizeof(primitives) / sizeof(primitives[0]))]);
+		gen->toks[tok].end = gen->len;
+	}
+}
+
+/* A top level object or array, with the tokens expected for it */
+static void scan_gen_doc(scan_gen_t *gen)
+{
+	do {
+		gen->len = 0;
+		gen->num_toks = 0;
+		scan_gen_space(gen);
+		scan_gen_value(gen, 0);
+		scan_gen_space(gen);
+	} while (gen->toks[0].type != JSMN_OBJECT && gen->toks[0].type != JSMN_ARRAY);
+}
+
+static bool scan_toks_match(const scan_gen_t *gen, const _jsmntok_t *toks, int count)
+{
+	int i;
+	if (count != gen->num_toks) {
+		return false;
+	}
+	for (i = 0; i < count; i++) {
+		if (toks[i].type != gen->toks[i].type || toks[i].start != gen->toks[i].start ||
+				toks[i].end != gen->toks[i].end || toks[i].size != gen->toks[i].size) {
+			return false;
+		}
+	}
+	return true;
+}
+
+TEST_CASE("jsmn scan gives the expected tokens at every alignment", "[json_parser]")
+{
+	scan_gen_t *gen = calloc(1, sizeof(scan_gen_t));
+	char *buf = malloc(SCAN_DOC_MAX_LEN + SCAN_MAX_ALIGN);
+	_jsmntok_t *toks = calloc(SCAN_MAX_TOKENS, sizeof(_jsmntok_t));
+	TEST_ASSERT_NOT_NULL(gen);
+	TEST_ASSERT_NOT_NULL(buf);
+	TEST_ASSERT_NOT_NULL(toks);
+	gen->doc = malloc(SCAN_DOC_MAX_LEN);
+	TEST_ASSERT_NOT_NULL(gen->doc);
+	gen->seed = 1;
+
+	_jsmn_parser parser;
+	int d, align;
+	for (d = 0; d < SCAN_DOCS; d++) {
+		scan_gen_doc(gen);
+		for (align = 0; align < SCAN_MAX_ALIGN; align++) {
+			char *js = buf + align;
+			memcpy(js, gen->doc, gen->len);
+			__jsmn_init(&parser);
+			int count = __jsmn_parse(&parser, js, gen->len, toks, SCAN_MAX_TOKENS);
+			if (!scan_toks_match(gen, toks, count)) {
+				printf("Mismatch for document %d at alignment %d: %.*s\n", d, align, gen->len, js);
+				TEST_FAIL_MESSAGE("Tokens differ from the expected ones");
+			}
+			__jsmn_init(&parser);
+			TEST_ASSERT_EQUAL(gen->num_toks, __jsmn_parse(&parser, js, gen->len, NULL, 0));
+		}
+	}
+	free(toks);
+	free(buf);
+	free(gen->doc);
+	free(gen);
+}
+
+TEST_CASE("jsmn scan stops strings at the end of the data and at NULL", "[json_parser]")
+{
+	char buf[160 + SCAN_MAX_ALIGN];
+	_jsmntok_t toks[4];
+	_jsmn_parser parser;
+	int body_len, cut, align;
+	for (align = 0; align < SCAN_MAX_ALIGN; align++) {
+		char *js = buf + align;
+		for (body_len = 0; body_len < 140; body_len++) {
+			/* ["aaaa...a"] */
+			js[0] = '[';
+			js[1] = '\"';
+			memset(js + 2, 'a', body_len);
+			js[body_len + 2] = '\"';
+			js[body_len + 3] = ']';
+			int len = body_len + 4;
+			__jsmn_init(&parser);
+			TEST_ASSERT_EQUAL(2, __jsmn_parse(&parser, js, len, toks, 4));
+			TEST_ASSERT_EQUAL(body_len + 2, toks[1].end);
+
+			/* Every truncation within the string */
+			for (cut = 2; cut < body_len + 3; cut++) {
+				__jsmn_init(&parser);
+				TEST_ASSERT_EQUAL(JSMN_ERROR_PART, __jsmn_parse(&parser, js, cut, toks, 4));
+			}
+			/* A NULL in the string ends the data */
+			if (body_len) {
+				int pos = 2 + (body_len * 7) % body_len;
+				js[pos] = '\0';
+				__jsmn_init(&parser);
+				TEST_ASSERT_EQUAL(JSMN_ERROR_PART, __jsmn_parse(&parser, js, len, toks, 4));
+			}
+		}
+	}
+}
+
+static int64_t scan_time_us(void)
+{
+#ifdef ESP_PLATFORM
+	return esp_timer_get_time();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+#define SCAN_BENCH_DOC_LEN	16384
+#define SCAN_BENCH_RUNS		20
+
+/* Array of objects, either compact or indented with spaces */
+static int scan_bench_doc(char *doc, bool pretty)
+{
+	static const char *nl = "\n        ";
+	int len = 0, i;
+	doc[len++] = '[';
+	for (i = 0; len < SCAN_BENCH_DOC_LEN - 256; i++) {
+		len += sprintf(doc + len, "%s%s{%s\"name\":\"parameter with a fairly long descriptive name\","
+				"%s\"value\":12345,%s\"enabled\":true%s}", i ? "," : "",
+				pretty ? nl : "", pretty ? nl : "", pretty ? nl : "", pretty ? nl : "",
+				pretty ? nl : "");
+	}
+	doc[len++] = ']';
+	return len;
+}
+
+TEST_CASE("jsmn scan throughput", "[json_parser][perf]")
+{
+	char *doc = malloc(SCAN_BENCH_DOC_LEN);
+	TEST_ASSERT_NOT_NULL(doc);
+	int pretty;
+	for (pretty = 0; pretty < 2; pretty++) {
+		int len = scan_bench_doc(doc, pretty);
+		_jsmn_parser parser;
+		__jsmn_init(&parser);
+		int count = __jsmn_parse(&parser, doc, len, NULL, 0);
+		TEST_ASSERT_TRUE(count > 0);
+		_jsmntok_t *toks = calloc(count, sizeof(_jsmntok_t));
+		TEST_ASSERT_NOT_NULL(toks);
+		int64_t start = scan_time_us();
+		int run;
+		for (run = 0; run < SCAN_BENCH_RUNS; run++) {
+			__jsmn_init(&parser);
+			TEST_ASSERT_EQUAL(count, __jsmn_parse(&parser, doc, len, toks, count));
+		}
+		int64_t elapsed = scan_time_us() - start;
+		printf("%s document of %d bytes, %d tokens: %.1f MB/s\n", pretty ? "Indented" : "Compact",
+				len, count, (double)len * SCAN_BENCH_RUNS / (elapsed ? elapsed : 1));
+		free(toks);
+	}
+	free(doc);
+}
@@ -0,0 +1,243 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <json_parser.h>
+#include "unity.h"
+
+/* Tests for the parsing of numbers by json_obj_get_int(), json_obj_get_int64() and
+ * json_obj_get_float(), which do not use strtol()/strtod(). Floats are checked against
+ * strtod() converted to float, which is what the parser is meant to match.
+ */
+
+#define NUM_JSON_MAX_LEN	96
+#define NUM_FLOAT_SAMPLES	100000
+#define NUM_INT_SAMPLES		100000
+
+/* Parse {"v":<num>}. Fails if either the document or the number is invalid */
+static int num_parse(const char *num, jparse_ctx_t *jctx, json_tok_t *toks, char *js)
+{
+	int len = snprintf(js, NUM_JSON_MAX_LEN, "{\"v\":%s}", num);
+	return json_parse_start_static(jctx, js, len, toks, 4);
+}
+
+static int num_get_int(const char *num, int *val)
+{
+	jparse_ctx_t jctx;
+	json_tok_t toks[4];
+	char js[NUM_JSON_MAX_LEN];
+	int ret = num_parse(num, &jctx, toks, js);
+	if (ret == 0) {
+		ret = json_obj_get_int(&jctx, "v", val);
+	}
+	json_parse_end(&jctx);
+	return ret;
+}
+
+static int num_get_int64(const char *num, int64_t *val)
+{
+	jparse_ctx_t jctx;
+	json_tok_t toks[4];
+	char js[NUM_JSON_MAX_LEN];
+	int ret = num_parse(num, &jctx, toks, js);
+	if (ret == 0) {
+		ret = json_obj_get_int64(&jctx, "v", val);
+	}
+	json_parse_end(&jctx);
+	return ret;
+}
+
+static int num_get_float(const char *num, float *val)
+{
+	jparse_ctx_t jctx;
+	json_tok_t toks[4];
+	char js[NUM_JSON_MAX_LEN];
+	int ret = num_parse(num, &jctx, toks, js);
+	if (ret == 0) {
+		ret = json_obj_get_float(&jctx, "v", val);
+	}
+	json_parse_end(&jctx);
+	return ret;
+}
+
+static uint32_t num_seed = 1;
+
+static uint32_t num_rand(void)
+{
+	num_seed = num_seed * 1103515245 + 12345;
+	return num_seed >> 1;
+}
+
+typedef struct {
+	const char *str;
+	bool valid;
+	int64_t val;
+} num_int_case_t;
+
+TEST_CASE("json_parser int32 limits", "[json_parser]")
+{
+	static const num_int_case_t cases[] = {
+		{"0", true, 0},
+		{"-0", true, 0},
+		{"2147483647", true, INT32_MAX},
+		{"-2147483648", true, INT32_MIN},
+		{"2147483648", false},
+		{"-2147483649", false},
+		{"4294967296", false},
+		{"21474836470", false},
+		{"99999999999999999999", false},
+		{"12.5", false},
+		{"1e3", false},
+		{"-", false},
+		{"01", false},
+		{"-01", false},
+		{"00", false},
+		{"-00", false},
+	};
+	int i;
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		int val = 0;
+		int ret = num_get_int(cases[i].str, &val);
+		TEST_ASSERT_EQUAL_MESSAGE(cases[i].valid, ret == 0, cases[i].str);
+		if (cases[i].valid) {
+			TEST_ASSERT_EQUAL_MESSAGE(cases[i].val, val, cases[i].str);
+		}
+	}
+}
+
+TEST_CASE("json_parser int64 limits", "[json_parser]")
+{
+	static const num_int_case_t cases[] = {
+		{"0", true, 0},
+		{"2147483648", true, 2147483648LL},
+		{"-2147483649", true, -2147483649LL},
+		{"9223372036854775807", true, INT64_MAX},
+		{"-9223372036854775808", true, INT64_MIN},
+		{"9223372036854775808", false},
+		{"-9223372036854775809", false},
+		{"18446744073709551615", false},
+		{"18446744073709551616", false},
+		{"92233720368547758070", false},
+		{"-", false},
+		{"01", false},
+		{"-0123", false},
+	};
+	int i;
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		int64_t val = 0;
+		int ret = num_get_int64(cases[i].str, &val);
+		TEST_ASSERT_EQUAL_MESSAGE(cases[i].valid, ret == 0, cases[i].str);
+		if (cases[i].valid) {
+			TEST_ASSERT_TRUE_MESSAGE(cases[i].val == val, cases[i].str);
+		}
+	}
+}
+
+TEST_CASE("json_parser int64 matches the printed value", "[json_parser]")
+{
+	char str[32];
+	int i;
+	num_seed = 1;
+	for (i = 0; i < NUM_INT_SAMPLES; i++) {
+		int64_t expected = ((int64_t)num_rand() << 33) ^ ((int64_t)num_rand() << 2) ^ num_rand();
+		/* Also short numbers, and both signs */
+		if (i % 3 == 0) {
+			expected %= 100000;
+		}
+		if (i % 2) {
+			expected = -expected;
+		}
+		snprintf(str, sizeof(str), "%lld", (long long)expected);
+		int64_t val;
+		TEST_ASSERT_EQUAL_MESSAGE(0, num_get_int64(str, &val), str);
+		TEST_ASSERT_TRUE_MESSAGE(expected == val, str);
+	}
+}
+
+/* Parse a number and compare it bit for bit with strtod() converted to float. Numbers out
+ * of the range of a float must fail.
+ */
+static bool num_check_float(const char *str)
+{
+	float expected = (float)strtod(str, NULL);
+	float val;
+	int ret = num_get_float(str, &val);
+	if (isinf(expected)) {
+		if (ret == 0) {
+			printf("%s: got %.9g, expected a failure\n", str, val);
+			return false;
+		}
+		return true;
+	}
+	if (ret != 0 || memcmp(&val, &expected, sizeof(val)) != 0) {
+		printf("%s: got %.9g (%d), expected %.9g\n", str, ret == 0 ? val : 0, ret, expected);
+		return false;
+	}
+	return true;
+}
+
+TEST_CASE("json_parser float edge cases", "[json_parser]")
+{
+	static const char *valid[] = {
+		"0", "-0", "0.0", "1.5", "-1.5", "0.1", "1E+2", "1e-2", "0e999999999",
+		"3.4028235e38", "3.40282356e38", "-3.4028235e38", "1.17549435e-38", "1.4e-45",
+		"1e-46", "1e-50", "1e-400", "123456789012345678901234", "0.000000000000000000001234",
+		"9007199254740993", "1.00000005960464477539062500001",
+		"3.4028236e38", "3.5e38", "1e39", "-1e39", "1e400",
+	};
+	/* Not JSON numbers, although strtod() accepts some of them */
+	static const char *invalid[] = {
+		"1.", ".5", "+1", "1e", "1e+", "-", "0x10", "1.5f", "01", "-01", "00.5", "01e2",
+	};
+	int i;
+	for (i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+		TEST_ASSERT_TRUE_MESSAGE(num_check_float(valid[i]), valid[i]);
+	}
+	for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		float val;
+		TEST_ASSERT_TRUE_MESSAGE(num_get_float(invalid[i], &val) != 0, invalid[i]);
+	}
+}
+
+TEST_CASE("json_parser float matches strtod", "[json_parser]")
+{
+	char str[48];
+	int i, bad = 0;
+	num_seed = 1;
+	for (i = 0; i < NUM_FLOAT_SAMPLES; i++) {
+		/* Any finite float, printed with enough digits to round trip, and with fewer */
+		uint32_t bits = (num_rand() << 16) ^ num_rand();
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		if (isnan(f) || isinf(f)) {
+			continue;
+		}
+		snprintf(str, sizeof(str), "%.9g", f);
+		bad += !num_check_float(str);
+		snprintf(str, sizeof(str), "%.6g", f);
+		bad += !num_check_float(str);
+		/* Decimals as sent by apps, with and without an exponent */
+		int len = snprintf(str, sizeof(str), "%s%u.%u", (i % 2) ? "-" : "",
+				(unsigned)(num_rand() % 100000), (unsigned)num_rand());
+		if (i % 3) {
+			snprintf(str + len, sizeof(str) - len, "e%d", (int)(num_rand() % 90) - 45);
+		}
+		bad += !num_check_float(str);
+	}
+	TEST_ASSERT_EQUAL(0, bad);
+}
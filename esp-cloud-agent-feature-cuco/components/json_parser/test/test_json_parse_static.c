@@ -0,0 +1,145 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <json_parser.h>
+#include <esp_cloud_mem.h>
+#include "unity.h"
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+/* Tests for json_parse_start_static(), which parses the inbound messages into a token pool
+ * of the caller in one pass, against json_parse_start(), which counts the tokens first and
+ * allocates them.
+ */
+
+/* Same as the pools of the shadow delta and app command handlers */
+#define STATIC_DELTA_TOKENS	48
+#define STATIC_APP_CMD_TOKENS	24
+#ifdef ESP_PLATFORM
+#define STATIC_BENCH_RUNS	10000
+#else
+#define STATIC_BENCH_RUNS	1000000
+#endif
+
+static const char static_delta[] =
+	"{\"version\":1234,\"timestamp\":1577836800,\"state\":{\"power\":true,\"brightness\":40,"
+	"\"name\":\"Living room\"},\"metadata\":{\"power\":{\"timestamp\":1577836800},"
+	"\"brightness\":{\"timestamp\":1577836800},\"name\":{\"timestamp\":1577836800}}}";
+
+static const char static_app_cmd[] =
+	"{\"cmd\":\"ota_upgrade\",\"source\":\"app\",\"data\":{\"devcice_id\":\"24:0A:C4:12:34:56\","
+	"\"ota_url\":\"https://ota.example.com/firmware/1.2.3/app.bin\",\"ota_version\":\"1.2.3\","
+	"\"ota_size\":1048576}}";
+
+static const struct {
+	const char *name;
+	const char *js;
+	int pool;
+} static_msgs[] = {
+	{"Shadow delta", static_delta, STATIC_DELTA_TOKENS},
+	{"App command", static_app_cmd, STATIC_APP_CMD_TOKENS},
+};
+
+static int64_t static_time_us(void)
+{
+#ifdef ESP_PLATFORM
+	return esp_timer_get_time();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static void static_check_delta(jparse_ctx_t *jctx)
+{
+	int version, brightness;
+	bool power;
+	char name[16];
+	TEST_ASSERT_EQUAL(0, json_obj_get_int(jctx, "version", &version));
+	TEST_ASSERT_EQUAL(1234, version);
+	TEST_ASSERT_EQUAL(0, json_obj_get_object(jctx, "state"));
+	TEST_ASSERT_EQUAL(0, json_obj_get_bool(jctx, "power", &power));
+	TEST_ASSERT_TRUE(power);
+	TEST_ASSERT_EQUAL(0, json_obj_get_int(jctx, "brightness", &brightness));
+	TEST_ASSERT_EQUAL(40, brightness);
+	TEST_ASSERT_EQUAL(0, json_obj_get_string(jctx, "name", name, sizeof(name)));
+	TEST_ASSERT_EQUAL_STRING("Living room", name);
+	TEST_ASSERT_EQUAL(0, json_obj_leave_object(jctx));
+}
+
+TEST_CASE("json_parse_start_static allocates only if the pool is too small", "[json_parser]")
+{
+	jparse_ctx_t jctx;
+	json_tok_t toks[STATIC_DELTA_TOKENS];
+	int len = strlen(static_delta);
+
+	uint32_t alloc_count = esp_cloud_mem_get_alloc_count();
+	TEST_ASSERT_EQUAL(0, json_parse_start_static(&jctx, static_delta, len, toks, STATIC_DELTA_TOKENS));
+	TEST_ASSERT_EQUAL(alloc_count, esp_cloud_mem_get_alloc_count());
+	static_check_delta(&jctx);
+	json_parse_end(&jctx);
+
+	/* The document has more tokens than this */
+	TEST_ASSERT_EQUAL(0, json_parse_start_static(&jctx, static_delta, len, toks, 8));
+	TEST_ASSERT_EQUAL(alloc_count + 1, esp_cloud_mem_get_alloc_count());
+	static_check_delta(&jctx);
+	json_parse_end(&jctx);
+
+	TEST_ASSERT_EQUAL(0, json_parse_start(&jctx, static_delta, len));
+	static_check_delta(&jctx);
+	json_parse_end(&jctx);
+
+	/* Invalid in both cases */
+	TEST_ASSERT_TRUE(json_parse_start_static(&jctx, static_delta, len - 1, toks, STATIC_DELTA_TOKENS) != 0);
+	TEST_ASSERT_TRUE(json_parse_start(&jctx, static_delta, len - 1) != 0);
+}
+
+TEST_CASE("json_parse_start_static parse time", "[json_parser][perf]")
+{
+	json_tok_t toks[STATIC_DELTA_TOKENS];
+	int i, run;
+	for (i = 0; i < sizeof(static_msgs) / sizeof(static_msgs[0]); i++) {
+		jparse_ctx_t jctx;
+		int len = strlen(static_msgs[i].js);
+		uint32_t alloc_count = esp_cloud_mem_get_alloc_count();
+		int64_t start = static_time_us();
+		for (run = 0; run < STATIC_BENCH_RUNS; run++) {
+			TEST_ASSERT_EQUAL(0, json_parse_start(&jctx, static_msgs[i].js, len));
+			json_parse_end(&jctx);
+		}
+		int64_t heap_time = static_time_us() - start;
+		uint32_t heap_allocs = esp_cloud_mem_get_alloc_count() - alloc_count;
+
+		alloc_count = esp_cloud_mem_get_alloc_count();
+		start = static_time_us();
+		for (run = 0; run < STATIC_BENCH_RUNS; run++) {
+			TEST_ASSERT_EQUAL(0, json_parse_start_static(&jctx, static_msgs[i].js, len, toks, static_msgs[i].pool));
+			json_parse_end(&jctx);
+		}
+		int64_t static_time = static_time_us() - start;
+		TEST_ASSERT_EQUAL(alloc_count, esp_cloud_mem_get_alloc_count());
+
+		printf("%s of %d bytes: json_parse_start %.0f ns (%.1f allocations), "
+				"json_parse_start_static %.0f ns (0 allocations)\n", static_msgs[i].name, len,
+				(double)heap_time * 1000 / STATIC_BENCH_RUNS, (double)heap_allocs / STATIC_BENCH_RUNS,
+				(double)static_time * 1000 / STATIC_BENCH_RUNS);
+	}
+}
@@ -0,0 +1,256 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <json_sax.h>
+#include <json_parser.h>
+#include "unity.h"
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+/* Tests for json_sax, which parses a document received in chunks. The events must not
+ * depend on where the chunks are split.
+ */
+
+/* Similar to the shadow get/accepted document */
+static const char sax_doc[] =
+	"{\"state\":{\"desired\":{\"power\":true,\"brightness\":40},"
+	"\"reported\":{\"power\":false,\"brightness\":35,\"name\":\"Living \\\"room\\\" \\u00e9\","
+	"\"temp\":-12.5e-1,\"ids\":[1,2,[3]],\"empty\":{}}},"
+	"\"metadata\":null,\"version\":1234,\"timestamp\":1577836800}";
+
+/* Events as event:key:value:depth, with "-" for a NULL key or value. The end of an
+ * object or array has no key.
+ */
+static const char sax_doc_events[] =
+	"0:-:-:0 0:state:-:1 0:desired:-:2 5:power:true:3 5:brightness:40:3 1:-:-:2 "
+	"0:reported:-:2 5:power:false:3 5:brightness:35:3 4:name:Living \\\"room\\\" \\u00e9:3 "
+	"5:temp:-12.5e-1:3 2:ids:-:3 5:-:1:4 5:-:2:4 2:-:-:4 5:-:3:5 3:-:-:4 3:-:-:3 "
+	"0:empty:-:3 1:-:-:3 1:-:-:2 1:-:-:1 5:metadata:null:1 5:version:1234:1 "
+	"5:timestamp:1577836800:1 1:-:-:0 ";
+
+#define SAX_LOG_SIZE	1024
+#define SAX_BUF_SIZE	64
+
+typedef struct {
+	char log[SAX_LOG_SIZE];
+	int len;
+	int events;
+	int abort_at;
+} sax_log_t;
+
+static int sax_log_cb(json_sax_event_t event, const char *key, const char *val, int val_len,
+		int depth, void *priv)
+{
+	sax_log_t *log = priv;
+	log->len += snprintf(log->log + log->len, SAX_LOG_SIZE - log->len, "%d:%s:%s:%d ", event,
+			key ? key : "-", val ? val : "-", depth);
+	TEST_ASSERT_TRUE(log->len < SAX_LOG_SIZE);
+	if (val) {
+		TEST_ASSERT_EQUAL(strlen(val), val_len);
+	}
+	return ++log->events == log->abort_at;
+}
+
+/* Feed the document in chunks of chunk_len bytes, the first one being first_len bytes */
+static int sax_parse(const char *doc, int len, int first_len, int chunk_len, int buf_size, sax_log_t *log)
+{
+	json_sax_ctx_t ctx;
+	char buf[SAX_BUF_SIZE];
+	int pos = 0, ret = 0;
+	memset(log->log, 0, sizeof(log->log));
+	log->len = 0;
+	log->events = 0;
+	json_sax_start(&ctx, buf, buf_size, sax_log_cb, log);
+	while (pos < len && ret == 0) {
+		int n = (pos == 0) ? first_len : chunk_len;
+		if (n > len - pos) {
+			n = len - pos;
+		}
+		ret = json_sax_feed(&ctx, doc + pos, n);
+		pos += n;
+	}
+	int end_ret = json_sax_end(&ctx);
+	return ret ? ret : end_ret;
+}
+
+TEST_CASE("json_sax events do not depend on the chunks", "[json_parser][json_sax]")
+{
+	static sax_log_t log;
+	int len = strlen(sax_doc);
+	int first, chunk;
+	log.abort_at = -1;
+	TEST_ASSERT_EQUAL(0, sax_parse(sax_doc, len, len, len, SAX_BUF_SIZE, &log));
+	TEST_ASSERT_EQUAL_STRING(sax_doc_events, log.log);
+
+	/* Split into two at every position, and into chunks of every size up to 16 bytes */
+	for (first = 1; first < len; first++) {
+		TEST_ASSERT_EQUAL(0, sax_parse(sax_doc, len, first, len, SAX_BUF_SIZE, &log));
+		TEST_ASSERT_EQUAL_STRING(sax_doc_events, log.log);
+	}
+	for (chunk = 1; chunk <= 16; chunk++) {
+		TEST_ASSERT_EQUAL(0, sax_parse(sax_doc, len, chunk, chunk, SAX_BUF_SIZE, &log));
+		TEST_ASSERT_EQUAL_STRING(sax_doc_events, log.log);
+	}
+}
+
+TEST_CASE("json_sax reports a truncated document as partial", "[json_parser][json_sax]")
+{
+	static sax_log_t log;
+	int len = strlen(sax_doc);
+	int cut;
+	log.abort_at = -1;
+	for (cut = 0; cut < len; cut++) {
+		/* The events so far are the same as for the full document */
+		TEST_ASSERT_EQUAL(JSMN_ERROR_PART, sax_parse(sax_doc, cut, 1, 1, SAX_BUF_SIZE, &log));
+		TEST_ASSERT_TRUE(strncmp(sax_doc_events, log.log, log.len) == 0);
+		TEST_ASSERT_EQUAL(JSMN_ERROR_PART, sax_parse(sax_doc, cut, cut / 2 + 1, 7, SAX_BUF_SIZE, &log));
+	}
+}
+
+TEST_CASE("json_sax errors", "[json_parser][json_sax]")
+{
+	static sax_log_t log;
+	static const char *invalid[] = {
+		"{\"a\" 1}", "{\"a\":1,}", "[1 2]", "{\"a\":\"\\x\"}", "{\"a\":1}}",
+		"{1:2}", "[\"\\u12G4\"]",
+	};
+	int i, len = strlen(sax_doc);
+	log.abort_at = -1;
+	for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		TEST_ASSERT_EQUAL_MESSAGE(JSMN_ERROR_INVAL, sax_parse(invalid[i], strlen(invalid[i]), 1, 1,
+				SAX_BUF_SIZE, &log), invalid[i]);
+	}
+	/* The key and the value do not fit the buffer */
+	TEST_ASSERT_EQUAL(JSMN_ERROR_NOMEM, sax_parse(sax_doc, len, 5, 5, 16, &log));
+
+	/* Too deep */
+	char deep[JSON_SAX_MAX_DEPTH + 2];
+	memset(deep, '[', sizeof(deep));
+	TEST_ASSERT_EQUAL(JSMN_ERROR_NOMEM, sax_parse(deep, sizeof(deep), 3, 3, SAX_BUF_SIZE, &log));
+
+	/* Stopped by the callback, with no events after that */
+	log.abort_at = 5;
+	TEST_ASSERT_EQUAL(JSON_SAX_ERROR_ABORTED, sax_parse(sax_doc, len, 4, 4, SAX_BUF_SIZE, &log));
+	TEST_ASSERT_EQUAL(5, log.events);
+}
+
+static int64_t sax_time_us(void)
+{
+#ifdef ESP_PLATFORM
+	return esp_timer_get_time();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+#define SAX_BENCH_DOC_LEN	32768
+/* As read from the network, e.g. by an MQTT client with a small receive buffer */
+#define SAX_BENCH_CHUNK_LEN	512
+#define SAX_BENCH_BUF_SIZE	128
+#define SAX_BENCH_RUNS		10
+/* Bytes of the document for each param, which are about 80 */
+#define SAX_BENCH_PARAM_LEN	82
+
+/* A large shadow get/accepted document, with a reported and a desired value and the
+ * metadata for every param
+ */
+static int sax_bench_doc(char *doc, int *num_params)
+{
+	int len = 0, i, params = (SAX_BENCH_DOC_LEN - 256) / SAX_BENCH_PARAM_LEN;
+	const char *sections[] = {"reported", "desired"};
+	int s;
+	len += sprintf(doc + len, "{\"state\":{");
+	for (s = 0; s < 2; s++) {
+		len += sprintf(doc + len, "%s\"%s\":{", s ? "," : "", sections[s]);
+		for (i = 0; i < params; i++) {
+			len += sprintf(doc + len, "%s\"param_%d\":%s", i ? "," : "", i,
+					(i % 3 == 0) ? "\"some string value\"" : (i % 3 == 1) ? "12345" : "true");
+		}
+		len += sprintf(doc + len, "}");
+	}
+	len += sprintf(doc + len, "},\"metadata\":{\"reported\":{");
+	for (i = 0; i < params; i++) {
+		len += sprintf(doc + len, "%s\"param_%d\":{\"timestamp\":1577836800}", i ? "," : "", i);
+	}
+	len += sprintf(doc + len, "}},\"version\":1234,\"timestamp\":1577836800}");
+	TEST_ASSERT_TRUE(len < SAX_BENCH_DOC_LEN);
+	*num_params = params;
+	return len;
+}
+
+static int sax_count_cb(json_sax_event_t event, const char *key, const char *val, int val_len,
+		int depth, void *priv)
+{
+	if (event == JSON_SAX_STRING || event == JSON_SAX_PRIMITIVE) {
+		(*(int *)priv)++;
+	}
+	return 0;
+}
+
+/* The memory needed besides the document: the tokens for json_parse_start(), against the
+ * context and buffer for json_sax. json_parse_start() also needs the whole document in
+ * memory, while json_sax needs only the chunk being fed.
+ */
+TEST_CASE("json_sax memory high-water on a 32 KB document", "[json_parser][json_sax][perf]")
+{
+	char *doc = malloc(SAX_BENCH_DOC_LEN);
+	TEST_ASSERT_NOT_NULL(doc);
+	int num_params;
+	int len = sax_bench_doc(doc, &num_params);
+
+	jparse_ctx_t jctx;
+	int num_tokens = 0, run;
+	int64_t start = sax_time_us();
+	for (run = 0; run < SAX_BENCH_RUNS; run++) {
+		TEST_ASSERT_EQUAL(0, json_parse_start(&jctx, doc, len));
+		num_tokens = jctx.num_tokens;
+		json_parse_end(&jctx);
+	}
+	int64_t tokens_time = (sax_time_us() - start) / SAX_BENCH_RUNS;
+	int tokens_size = num_tokens * sizeof(json_tok_t);
+
+	json_sax_ctx_t ctx;
+	char buf[SAX_BENCH_BUF_SIZE];
+	int values = 0, pos;
+	start = sax_time_us();
+	for (run = 0; run < SAX_BENCH_RUNS; run++) {
+		values = 0;
+		json_sax_start(&ctx, buf, sizeof(buf), sax_count_cb, &values);
+		for (pos = 0; pos < len; pos += SAX_BENCH_CHUNK_LEN) {
+			int n = (len - pos < SAX_BENCH_CHUNK_LEN) ? len - pos : SAX_BENCH_CHUNK_LEN;
+			TEST_ASSERT_EQUAL(0, json_sax_feed(&ctx, doc + pos, n));
+		}
+		TEST_ASSERT_EQUAL(0, json_sax_end(&ctx));
+	}
+	int64_t sax_time = (sax_time_us() - start) / SAX_BENCH_RUNS;
+	int sax_size = sizeof(ctx) + sizeof(buf);
+	/* Reported, desired and timestamp for every param, and the version and timestamp */
+	TEST_ASSERT_EQUAL(3 * num_params + 2, values);
+
+	printf("Document of %d bytes, %d params\n", len, num_params);
+	printf("json_parse_start: %d bytes of tokens (%d tokens) + %d bytes of document, %lld us\n",
+			tokens_size, num_tokens, len, (long long)tokens_time);
+	printf("json_sax: %d bytes of context and buffer + %d bytes of chunk, %lld us\n",
+			sax_size, SAX_BENCH_CHUNK_LEN, (long long)sax_time);
+	TEST_ASSERT_TRUE(sax_size * 10 < tokens_size);
+	free(doc);
+}